@@ -51,6 +51,7 @@ DIAG_ON(unused-macros)
 static void usage(void)
 {
 	fprintf(stderr, "usage: radict [OPTS] <attribute> [attribute...]\n");
+	fprintf(stderr, "  -C               Compile dictionaries, writing <file>" FR_DICTIONARY_CACHE_SUFFIX " next to each.\n");
 	fprintf(stderr, "  -E               Export dictionary definitions.\n");
 	fprintf(stderr, "  -D <dictdir>     Set main dictionary directory (defaults to " DICTDIR ").\n");
 	fprintf(stderr, "  -x               Debugging mode.\n");
@@ -195,6 +196,7 @@ int main(int argc, char *argv[])
 	char		c;
 	int		ret = 0;
 	bool		found = false;
+	bool		compile = false;
 	bool		export = false;
 
 	TALLOC_CTX	*autofree;
@@ -217,7 +219,11 @@ int main(int argc, char *argv[])
 
 	fr_debug_lvl = 1;
 
-	while ((c = getopt(argc, argv, "ED:xh")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "CED:xh")) != -1) switch (c) {
+		case 'C':
+			compile = true;
+			break;
+
 		case 'E':
 			export = true;
 			break;
@@ -255,6 +261,8 @@ int main(int argc, char *argv[])
 		goto finish;
 	}
 
+	fr_dict_global_compile(compile);
+
 	INFO("Loading dictionary: %s/%s", dict_dir, FR_DICTIONARY_FILE);
 
 	if (fr_dict_internal_afrom_file(dict_end++, FR_DICTIONARY_INTERNAL_DIR) < 0) {
@@ -774,9 +774,16 @@ int main(int argc, char *argv[])
 		fr_schedule_config_t *schedule;
 
 		schedule = talloc_zero(global_ctx, fr_schedule_config_t);
-		schedule->max_workers = config->max_networks;
-		schedule->max_networks = config->max_workers;
+		schedule->max_networks = config->max_networks;
+		schedule->max_workers = config->max_workers;
 		schedule->stats_interval = config->stats_interval;
+		schedule->work_stealing = config->work_stealing;
+		schedule->network_cpus = config->network_cpus;
+		schedule->worker_cpus = config->worker_cpus;
+		schedule->numa_pairing = config->numa_pairing;
+		schedule->worker.talloc_pool_size = config->talloc_pool_size;
+		schedule->worker.overload_target = config->overload_target;
+		schedule->worker.overload_interval = config->overload_interval;
 
 		/*
 		 *	Single server mode: use the global event list.
@@ -524,6 +524,56 @@ static bool do_xlats(char const *filename, FILE *fp)
 			continue;
 		}
 
+		/*
+		 *	Look for "bench <iterations> <xlat>"
+		 *
+		 *	Expands the same compiled xlat many times, and
+		 *	prints the average time each expansion took.  The
+		 *	result of the last expansion can be checked with
+		 *	"data", as for "xlat".
+		 */
+		if (strncmp(input, "bench ", 6) == 0) {
+			ssize_t		slen;
+			unsigned long	i, iterations;
+			char		*fmt, *q;
+			xlat_exp_t	*head;
+			fr_time_t	start, stop;
+
+			iterations = strtoul(input + 6, &q, 10);
+			if ((iterations == 0) || (*q != ' ')) {
+				fprintf(stderr, "Invalid iteration count at line %d of %s\n", lineno, filename);
+				TALLOC_FREE(request);
+				return false;
+			}
+			q++;
+
+			fmt = talloc_typed_strdup(NULL, q);
+			slen = xlat_tokenize_ephemeral(fmt, &head, request, fmt, NULL);
+			if (slen <= 0) {
+				talloc_free(fmt);
+				snprintf(output, sizeof(output), "ERROR offset %d '%s'", (int) -slen,
+					 fr_strerror());
+				continue;
+			}
+
+			start = fr_time();
+			for (i = 0; i < iterations; i++) {
+				len = xlat_eval_compiled(output, sizeof(output), request, head, NULL, NULL);
+				if (len < 0) break;
+			}
+			stop = fr_time();
+			TALLOC_FREE(fmt); /* also frees 'head' */
+
+			if (len < 0) {
+				snprintf(output, sizeof(output), "ERROR expanding xlat: %s", fr_strerror());
+				continue;
+			}
+
+			INFO("%s[%d]: %s - %lu expansions, %" PRIu64 " ns each", filename, lineno, q,
+			     iterations, (uint64_t) (stop - start) / iterations);
+			continue;
+		}
+
 		/*
 		 *	Look for "data".
 		 */
@@ -981,7 +1031,7 @@ int main(int argc, char *argv[])
 	if (modules_thread_instantiate(thread_ctx, el) < 0) EXIT_WITH_FAILURE;
 	if (xlat_thread_instantiate(thread_ctx) < 0) EXIT_WITH_FAILURE;
 
-	state = fr_state_tree_init(autofree, attr_state, false, 256, 10, 0);
+	state = fr_state_tree_init(autofree, attr_state, false, 256, 10, 0, 1);
 
 	/*
 	 *  Set the panic action (if required)
@@ -1082,14 +1132,34 @@ int main(int argc, char *argv[])
 	if (count == 1) {
 		process(request);
 	} else {
-		int i;
-		REQUEST *old = request_clone(request);
+		int		i;
+		uint64_t	instructions = 0;
+		fr_time_t	start, elapsed = 0;
+		REQUEST		*old = request_clone(request);
+
 		talloc_free(request);
+		request = NULL;
 
+		/*
+		 *	Keep the last request, so that its reply can be
+		 *	checked below.
+		 */
 		for (i = 0; i < count; i++) {
+			talloc_free(request);
 			request = request_clone(old);
+
+			start = fr_time();
 			process(request);
-			talloc_free(request);
+			elapsed += fr_time() - start;
+
+			instructions += unlang_interpret_instructions(request);
+		}
+		talloc_free(old);
+
+		INFO("Processed %i requests, %" PRIu64 " ns each", count, (uint64_t) elapsed / count);
+		if (instructions) {
+			INFO("Executed %" PRIu64 " instructions, %" PRIu64 " ns each",
+			     instructions, (uint64_t) elapsed / instructions);
 		}
 	}
 
@@ -1194,7 +1264,7 @@ static void NEVER_RETURNS usage(main_config_t const *config, int status)
 
 	fprintf(output, "Usage: %s [options]\n", config->name);
 	fprintf(output, "Options:\n");
-	fprintf(output, "  -c <count>         Run packets through the interpreter <count> times\n");
+	fprintf(output, "  -c <count>         Run packets through the interpreter <count> times, and print the time taken\n");
 	fprintf(output, "  -d <raddb_dir>     Configuration files are in \"raddb_dir/*\".\n");
 	fprintf(output, "  -D <dict_dir>      Dictionary files are in \"dict_dir/*\".\n");
 	fprintf(output, "  -f <file>          Filter reply against attributes in 'file'.\n");
@@ -980,3 +980,35 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 	fr_log(log, L_INFO, file, line, "\tlast read other end = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.last_read_other);
 	fr_log(log, L_INFO, file, line, "\tlast signal other = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.last_sent_signal);
 }
+
+/** Write the statistics for both ends of a channel
+ *
+ * The counters are read without locking, so they may be slightly stale.
+ *
+ * @param[in] m		to write to.
+ * @param[in] ch	to read the statistics from.
+ * @param[in] labels	which identify the channel, e.g. network="0",channel="1".
+ */
+void fr_channel_metrics(fr_metrics_t *m, fr_channel_t const *ch, char const *labels)
+{
+	fr_metrics_gauge(m, "freeradius_channel_outstanding", "Requests sent to a worker without a reply.",
+			 ch->end[TO_RESPONDER].stats.outstanding, "%s", labels);
+
+	fr_metrics_counter(m, "freeradius_channel_packets", "Messages sent over a channel.",
+			   ch->end[TO_RESPONDER].stats.packets, "%s,direction=\"to_responder\"", labels);
+	fr_metrics_counter(m, "freeradius_channel_packets", "Messages sent over a channel.",
+			   ch->end[TO_REQUESTOR].stats.packets, "%s,direction=\"to_requestor\"", labels);
+
+	fr_metrics_counter(m, "freeradius_channel_signals", "Signals sent to wake the other end of a channel.",
+			   ch->end[TO_RESPONDER].stats.signals, "%s,direction=\"to_responder\"", labels);
+	fr_metrics_counter(m, "freeradius_channel_signals", "Signals sent to wake the other end of a channel.",
+			   ch->end[TO_REQUESTOR].stats.signals, "%s,direction=\"to_requestor\"", labels);
+
+	fr_metrics_counter(m, "freeradius_channel_resignals", "Signals re-sent to a worker.",
+			   ch->end[TO_RESPONDER].stats.resignals, "%s", labels);
+
+	fr_metrics_counter(m, "freeradius_channel_kevents", "Events serviced by a channel.",
+			   ch->end[TO_RESPONDER].stats.kevents, "%s,direction=\"to_responder\"", labels);
+	fr_metrics_counter(m, "freeradius_channel_kevents", "Events serviced by a channel.",
+			   ch->end[TO_REQUESTOR].stats.kevents, "%s,direction=\"to_requestor\"", labels);
+}
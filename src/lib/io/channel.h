@@ -53,6 +53,7 @@ typedef struct fr_listen fr_listen_t;
 #include <freeradius-devel/io/message.h>
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/io/base.h>
+#include <freeradius-devel/server/metrics.h>
 #include <freeradius-devel/util/dlist.h>
 
 #include <sys/types.h>
@@ -189,6 +190,8 @@ void	*fr_channel_requestor_uctx_get(fr_channel_t *ch) CC_HINT(nonnull);
 
 void	fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char const *file, int line);
 
+void	fr_channel_metrics(fr_metrics_t *m, fr_channel_t const *ch, char const *labels) CC_HINT(nonnull);
+
 #ifdef __cplusplus
 }
 #endif
@@ -61,6 +61,8 @@ struct fr_async_s {
 						//!< and how we'll send the reply.
 	uint32_t		priority;	//!< higher == higher priority
 	bool			fake;		//!< is it a fake request
+	void			*stolen;	//!< the worker we stole the packet from, if any.
+						//!< It owns the channel, and sends the reply.
 };
 
 int fr_io_listen_free(fr_listen_t *li);
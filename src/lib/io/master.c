@@ -31,6 +31,7 @@
 #include <freeradius-devel/unlang/base.h>
 
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/socket.h>
 #include <freeradius-devel/util/syserror.h>
 
 typedef struct {
@@ -736,7 +737,12 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 	}
 
 	DEBUG("proto_%s - starting connection %s", inst->app_io->name, connection->name);
-	connection->nr = fr_schedule_listen_add(thread->sc, connection->listen);
+	/*
+	 *	The connection uses the client and tracking tables
+	 *	of this listener, so it has to be run by the same
+	 *	network thread.
+	 */
+	connection->nr = fr_schedule_listen_add_to(thread->sc, thread->nr, connection->listen);
 	if (!connection->nr) {
 		ERROR("proto_%s - Failed inserting connection into scheduler.  Closing it, and diuscarding all packets for connection %s.", inst->app_io->name, connection->name);
 		pthread_mutex_lock(&client->mutex);
@@ -1737,6 +1743,12 @@ static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
 		inst->app_io->event_list_set(child, el, nr);
 	}
 
+	/*
+	 *	Connections accepted by this socket are added to
+	 *	the same network.
+	 */
+	if (!connection) thread->nr = nr;
+
 	/*
 	 *	No dynamic clients AND no packet cleanups?  We don't
 	 *	need timers.
@@ -2758,25 +2770,27 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Open one master socket, and add it to the scheduler
+ *
+ * @param[in] ctx			to allocate the listener in.
+ * @param[in] inst			the master IO instance.
+ * @param[in] sc			the scheduler.
+ * @param[in] default_message_size	for the message ring buffer.
+ * @param[in] num_messages		for the message ring buffer.
+ * @param[in] sibling			this is an additional SO_REUSEPORT socket
+ *					for an address we've already opened.
+ * @param[out] out			the child listener which was opened.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int master_io_listen_socket(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+				   size_t default_message_size, size_t num_messages,
+				   bool sibling, fr_listen_t **out)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		fr_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->thread_inst_size) {
-		fr_strerror_printf("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -2892,9 +2906,10 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	li->name = child->name;
 
 	/*
-	 *	Record which socket we opened.
+	 *	Record which socket we opened.  Siblings share the
+	 *	address of the first socket, so they aren't conflicts.
 	 */
-	if (child->app_io_addr) {
+	if (child->app_io_addr && !sibling) {
 		fr_listen_t *other;
 
 		other = listen_find_any(thread->child);
@@ -2920,6 +2935,62 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 		return -1;
 	}
 
+	*out = child;
+	return 0;
+}
+
+int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	fr_listen_t	*first = NULL, *child;
+	uint32_t	i, num_sockets;
+
+	/*
+	 *	No IO paths, so we don't initialize them.
+	 */
+	if (!inst->app_io) {
+		fr_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->thread_inst_size) {
+		fr_strerror_printf("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
+		return -1;
+	}
+
+	num_sockets = inst->num_sockets;
+	if (!num_sockets) num_sockets = 1;
+
+	/*
+	 *	Open multiple sockets on the same address.  The
+	 *	scheduler spreads them across the network threads.
+	 *	Each socket has its own master listener, and
+	 *	therefore its own client and duplicate tracking.
+	 *
+	 *	The kernel picks a socket by hashing the source and
+	 *	destination address and port, so retransmissions from
+	 *	a client arrive on the same socket as the original
+	 *	packet.
+	 */
+	for (i = 0; i < num_sockets; i++) {
+		if (master_io_listen_socket(ctx, inst, sc, default_message_size, num_messages,
+					    (i > 0), &child) < 0) return -1;
+
+		if (!first) first = child;
+	}
+
+	/*
+	 *	Clients which change source port between
+	 *	retransmissions would be hashed to different sockets.
+	 *	If asked, steer packets by source IP address only.
+	 */
+	if ((num_sockets > 1) && inst->steer_by_source && first->app_io_addr) {
+		if (fr_socket_reuseport_steer(first->fd, first->app_io_addr->ipaddr.af, num_sockets) < 0) {
+			PWARN("proto_%s - Failed steering packets by source IP address for %s",
+			      inst->app_io->name, first->name);
+		}
+	}
+
 	return 0;
 }
 
@@ -82,6 +82,9 @@ typedef struct {
 	uint32_t			max_clients;			//!< maximum number of dynamic clients to allow
 	uint32_t			max_pending_packets;		//!< maximum number of pending packets
 
+	uint32_t			num_sockets;			//!< number of SO_REUSEPORT sockets to open
+	bool				steer_by_source;		//!< steer packets to sockets by source IP
+
 	fr_time_delta_t			cleanup_delay;			//!< for Access-Request packets
 	fr_time_delta_t			idle_timeout;			//!< for dynamic clients
 	fr_time_delta_t			nak_lifetime;			//!< lifetime of NAKed clients
@@ -152,7 +152,10 @@ static int8_t reply_cmp(void const *one, void const *two)
 	fr_channel_data_t const *a = one, *b = two;
 	int ret;
 
-	ret = (a->priority > b->priority) - (a->priority < b->priority);
+	/*
+	 *	Larger numbers mean higher priority
+	 */
+	ret = (a->priority < b->priority) - (a->priority > b->priority);
 	if (ret != 0) return ret;
 
 	return (a->m.when > b->m.when) - (a->m.when < b->m.when);
@@ -163,7 +166,10 @@ static int8_t waiting_cmp(void const *one, void const *two)
 	fr_channel_data_t const *a = one, *b = two;
 	int ret;
 
-	ret = (a->priority > b->priority) - (a->priority < b->priority);
+	/*
+	 *	Larger numbers mean higher priority
+	 */
+	ret = (a->priority < b->priority) - (a->priority > b->priority);
 	if (ret != 0) return ret;
 
 	return (a->reply.request_time > b->reply.request_time) - (a->reply.request_time < b->reply.request_time);
@@ -1689,6 +1695,44 @@ void fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log)
 	}
 }
 
+/** Write the statistics for a network, and its channels to the workers
+ *
+ * Called from another thread.  The counters are only written by
+ * the network, so we just read them.
+ *
+ * @param[in] m		to write to.
+ * @param[in] nr	to read the statistics from.
+ * @param[in] labels	which identify the network, e.g. network="0".
+ */
+void fr_network_metrics(fr_metrics_t *m, fr_network_t const *nr, char const *labels)
+{
+	int i;
+
+	fr_metrics_counter(m, "freeradius_network_packets_in", "Packets read by a network.",
+			   nr->stats.in, "%s", labels);
+	fr_metrics_counter(m, "freeradius_network_packets_out", "Replies written by a network.",
+			   nr->stats.out, "%s", labels);
+	fr_metrics_counter(m, "freeradius_network_packets_dup", "Duplicate packets read by a network.",
+			   nr->stats.dup, "%s", labels);
+	fr_metrics_counter(m, "freeradius_network_packets_dropped", "Packets dropped by a network.",
+			   nr->stats.dropped, "%s", labels);
+
+	fr_metrics_gauge(m, "freeradius_network_workers", "Workers a network sends packets to.",
+			 nr->num_workers, "%s", labels);
+	fr_metrics_gauge(m, "freeradius_network_sockets", "Sockets being read by a network.",
+			 rbtree_num_elements(nr->sockets), "%s", labels);
+
+	for (i = 0; i < nr->max_workers; i++) {
+		fr_network_worker_t const	*w = nr->workers[i];
+		char				buffer[128];
+
+		if (!w) continue;
+
+		snprintf(buffer, sizeof(buffer), "%s,channel=\"%d\"", labels, i);
+		fr_channel_metrics(m, w->channel, buffer);
+	}
+}
+
 static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
 {
 	fr_network_t const *nr = ctx;
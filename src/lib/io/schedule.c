@@ -34,8 +34,23 @@ RCSID("$Id$")
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/server/trigger.h>
 
+#include <ctype.h>
 #include <pthread.h>
 
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#  include <sched.h>
+#endif
+
+#ifdef __linux__
+#  include <dirent.h>
+#endif
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 /*
  *	Other OS's have sem_init, OS X doesn't.
  */
@@ -64,6 +79,15 @@ RCSID("$Id$")
 
 #define SEM_WAIT_INTR(_x) do {if (sem_wait(_x) == 0) break;} while (errno == EINTR)
 
+/*
+ *	The highest CPU number we allow in network_cpus and worker_cpus.
+ */
+#ifdef CPU_SETSIZE
+#  define SCHEDULE_MAX_CPUS	CPU_SETSIZE
+#else
+#  define SCHEDULE_MAX_CPUS	(1024)
+#endif
+
 /**
  *  Track the child thread status.
  */
@@ -87,6 +111,7 @@ typedef struct {
 
 	unsigned int	id;			//!< a unique ID
 	int		uses;			//!< how many network threads are using it
+	int		cpu;			//!< we're pinned to, or -1.
 	fr_time_t	cpu_time;		//!< how much CPU time this worker has used
 
 	fr_dlist_t	entry;			//!< our entry into the linked list of workers
@@ -107,6 +132,8 @@ typedef struct {
 	pthread_t	pthread_id;		//!< the thread of this network
 
 	unsigned int	id;			//!< a unique ID
+	int		cpu;			//!< we're pinned to, or -1.
+	int		node;			//!< NUMA node of the CPU, or -1.
 	fr_schedule_t	*sc;			//!< the scheduler we are running under
 
 	fr_schedule_child_status_t status;	//!< status of the worker
@@ -143,11 +170,197 @@ struct fr_schedule_s {
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
 
-	fr_schedule_network_t *sn;		//!< pointer to the (one) network thread
+	fr_schedule_network_t **networks;	//!< array of network threads
+	unsigned int	num_networks;		//!< number of entries in the networks array
+
+	atomic_uint_fast32_t next_network;	//!< round-robin counter for listen_add
+
+	fr_worker_group_t *group;		//!< for work stealing, if enabled.
+
+	int		*network_cpus;		//!< CPUs to pin network threads to, in order.
+	int		num_network_cpus;
+	int		*worker_cpus;		//!< CPUs to pin worker threads to, in order.
+	int		num_worker_cpus;
+	int		*worker_nodes;		//!< NUMA node of each worker, if pairing is enabled.
+
+	fr_metrics_source_t *metrics;		//!< for the workers and networks.
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
 
+/** Parse a list of CPUs, e.g. "0-3,8,10-11"
+ *
+ * @param[in] ctx	to allocate the list in.
+ * @param[out] out	the CPUs, in the order they were given.
+ * @param[in] name	of the configuration item, for error messages.
+ * @param[in] str	to parse.
+ * @return
+ *	- <0 on error.
+ *	- the number of CPUs in the list.
+ */
+static int schedule_cpus_parse(TALLOC_CTX *ctx, int **out, char const *name, char const *str)
+{
+	char const	*p = str;
+	int		*cpus = NULL;
+	int		num = 0;
+
+	*out = NULL;
+
+	while (*p) {
+		char		*end;
+		unsigned long	first, last, i;
+
+		while (isspace((uint8_t) *p)) p++;
+
+		first = last = strtoul(p, &end, 10);
+		if (end == p) goto invalid;
+		p = end;
+
+		if (*p == '-') {
+			p++;
+			last = strtoul(p, &end, 10);
+			if ((end == p) || (last < first)) goto invalid;
+			p = end;
+		}
+
+		if (last >= SCHEDULE_MAX_CPUS) {
+			fr_strerror_printf("Invalid value for '%s' - CPU %lu is larger than the maximum of %u",
+					   name, last, SCHEDULE_MAX_CPUS - 1);
+			talloc_free(cpus);
+			return -1;
+		}
+
+		MEM(cpus = talloc_realloc(ctx, cpus, int, num + (last - first) + 1));
+		for (i = first; i <= last; i++) cpus[num++] = i;
+
+		while (isspace((uint8_t) *p)) p++;
+		if (!*p) break;
+		if (*p != ',') goto invalid;
+		p++;
+	}
+
+	if (!num) {
+	invalid:
+		fr_strerror_printf("Invalid value for '%s' - expected a list of CPUs, e.g. \"0-3,8\"", name);
+		talloc_free(cpus);
+		return -1;
+	}
+
+	*out = cpus;
+	return num;
+}
+
+/** Return the NUMA node a CPU belongs to
+ *
+ * @return
+ *	- the node.
+ *	- -1 if it's unknown.
+ */
+static int schedule_cpu_node(int cpu)
+{
+#ifdef __linux__
+	char		path[64];
+	DIR		*dir;
+	struct dirent	*de;
+	int		node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+	dir = opendir(path);
+	if (!dir) return -1;
+
+	while ((de = readdir(dir)) != NULL) {
+		if ((strncmp(de->d_name, "node", 4) != 0) || !isdigit((uint8_t) de->d_name[4])) continue;
+
+		node = atoi(de->d_name + 4);
+		break;
+	}
+	closedir(dir);
+
+	return node;
+#else
+	return -1;
+#endif
+}
+
+/** Pin the current thread to a CPU
+ *
+ * Memory is allocated on the NUMA node of the CPU which first touches
+ * it, so a thread must be pinned before it allocates its message sets
+ * and ring buffers.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] name	of the thread, for log messages.
+ * @param[in] cpu	to pin the thread to, or -1 to leave it alone.
+ * @return
+ *	- <0 on error.
+ *	- 0 on success.
+ */
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+static int schedule_thread_pin(fr_schedule_t *sc, char const *name, int cpu)
+{
+	cpu_set_t	set;
+	int		ret;
+
+	if (cpu < 0) return 0;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0) {
+		ERROR("%s - Failed pinning thread to CPU %d: %s", name, cpu, fr_syserror(ret));
+		return -1;
+	}
+
+	DEBUG("%s - Pinned to CPU %d", name, cpu);
+
+	return 0;
+}
+#else
+static int schedule_thread_pin(UNUSED fr_schedule_t *sc, UNUSED char const *name, UNUSED int cpu)
+{
+	return 0;
+}
+#endif
+
+/** Decide whether a network thread should send packets to a worker
+ *
+ * If NUMA pairing is enabled, networks only use workers on the same
+ * node, so that packets don't cross the interconnect.  But every network
+ * needs a worker, and every worker needs a network, so we fall back to
+ * using all of them when a node has no networks, or no workers.
+ */
+static bool schedule_network_uses_worker(fr_schedule_t *sc, fr_schedule_network_t *sn, fr_schedule_worker_t *sw)
+{
+	int	node = sc->worker_nodes ? sc->worker_nodes[sw->id] : -1;
+	bool	found;
+	unsigned int i;
+
+	if ((node < 0) || (sn->node < 0) || (node == sn->node)) return true;
+
+	/*
+	 *	Does the network have any workers on its own node?
+	 */
+	found = false;
+	for (i = 0; i < sc->config->max_workers; i++) {
+		if (sc->worker_nodes[i] == sn->node) {
+			found = true;
+			break;
+		}
+	}
+	if (!found) return true;
+
+	/*
+	 *	Does the worker have any networks on its own node?
+	 */
+	for (i = 0; i < sc->num_networks; i++) {
+		if (sc->networks[i]->node == node) return false;
+	}
+
+	return true;
+}
+
 /** Return the worker id for the current thread
  *
  * @return worker ID
@@ -168,12 +381,15 @@ static void *fr_schedule_worker_thread(void *arg)
 	fr_schedule_worker_t		*sw = talloc_get_type_abort(arg, fr_schedule_worker_t);
 	fr_schedule_t			*sc = sw->sc;
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
+	unsigned int			i;
 	char worker_name[32];
 
 	worker_id = sw->id;		/* Store the current worker ID */
 
 	snprintf(worker_name, sizeof(worker_name), "Worker %d", sw->id);
 
+	if (schedule_thread_pin(sc, worker_name, sw->cpu) < 0) goto fail;
+
 	sw->ctx = ctx = talloc_init("%s", worker_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", worker_name);
@@ -189,12 +405,17 @@ static void *fr_schedule_worker_thread(void *arg)
 	}
 
 
-	sw->worker = fr_worker_create(ctx, sw->el, worker_name, sc->log, sc->lvl, NULL);
+	sw->worker = fr_worker_create(ctx, sw->el, worker_name, sc->log, sc->lvl, &sc->config->worker);
 	if (!sw->worker) {
 		PERROR("%s - Failed creating worker", worker_name);
 		goto fail;
 	}
 
+	if (sc->group && (fr_worker_group_join(sc->group, sw->worker, sw->id) < 0)) {
+		PERROR("%s - Failed joining worker group", worker_name);
+		goto fail;
+	}
+
 	/*
 	 *	@todo make this a registry
 	 */
@@ -215,7 +436,18 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	sw->status = FR_CHILD_RUNNING;
 
-	(void) fr_network_worker_add(sc->sn->nr, sw->worker);
+	/*
+	 *	Every network thread can send packets to every
+	 *	worker, unless they're paired by NUMA node.  The
+	 *	worker exits once all of the networks using it have
+	 *	closed their channels.
+	 */
+	for (i = 0; i < sc->num_networks; i++) {
+		if (!schedule_network_uses_worker(sc, sc->networks[i], sw)) continue;
+
+		(void) fr_network_worker_add(sc->networks[i]->nr, sw->worker);
+		sw->uses++;
+	}
 
 	DEBUG3("%s - Started", worker_name);
 
@@ -270,6 +502,41 @@ static void stats_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 	(void) fr_event_timer_at(sn, el, &sn->ev, now + sn->sc->config->stats_interval, stats_timer, sn);
 }
 
+/** Write the statistics for all of the networks and workers
+ *
+ * Called from whichever thread is scraping the metrics.  The source
+ * is freed before any worker or network is destroyed.
+ */
+static void schedule_metrics(fr_metrics_t *m, void *uctx)
+{
+	fr_schedule_t		*sc = talloc_get_type_abort(uctx, fr_schedule_t);
+	fr_schedule_worker_t	*sw = NULL;
+	unsigned int		i;
+	char			buffer[32];
+
+	if (sc->el) {
+		fr_network_metrics(m, sc->single_network, "network=\"0\"");
+		fr_worker_metrics(m, sc->single_worker, "worker=\"0\"");
+		return;
+	}
+
+	for (i = 0; i < sc->num_networks; i++) {
+		fr_schedule_network_t *sn = sc->networks[i];
+
+		if (!sn || (sn->status != FR_CHILD_RUNNING) || !sn->nr) continue;
+
+		snprintf(buffer, sizeof(buffer), "network=\"%u\"", sn->id);
+		fr_network_metrics(m, sn->nr, buffer);
+	}
+
+	while ((sw = fr_dlist_next(&sc->workers, sw))) {
+		if ((sw->status != FR_CHILD_RUNNING) || !sw->worker) continue;
+
+		snprintf(buffer, sizeof(buffer), "worker=\"%u\"", sw->id);
+		fr_worker_metrics(m, sw->worker, buffer);
+	}
+}
+
 /** Initialize and run the network thread.
  *
  * @param[in] arg the fr_schedule_network_t
@@ -288,6 +555,8 @@ static void *fr_schedule_network_thread(void *arg)
 
 	INFO("%s - Starting", network_name);
 
+	if (schedule_thread_pin(sc, network_name, sn->cpu) < 0) goto fail;
+
 	sn->ctx = ctx = talloc_init("%s", network_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", network_name);
@@ -342,6 +611,50 @@ fail:
 	return NULL;
 }
 
+/** Tell all running network threads to exit, and wait for them to do so
+ *
+ * Once the networks have exited, the caller knows that the network
+ * channels have been closed, and the workers will exit.
+ *
+ * @param[in] sc	the scheduler
+ */
+static void fr_schedule_networks_exit(fr_schedule_t *sc)
+{
+	unsigned int i;
+
+	for (i = 0; i < sc->num_networks; i++) {
+		fr_schedule_network_t *sn = sc->networks[i];
+
+		if (sn->status != FR_CHILD_RUNNING) continue;
+
+		fr_fatal_assert_msg(fr_network_exit(sn->nr) == 0, "%s", fr_strerror());
+		SEM_WAIT_INTR(&sc->network_sem);
+	}
+}
+
+/** Free the resources of all network threads
+ *
+ * @param[in] sc	the scheduler
+ */
+static void fr_schedule_networks_free(fr_schedule_t *sc)
+{
+	unsigned int i;
+
+	for (i = 0; i < sc->num_networks; i++) {
+		fr_schedule_network_t *sn = sc->networks[i];
+
+		if (pthread_join(sn->pthread_id, NULL) != 0) {
+			ERROR("Failed joining network %i: %s", sn->id, fr_syserror(errno));
+		} else {
+			DEBUG2("Network %i joined (cleaned up)", sn->id);
+		}
+		TALLOC_FREE(sn->ctx);
+	}
+
+	sc->num_networks = 0;
+	TALLOC_FREE(sc->networks);
+}
+
 /** Creates a new thread using our standard set of options
  *
  * New threads are:
@@ -435,7 +748,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 			return NULL;
 		}
 
-		sc->single_worker = fr_worker_create(sc, el, "Worker", sc->log, sc->lvl, NULL);
+		sc->single_worker = fr_worker_create(sc, el, "Worker", sc->log, sc->lvl, config ? &config->worker : NULL);
 		if (!sc->single_worker) {
 			PERROR("Failed creating worker");
 			goto pre_instantiate_st_fail;
@@ -484,6 +797,8 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 			goto st_fail;
 		}
 
+		MEM(sc->metrics = fr_metrics_source_add(sc, schedule_metrics, sc));
+
 		return sc;
 	}
 
@@ -497,10 +812,52 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	} else {
 		sc->config = config;
 
-		if (sc->config->max_networks != 1) sc->config->max_networks = 1;
+		if (sc->config->max_networks < 1) sc->config->max_networks = 1;
+		if (sc->config->max_networks > 32) sc->config->max_networks = 32;
 		if (sc->config->max_workers < 1) sc->config->max_workers = 1;
 		if (sc->config->max_workers > 64) sc->config->max_workers = 64;
 
+		if (sc->config->network_cpus) {
+			sc->num_network_cpus = schedule_cpus_parse(sc, &sc->network_cpus, "network_cpus",
+								   sc->config->network_cpus);
+			if (sc->num_network_cpus < 0) {
+			cpus_fail:
+				PERROR("Failed configuring thread affinity");
+				talloc_free(sc);
+				return NULL;
+			}
+		}
+
+		if (sc->config->worker_cpus) {
+			sc->num_worker_cpus = schedule_cpus_parse(sc, &sc->worker_cpus, "worker_cpus",
+								  sc->config->worker_cpus);
+			if (sc->num_worker_cpus < 0) goto cpus_fail;
+		}
+
+#ifndef HAVE_PTHREAD_SETAFFINITY_NP
+		if (sc->network_cpus || sc->worker_cpus) {
+			WARN("Thread affinity is not supported on this platform, ignoring 'network_cpus' and 'worker_cpus'");
+			TALLOC_FREE(sc->network_cpus);
+			TALLOC_FREE(sc->worker_cpus);
+			sc->num_network_cpus = sc->num_worker_cpus = 0;
+		}
+#endif
+
+		/*
+		 *	Pairing needs to know where all of the workers
+		 *	are before any of them start, so that every
+		 *	worker makes the same decision.
+		 */
+		if (sc->config->numa_pairing) {
+			if (!sc->network_cpus || !sc->worker_cpus) {
+				WARN("'numa_pairing' requires 'network_cpus' and 'worker_cpus', ignoring it");
+			} else {
+				MEM(sc->worker_nodes = talloc_array(sc, int, sc->config->max_workers));
+				for (i = 0; i < sc->config->max_workers; i++) {
+					sc->worker_nodes[i] = schedule_cpu_node(sc->worker_cpus[i % sc->num_worker_cpus]);
+				}
+			}
+		}
 	}
 
 	/*
@@ -522,26 +879,61 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		return NULL;
 	}
 
+	atomic_init(&sc->next_network, 0);
+
 	/*
-	 *	Create the network thread first.
-	 *	@todo - create multiple network threads
+	 *	Create the network threads first, so that the
+	 *	workers can add themselves to every network.
 	 */
-	sc->sn = talloc_zero(sc, fr_schedule_network_t);
-	sc->sn->sc = sc;
-	sc->sn->id = 0;
+	MEM(sc->networks = talloc_zero_array(sc, fr_schedule_network_t *, sc->config->max_networks));
 
-	if (fr_schedule_pthread_create(&sc->sn->pthread_id, fr_schedule_network_thread, sc->sn) < 0) {
-		PERROR("Failed creating network thread");
-		goto fail;
+	for (i = 0; i < sc->config->max_networks; i++) {
+		fr_schedule_network_t *sn;
+
+		DEBUG3("Creating %u/%u networks", i, sc->config->max_networks);
+
+		MEM(sn = talloc_zero(sc->networks, fr_schedule_network_t));
+		sn->sc = sc;
+		sn->id = i;
+		sn->cpu = sc->network_cpus ? sc->network_cpus[i % sc->num_network_cpus] : -1;
+		sn->node = sc->worker_nodes ? schedule_cpu_node(sn->cpu) : -1;
+		sn->status = FR_CHILD_INITIALIZING;
+
+		if (sn->node >= 0) {
+			DEBUG("Network %u - Using CPU %d on NUMA node %d", i, sn->cpu, sn->node);
+		} else if (sn->cpu >= 0) {
+			DEBUG("Network %u - Using CPU %d", i, sn->cpu);
+		}
+
+		if (fr_schedule_pthread_create(&sn->pthread_id, fr_schedule_network_thread, sn) < 0) {
+			PERROR("Failed creating network thread %u", i);
+			talloc_free(sn);
+			goto fail;
+		}
+		sc->networks[sc->num_networks++] = sn;
+
+		SEM_WAIT_INTR(&sc->network_sem);
+		if (sn->status != FR_CHILD_RUNNING) {
+		fail:
+			fr_schedule_networks_exit(sc);
+			fr_schedule_networks_free(sc);
+			sem_destroy(&sc->network_sem);
+			sem_destroy(&sc->worker_sem);
+			talloc_free(sc);
+			return NULL;
+		}
 	}
 
-	SEM_WAIT_INTR(&sc->network_sem);
-	if (sc->sn->status != FR_CHILD_RUNNING) {
-	fail:
-		if (sc->sn->ctx) TALLOC_FREE(sc->sn->ctx);
-		TALLOC_FREE(sc->sn);
-		fr_schedule_destroy(&sc);
-		return NULL;
+	/*
+	 *	Let idle workers take packets which busy workers
+	 *	haven't started on yet.
+	 */
+	if (sc->config->work_stealing && (sc->config->max_workers > 1)) {
+		sc->group = fr_worker_group_create(sc, sc->config->max_workers);
+		if (!sc->group) {
+			PERROR("Failed creating worker group");
+			goto fail;
+		}
 	}
 
 	/*
@@ -560,8 +952,15 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		}
 
 		sw->id = i;
+		sw->cpu = sc->worker_cpus ? sc->worker_cpus[i % sc->num_worker_cpus] : -1;
 		sw->sc = sc;
 		sw->status = FR_CHILD_INITIALIZING;
+
+		if (sc->worker_nodes && (sc->worker_nodes[i] >= 0)) {
+			DEBUG("Worker %u - Using CPU %d on NUMA node %d", i, sw->cpu, sc->worker_nodes[i]);
+		} else if (sw->cpu >= 0) {
+			DEBUG("Worker %u - Using CPU %d", i, sw->cpu);
+		}
 		fr_dlist_insert_head(&sc->workers, sw);
 
 		if (fr_schedule_pthread_create(&sw->pthread_id, fr_schedule_worker_thread, sw) < 0) {
@@ -619,11 +1018,18 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		}
 	}
 
-	if (fr_command_register_hook(NULL, "0", sc->sn->nr, cmd_network_table) < 0) {
-		PERROR("Failed adding network commands");
-		goto st_fail;
+	for (i = 0; i < sc->num_networks; i++) {
+		char buffer[32];
+
+		snprintf(buffer, sizeof(buffer), "%d", i);
+		if (fr_command_register_hook(NULL, buffer, sc->networks[i]->nr, cmd_network_table) < 0) {
+			PERROR("Failed adding network commands");
+			goto st_fail;
+		}
 	}
 
+	MEM(sc->metrics = fr_metrics_source_add(sc, schedule_metrics, sc));
+
 	if (sc) INFO("Scheduler created successfully with %u networks and %u workers",
 		     sc->config->max_networks, (unsigned int)fr_dlist_num_elements(&sc->workers));
 
@@ -647,6 +1053,12 @@ int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 
 	sc->running = false;
 
+	/*
+	 *	Stop anyone reading the worker and network
+	 *	statistics before we start freeing them.
+	 */
+	TALLOC_FREE(sc->metrics);
+
 	/*
 	 *	Single threaded mode: kill the only network / worker we have.
 	 */
@@ -660,19 +1072,16 @@ int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 		goto done;
 	}
 
-	if (!fr_cond_assert(sc->sn)) return -1;
+	if (!fr_cond_assert(sc->num_networks > 0)) return -1;
 	if (!fr_cond_assert(fr_dlist_num_elements(&sc->workers) > 0)) return -1;
 
 	/*
-	 *	If the network thread is running, tell it to exit, and
-	 *	wait for it to do so.  Once it's exited, we know that
-	 *	this thread can use the network channels to tell the
-	 *	workers that the network side is going away.
+	 *	If the network threads are running, tell them to exit,
+	 *	and wait for them to do so.  Once they've exited, we
+	 *	know that this thread can use the network channels to
+	 *	tell the workers that the network side is going away.
 	 */
-	if (sc->sn->status == FR_CHILD_RUNNING) {
-		fr_fatal_assert_msg(fr_network_exit(sc->sn->nr) == 0, "%s", fr_strerror());
-		SEM_WAIT_INTR(&sc->network_sem);
-	}
+	fr_schedule_networks_exit(sc);
 
 	/*
 	 *	Wait for all worker threads to finish.  THEN clean up
@@ -708,7 +1117,7 @@ int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 		talloc_free(sw->ctx);
 	}
 
-	TALLOC_FREE(sc->sn->ctx);
+	fr_schedule_networks_free(sc);
 
 	sem_destroy(&sc->network_sem);
 	sem_destroy(&sc->worker_sem);
@@ -723,6 +1132,26 @@ done:
 	return 0;
 }
 
+/** Pick the network thread for a new listener
+ *
+ * Listeners are spread over the network threads round-robin.  This
+ * may be called from the main thread, or from a network thread which
+ * is adding a new listener, e.g. for a detail file.
+ *
+ * @param[in] sc the scheduler
+ * @return the network to use.
+ */
+static fr_network_t *fr_schedule_network_next(fr_schedule_t *sc)
+{
+	uint32_t n;
+
+	if (sc->el) return sc->single_network;
+
+	n = atomic_fetch_add_explicit(&sc->next_network, 1, memory_order_relaxed);
+
+	return sc->networks[n % sc->num_networks]->nr;
+}
+
 /** Add a fr_listen_t to a scheduler.
  *
  * @param[in] sc the scheduler
@@ -737,11 +1166,29 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 
 	(void) talloc_get_type_abort(sc, fr_schedule_t);
 
-	if (sc->el) {
-		nr = sc->single_network;
-	} else {
-		nr = sc->sn->nr;
-	}
+	nr = fr_schedule_network_next(sc);
+
+	if (fr_network_listen_add(nr, li) < 0) return NULL;
+
+	return nr;
+}
+
+/** Add a fr_listen_t to a particular network in a scheduler.
+ *
+ * Connected sockets share their client's tracking structures with the
+ * listener which accepted them, so they must be serviced by the same
+ * network thread, and not spread over the networks.
+ *
+ * @param[in] sc the scheduler
+ * @param[in] nr the network to add the socket to.
+ * @param[in] li the ctx and callbacks for the transport.
+ * @return
+ *	- NULL on error
+ *	- the fr_network_t that the socket was added to.
+ */
+fr_network_t *fr_schedule_listen_add_to(fr_schedule_t *sc, fr_network_t *nr, fr_listen_t *li)
+{
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
 
 	if (fr_network_listen_add(nr, li) < 0) return NULL;
 
@@ -762,11 +1209,7 @@ fr_network_t *fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li)
 
 	(void) talloc_get_type_abort(sc, fr_schedule_t);
 
-	if (sc->el) {
-		nr = sc->single_network;
-	} else {
-		nr = sc->sn->nr;
-	}
+	nr = fr_schedule_network_next(sc);
 
 	if (fr_network_directory_add(nr, li) < 0) return NULL;
 
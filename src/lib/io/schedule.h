@@ -65,6 +65,14 @@ typedef struct {
 	uint32_t	max_workers;		//!< number of network threads
 
 	fr_time_delta_t	stats_interval;		//!< print channel statistics
+
+	bool		work_stealing;		//!< idle workers take packets from busy ones
+
+	char const	*network_cpus;		//!< CPUs to pin network threads to, e.g. "0-3,8"
+	char const	*worker_cpus;		//!< CPUs to pin worker threads to
+	bool		numa_pairing;		//!< networks only use workers on the same NUMA node
+
+	fr_worker_config_t worker;		//!< configuration passed to each worker
 } fr_schedule_config_t;
 
 int			fr_schedule_worker_id(void);
@@ -78,6 +86,7 @@ fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_
 int			fr_schedule_destroy(fr_schedule_t **sc);
 
 fr_network_t		*fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
+fr_network_t		*fr_schedule_listen_add_to(fr_schedule_t *sc, fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
 fr_network_t		*fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
 #ifdef __cplusplus
 }
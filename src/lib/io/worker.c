@@ -46,6 +46,14 @@
  *  yielded, it is placed onto the yielded list in the worker
  *  "tracking" data structure.
  *
+ *  When the scheduler puts workers into a group, a worker which
+ *  already has runnable requests doesn't decode new packets.  It
+ *  defers them to a queue which its siblings can read.  A worker
+ *  with nothing to run takes packets from its own queue first, and
+ *  then "steals" them from its siblings.  Only the worker which owns
+ *  a channel may write to it, so the thief encodes the reply, and
+ *  hands it back to the owner to send.
+ *
  * @copyright 2016 Alan DeKok (aland@freeradius.org)
  */
 RCSID("$Id$")
@@ -61,6 +69,10 @@ RCSID("$Id$")
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <unistd.h>
 
 #ifdef WITH_VERIFY_PTR
 static void worker_verify(fr_worker_t *worker);
@@ -71,6 +83,48 @@ static void worker_verify(fr_worker_t *worker);
 
 static _Thread_local fr_worker_t *thread_local_worker;
 
+/*
+ *	The maximum number of packets a worker can defer.  This
+ *	includes packets which have been stolen, but not replied to.
+ */
+#define WORKER_DEFERRED_MAX	(1024)
+
+/** A worker's entry in a group of workers which steal from each other
+ *
+ * The entry is owned by the group, and outlives the worker, so
+ * siblings can still use it while the worker is exiting.
+ */
+typedef struct {
+	fr_atomic_queue_t	*deferred;	//!< Packets the worker hasn't decoded.  Anyone may pop them.
+	fr_atomic_queue_t	*returned;	//!< Replies to packets which siblings stole from the worker.
+	int			pipe[2];	//!< For waking the worker.
+
+	atomic_bool		idle;		//!< The worker is waiting for events.
+	atomic_bool		closed;		//!< The worker is exiting, and won't defer any more packets.
+} fr_worker_slot_t;
+
+struct fr_worker_group_s {
+	uint32_t		num;		//!< Number of slots.
+	fr_worker_slot_t	*slot;		//!< One for each worker.
+};
+
+/** A reply to a stolen packet, on its way back to the worker which owns the channel
+ *
+ */
+typedef struct {
+	fr_channel_data_t	*cd;		//!< The packet, if the owner should NAK it.  Otherwise NULL.
+
+	fr_channel_t		*ch;		//!< To send the reply on.
+	fr_listen_t		*listen;	//!< The packet was received on.
+	void			*packet_ctx;	//!< From the packet.
+	fr_time_t		recv_time;	//!< When the network thread received the packet.
+	fr_time_t		when;		//!< The thief finished the request.
+	fr_time_delta_t		processing_time; //!< How long the thief spent running the request.
+
+	size_t			size;		//!< Of the encoded reply.
+	uint8_t			data[];		//!< The encoded reply.
+} worker_steal_reply_t;
+
 /**
  *  A worker which takes packets from a master, and processes them.
  */
@@ -115,9 +169,309 @@ struct fr_worker_s {
 	fr_event_timer_t const	*ev_cleanup;	//!< timer for max_request_time
 
 	fr_channel_t		**channel;	//!< list of channels
+
+	fr_worker_group_t	*group;		//!< workers we steal packets from, if any
+	fr_worker_slot_t	*slot;		//!< our entry in the group
+	uint32_t		id;		//!< index of our entry in the group
+
+	uint32_t		num_deferred;	//!< packets we've deferred, and haven't yet replied to
+	uint64_t		num_steals;	//!< number of packets we've taken from siblings
+	uint64_t		num_stolen;	//!< number of packets siblings have taken from us
+
+	fr_time_delta_t		queue_delay;	//!< of the last request we started
+	fr_time_t		overload_above;	//!< when we next raise the shedding priority, or 0
+	uint32_t		overload_priority; //!< shed packets at or below this priority, or 0
+	uint64_t		num_shed;	//!< number of packets shed because we were overloaded
 };
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now);
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now,
+				     fr_worker_slot_t *stolen);
+static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now);
+static void worker_steal_close_pending(fr_worker_t *worker);
+
+/** Wake up an idle sibling, so that it can steal a packet we've deferred
+ *
+ */
+static void worker_steal_wake(fr_worker_t *worker)
+{
+	uint32_t i;
+
+	for (i = 1; i < worker->group->num; i++) {
+		fr_worker_slot_t	*slot = &worker->group->slot[(worker->id + i) % worker->group->num];
+		bool			idle = true;
+
+		/*
+		 *	Clear the flag, so that only one of us
+		 *	wakes it up.
+		 */
+		if (!atomic_compare_exchange_strong(&slot->idle, &idle, false)) continue;
+
+		if (write(slot->pipe[1], "", 1) < 0) {
+			DEBUG3("Failed waking sibling %u - %s", (worker->id + i) % worker->group->num,
+			       fr_syserror(errno));
+		}
+		return;
+	}
+}
+
+/** Defer a packet, so that we or a sibling can decode it later
+ *
+ * @return
+ *	- true if the packet was deferred.
+ *	- false if there's no room.  The caller should decode it now.
+ */
+static bool worker_defer(fr_worker_t *worker, fr_channel_data_t *cd)
+{
+	if (worker->num_deferred >= WORKER_DEFERRED_MAX) return false;
+
+	if (!fr_atomic_queue_push(worker->slot->deferred, cd)) return false;
+	worker->num_deferred++;
+
+	worker_steal_wake(worker);
+
+	return true;
+}
+
+/** Take a deferred packet from ourselves, or from a sibling, and decode it
+ *
+ * @return
+ *	- true if we found a packet.
+ *	- false if there was nothing to take.
+ */
+static bool worker_steal(fr_worker_t *worker, fr_time_t now)
+{
+	fr_channel_data_t	*cd;
+	uint32_t		i;
+
+	if (fr_atomic_queue_pop(worker->slot->deferred, (void **) &cd)) {
+		fr_assert(worker->num_deferred > 0);
+		worker->num_deferred--;
+		worker_request_bootstrap(worker, cd, now, NULL);
+		return true;
+	}
+
+	for (i = 1; i < worker->group->num; i++) {
+		fr_worker_slot_t *slot = &worker->group->slot[(worker->id + i) % worker->group->num];
+
+		if (atomic_load(&slot->closed)) continue;
+
+		if (!fr_atomic_queue_pop(slot->deferred, (void **) &cd)) continue;
+
+		DEBUG3("Stole packet from sibling %u", (worker->id + i) % worker->group->num);
+		worker->num_steals++;
+		worker_request_bootstrap(worker, cd, now, slot);
+		return true;
+	}
+
+	return false;
+}
+
+/** Hand a reply to a stolen packet back to the worker which owns its channel
+ *
+ * @param[in] worker	the thief.
+ * @param[in] slot	of the worker we stole the packet from.
+ * @param[in] sr	the reply.
+ */
+static void worker_steal_return(fr_worker_t *worker, fr_worker_slot_t *slot, worker_steal_reply_t *sr)
+{
+	/*
+	 *	The owner stops deferring packets once it has
+	 *	WORKER_DEFERRED_MAX outstanding, so this can't fail.
+	 */
+	if (!fr_cond_assert(fr_atomic_queue_push(slot->returned, sr))) {
+		talloc_free(sr);
+		return;
+	}
+
+	if (write(slot->pipe[1], "", 1) < 0) {
+		ERROR("Failed signalling reply to stolen packet - %s", fr_syserror(errno));
+	}
+}
+
+/** Return a stolen packet to its owner, so that it can NAK it
+ *
+ */
+static void worker_steal_nak(fr_worker_t *worker, fr_worker_slot_t *slot, fr_channel_data_t *cd)
+{
+	worker_steal_reply_t *sr;
+
+	MEM(sr = talloc_zero(NULL, worker_steal_reply_t));
+	sr->cd = cd;
+
+	worker_steal_return(worker, slot, sr);
+}
+
+/** NAK a packet, or have its owner NAK it if we stole it
+ *
+ */
+static inline void worker_nak_or_return(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now,
+					fr_worker_slot_t *stolen)
+{
+	if (stolen) {
+		worker_steal_nak(worker, stolen, cd);
+		return;
+	}
+
+	worker_nak(worker, cd, now);
+}
+
+/** Send a reply to a packet a sibling stole from us
+ *
+ * @param[in] worker	the owner of the channel.
+ * @param[in] sr	the reply.
+ * @param[in] now	the current time.
+ */
+static void worker_steal_reply_send(fr_worker_t *worker, worker_steal_reply_t *sr, fr_time_t now)
+{
+	fr_channel_data_t	*reply;
+	fr_message_set_t	*ms;
+
+	fr_assert(worker->num_deferred > 0);
+	worker->num_deferred--;
+	worker->num_stolen++;
+
+	/*
+	 *	We haven't acked the close, so the packet and the
+	 *	channel are still valid.  But the network side doesn't
+	 *	want any more replies.
+	 */
+	if (sr->cd) {
+		if (!fr_channel_active(sr->cd->channel.ch)) {
+			fr_message_done(&sr->cd->m);
+		} else {
+			worker_nak(worker, sr->cd, now);
+		}
+		goto done;
+	}
+
+	if (!fr_channel_active(sr->ch)) goto done;
+
+	ms = fr_channel_responder_uctx_get(sr->ch);
+	fr_assert(ms != NULL);
+
+	reply = (fr_channel_data_t *) fr_message_reserve(ms, sr->size);
+	fr_assert(reply != NULL);
+
+	if (sr->size) {
+		memcpy(reply->m.data, sr->data, sr->size);
+		(void) fr_message_alloc(ms, &reply->m, sr->size);
+	}
+
+	reply->m.when = sr->when;
+	reply->reply.cpu_time = worker->tracking.running_total;
+	reply->reply.processing_time = sr->processing_time;
+	reply->reply.request_time = sr->recv_time;
+
+	reply->listen = sr->listen;
+	reply->packet_ctx = sr->packet_ctx;
+
+	if (fr_channel_send_reply(sr->ch, reply) < 0) {
+		ERROR("Failed sending reply to network thread");
+	}
+
+	worker->stats.out++;
+
+done:
+	talloc_free(sr);
+
+	if (!worker->num_deferred && atomic_load(&worker->slot->closed)) worker_steal_close_pending(worker);
+}
+
+/** Read replies which our siblings have handed back, or wake up to steal packets
+ *
+ */
+static void worker_steal_signal(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_worker_t		*worker = talloc_get_type_abort(uctx, fr_worker_t);
+	worker_steal_reply_t	*sr;
+	uint8_t			buffer[64];
+	fr_time_t		now = fr_time();
+
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+
+	while (fr_atomic_queue_pop(worker->slot->returned, (void **) &sr)) worker_steal_reply_send(worker, sr, now);
+}
+
+/** Update the overload state with the queue delay of a new request
+ *
+ * This is loosely based on CoDel.  The queue delay is the time from
+ * when the network thread received the packet, to when we first run
+ * it.  If the delay stays above the target for a whole interval, we
+ * start shedding low priority packets.  If that isn't enough, then
+ * after each further interval we shed the next priority up, but never
+ * PRIORITY_HIGH or above.  As soon as one request sees a delay below
+ * the target, we stop shedding.
+ *
+ * The priorities come from the listener, e.g. the "priority"
+ * section of proto_radius.
+ *
+ * @param[in] worker	the worker.
+ * @param[in] request	which we're about to run for the first time.
+ * @param[in] now	the current time.
+ * @return
+ *	- true if the request should be shed.
+ *	- false if it should be run.
+ */
+static bool worker_overload_check(fr_worker_t *worker, REQUEST *request, fr_time_t now)
+{
+	fr_time_delta_t delay;
+
+	if (!worker->config.overload_target) return false;
+
+	delay = (now > request->async->recv_time) ? now - request->async->recv_time : 0;
+	worker->queue_delay = delay;
+
+	if (delay < worker->config.overload_target) {
+		worker->overload_above = 0;
+
+		if (worker->overload_priority) {
+			INFO("Queue delay is below target - no longer shedding packets");
+			worker->overload_priority = 0;
+		}
+		return false;
+	}
+
+	if (!worker->overload_above) {
+		worker->overload_above = now + worker->config.overload_interval;
+		return false;
+	}
+
+	if (now >= worker->overload_above) {
+		worker->overload_above = now + worker->config.overload_interval;
+
+		if (!worker->overload_priority) {
+			WARN("Queue delay has been above target for %.3fs - shedding low priority packets",
+			     (double) worker->config.overload_interval / NSEC);
+			worker->overload_priority = PRIORITY_LOW;
+
+		} else if (worker->overload_priority < PRIORITY_NORMAL) {
+			WARN("Queue delay is still above target - shedding normal priority packets");
+			worker->overload_priority = PRIORITY_NORMAL;
+		}
+	}
+
+	return (request->async->priority <= worker->overload_priority);
+}
+
+/** Decide whether to shed a packet as soon as we receive it
+ *
+ * This saves decoding packets which would be shed anyway.  We only
+ * learn the queue delay when requests start, so if no requests have
+ * started for a while, we assume the overload has passed.
+ */
+static bool worker_overload_shed(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+{
+	if (!worker->overload_priority) return false;
+
+	if (now >= (worker->overload_above + worker->config.overload_interval)) {
+		INFO("No recent requests above target queue delay - no longer shedding packets");
+		worker->overload_above = 0;
+		worker->overload_priority = 0;
+		return false;
+	}
+
+	return (cd->priority <= worker->overload_priority);
+}
 
 /** Callback which handles a message being received on the worker side.
  *
@@ -127,12 +481,29 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
  */
 static void worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_t *cd)
 {
-	fr_worker_t *worker = ctx;
+	fr_worker_t	*worker = ctx;
+	fr_time_t	now = fr_time();
 
 	worker->stats.in++;
 	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
 	cd->channel.ch = ch;
-	worker_request_bootstrap(worker, cd, fr_time());
+
+	if (worker_overload_shed(worker, cd, now)) {
+		DEBUG3("Overloaded - shedding packet with priority %u", cd->priority);
+		worker->num_shed++;
+		worker_nak(worker, cd, now);
+		return;
+	}
+
+	/*
+	 *	We already have requests to run.  Leave the packet
+	 *	where an idle sibling can take it.  Duplicates have to
+	 *	be checked against our own requests, so we keep those.
+	 */
+	if (worker->slot && (fr_heap_num_elements(worker->runnable) > 0) &&
+	    !cd->listen->track_duplicates && worker_defer(worker, cd)) return;
+
+	worker_request_bootstrap(worker, cd, now, NULL);
 }
 
 static void worker_exit(fr_worker_t *worker)
@@ -150,6 +521,82 @@ static void worker_exit(fr_worker_t *worker)
 	(void)fr_event_post_delete(worker->el, fr_worker_post_event, worker);
 }
 
+/** Acknowledge that a channel has been closed, and forget about it
+ *
+ * @param[in] worker	the worker
+ * @param[in] ch	which the network side has closed.
+ */
+static void worker_channel_close(fr_worker_t *worker, fr_channel_t *ch)
+{
+	int			i;
+	bool			ok = false;
+	fr_message_set_t	*ms;
+
+	/*
+	 *	Locate the signalling channel in the list
+	 *	of channels.
+	 */
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (!worker->channel[i]) continue;
+
+		if (worker->channel[i] != ch) continue;
+
+		ms = fr_channel_responder_uctx_get(ch);
+
+		fr_channel_responder_ack_close(ch);
+		fr_assert(ms != NULL);
+		fr_message_set_gc(ms);
+		talloc_free(ms);
+
+		worker->channel[i] = NULL;
+		fr_assert(worker->num_channels > 0);
+		worker->num_channels--;
+		ok = true;
+		break;
+	}
+
+	fr_cond_assert(ok);
+
+	/*
+	 *	Our last input channel closed,
+	 *	time to die.
+	 */
+	if (worker->num_channels == 0) worker_exit(worker);
+}
+
+/** Stop siblings from taking our packets, and throw away the ones nobody has taken
+ *
+ * Called when the network side starts closing our channels.
+ */
+static void worker_steal_close(fr_worker_t *worker)
+{
+	fr_channel_data_t *cd;
+
+	atomic_store(&worker->slot->closed, true);
+
+	while (fr_atomic_queue_pop(worker->slot->deferred, (void **) &cd)) {
+		fr_assert(worker->num_deferred > 0);
+		worker->num_deferred--;
+		fr_message_done(&cd->m);
+	}
+}
+
+/** Ack the channel closes we delayed, now that siblings have returned all of our packets
+ *
+ */
+static void worker_steal_close_pending(fr_worker_t *worker)
+{
+	int i;
+
+	for (i = 0; i < worker->config.max_channels; i++) {
+		fr_channel_t *ch = worker->channel[i];
+
+		if (!ch || fr_channel_active(ch)) continue;
+
+		worker_channel_close(worker, ch);
+	}
+}
+
 /** Handle a control plane message sent to the worker via a channel
  *
  * @param[in] ctx	the worker
@@ -228,38 +675,22 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 	case FR_CHANNEL_CLOSE:
 		fr_assert(ch != NULL);
 
-		ok = false;
-
 		/*
-		 *	Locate the signalling channel in the list
-		 *	of channels.
+		 *	The network side frees the packets and the
+		 *	listeners once we ack the close.  Siblings may
+		 *	still be running packets which they stole from
+		 *	us, so we wait for them to hand those back.
 		 */
-		for (i = 0; i < worker->config.max_channels; i++) {
-			if (!worker->channel[i]) continue;
-
-			if (worker->channel[i] != ch) continue;
-
-			ms = fr_channel_responder_uctx_get(ch);
-
-			fr_channel_responder_ack_close(ch);
-			fr_assert(ms != NULL);
-			fr_message_set_gc(ms);
-			talloc_free(ms);
-
-			worker->channel[i] = NULL;
-			fr_assert(worker->num_channels > 0);
-			worker->num_channels--;
-			ok = true;
-			break;
+		if (worker->slot) {
+			worker_steal_close(worker);
+			if (worker->num_deferred > 0) {
+				DEBUG3("Waiting for siblings to return %u packets before closing channel",
+				       worker->num_deferred);
+				break;
+			}
 		}
 
-		fr_cond_assert(ok);
-
-		/*
-		 *	Our last input channel closed,
-		 *	time to die.
-		 */
-		if (worker->num_channels == 0) worker_exit(worker);
+		worker_channel_close(worker, ch);
 		break;
 	}
 }
@@ -355,6 +786,56 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 
 static void worker_max_request_timer(fr_worker_t *worker);
 
+/** Encode a reply
+ *
+ * @return the length of the reply.  Always at least one byte.
+ */
+static ssize_t worker_encode(fr_worker_t *worker, REQUEST *request, uint8_t *data, size_t data_len)
+{
+	ssize_t			slen = 0;
+	fr_listen_t const	*listen = request->async->listen;
+
+	if (listen->app->encode) {
+		slen = listen->app->encode(listen->app_instance, request, data, data_len);
+	} else if (listen->app_io->encode) {
+		slen = listen->app_io->encode(listen->app_io_instance, request, data, data_len);
+	}
+	if (slen < 0) {
+		ERROR("Failed encoding request");
+		*data = 0;
+		slen = 1;
+	}
+
+	return slen;
+}
+
+/** Encode the reply to a stolen packet, and hand it back to the worker which owns the channel
+ *
+ * @param[in] worker	the thief.
+ * @param[in] request	to reply to.
+ * @param[in] size	the maximum size of the reply.  Zero if the owner
+ *			should only tell the network side that we're done.
+ */
+static void worker_steal_reply(fr_worker_t *worker, REQUEST *request, size_t size)
+{
+	worker_steal_reply_t *sr;
+
+	MEM(sr = talloc_zero_size(NULL, sizeof(*sr) + size));
+	talloc_set_name_const(sr, "worker_steal_reply_t");
+
+	if (size) sr->size = worker_encode(worker, request, sr->data, size);
+
+	sr->ch = request->async->channel;
+	sr->listen = request->async->listen;
+	sr->packet_ctx = request->async->packet_ctx;
+	sr->recv_time = request->async->recv_time;
+	sr->when = request->async->tracking.last_changed;
+	sr->processing_time = request->async->tracking.running_total;
+
+	worker_steal_return(worker, request->async->stolen, sr);
+	request->async->stolen = NULL;
+}
+
 
 /** Send a response packet to the network side
  *
@@ -376,6 +857,20 @@ static void worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t size
 	 */
 	fr_assert(request->runnable_id < 0);
 
+	/*
+	 *	Only the worker which owns the channel can write to
+	 *	it, so hand the reply back to that worker.
+	 */
+	if (request->async->stolen) {
+		fr_time_tracking_end(&worker->predicted, &request->async->tracking, now);
+		fr_assert(worker->num_active > 0);
+		worker->num_active--;
+
+		RDEBUG("Finished request - returning the reply to the worker we stole it from");
+		worker_steal_reply(worker, request, worker->exiting ? 0 : size);
+		goto finished;
+	}
+
 	/*
 	 *	If it's a fake request, or we're exiting, don't send a
 	 *	real reply.  Just toss the request.
@@ -412,21 +907,7 @@ static void worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t size
 	 *	Encode it, if required.
 	 */
 	if (size) {
-		ssize_t slen = 0;
-		fr_listen_t const *listen = request->async->listen;
-
-		if (listen->app->encode) {
-			slen = listen->app->encode(listen->app_instance, request,
-						   reply->m.data, reply->m.rb_size);
-		} else if (listen->app_io->encode) {
-			slen = listen->app_io->encode(listen->app_io_instance, request,
-						      reply->m.data, reply->m.rb_size);
-		}
-		if (slen < 0) {
-			ERROR("Failed encoding request");
-			*reply->m.data = 0;
-			slen = 1;
-		}
+		ssize_t slen = worker_encode(worker, request, reply->m.data, reply->m.rb_size);
 
 		/*
 		 *	Shrink the buffer to the actual packet size.
@@ -691,7 +1172,15 @@ static void worker_request_time_tracking_start(fr_worker_t *worker, REQUEST *req
 	if (!worker->ev_cleanup) worker_max_request_timer(worker);
 }
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+/** Decode a packet, and create a request for it
+ *
+ * @param[in] worker	the worker.
+ * @param[in] cd	the packet.
+ * @param[in] now	the current time.
+ * @param[in] stolen	the entry of the worker we stole the packet from, if any.
+ */
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now,
+				     fr_worker_slot_t *stolen)
 {
 	bool			is_dup;
 	int			ret = -1;
@@ -725,6 +1214,8 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 
 	request->async->listen = cd->listen;
 	request->async->packet_ctx = cd->packet_ctx;
+	request->async->priority = cd->priority;
+	request->async->stolen = stolen;
 	listen = request->async->listen;
 
 	/*
@@ -741,7 +1232,7 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 	if (ret < 0) {
 		talloc_free(ctx);
 nak:
-		worker_nak(worker, cd, now);
+		worker_nak_or_return(worker, cd, now, stolen);
 		return;
 	}
 
@@ -753,7 +1244,7 @@ nak:
 
 	if (!request->async->process) {
 		RERROR("Protocol failed to set 'process' function");
-		worker_nak(worker, cd, now);
+		worker_nak_or_return(worker, cd, now, stolen);
 		return;
 	}
 
@@ -862,6 +1353,7 @@ static void worker_run_request(fr_worker_t *worker, fr_time_t start)
 	rlm_rcode_t final;
 	REQUEST *request;
 	fr_time_t now;
+	bool is_new;
 
 	WORKER_VERIFY;
 
@@ -873,6 +1365,13 @@ redo:
 
 	REQUEST_VERIFY(request);
 	fr_assert(request->runnable_id < 0);
+
+	/*
+	 *	Requests are started and yielded at the same time,
+	 *	so if they've never been resumed, this is the first
+	 *	time they've run.
+	 */
+	is_new = (request->async->tracking.last_resumed == request->async->tracking.started);
 	fr_time_tracking_resume(&request->async->tracking, now);
 
 	fr_assert(request->parent == NULL);
@@ -886,12 +1385,42 @@ redo:
 	 *	For real requests, if the channel is gone, just stop
 	 *	the request and free it.
 	 */
-	if (!request->async->fake && !fr_channel_active(request->async->channel)) {
+	if (request->async->stolen) {
+		/*
+		 *	The channel belongs to the worker we stole the
+		 *	request from, so we can't look at it.  If that
+		 *	worker is exiting, it won't send the reply.
+		 */
+		if (atomic_load(&((fr_worker_slot_t *) request->async->stolen)->closed)) {
+			worker_stop_request(worker, request, now);
+			worker_steal_reply(worker, request, 0);
+			fr_assert(worker->num_active > 0);
+			worker->num_active--;
+			talloc_free(request);
+			return;
+		}
+
+	} else if (!request->async->fake && !fr_channel_active(request->async->channel)) {
 		worker_stop_request(worker, request, now);
 		talloc_free(request);
 		return;
 	}
 
+	/*
+	 *	We're overloaded, and this request is low priority.
+	 *	Finish it without a reply, as if it had failed.
+	 */
+	if (is_new && !request->async->fake && worker_overload_check(worker, request, now)) {
+		RDEBUG("Overloaded - shedding request");
+		worker->num_shed++;
+
+		if (request->async->listen->track_duplicates) (void) rbtree_deletebydata(worker->dedup, request);
+
+		worker_send_reply(worker, request, 0, now);
+		now = fr_time();
+		goto keep_going;
+	}
+
 	/*
 	 *	Everything else, run the request.
 	 */
@@ -967,7 +1496,10 @@ static int8_t worker_runnable_cmp(void const *one, void const *two)
 	REQUEST const *a = one, *b = two;
 	int ret;
 
-	ret = (a->async->priority > b->async->priority) - (a->async->priority < b->async->priority);
+	/*
+	 *	Larger numbers mean higher priority
+	 */
+	ret = (a->async->priority < b->async->priority) - (a->async->priority > b->async->priority);
 	if (ret != 0) return ret;
 
 	return (a->async->recv_time > b->async->recv_time) - (a->async->recv_time < b->async->recv_time);
@@ -1029,6 +1561,12 @@ void fr_worker_destroy(fr_worker_t *worker)
 			count++;
 		}
 		worker_stop_request(worker, request, now);
+
+		/*
+		 *	Let the worker we stole it from know that
+		 *	it's done, so that it can exit, too.
+		 */
+		if (request->async->stolen) worker_steal_reply(worker, request, 0);
 		talloc_free(request);
 	}
 	fr_assert(fr_heap_num_elements(worker->runnable) == 0);
@@ -1094,6 +1632,21 @@ nomem:
 	CHECK_CONFIG(ring_buffer_size, (1 << 17), (1 << 20));
 	CHECK_CONFIG(max_request_time, fr_time_delta_from_sec(30), fr_time_delta_from_sec(60));
 
+	/*
+	 *	A zero target disables shedding, so only check the
+	 *	interval when it's enabled.
+	 */
+	if (worker->config.overload_target) {
+		CHECK_CONFIG(overload_target, fr_time_delta_from_msec(1), fr_time_delta_from_sec(10));
+		CHECK_CONFIG(overload_interval, fr_time_delta_from_msec(100), fr_time_delta_from_sec(10));
+	}
+
+	/*
+	 *	All requests for this worker are allocated in this
+	 *	thread, so size their pools here.
+	 */
+	request_pool_size_set(worker->config.talloc_pool_size);
+
 	worker->channel = talloc_zero_array(worker, fr_channel_t *, worker->config.max_channels);
 	if (!worker->channel) {
 		talloc_free(worker);
@@ -1174,6 +1727,22 @@ void fr_worker(fr_worker_t *worker)
 		 *	the event loop, but we don't wait for events.
 		 */
 		wait_for_event = (fr_heap_num_elements(worker->runnable) == 0);
+
+		/*
+		 *	Nothing to run, so look for a packet which we,
+		 *	or a sibling, deferred.  We say we're idle
+		 *	before looking, so that a sibling which defers
+		 *	a packet after we've looked will wake us up.
+		 */
+		if (wait_for_event && worker->slot) {
+			atomic_store(&worker->slot->idle, true);
+
+			if (worker_steal(worker, fr_time())) {
+				atomic_store(&worker->slot->idle, false);
+				wait_for_event = false;
+			}
+		}
+
 		if (wait_for_event) {
 			DEBUG4("Ready to process requests");
 		}
@@ -1184,6 +1753,7 @@ void fr_worker(fr_worker_t *worker)
 		 */
 		DEBUG3("Gathering events - %s", wait_for_event ? "will wait" : "Will not wait");
 		num_events = fr_event_corral(worker->el, fr_time(), wait_for_event);
+		if (worker->slot) atomic_store(&worker->slot->idle, false);
 		if (num_events < 0) {
 			PERROR("Failed retrieving events");
 			break;
@@ -1329,6 +1899,119 @@ fr_channel_t *fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_
 	return ch;
 }
 
+static int _worker_group_free(fr_worker_group_t *group)
+{
+	uint32_t i;
+
+	for (i = 0; i < group->num; i++) {
+		fr_worker_slot_t	*slot = &group->slot[i];
+		worker_steal_reply_t	*sr;
+
+		/*
+		 *	The workers have exited, so nobody is going
+		 *	to send these.
+		 */
+		if (slot->returned) while (fr_atomic_queue_pop(slot->returned, (void **) &sr)) talloc_free(sr);
+
+		if (slot->pipe[0] >= 0) close(slot->pipe[0]);
+		if (slot->pipe[1] >= 0) close(slot->pipe[1]);
+	}
+
+	return 0;
+}
+
+/** Create a group of workers which steal packets from each other
+ *
+ * The group must be freed after all of its workers have exited.
+ *
+ * @param[in] ctx	to allocate the group in.
+ * @param[in] num	the number of workers in the group.
+ * @return
+ *	- NULL on error.
+ *	- fr_worker_group_t on success.
+ */
+fr_worker_group_t *fr_worker_group_create(TALLOC_CTX *ctx, uint32_t num)
+{
+	fr_worker_group_t	*group;
+	uint32_t		i;
+
+	group = talloc_zero(ctx, fr_worker_group_t);
+	if (!group) {
+	nomem:
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+
+	group->slot = talloc_zero_array(group, fr_worker_slot_t, num);
+	if (!group->slot) {
+		talloc_free(group);
+		goto nomem;
+	}
+
+	for (i = 0; i < num; i++) {
+		group->slot[i].pipe[0] = group->slot[i].pipe[1] = -1;
+		atomic_init(&group->slot[i].idle, false);
+		atomic_init(&group->slot[i].closed, false);
+	}
+	group->num = num;
+	talloc_set_destructor(group, _worker_group_free);
+
+	for (i = 0; i < num; i++) {
+		fr_worker_slot_t *slot = &group->slot[i];
+
+		slot->deferred = fr_atomic_queue_create(group->slot, WORKER_DEFERRED_MAX);
+		slot->returned = fr_atomic_queue_create(group->slot, WORKER_DEFERRED_MAX);
+		if (!slot->deferred || !slot->returned) {
+			fr_strerror_printf("Failed creating atomic queue");
+		fail:
+			talloc_free(group);
+			return NULL;
+		}
+
+		if (pipe(slot->pipe) < 0) {
+			fr_strerror_printf("Failed opening pipe for worker group: %s", fr_syserror(errno));
+			goto fail;
+		}
+		if ((fr_nonblock(slot->pipe[0]) < 0) || (fr_nonblock(slot->pipe[1]) < 0)) goto fail;
+	}
+
+	return group;
+}
+
+/** Add a worker to a group, so that it can steal packets from its siblings
+ *
+ * Must be called from the worker's thread, before it starts processing
+ * packets.
+ *
+ * @param[in] group	to join.
+ * @param[in] worker	to add.
+ * @param[in] id	the worker's index in the group.  Each worker must
+ *			use a different one.
+ * @return
+ *	- <0 on error.
+ *	- 0 on success.
+ */
+int fr_worker_group_join(fr_worker_group_t *group, fr_worker_t *worker, uint32_t id)
+{
+	WORKER_VERIFY;
+
+	if (id >= group->num) {
+		fr_strerror_printf("Worker %u is outside of the group", id);
+		return -1;
+	}
+
+	if (fr_event_fd_insert(worker, worker->el, group->slot[id].pipe[0], worker_steal_signal, NULL, NULL, worker) < 0) {
+		fr_strerror_printf_push("Failed adding FD to event list for worker group");
+		return -1;
+	}
+
+	worker->group = group;
+	worker->slot = &group->slot[id];
+	worker->id = id;
+
+	return 0;
+}
+
 #ifdef WITH_VERIFY_PTR
 /** Verify the worker data structures.
  *
@@ -1378,6 +2061,54 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	return 6;
 }
 
+/** Write the statistics for a worker
+ *
+ * Called from another thread.  The counters are only written by
+ * the worker, so we just read them.
+ *
+ * @param[in] m		to write to.
+ * @param[in] worker	to read the statistics from.
+ * @param[in] labels	which identify the worker, e.g. worker="0".
+ */
+void fr_worker_metrics(fr_metrics_t *m, fr_worker_t const *worker, char const *labels)
+{
+	fr_metrics_counter(m, "freeradius_worker_packets_in", "Packets received by a worker.",
+			   worker->stats.in, "%s", labels);
+	fr_metrics_counter(m, "freeradius_worker_packets_out", "Replies sent by a worker.",
+			   worker->stats.out, "%s", labels);
+	fr_metrics_counter(m, "freeradius_worker_packets_dup", "Duplicate packets received by a worker.",
+			   worker->stats.dup, "%s", labels);
+	fr_metrics_counter(m, "freeradius_worker_packets_dropped", "Packets dropped by a worker.",
+			   worker->stats.dropped, "%s", labels);
+	fr_metrics_counter(m, "freeradius_worker_naks", "Packets a worker sent back to the network unprocessed.",
+			   worker->num_naks, "%s", labels);
+
+	fr_metrics_gauge(m, "freeradius_worker_requests_active", "Requests being processed by a worker.",
+			 worker->num_active, "%s", labels);
+	fr_metrics_gauge(m, "freeradius_worker_requests_runnable", "Requests waiting for a worker to run them.",
+			 fr_heap_num_elements(worker->runnable), "%s", labels);
+
+	if (worker->config.overload_target) {
+		fr_metrics_counter(m, "freeradius_worker_packets_shed", "Packets a worker shed because it was overloaded.",
+				   worker->num_shed, "%s", labels);
+		fr_metrics_gauge(m, "freeradius_worker_overload_priority",
+				 "Packets at or below this priority are being shed.  0 if the worker isn't overloaded.",
+				 worker->overload_priority, "%s", labels);
+		fr_metrics_gauge(m, "freeradius_worker_queue_delay_microseconds",
+				 "Queue delay of the last request a worker started.",
+				 fr_time_delta_to_usec(worker->queue_delay), "%s", labels);
+	}
+
+	if (!worker->slot) return;
+
+	fr_metrics_counter(m, "freeradius_worker_steals", "Packets a worker took from its siblings.",
+			   worker->num_steals, "%s", labels);
+	fr_metrics_counter(m, "freeradius_worker_stolen", "Packets a worker's siblings took from it.",
+			   worker->num_stolen, "%s", labels);
+	fr_metrics_gauge(m, "freeradius_worker_packets_deferred", "Packets a worker deferred, which haven't been replied to.",
+			 worker->num_deferred, "%s", labels);
+}
+
 static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	fr_worker_t const *worker = ctx;
@@ -1391,6 +2122,20 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.naks\t\t\t%" PRIu64 "\n", worker->num_naks);
 		fprintf(fp, "count.active\t\t\t%" PRIu64 "\n", worker->num_active);
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
+		if (worker->slot) {
+			fprintf(fp, "count.deferred\t\t\t%u\n", worker->num_deferred);
+			fprintf(fp, "count.steals\t\t\t%" PRIu64 "\n", worker->num_steals);
+			fprintf(fp, "count.stolen\t\t\t%" PRIu64 "\n", worker->num_stolen);
+		}
+		if (worker->config.overload_target) {
+			fprintf(fp, "count.shed\t\t\t%" PRIu64 "\n", worker->num_shed);
+			fprintf(fp, "overload.priority\t\t%s\n", worker->overload_priority ?
+				fr_table_str_by_value(channel_packet_priority, worker->overload_priority, "<INVALID>") :
+				"none");
+			when = worker->queue_delay;
+			fprintf(fp, "overload.queue_delay\t\t%u.%06u\n", (unsigned int) (when / NSEC),
+				(unsigned int) (when % NSEC) / 1000);
+		}
 	}
 
 	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
@@ -37,6 +37,11 @@ extern "C" {
  */
 typedef struct fr_worker_s fr_worker_t;
 
+/**
+ *  A group of workers which steal packets from each other.
+ */
+typedef struct fr_worker_group_s fr_worker_group_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -45,6 +50,7 @@ typedef struct fr_worker_s fr_worker_t;
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/log.h>
 #include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/metrics.h>
 #include <freeradius-devel/io/base.h>
 
 #include <talloc.h>
@@ -66,6 +72,9 @@ typedef struct {
 	fr_time_delta_t	max_request_time;	//!< maximum time a request can be processed
 
 	size_t		talloc_pool_size;	//!< for each request
+
+	fr_time_delta_t	overload_target;	//!< queue delay above which we're overloaded.  0 to disable.
+	fr_time_delta_t	overload_interval;	//!< how long the delay must stay above the target
 } fr_worker_config_t;
 
 fr_worker_t	*fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const *name,
@@ -73,6 +82,10 @@ fr_worker_t	*fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const *
 
 void		fr_worker_destroy(fr_worker_t *worker) CC_HINT(nonnull);
 
+fr_worker_group_t *fr_worker_group_create(TALLOC_CTX *ctx, uint32_t num);
+
+int		fr_worker_group_join(fr_worker_group_t *group, fr_worker_t *worker, uint32_t id) CC_HINT(nonnull);
+
 void		fr_worker(fr_worker_t *worker) CC_HINT(nonnull);
 
 void		fr_worker_debug(fr_worker_t *worker, FILE *fp) CC_HINT(nonnull);
@@ -85,6 +98,8 @@ fr_channel_t	*fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_
 
 int		fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats) CC_HINT(nonnull);
 
+void		fr_worker_metrics(fr_metrics_t *m, fr_worker_t const *worker, char const *labels) CC_HINT(nonnull);
+
 /*
  *	From src/lib/server/module.h.  Copied here as that file
  *	includes schedule.h, which includes this file.  But that
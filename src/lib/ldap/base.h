@@ -12,6 +12,7 @@
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/connection.h>
 #include <freeradius-devel/server/map.h>
+#include <freeradius-devel/server/trunk.h>
 
 #define LDAP_DEPRECATED 0	/* Quiet warnings about LDAP_DEPRECATED not being defined */
 
@@ -300,9 +301,58 @@ typedef struct {
 
 	fr_ldap_state_t		state;			//!< LDAP connection state machine.
 
+	rbtree_t		*queries;		//!< Operations sent on this connection, by msgid.
+							///< Only used by trunk connections.
+	uint32_t		refs;			//!< Number of query results which need the handle
+							///< to remain valid.
+
 	void			*uctx;			//!< User data associated with the handle.
 } fr_ldap_connection_t;
 
+/** Type of operation an #fr_ldap_query_t performs
+ *
+ */
+typedef enum {
+	FR_LDAP_QUERY_SEARCH = 0,			//!< Search the directory.
+	FR_LDAP_QUERY_BIND				//!< Simple bind.
+} fr_ldap_query_type_t;
+
+/** An LDAP operation run on a trunk connection
+ *
+ * The request which issued the query yields, and is resumed when the
+ * result is available.
+ */
+typedef struct {
+	fr_ldap_query_type_t	type;			//!< What operation to perform.
+
+	char const		*dn;			//!< Base DN for searches, or the DN to bind as.
+	int			scope;			//!< Search scope.
+	char const		*filter;		//!< Search filter.  May be NULL.
+	char const * const	*attrs;			//!< Attributes to retrieve.  Must remain valid
+							///< until the query completes.
+	char const		*password;		//!< To bind with.
+
+	LDAPControl		**serverctrls;		//!< Extra controls to pass to the server.
+	LDAPControl		**clientctrls;		//!< Extra controls to pass to libldap.
+
+	fr_trunk_request_t	*treq;			//!< Trunk request.  NULL once the query completes.
+
+	fr_ldap_rcode_t		ret;			//!< Result of the operation.
+	LDAPMessage		*result;		//!< Result of a successful search.  Freed with the query.
+	fr_ldap_connection_t	*ldap_conn;		//!< The result was received on.  Stays valid until
+							///< the query is freed.
+} fr_ldap_query_t;
+
+/** A set of connections to a directory server, owned by a single thread
+ *
+ */
+typedef struct {
+	fr_trunk_t		*trunk;			//!< Connections to the directory.
+	fr_ldap_config_t const	*config;		//!< Connection configuration.
+	char const		*log_prefix;		//!< Prepended to log messages.
+	bool			bind_only;		//!< Connections only run user binds, one at a time.
+} fr_ldap_trunk_t;
+
 /** Contains a collection of values
  *
  */
@@ -497,7 +547,10 @@ fr_ldap_rcode_t	 fr_ldap_sasl_interactive(REQUEST *request,
 fr_ldap_connection_t *fr_ldap_connection_alloc(TALLOC_CTX *ctx);
 
 fr_connection_t	*fr_ldap_connection_state_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
-					        fr_ldap_config_t const *config, char *log_prefix);
+						fr_connection_conf_t const *conn_conf,
+					        fr_ldap_config_t const *config, char const *log_prefix);
+
+void		fr_ldap_connection_unpin(fr_ldap_connection_t *c);
 
 int		fr_ldap_connection_configure(fr_ldap_connection_t *c, fr_ldap_config_t const *config);
 
@@ -538,6 +591,21 @@ int		fr_ldap_bind_async(fr_ldap_connection_t *c,
 				   char const *bind_dn, char const *password,
 				   LDAPControl **serverctrls, LDAPControl **clientctrls);
 
+/*
+ *	trunk.c - Multiplexed operations on per-thread connections
+ */
+fr_ldap_trunk_t	*fr_ldap_trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+				     fr_ldap_config_t const *config, fr_trunk_conf_t const *conf,
+				     char const *log_prefix, bool bind_only);
+
+fr_ldap_query_t	*fr_ldap_trunk_search(TALLOC_CTX *ctx, REQUEST *request, fr_ldap_trunk_t *ttrunk,
+				      char const *dn, int scope, char const *filter, char const * const *attrs,
+				      LDAPControl **serverctrls, LDAPControl **clientctrls);
+
+fr_ldap_query_t	*fr_ldap_trunk_bind(TALLOC_CTX *ctx, REQUEST *request, fr_ldap_trunk_t *ttrunk,
+				    char const *dn, char const *password,
+				    LDAPControl **serverctrls, LDAPControl **clientctrls);
+
 
 /*
  *	uti.c - Utility functions
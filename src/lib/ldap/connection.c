@@ -313,9 +313,40 @@ int fr_ldap_connection_configure(fr_ldap_connection_t *c, fr_ldap_config_t const
  * @param[in] h		to close.
  * @param[in] uctx	Connection config and handle.
  */
-static void _ldap_connection_close(UNUSED fr_event_list_t *el, void *h, UNUSED void *uctx)
+static void _ldap_connection_close(fr_event_list_t *el, void *h, UNUSED void *uctx)
 {
-	talloc_free(h);
+	fr_ldap_connection_t	*c = talloc_get_type_abort(h, fr_ldap_connection_t);
+	int			fd = -1;
+
+	if (!c->refs) {
+		talloc_free(c);
+		return;
+	}
+
+	/*
+	 *	Query results which were received on this
+	 *	connection are still being processed, and
+	 *	libldap needs the handle to parse them.
+	 *
+	 *	Stop listening on the handle, and free it
+	 *	when the last of the results is freed.
+	 */
+	if ((ldap_get_option(c->handle, LDAP_OPT_DESC, &fd) == LDAP_OPT_SUCCESS) && (fd >= 0)) {
+		(void) fr_event_fd_delete(el, fd, FR_EVENT_FILTER_IO);
+	}
+	c->conn = NULL;
+	talloc_steal(NULL, c);
+}
+
+/** Release a reference to a connection handle, freeing it if the connection has been closed
+ *
+ * @param[in] c		to release.
+ */
+void fr_ldap_connection_unpin(fr_ldap_connection_t *c)
+{
+	fr_assert(c->refs > 0);
+
+	if ((--c->refs == 0) && !c->conn) talloc_free(c);
 }
 
 /** Close and delete a connection
@@ -430,6 +461,7 @@ static fr_connection_state_t _ldap_connection_init(void **h, fr_connection_t *co
 	fr_ldap_state_t		state;
 
 	c = fr_ldap_connection_alloc(conn);
+	c->conn = conn;
 
 	/*
 	 *	Configure/allocate the libldap handle
@@ -456,11 +488,14 @@ static fr_connection_state_t _ldap_connection_init(void **h, fr_connection_t *co
  *
  * @param[in] ctx		to allocate any memory in, and to bind the lifetime of the connection to.
  * @param[in] el		to insert I/O and timer callbacks into.
+ * @param[in] conn_conf		Timeouts for the connection.  If NULL, net_timeout and
+ *				reconnection_delay from the config are used.
  * @param[in] config		to use to bind the connection to an LDAP server.
  * @param[in] log_prefix	to prepend to connection state messages.
  */
 fr_connection_t	*fr_ldap_connection_state_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
-					        fr_ldap_config_t const *config, char *log_prefix)
+						fr_connection_conf_t const *conn_conf,
+					        fr_ldap_config_t const *config, char const *log_prefix)
 {
 	fr_connection_t *conn;
 
@@ -469,7 +504,7 @@ fr_connection_t	*fr_ldap_connection_state_alloc(TALLOC_CTX *ctx, fr_event_list_t
 				   	.init = _ldap_connection_init,
 				   	.close = _ldap_connection_close
 				   },
-				   &(fr_connection_conf_t){
+				   conn_conf ? conn_conf : &(fr_connection_conf_t){
 				   	.connection_timeout = config->net_timeout,
 				   	.reconnection_delay = config->reconnection_delay
 				   },
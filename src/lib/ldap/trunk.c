@@ -0,0 +1,613 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/ldap/trunk.c
+ * @brief Run LDAP operations on per-thread connections without blocking the worker.
+ *
+ * Connections are brought up by the async state machine in state.c (StartTLS, then
+ * a bind as the admin user).  Once a connection is running, any number of searches
+ * may be outstanding on it.  Each operation is tracked by the msgid libldap assigned
+ * it, and results are matched back to their queries as they arrive.
+ *
+ * Binds change the identity of the whole connection, and the server won't process
+ * other operations while a bind is in progress, so user binds go through a separate
+ * trunk, where only one operation is outstanding per connection.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+USES_APPLE_DEPRECATED_API
+
+#include <freeradius-devel/ldap/base.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/debug.h>
+
+/** Protocol request, allocated in the treq
+ *
+ */
+typedef struct {
+	fr_trunk_request_t	*treq;		//!< Request this operation belongs to.
+	int			msgid;		//!< Assigned by libldap when the operation was sent.
+	fr_event_timer_t const	*ev;		//!< res_timeout for the operation.
+} ldap_trunk_request_t;
+
+static int ldap_trunk_request_cmp(void const *one, void const *two)
+{
+	ldap_trunk_request_t const	*a = one;
+	ldap_trunk_request_t const	*b = two;
+
+	return (a->msgid > b->msgid) - (a->msgid < b->msgid);
+}
+
+static fr_connection_t *ldap_trunk_conn_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+					      fr_connection_conf_t const *conf,
+					      char const *log_prefix, void *uctx)
+{
+	fr_ldap_trunk_t		*ttrunk = talloc_get_type_abort(uctx, fr_ldap_trunk_t);
+
+	return fr_ldap_connection_state_alloc(tconn, el, conf, ttrunk->config, log_prefix);
+}
+
+static void _ldap_trunk_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	fr_trunk_connection_signal_readable(tconn);
+}
+
+static void _ldap_trunk_conn_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	fr_trunk_connection_signal_writable(tconn);
+}
+
+static void _ldap_trunk_conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+				   int fd_errno, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	ERROR("Connection failed: %s", fr_syserror(fd_errno));
+
+	fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+static void ldap_trunk_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+				   fr_event_list_t *el,
+				   fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(conn->h, fr_ldap_connection_t);
+	fr_event_fd_cb_t	read_fn = NULL;
+	fr_event_fd_cb_t	write_fn = NULL;
+	int			fd = -1;
+
+	if ((ldap_get_option(c->handle, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS) || (fd < 0)) {
+		ERROR("Failed retrieving file descriptor from libldap handle");
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	switch (notify_on) {
+	case FR_TRUNK_CONN_EVENT_NONE:
+		(void) fr_event_fd_delete(el, fd, FR_EVENT_FILTER_IO);
+		return;
+
+	case FR_TRUNK_CONN_EVENT_READ:
+		read_fn = _ldap_trunk_conn_readable;
+		break;
+
+	case FR_TRUNK_CONN_EVENT_WRITE:
+		write_fn = _ldap_trunk_conn_writable;
+		break;
+
+	case FR_TRUNK_CONN_EVENT_BOTH:
+		read_fn = _ldap_trunk_conn_readable;
+		write_fn = _ldap_trunk_conn_writable;
+		break;
+	}
+
+	if (fr_event_fd_insert(c, el, fd, read_fn, write_fn, _ldap_trunk_conn_error, tconn) < 0) {
+		PERROR("Failed inserting FD event");
+
+		/*
+		 *	May free the connection!
+		 */
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+	}
+}
+
+/** The server didn't respond to an operation within res_timeout
+ *
+ */
+static void _ldap_trunk_request_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_trunk_request_t	*treq = talloc_get_type_abort(uctx, fr_trunk_request_t);
+	ldap_trunk_request_t	*u = talloc_get_type_abort(treq->preq, ldap_trunk_request_t);
+	fr_ldap_query_t		*query;
+	fr_ldap_connection_t	*c;
+	REQUEST			*request = treq->request;
+
+	u->ev = NULL;
+
+	/*
+	 *	The query may have been freed, and the request
+	 *	cancelled, before the cancellation was sent.
+	 */
+	if (treq->state != FR_TRUNK_REQUEST_STATE_SENT) return;
+
+	query = talloc_get_type_abort(treq->rctx, fr_ldap_query_t);
+	c = talloc_get_type_abort(treq->tconn->conn->h, fr_ldap_connection_t);
+
+	ROPTIONAL(RERROR, ERROR, "Timeout waiting for response to LDAP operation");
+	(void) ldap_abandon_ext(c->handle, u->msgid, NULL, NULL);
+
+	query->ret = LDAP_PROC_TIMEOUT;
+	fr_trunk_request_signal_fail(treq);
+}
+
+/** Send operations to the directory
+ *
+ * Searches are pipelined, but binds are sent one at a time.
+ */
+static void ldap_trunk_request_mux(fr_event_list_t *el,
+				   fr_trunk_connection_t *tconn, fr_connection_t *conn, void *uctx)
+{
+	fr_ldap_trunk_t		*ttrunk = talloc_get_type_abort(uctx, fr_ldap_trunk_t);
+	fr_ldap_connection_t	*c = talloc_get_type_abort(conn->h, fr_ldap_connection_t);
+	fr_trunk_request_t	*treq;
+
+	if (!c->queries) MEM(c->queries = rbtree_talloc_create(c, ldap_trunk_request_cmp,
+							       ldap_trunk_request_t, NULL, RBTREE_FLAG_NONE));
+
+	while (fr_trunk_connection_pop_request(&treq, tconn) == 0) {
+		ldap_trunk_request_t	*u = talloc_get_type_abort(treq->preq, ldap_trunk_request_t);
+		fr_ldap_query_t		*query = talloc_get_type_abort(treq->rctx, fr_ldap_query_t);
+		REQUEST			*request = treq->request;
+
+		LDAPControl		*our_serverctrls[LDAP_MAX_CONTROLS];
+		LDAPControl		*our_clientctrls[LDAP_MAX_CONTROLS];
+		int			ret = LDAP_OTHER;
+
+		if (ttrunk->bind_only && (rbtree_num_elements(c->queries) > 0)) break;
+
+		fr_ldap_control_merge(our_serverctrls, our_clientctrls,
+				      NUM_ELEMENTS(our_serverctrls),
+				      NUM_ELEMENTS(our_clientctrls),
+				      c, query->serverctrls, query->clientctrls);
+
+		switch (query->type) {
+		case FR_LDAP_QUERY_SEARCH:
+		{
+			char **search_attrs;
+
+			/*
+			 *	OpenLDAP library doesn't declare attrs array as const, but
+			 *	it really should be *sigh*.
+			 */
+			memcpy(&search_attrs, &query->attrs, sizeof(search_attrs));
+
+			if (query->filter) {
+				ROPTIONAL(RDEBUG2, DEBUG2, "Performing search in \"%s\" with filter \"%s\", scope \"%s\"",
+					  query->dn, query->filter,
+					  fr_table_str_by_value(fr_ldap_scope, query->scope, "<INVALID>"));
+			} else {
+				ROPTIONAL(RDEBUG2, DEBUG2, "Performing unfiltered search in \"%s\", scope \"%s\"",
+					  query->dn, fr_table_str_by_value(fr_ldap_scope, query->scope, "<INVALID>"));
+			}
+
+			ret = ldap_search_ext(c->handle, query->dn, query->scope, query->filter, search_attrs,
+					      0, our_serverctrls, our_clientctrls, NULL, 0, &u->msgid);
+		}
+			break;
+
+		case FR_LDAP_QUERY_BIND:
+		{
+			struct berval	cred;
+
+			memcpy(&cred.bv_val, &query->password, sizeof(cred.bv_val));
+			cred.bv_len = talloc_array_length(query->password) - 1;
+
+			ROPTIONAL(RDEBUG2, DEBUG2, "Binding as \"%s\"", query->dn);
+
+			/*
+			 *	Yes, confusingly named.  This is the simple version
+			 *	of the SASL bind function that should always be
+			 *	available.
+			 */
+			ret = ldap_sasl_bind(c->handle, query->dn, LDAP_SASL_SIMPLE, &cred,
+					     our_serverctrls, our_clientctrls, &u->msgid);
+		}
+			break;
+		}
+
+		switch (ret) {
+		case LDAP_SUCCESS:
+			break;
+
+		/*
+		 *	The requests are moved to another connection.
+		 */
+		case LDAP_SERVER_DOWN:
+		case LDAP_UNAVAILABLE:
+		case LDAP_BUSY:
+			ROPTIONAL(RPWARN, PWARN, "Connection failed: %s", ldap_err2string(ret));
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+
+		default:
+			ROPTIONAL(RERROR, ERROR, "Failed sending LDAP operation: %s", ldap_err2string(ret));
+			query->ret = LDAP_PROC_ERROR;
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+
+		u->treq = treq;
+		if (!rbtree_insert(c->queries, u)) {
+			ROPTIONAL(RERROR, ERROR, "Duplicate msgid %i", u->msgid);
+			(void) ldap_abandon_ext(c->handle, u->msgid, NULL, NULL);
+			query->ret = LDAP_PROC_ERROR;
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+
+		if (ttrunk->config->res_timeout &&
+		    (fr_event_timer_in(u, el, &u->ev, ttrunk->config->res_timeout,
+				       _ldap_trunk_request_timeout, treq) < 0)) {
+			ROPTIONAL(RPWARN, PWARN, "Failed inserting result timeout");
+		}
+
+		fr_trunk_request_signal_sent(treq);
+	}
+}
+
+/** Read results, and match them to the operations that were sent
+ *
+ */
+static void ldap_trunk_request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(conn->h, fr_ldap_connection_t);
+
+	for (;;) {
+		LDAPMessage		*result = NULL, *msg;
+		ldap_trunk_request_t	find, *u;
+		fr_trunk_request_t	*treq;
+		fr_ldap_query_t		*query;
+		fr_ldap_rcode_t		status = LDAP_PROC_SUCCESS;
+		REQUEST			*request;
+
+		/*
+		 *	Poll for any operation for which all the
+		 *	responses have been received.
+		 */
+		switch (ldap_result(c->handle, LDAP_RES_ANY, LDAP_MSG_ALL, &fr_time_delta_to_timeval(0), &result)) {
+		case 0:
+			return;
+
+		case -1:
+			PERROR("Failed reading result: %s", fr_ldap_error_str(c));
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+
+		default:
+			break;
+		}
+
+		find.msgid = ldap_msgid(result);
+		u = rbtree_finddata(c->queries, &find);
+		if (!u) {
+			DEBUG3("Discarding result for abandoned operation %i", find.msgid);
+			ldap_msgfree(result);
+			continue;
+		}
+		treq = u->treq;
+
+		if (treq->state != FR_TRUNK_REQUEST_STATE_SENT) {
+			ldap_msgfree(result);
+			continue;
+		}
+
+		query = talloc_get_type_abort(treq->rctx, fr_ldap_query_t);
+		request = treq->request;
+
+		for (msg = ldap_first_message(c->handle, result);
+		     msg;
+		     msg = ldap_next_message(c->handle, msg)) {
+			status = fr_ldap_error_check(NULL, c, msg, query->dn);
+			if (status != LDAP_PROC_SUCCESS) break;
+		}
+
+		if ((status == LDAP_PROC_SUCCESS) && (query->type == FR_LDAP_QUERY_SEARCH)) {
+			int count;
+
+			count = ldap_count_entries(c->handle, result);
+			if (count < 0) {
+				ROPTIONAL(REDEBUG, ERROR, "Error counting results: %s", fr_ldap_error_str(c));
+				status = LDAP_PROC_ERROR;
+			} else if (count == 0) {
+				ROPTIONAL(RDEBUG2, DEBUG2, "Search returned no results");
+				status = LDAP_PROC_NO_RESULT;
+			}
+		}
+
+		switch (status) {
+		case LDAP_PROC_SUCCESS:
+		case LDAP_PROC_NO_RESULT:
+			break;
+
+		case LDAP_PROC_BAD_DN:
+			ROPTIONAL(RDEBUG2, DEBUG2, "DN %s does not exist", query->dn);
+			break;
+
+		default:
+			ROPTIONAL(RPEDEBUG, PERROR, "LDAP operation failed");
+			break;
+		}
+
+		query->ret = status;
+		if ((status == LDAP_PROC_SUCCESS) && (query->type == FR_LDAP_QUERY_SEARCH)) {
+			query->result = result;
+			query->ldap_conn = c;
+			c->refs++;
+		} else {
+			ldap_msgfree(result);
+		}
+
+		fr_trunk_request_signal_complete(treq);
+	}
+}
+
+/** Abandon operations which are no longer needed
+ *
+ * There's no response to an abandon, so the cancellation completes immediately.
+ * Any results that arrive later are discarded by the demuxer.
+ */
+static void ldap_trunk_request_cancel_mux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(conn->h, fr_ldap_connection_t);
+	fr_trunk_request_t	*treq;
+
+	while (fr_trunk_connection_pop_cancellation(&treq, tconn) == 0) {
+		ldap_trunk_request_t	*u = talloc_get_type_abort(treq->preq, ldap_trunk_request_t);
+
+		(void) ldap_abandon_ext(c->handle, u->msgid, NULL, NULL);
+
+		fr_trunk_request_signal_cancel_sent(treq);
+		fr_trunk_request_signal_cancel_complete(treq);
+	}
+}
+
+static void ldap_trunk_request_conn_release(fr_connection_t *conn, void *preq_to_reset, UNUSED void *uctx)
+{
+	fr_ldap_connection_t	*c = talloc_get_type_abort(conn->h, fr_ldap_connection_t);
+	ldap_trunk_request_t	*u = talloc_get_type_abort(preq_to_reset, ldap_trunk_request_t);
+
+	if (u->ev) fr_event_timer_delete(&u->ev);
+	if (u->treq && c->queries) rbtree_deletebydata(c->queries, u);
+	u->treq = NULL;
+}
+
+static void ldap_trunk_request_complete(REQUEST *request, UNUSED void *preq, void *rctx, UNUSED void *uctx)
+{
+	fr_ldap_query_t		*query = talloc_get_type_abort(rctx, fr_ldap_query_t);
+
+	query->treq = NULL;
+
+	unlang_interpret_resumable(request);
+}
+
+static void ldap_trunk_request_fail(REQUEST *request, UNUSED void *preq, void *rctx,
+				    UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	fr_ldap_query_t		*query = talloc_get_type_abort(rctx, fr_ldap_query_t);
+
+	if (query->ret == LDAP_PROC_SUCCESS) query->ret = LDAP_PROC_ERROR;
+	query->treq = NULL;
+
+	unlang_interpret_resumable(request);
+}
+
+static void ldap_trunk_request_free(UNUSED REQUEST *request, void *preq_to_free, UNUSED void *uctx)
+{
+	talloc_free(preq_to_free);
+}
+
+/** Cancel the operation if it's still running, and release the connection handle
+ *
+ */
+static int _ldap_query_free(fr_ldap_query_t *query)
+{
+	if (query->treq) {
+		ldap_trunk_request_t *u = talloc_get_type_abort(query->treq->preq, ldap_trunk_request_t);
+
+		/*
+		 *	The timer references the query, and the
+		 *	cancellation may not be sent until later.
+		 */
+		if (u->ev) fr_event_timer_delete(&u->ev);
+		fr_trunk_request_signal_cancel(query->treq);
+	}
+	if (query->result) ldap_msgfree(query->result);
+	if (query->ldap_conn) fr_ldap_connection_unpin(query->ldap_conn);
+
+	return 0;
+}
+
+/** Allocate a query
+ *
+ */
+static fr_ldap_query_t *ldap_query_alloc(TALLOC_CTX *ctx, fr_ldap_query_type_t type, char const *dn,
+					 LDAPControl **serverctrls, LDAPControl **clientctrls)
+{
+	fr_ldap_query_t		*query;
+
+	MEM(query = talloc_zero(ctx, fr_ldap_query_t));
+	query->type = type;
+	query->dn = talloc_strdup(query, dn ? dn : "");
+	query->serverctrls = serverctrls;
+	query->clientctrls = clientctrls;
+
+	return query;
+}
+
+/** Enqueue a query on a trunk
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The query is freed.
+ */
+static int ldap_trunk_query_enqueue(fr_ldap_query_t *query, REQUEST *request, fr_ldap_trunk_t *ttrunk)
+{
+	fr_trunk_request_t	*treq;
+	ldap_trunk_request_t	*u;
+
+	treq = fr_trunk_request_alloc(ttrunk->trunk, request);
+	if (!treq) {
+	error:
+		talloc_free(query);
+		return -1;
+	}
+
+	MEM(u = talloc_zero(treq, ldap_trunk_request_t));
+
+	if (fr_trunk_request_enqueue(&treq, ttrunk->trunk, request, u, query) < 0) {
+		fr_trunk_request_free(&treq);
+		goto error;
+	}
+	query->treq = treq;
+	talloc_set_destructor(query, _ldap_query_free);
+
+	return 0;
+}
+
+/** Search for something in the LDAP directory
+ *
+ * The caller should yield, and will be resumed when the search completes,
+ * at which point query->ret contains one of the LDAP_PROC_* (#fr_ldap_rcode_t)
+ * values, and query->result contains the entries if the search succeeded.
+ *
+ * Freeing the query before it completes abandons the search.
+ *
+ * @param[in] ctx		to allocate the query in.
+ * @param[in] request		Current request.
+ * @param[in] ttrunk		to run the search on.
+ * @param[in] dn		to use as base for the search.
+ * @param[in] scope		to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
+ * @param[in] filter		to use, should be pre-escaped.
+ * @param[in] attrs		to retrieve.  Must remain valid until the search completes.
+ * @param[in] serverctrls	Search controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls	Search controls for ldap_search.  May be NULL.
+ * @return
+ *	- The query.
+ *	- NULL if the search couldn't be enqueued.
+ */
+fr_ldap_query_t *fr_ldap_trunk_search(TALLOC_CTX *ctx, REQUEST *request, fr_ldap_trunk_t *ttrunk,
+				      char const *dn, int scope, char const *filter, char const * const *attrs,
+				      LDAPControl **serverctrls, LDAPControl **clientctrls)
+{
+	fr_ldap_query_t		*query;
+
+	fr_assert(!ttrunk->bind_only);
+
+	query = ldap_query_alloc(ctx, FR_LDAP_QUERY_SEARCH, dn, serverctrls, clientctrls);
+	query->scope = scope;
+	if (filter) query->filter = talloc_strdup(query, filter);
+	query->attrs = attrs;
+
+	if (ldap_trunk_query_enqueue(query, request, ttrunk) < 0) return NULL;
+
+	return query;
+}
+
+/** Bind to the directory as a user
+ *
+ * The caller should yield, and will be resumed when the bind completes,
+ * at which point query->ret contains one of the LDAP_PROC_* (#fr_ldap_rcode_t)
+ * values.
+ *
+ * @param[in] ctx		to allocate the query in.
+ * @param[in] request		Current request.
+ * @param[in] ttrunk		to run the bind on.  Must have been allocated with bind_only.
+ * @param[in] dn		to bind as.
+ * @param[in] password		to bind with.
+ * @param[in] serverctrls	Extra controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls	Extra controls to pass to libldap.  May be NULL.
+ * @return
+ *	- The query.
+ *	- NULL if the bind couldn't be enqueued.
+ */
+fr_ldap_query_t *fr_ldap_trunk_bind(TALLOC_CTX *ctx, REQUEST *request, fr_ldap_trunk_t *ttrunk,
+				    char const *dn, char const *password,
+				    LDAPControl **serverctrls, LDAPControl **clientctrls)
+{
+	fr_ldap_query_t		*query;
+
+	fr_assert(ttrunk->bind_only);
+
+	query = ldap_query_alloc(ctx, FR_LDAP_QUERY_BIND, dn, serverctrls, clientctrls);
+	query->password = talloc_strdup(query, password ? password : "");
+
+	if (ldap_trunk_query_enqueue(query, request, ttrunk) < 0) return NULL;
+
+	return query;
+}
+
+/** Allocate a set of connections to a directory for the current thread
+ *
+ * @param[in] ctx		to allocate the trunk in.
+ * @param[in] el		This thread's event list.
+ * @param[in] config		Connection configuration.  Must remain valid for the
+ *				lifetime of the trunk.
+ * @param[in] conf		Trunk configuration.
+ * @param[in] log_prefix	to prepend to log messages.
+ * @param[in] bind_only		Only used for binding as users.  Only one bind is
+ *				outstanding on a connection at a time.
+ * @return
+ *	- A new trunk.
+ *	- NULL on failure.
+ */
+fr_ldap_trunk_t *fr_ldap_trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+				     fr_ldap_config_t const *config, fr_trunk_conf_t const *conf,
+				     char const *log_prefix, bool bind_only)
+{
+	static fr_trunk_io_funcs_t	io_funcs = {
+						.connection_alloc = ldap_trunk_conn_alloc,
+						.connection_notify = ldap_trunk_conn_notify,
+						.request_mux = ldap_trunk_request_mux,
+						.request_demux = ldap_trunk_request_demux,
+						.request_cancel_mux = ldap_trunk_request_cancel_mux,
+						.request_conn_release = ldap_trunk_request_conn_release,
+						.request_complete = ldap_trunk_request_complete,
+						.request_fail = ldap_trunk_request_fail,
+						.request_free = ldap_trunk_request_free
+					};
+	fr_ldap_trunk_t			*ttrunk;
+
+	MEM(ttrunk = talloc_zero(ctx, fr_ldap_trunk_t));
+	ttrunk->config = config;
+	ttrunk->log_prefix = talloc_strdup(ttrunk, log_prefix);
+	ttrunk->bind_only = bind_only;
+
+	ttrunk->trunk = fr_trunk_alloc(ttrunk, el, &io_funcs, conf, ttrunk->log_prefix, ttrunk, false);
+	if (!ttrunk->trunk) {
+		talloc_free(ttrunk);
+		return NULL;
+	}
+
+	return ttrunk;
+}
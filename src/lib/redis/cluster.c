@@ -2075,6 +2075,60 @@ int fr_redis_cluster_pool_by_node_addr(fr_pool_t **pool, fr_redis_cluster_t *clu
 	return 0;
 }
 
+/** Remap the cluster using a connection to a specific node
+ *
+ * Used by callers which don't hold a pooled connection, such as those
+ * issuing commands asynchronously, to refresh the key slot map after
+ * receiving a -MOVED redirect.
+ *
+ * @note Blocks whilst the map is retrieved.  Remaps are rate limited,
+ *	so this only happens once per second at most.
+ *
+ * @param[in] request		The current request.  May be NULL.
+ * @param[in] cluster		to remap.
+ * @param[in] node_addr		of the node to retrieve the map from.
+ * @return
+ *	- FR_REDIS_CLUSTER_RCODE_IGNORED if the cluster was remapped recently.
+ *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
+ *	- FR_REDIS_CLUSTER_RCODE_NO_CONNECTION if no connection to the node was available.
+ *	- FR_REDIS_CLUSTER_RCODE_FAILED on other failure.
+ */
+fr_redis_cluster_rcode_t fr_redis_cluster_remap_by_node_addr(REQUEST *request, fr_redis_cluster_t *cluster,
+							     fr_socket_addr_t *node_addr)
+{
+	fr_pool_t			*pool;
+	fr_redis_conn_t			*conn;
+	fr_redis_cluster_rcode_t	rcode;
+
+	if (fr_redis_cluster_pool_by_node_addr(&pool, cluster, node_addr, true) < 0) return FR_REDIS_CLUSTER_RCODE_FAILED;
+
+	conn = fr_pool_connection_get(pool, request);
+	if (!conn) {
+		fr_strerror_printf("No connections available for cluster node");
+		return FR_REDIS_CLUSTER_RCODE_NO_CONNECTION;
+	}
+
+	rcode = fr_redis_cluster_remap(request, cluster, conn);
+	fr_pool_connection_release(pool, request, conn);
+
+	return rcode;
+}
+
+/** Get the address of the node a -MOVED or -ASK redirect points to
+ *
+ * @param[out] out	Where to write the node's address.
+ * @param[in] reply	containing the redirect.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the reply wasn't a valid redirect.
+ */
+int fr_redis_cluster_redirect_addr(fr_socket_addr_t *out, redisReply *reply)
+{
+	if (cluster_node_conf_from_redirect(NULL, out, reply) != FR_REDIS_CLUSTER_RCODE_SUCCESS) return -1;
+
+	return 0;
+}
+
 /** Private ctx structure to pass to _cluster_role_walk
  *
  */
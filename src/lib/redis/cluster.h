@@ -120,6 +120,11 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
  */
 int fr_redis_cluster_pool_by_node_addr(fr_pool_t **pool, fr_redis_cluster_t *cluster,
 				       fr_socket_addr_t *node, bool create);
+
+fr_redis_cluster_rcode_t fr_redis_cluster_remap_by_node_addr(REQUEST *request, fr_redis_cluster_t *cluster,
+							     fr_socket_addr_t *node_addr);
+
+int fr_redis_cluster_redirect_addr(fr_socket_addr_t *out, redisReply *reply);
 ssize_t fr_redis_cluster_node_addr_by_role(TALLOC_CTX *ctx, fr_socket_addr_t *out[],
 					   fr_redis_cluster_t *cluster, bool is_master, bool is_slave);
 
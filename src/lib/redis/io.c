@@ -66,6 +66,24 @@ static void _redis_connected(redisAsyncContext const *ac, UNUSED int status)
 	fr_connection_signal_connected(conn);
 }
 
+/** Called by hiredis with the response to AUTH or SELECT
+ *
+ * These are sent by #_redis_io_connection_init, before any pipelined commands,
+ * and don't pass through the pipeline, so don't have sequence numbers.
+ */
+static void _redis_io_setup_reply(redisAsyncContext *ac, void *vreply, UNUSED void *privdata)
+{
+	fr_connection_t		*conn = talloc_get_type_abort(ac->data, fr_connection_t);
+	redisReply		*reply = vreply;
+
+	if (!reply) return;	/* Disconnected */
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		ERROR("Connection setup failed: %s", reply->str);
+		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+	}
+}
+
 /** Redis FD became readable
  *
  */
@@ -380,6 +398,23 @@ static fr_connection_state_t _redis_io_connection_init(void **h_out, fr_connecti
 
 	fr_dlist_talloc_init(&h->ignore, fr_redis_sqn_ignore_t, entry);
 
+	/*
+	 *	hiredis buffers these until the connection
+	 *	is open, so they're always the first commands
+	 *	sent on the connection.
+	 */
+	if (conf->password &&
+	    (redisAsyncCommand(h->ac, _redis_io_setup_reply, NULL, "AUTH %s", conf->password) != REDIS_OK)) {
+		ERROR("Failed queueing AUTH command");
+		goto error;
+	}
+
+	if (conf->database &&
+	    (redisAsyncCommand(h->ac, _redis_io_setup_reply, NULL, "SELECT %u", conf->database) != REDIS_OK)) {
+		ERROR("Failed queueing SELECT command");
+		goto error;
+	}
+
 	return FR_CONNECTION_STATE_CONNECTING;
 }
 
@@ -30,6 +30,7 @@
 
 #include "pipeline.h"
 #include "io.h"
+#include "cluster.h"
 
 
 /** Thread local state for a cluster
@@ -42,6 +43,12 @@ struct fr_redis_cluster_thread_s {
 	char				*log_prefix;	//!< Common log prefix to use for all cluster related
 							///< messages.
 	bool				delay_start;	//!< Prevent connections from spawning immediately.
+
+	fr_redis_cluster_t		*cluster;	//!< Shared cluster state.  Provides the key slot to
+							///< node mappings.  May be NULL.
+	fr_redis_conf_t const		*conf;		//!< Database number, password, etc...
+	rbtree_t			*trunks;	//!< Trunks for each node we've communicated with,
+							///< ordered by node address.
 };
 
 /** The thread local free list
@@ -72,6 +79,7 @@ struct fr_redis_command_s {
 
 	char const			*str;		//!< The command string.
 	size_t				len;		//!< Length of the command string.
+	bool				formatted;	//!< str is already in the Redis wire format.
 
 	uint64_t			sqn;		//!< The sequence number of the command.  This is only
 							///< valid for a specific handle, and is unique within
@@ -142,6 +150,8 @@ struct fr_redis_command_set_s {
 };
 
 struct fr_redis_trunk_s {
+	fr_socket_addr_t		addr;		//!< Address of the node this trunk connects to.
+							///< Only set for trunks belonging to a cluster thread.
 	fr_redis_io_conf_t const	*io_conf;	//!< Redis I/O configuration.  Specifies how to connect
 							///< to the host this trunk is used to communicate with.
 	fr_trunk_t			*trunk;		//!< Trunk containing all the connections to a specific
@@ -180,7 +190,7 @@ static int _redis_command_set_free(fr_redis_command_set_t *cmds)
 	}
 
 	talloc_free_children(cmds);
-	memset(&cmds, 0, sizeof(cmds));
+	memset(cmds, 0, sizeof(*cmds));
 
 	fr_dlist_insert_head(command_set_free_list, cmds);
 
@@ -262,7 +272,7 @@ fr_redis_command_set_t *fr_redis_command_set_alloc(TALLOC_CTX *ctx,
  */
 static int _redis_command_free(fr_redis_command_t *cmd)
 {
-	//if (cmd->result) fr_redis_reply_free(&cmd->result);
+	fr_redis_reply_free(&cmd->result);
 
 	return 0;
 }
@@ -272,40 +282,29 @@ redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd)
 	return cmd->result;
 }
 
-/** Add a preformatted/expanded command to the command set
+/** Determine whether a command starts or ends a transaction block
  *
- * The command must either be entirely static, or parented by the command set.
+ * Because commands from many different requests share the same connection
+ * we need to ensure that transaction blocks aren't left dangling and
+ * that the commands are all in the right order.
  *
- * @note Caller should disallow "SUBSCRIBE" et al, if they're not appropriate.
- * 	 As subscribing to a stream where we're not expecting it would break
- * 	 things, badly.
+ * We try very hard to do this without incurring a performance penalty
+ * for non-transactional commands.
  *
- * @param[in] cmds	Command set to add command to.
- * @param[in] cmd_str	A fully expanded/formatted command to send to redis.
- *			Must be static, or have the same lifetime as the
- *			command set (allocated with the command set as the parent).
- * @param[in] cmd_len	Length of the command.
+ * @param[out] type	of the command.
+ * @param[in] cmds	Command set the command is being added to.
+ * @param[in] cmd_str	Command, or command name.
  * @return
- *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
- *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if the command would unbalance the transaction.
+ *	- FR_REDIS_PIPELINE_OK otherwise.
  */
-fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
-							     char const *cmd_str, size_t cmd_len)
+static fr_redis_pipeline_status_t redis_command_type(fr_redis_command_type_t *type,
+						     fr_redis_command_set_t *cmds, char const *cmd_str)
 {
 	REQUEST			*request = cmds->request;
-	fr_redis_command_t	*cmd;
-	fr_redis_command_type_t	type = FR_REDIS_COMMAND_NORMAL;
 
-	/*
-	 *	Transaction sanity checks.
-	 *
-	 *	Because commands from many different requests share the same connection
-	 *	we need to ensure that transaction blocks aren't left dangling and
-	 *	that the commands are all in the right order.
-	 *
-	 *	We try very hard to do this without incurring a performance penalty
-	 *      for non-transactional commands.
-	 */
+	*type = FR_REDIS_COMMAND_NORMAL;
+
 	switch (tolower(cmd_str[0])) {
 	case 'm':
 		if (tolower(cmd_str[1] != 'u')) break;
@@ -323,7 +322,7 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		 *	that's marked as the start of the transaction
 		 *	block.
 		 */
-		type = cmds->txn_watch ? FR_REDIS_COMMAND_TRANSACTION_START : FR_REDIS_COMMAND_NORMAL;
+		*type = cmds->txn_watch ? FR_REDIS_COMMAND_TRANSACTION_START : FR_REDIS_COMMAND_NORMAL;
 		cmds->txn_start++;	/* Yes MULTI increments start, not WATCH */
 		break;
 
@@ -345,7 +344,7 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 			ROPTIONAL(ERROR, REDEBUG, "Transaction not started, missing \"MULTI\" command");
 			return FR_REDIS_PIPELINE_BAD_CMDS;
 		}
-		type = FR_REDIS_COMMAND_TRANSACTION_END;
+		*type = FR_REDIS_COMMAND_TRANSACTION_END;
 		cmds->txn_end++;
 		break;
 
@@ -366,6 +365,34 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		break;
 	}
 
+	return FR_REDIS_PIPELINE_OK;
+}
+
+/** Add a preformatted/expanded command to the command set
+ *
+ * The command must either be entirely static, or parented by the command set.
+ *
+ * @note Caller should disallow "SUBSCRIBE" et al, if they're not appropriate.
+ * 	 As subscribing to a stream where we're not expecting it would break
+ * 	 things, badly.
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] cmd_str	A fully expanded/formatted command to send to redis.
+ *			Must be static, or have the same lifetime as the
+ *			command set (allocated with the command set as the parent).
+ * @param[in] cmd_len	Length of the command.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
+							     char const *cmd_str, size_t cmd_len)
+{
+	fr_redis_command_t	*cmd;
+	fr_redis_command_type_t	type;
+
+	if (redis_command_type(&type, cmds, cmd_str) != FR_REDIS_PIPELINE_OK) return FR_REDIS_PIPELINE_BAD_CMDS;
+
 	MEM(cmd = talloc_zero(cmds, fr_redis_command_t));
 	talloc_set_destructor(cmd, _redis_command_free);
 	cmd->cmds = cmds;
@@ -377,6 +404,50 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	return FR_REDIS_PIPELINE_OK;
 }
 
+/** Add a command, split into its arguments, to the command set
+ *
+ * Unlike #fr_redis_command_preformatted_add, arguments may contain spaces
+ * or binary data.  The arguments are copied, so may be freed once this
+ * function returns.
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] argc	Number of arguments, including the command name.
+ * @param[in] argv	Command name, then its arguments.
+ * @param[in] argv_len	Length of each argument.  If NULL, each argument
+ *			must be \0 terminated.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_argv_add(fr_redis_command_set_t *cmds,
+						     int argc, char const **argv, size_t const *argv_len)
+{
+	fr_redis_command_t	*cmd;
+	fr_redis_command_type_t	type;
+	char			*formatted;
+	int			len;
+
+	if (argc < 1) return FR_REDIS_PIPELINE_BAD_CMDS;
+
+	if (redis_command_type(&type, cmds, argv[0]) != FR_REDIS_PIPELINE_OK) return FR_REDIS_PIPELINE_BAD_CMDS;
+
+	len = redisFormatCommandArgv(&formatted, argc, argv, argv_len);
+	if (len < 0) return FR_REDIS_PIPELINE_FAIL;
+
+	MEM(cmd = talloc_zero(cmds, fr_redis_command_t));
+	talloc_set_destructor(cmd, _redis_command_free);
+	cmd->cmds = cmds;
+	cmd->type = type;
+	MEM(cmd->str = talloc_memdup(cmd, formatted, len));
+	cmd->len = len;
+	cmd->formatted = true;
+	free(formatted);
+
+	fr_dlist_insert_tail(&cmds->pending, cmd);
+
+	return FR_REDIS_PIPELINE_OK;
+}
+
 /** Enqueue a command set on a specific trunk
  *
  * The command set may be passed around several trunks before it is complete.
@@ -409,6 +480,18 @@ fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, f
 	}
 }
 
+/** Signal that the creator of the command set no longer needs the results
+ *
+ * Must only be called before the complete or fail callback has run.
+ * The command set is freed by the trunk.
+ *
+ * @param[in] cmds	to cancel.
+ */
+void fr_redis_command_set_cancel(fr_redis_command_set_t *cmds)
+{
+	if (cmds->treq) fr_trunk_request_signal_cancel(cmds->treq);
+}
+
 /** Callback for for receiving Redis replies
  *
  * This is called by hiredis for each response is receives.  privData is set to the
@@ -431,23 +514,47 @@ static void _redis_pipeline_demux(struct redisAsyncContext *ac, void *vreply, vo
 	fr_connection_t		*conn = talloc_get_type_abort(ac->ev.data, fr_connection_t);
 	fr_redis_handle_t	*h = talloc_get_type_abort(conn->h, fr_redis_handle_t);
 	redisReply		*reply = vreply;
+
+	/*
+	 *	The connection was closed.  The trunk
+	 *	will move or fail the command sets.
+	 */
+	if (!reply) return;
+
 	/*
 	 *	First check if we should ignore the response
+	 *
+	 *	hiredis frees the reply when we return.
 	 */
 	if (!fr_redis_connection_process_response(h)) {
 		DEBUG4("Ignoring response with SQN %"PRIu64, (h->rsp_sqn - 1));	/* Already incremented */
-		fr_redis_reply_free((redisReply **)&reply);
 		return;
 	}
 
 	/*
-	 *	FIXME - Need to check TRYAGAIN, MOVED etc...
-	 *	I guess we might want to wait for the end of
-	 *	the command set to do that.
+	 *	hiredis frees the reply when we return, but the
+	 *	result needs to outlive the callback, as it's
+	 *	only processed once the whole command set is
+	 *	complete.
+	 *
+	 *	Move the contents of the reply into a new
+	 *	top level reply, leaving hiredis an empty
+	 *	shell to free.
 	 */
 	cmd = talloc_get_type_abort(privdata, fr_redis_command_t);
 	cmds = cmd->cmds;
-	cmd->result = reply;
+	MEM(cmd->result = malloc(sizeof(*cmd->result)));
+	memcpy(cmd->result, reply, sizeof(*cmd->result));
+	reply->type = REDIS_REPLY_NIL;
+	reply->str = NULL;
+	reply->element = NULL;
+	reply->elements = 0;
+
+	/*
+	 *	Redirects (-MOVED/-ASK) and -TRYAGAIN are left
+	 *	to the owner of the command set, as it knows
+	 *	which commands need to be sent again.
+	 */
 
 	fr_dlist_remove(&cmds->sent, cmd);
 	fr_dlist_insert_tail(&cmds->completed, cmd);
@@ -473,14 +580,16 @@ static fr_connection_t *_redis_pipeline_connection_alloc(fr_trunk_connection_t *
 /** Enqueue one or more command sets onto a redis handle
  *
  * Because the trunk is in always writable mode, _redis_pipeline_mux
- * will be called any time fr_trunk_request_enqueue is called, so there'll only
- * ever be one command to dequeue.
+ * will be called any time fr_trunk_request_enqueue is called, so there'll
+ * usually only be one command set to dequeue.
  *
+ * @param[in] el		Event list.  Unused.
  * @param[in] tconn		Trunk connection holding the commands to enqueue.
  * @param[in] conn		Connection handle containing the fr_redis_handle_t.
  * @param[in] uctx		fr_redis_cluster_t.  Unused.
  */
-static void _redis_pipeline_mux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+static void _redis_pipeline_mux(UNUSED fr_event_list_t *el,
+				fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
 	fr_trunk_request_t	*treq;
 	fr_redis_command_set_t 	*cmds;
@@ -488,29 +597,41 @@ static void _redis_pipeline_mux(fr_trunk_connection_t *tconn, fr_connection_t *c
 	fr_redis_handle_t	*h = talloc_get_type_abort(conn->h, fr_redis_handle_t);
 	REQUEST			*request;
 
-	treq = fr_trunk_connection_pop_request(&request, (void *)&cmds, NULL, tconn);
-	while ((cmd = fr_dlist_head(&cmds->pending))) {
-		/*
-		 *	If this fails it probably means the connection
-		 *	is disconnecting, but if that's happening then
-		 *	we shouldn't be enqueueing new requests?
-		 */
-		if (unlikely(redisAsyncCommand(h->ac, _redis_pipeline_demux, cmd, "%s", cmd->str) != REDIS_OK)) {
-			ROPTIONAL(ERROR, REDEBUG, "Unexpected error queueing REDIS command");
+	while (fr_trunk_connection_pop_request(&treq, tconn) == 0) {
+		cmds = talloc_get_type_abort(treq->preq, fr_redis_command_set_t);
+		request = treq->request;
 
-			while ((cmd = fr_dlist_head(&cmds->sent))) {
-				fr_redis_connection_ignore_response(h, cmd->sqn);
-				fr_dlist_remove(&cmds->sent, cmd);
-				fr_dlist_insert_tail(&cmds->pending, cmd);
+		while ((cmd = fr_dlist_head(&cmds->pending))) {
+			int ret;
+
+			if (cmd->formatted) {
+				ret = redisAsyncFormattedCommand(h->ac, _redis_pipeline_demux, cmd, cmd->str, cmd->len);
+			} else {
+				ret = redisAsyncCommand(h->ac, _redis_pipeline_demux, cmd, "%s", cmd->str);
+			}
+
+			/*
+			 *	If this fails it probably means the connection
+			 *	is disconnecting, but if that's happening then
+			 *	we shouldn't be enqueueing new requests?
+			 */
+			if (unlikely(ret != REDIS_OK)) {
+				ROPTIONAL(RERROR, ERROR, "Unexpected error queueing REDIS command");
+
+				while ((cmd = fr_dlist_head(&cmds->sent))) {
+					fr_redis_connection_ignore_response(h, cmd->sqn);
+					fr_dlist_remove(&cmds->sent, cmd);
+					fr_dlist_insert_tail(&cmds->pending, cmd);
+				}
+				fr_trunk_request_signal_fail(treq);
+				break;
 			}
-			fr_trunk_request_signal_fail(treq);
-			return;
+			cmd->sqn = fr_redis_connection_sent_request(h);
+			fr_dlist_remove(&cmds->pending, cmd);
+			fr_dlist_insert_tail(&cmds->sent, cmd);
 		}
-		cmd->sqn = fr_redis_connection_sent_request(h);
-		fr_dlist_remove(&cmds->pending, cmd);
-		fr_dlist_insert_tail(&cmds->sent, cmd);
+		if (!cmd) fr_trunk_request_signal_sent(treq);
 	}
-	fr_trunk_request_signal_sent(treq);
 }
 
 /** Deal with cancellation of sent requests
@@ -519,7 +640,7 @@ static void _redis_pipeline_mux(fr_trunk_connection_t *tconn, fr_connection_t *c
  * on why the commands were cancelled, we either tell the handle to ignore
  * them, or move them back into the pending list.
  */
-static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, UNUSED fr_trunk_request_t *treq, void *preq,
+static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, void *preq,
 					       fr_trunk_cancel_reason_t reason, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
@@ -564,6 +685,7 @@ static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, UNUSED fr_
 			fr_redis_connection_ignore_response(h, cmd->sqn);
 		}
 	}
+		return;
 
 	case FR_TRUNK_CANCEL_REASON_NONE:
 		fr_assert(0);
@@ -585,8 +707,8 @@ static void _redis_pipeline_command_set_complete(UNUSED REQUEST *request, void *
 /** Signal the API client that we failed enqueuing the commands
  *
  */
-static void _redis_pipeline_command_set_fail(UNUSED REQUEST *request, void *preq,
-					     UNUSED void *rctx, UNUSED void *uctx)
+static void _redis_pipeline_command_set_fail(UNUSED REQUEST *request, void *preq, UNUSED void *rctx,
+					     UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
@@ -627,6 +749,7 @@ fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread
 
 	MEM(rtrunk = talloc_zero(cluster_thread, fr_redis_trunk_t));
 	rtrunk->io_conf = io_conf;
+	rtrunk->cluster = cluster_thread;
 	rtrunk->trunk = fr_trunk_alloc(rtrunk, cluster_thread->el,
 				       &io_funcs, cluster_thread->tconf, cluster_thread->log_prefix, rtrunk,
 				       cluster_thread->delay_start);
@@ -638,13 +761,35 @@ fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread
 	return rtrunk;
 }
 
+static int _redis_trunk_cmp(void const *a, void const *b)
+{
+	fr_redis_trunk_t const *my_a = a, *my_b = b;
+	int ret;
+
+	ret = fr_ipaddr_cmp(&my_a->addr.ipaddr, &my_b->addr.ipaddr);
+	if (ret != 0) return ret;
+
+	return my_a->addr.port - my_b->addr.port;
+}
+
 /** Allocate per-thread, per-cluster instance
  *
  * This structure represents all the connections for a given thread for a given cluster.
  * The structures holds the trunk connections to talk to each cluster member.
  *
+ * @param[in] ctx		to allocate the cluster thread in.
+ * @param[in] el		Event list serviced by this thread.
+ * @param[in] tconf		Configuration for each of the trunks.
+ * @param[in] cluster		to use for resolving keys to nodes.  May be NULL if
+ *				trunks will only be allocated directly with
+ *				#fr_redis_trunk_alloc.
+ * @param[in] conf		Database number, password etc... for connections to nodes.
+ * @param[in] log_prefix	to use for trunk log messages.
  */
-fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_trunk_conf_t const *tconf)
+fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+							 fr_trunk_conf_t const *tconf,
+							 fr_redis_cluster_t *cluster, fr_redis_conf_t const *conf,
+							 char const *log_prefix)
 {
 	fr_redis_cluster_thread_t *cluster_thread;
 	fr_trunk_conf_t *our_tconf;
@@ -655,8 +800,118 @@ fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_eve
 
 	cluster_thread->el = el;
 	cluster_thread->tconf = our_tconf;
+	cluster_thread->cluster = cluster;
+	cluster_thread->conf = conf;
+	if (log_prefix) MEM(cluster_thread->log_prefix = talloc_typed_strdup(cluster_thread, log_prefix));
+	MEM(cluster_thread->trunks = rbtree_create(cluster_thread, _redis_trunk_cmp, NULL, 0));
 
 	return cluster_thread;
 }
 
+/** Get the trunk for a specific node, allocating it if this thread hasn't communicated with the node before
+ *
+ * @param[in] cluster_thread	to get the trunk from.
+ * @param[in] node_addr		Address of the node.
+ * @return
+ *	- The trunk for the node.
+ *	- NULL if a new trunk couldn't be allocated.
+ */
+fr_redis_trunk_t *fr_redis_cluster_thread_trunk_by_addr(fr_redis_cluster_thread_t *cluster_thread,
+							fr_socket_addr_t const *node_addr)
+{
+	fr_redis_trunk_t	find, *rtrunk;
+	fr_redis_io_conf_t	*io_conf;
+	char			buffer[FR_IPADDR_STRLEN];
+
+	find.addr = *node_addr;
+	rtrunk = rbtree_finddata(cluster_thread->trunks, &find);
+	if (rtrunk) return rtrunk;
+
+	MEM(io_conf = talloc_zero(cluster_thread, fr_redis_io_conf_t));
+	fr_inet_ntop(buffer, sizeof(buffer), &node_addr->ipaddr);
+	MEM(io_conf->hostname = talloc_typed_strdup(io_conf, buffer));
+	io_conf->port = node_addr->port;
+	if (cluster_thread->conf) {
+		io_conf->database = cluster_thread->conf->database;
+		io_conf->password = cluster_thread->conf->password;
+		io_conf->connection_timeout = cluster_thread->conf->connection_timeout;
+		io_conf->reconnection_delay = cluster_thread->conf->reconnection_delay;
+	}
+	io_conf->log_prefix = cluster_thread->log_prefix;
+
+	rtrunk = fr_redis_trunk_alloc(cluster_thread, io_conf);
+	if (!rtrunk) {
+		talloc_free(io_conf);
+		return NULL;
+	}
+	talloc_steal(rtrunk, io_conf);
+	rtrunk->addr = *node_addr;
+
+	rbtree_insert(cluster_thread->trunks, rtrunk);
+
+	return rtrunk;
+}
+
+/** Get the trunk for the node which serves a particular key
+ *
+ * @param[in] cluster_thread	to get the trunk from.
+ * @param[in] request		The current request.
+ * @param[in] key		to resolve.  If NULL, a random node is chosen.
+ * @param[in] key_len		Length of the key.
+ * @param[in] read_only		Prefer a slave, if the key slot has one.
+ * @return
+ *	- The trunk for the node.
+ *	- NULL if no node is available, or a new trunk couldn't be allocated.
+ */
+fr_redis_trunk_t *fr_redis_cluster_thread_trunk_by_key(fr_redis_cluster_thread_t *cluster_thread, REQUEST *request,
+						       uint8_t const *key, size_t key_len, bool read_only)
+{
+	fr_redis_cluster_key_slot_t const	*key_slot;
+	fr_redis_cluster_node_t const		*node = NULL;
+	fr_socket_addr_t			node_addr;
+
+	fr_assert(cluster_thread->cluster);
 
+	key_slot = fr_redis_cluster_slot_by_key(cluster_thread->cluster, request, key, key_len);
+	if (read_only) node = fr_redis_cluster_slave(cluster_thread->cluster, key_slot, 0);
+	if (!node) node = fr_redis_cluster_master(cluster_thread->cluster, key_slot);
+
+	if ((fr_redis_cluster_ipaddr(&node_addr.ipaddr, node) < 0) ||
+	    (fr_redis_cluster_port(&node_addr.port, node) < 0) || !node_addr.ipaddr.af) {
+		ROPTIONAL(REDEBUG, ERROR, "No node available for key slot");
+		return NULL;
+	}
+
+	return fr_redis_cluster_thread_trunk_by_addr(cluster_thread, &node_addr);
+}
+
+/** Get the trunk for the node a -MOVED or -ASK redirect points to
+ *
+ * On -MOVED the cluster is remapped too, so subsequent lookups go to
+ * the right node.
+ *
+ * @param[in] cluster_thread	to get the trunk from.
+ * @param[in] request		The current request.
+ * @param[in] reply		containing the redirect.
+ * @return
+ *	- The trunk for the node.
+ *	- NULL if the redirect was invalid, or a new trunk couldn't be allocated.
+ */
+fr_redis_trunk_t *fr_redis_cluster_thread_trunk_by_redirect(fr_redis_cluster_thread_t *cluster_thread,
+							    REQUEST *request, redisReply *reply)
+{
+	fr_socket_addr_t	node_addr;
+
+	if (fr_redis_cluster_redirect_addr(&node_addr, reply) < 0) {
+		ROPTIONAL(RPEDEBUG, PERROR, "Invalid redirect");
+		return NULL;
+	}
+
+	if (cluster_thread->cluster &&
+	    (strncmp(REDIS_ERROR_MOVED_STR, reply->str, sizeof(REDIS_ERROR_MOVED_STR) - 1) == 0) &&
+	    (fr_redis_cluster_remap_by_node_addr(request, cluster_thread->cluster, &node_addr) < 0)) {
+		ROPTIONAL(RPWDEBUG, PWARN, "Cluster remap failed");
+	}
+
+	return fr_redis_cluster_thread_trunk_by_addr(cluster_thread, &node_addr);
+}
@@ -56,6 +56,7 @@ RCSIDH(base_h, "$Id$")
 #include <freeradius-devel/server/pool.h>
 #include <freeradius-devel/server/protocol.h>
 #include <freeradius-devel/server/regex.h>
+#include <freeradius-devel/server/reload.h>
 #include <freeradius-devel/server/rcode.h>
 #include <freeradius-devel/server/request_data.h>
 #include <freeradius-devel/server/request.h>
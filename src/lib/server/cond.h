@@ -31,6 +31,7 @@ extern "C" {
 
 #include <freeradius-devel/server/tmpl.h>
 #include <freeradius-devel/server/map.h>
+#include <freeradius-devel/server/rcode.h>
 
 #ifndef RADIUSD_H
 /*
@@ -61,6 +62,16 @@ typedef enum {
 	PASS2_PAIRCOMPARE
 } fr_cond_pass2_t;
 
+/** How a condition is evaluated, selected by #fr_cond_optimise
+ *
+ */
+typedef enum {
+	COND_EVAL_GENERIC = 0,				//!< Operands are cast and compared at run time.
+	COND_EVAL_RCODE,				//!< Bare module return code, resolved at compile time.
+	COND_EVAL_ATTR_CMP_DATA				//!< Attribute compared with data of the same type,
+							//!< so nothing needs casting.
+} fr_cond_eval_t;
+
 /*
  *	Allow for the following structures:
  *
@@ -85,6 +96,9 @@ struct fr_cond_s {
 
 	fr_dict_attr_t const	*cast;
 
+	fr_cond_eval_t		eval;
+	rlm_rcode_t		rcode;		//!< To compare the previous return code with, for #COND_EVAL_RCODE.
+
 	fr_cond_op_t		next_op;
 	fr_cond_t		*next;
 };
@@ -95,6 +109,8 @@ size_t cond_snprint(size_t *need, char *buffer, size_t bufsize, fr_cond_t const
 
 bool fr_cond_walk(fr_cond_t *head, bool (*callback)(fr_cond_t *cond, void *uctx), void *uctx);
 
+void fr_cond_optimise(fr_cond_t *head);
+
 #ifdef __cplusplus
 }
 #endif
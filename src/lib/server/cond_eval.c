@@ -157,7 +157,7 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 	uint32_t	subcaptures;
 	int		ret;
 
-	regex_t		*preg, *rreg = NULL;
+	regex_t		*preg;
 	fr_regmatch_t	*regmatch;
 
 	if (!fr_cond_assert(lhs != NULL)) return -1;
@@ -168,27 +168,30 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 	switch (map->rhs->type) {
 	case TMPL_TYPE_REGEX_STRUCT: /* pre-compiled to a regex */
 		preg = map->rhs->tmpl_preg;
+
+		subcaptures = regex_subcapture_count(preg);
+		if (!subcaptures) subcaptures = REQUEST_MAX_REGEX + 1;	/* +1 for %{0} (whole match) capture group */
+		MEM(regmatch = regex_match_data_alloc(NULL, subcaptures));
 		break;
 
+	/*
+	 *	Expanded at run-time.  The same expansion is often
+	 *	seen again, so use the thread's cache.
+	 */
 	default:
 		if (!fr_cond_assert(rhs && rhs->type == FR_TYPE_STRING)) return -1;
 		if (!fr_cond_assert(rhs && rhs->vb_strvalue)) return -1;
-		slen = regex_compile(request, &rreg, rhs->vb_strvalue, rhs->datum.length,
-				     &map->rhs->tmpl_regex_flags, true, true);
+		slen = regex_cache_compile(&preg, &regmatch, rhs->vb_strvalue, rhs->datum.length,
+					   &map->rhs->tmpl_regex_flags, true);
 		if (slen <= 0) {
 			REMARKER(rhs->vb_strvalue, -slen, "%s", fr_strerror());
 			EVAL_DEBUG("FAIL %d", __LINE__);
 
 			return -1;
 		}
-		preg = rreg;
 		break;
 	}
 
-	subcaptures = regex_subcapture_count(preg);
-	if (!subcaptures) subcaptures = REQUEST_MAX_REGEX + 1;	/* +1 for %{0} (whole match) capture group */
-	MEM(regmatch = regex_match_data_alloc(NULL, subcaptures));
-
 	/*
 	 *	Evaluate the expression
 	 */
@@ -213,8 +216,14 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 		break;
 	}
 
-	talloc_free(regmatch);	/* free if not consumed */
-	if (preg) talloc_free(rreg);
+	/*
+	 *	Free or give back the match data if not consumed.
+	 */
+	if (map->rhs->type == TMPL_TYPE_REGEX_STRUCT) {
+		talloc_free(regmatch);
+	} else {
+		regex_cache_release(preg, regmatch);
+	}
 
 	return ret;
 }
@@ -615,6 +624,25 @@ int cond_eval_map(REQUEST *request, UNUSED int modreturn, UNUSED int depth, fr_c
 			rcode = cond_normalise_and_cmp(request, c, NULL);
 			break;
 		}
+
+		/*
+		 *	Data was cast to the type of the attribute
+		 *	at compile time, so the values can be
+		 *	compared directly.
+		 */
+		if (c->eval == COND_EVAL_ATTR_CMP_DATA) {
+			fr_value_box_t const *rhs = &map->rhs->tmpl_value;
+
+			EVAL_DEBUG("CMP ATTR WITH DATA");
+			for (vp = tmpl_cursor_init(&rcode, &cursor, request, map->lhs);
+			     vp;
+			     vp = fr_cursor_next(&cursor)) {
+				rcode = fr_value_box_cmp_op(map->op, &vp->data, rhs);
+				if (rcode != 0) break;
+			}
+			break;
+		}
+
 		for (vp = tmpl_cursor_init(&rcode, &cursor, request, map->lhs);
 		     vp;
 	     	     vp = fr_cursor_next(&cursor)) {
@@ -705,6 +733,11 @@ int cond_eval(REQUEST *request, int modreturn, int depth, fr_cond_t const *c)
 	while (c) {
 		switch (c->type) {
 		case COND_TYPE_EXISTS:
+			if (c->eval == COND_EVAL_RCODE) {
+				rcode = (c->rcode == modreturn);
+				break;
+			}
+
 			rcode = cond_eval_tmpl(request, modreturn, depth, c->data.vpt);
 			/* Existence checks are special, because we expect them to fail */
 			if (rcode < 0) rcode = 0;
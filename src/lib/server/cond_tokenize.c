@@ -1655,3 +1655,93 @@ bool fr_cond_walk(fr_cond_t *c, bool (*callback)(fr_cond_t *cond, void *uctx), v
 
 	return true;
 }
+
+/** Resolve bare module return codes
+ *
+ */
+static void cond_optimise_exists(fr_cond_t *c)
+{
+	rlm_rcode_t rcode;
+
+	if (!tmpl_is_unparsed(c->data.vpt)) return;
+
+	rcode = fr_table_value_by_str(rcode_table, c->data.vpt->name, RLM_MODULE_UNKNOWN);
+	if (rcode == RLM_MODULE_UNKNOWN) return;
+
+	c->eval = COND_EVAL_RCODE;
+	c->rcode = rcode;
+}
+
+/** Cast data to the type it will be compared as, and avoid casting at run time
+ *
+ * Follows the same rules as cond_normalise_and_cmp() for picking the
+ * type the operands are compared as.
+ */
+static void cond_optimise_map(fr_cond_t *c)
+{
+	vp_map_t		*map = c->data.map;
+	fr_dict_attr_t const	*cast;
+	fr_value_box_t		value;
+
+	if (map->op == T_OP_REG_EQ) return;
+
+	/*
+	 *	paircmp() does its own comparisons.
+	 */
+	if (c->pass2_fixup != PASS2_FIXUP_NONE) return;
+
+	if (!tmpl_is_attr(map->lhs) || !tmpl_is_data(map->rhs)) return;
+
+	cast = c->cast ? c->cast : map->lhs->tmpl_da;
+
+	/*
+	 *	Otherwise the data is cast again for every value
+	 *	of the attribute.  If the cast fails here, leave
+	 *	it to fail at run time, as it did before.
+	 */
+	if (map->rhs->tmpl_value_type != cast->type) {
+		if (fr_value_box_cast(map->rhs, &value, cast->type, cast, &map->rhs->tmpl_value) < 0) {
+			fr_strerror();	/* Clear the error */
+			return;
+		}
+		fr_value_box_clear(&map->rhs->tmpl_value);
+		map->rhs->tmpl_value = value;
+	}
+
+	if (map->lhs->tmpl_da->type != cast->type) return;
+
+	c->eval = COND_EVAL_ATTR_CMP_DATA;
+}
+
+/** Select specialised evaluation functions for a condition
+ *
+ * Constant sub-conditions have already been folded by the tokenizer.
+ * This does the same for the parts of a condition which can only be
+ * resolved after the pass2 fixups, so that cond_eval() doesn't repeat
+ * the work for every request.
+ *
+ * @param[in] head	of the condition.  It's modified in place.
+ */
+void fr_cond_optimise(fr_cond_t *head)
+{
+	fr_cond_t *c;
+
+	for (c = head; c; c = c->next) {
+		switch (c->type) {
+		case COND_TYPE_EXISTS:
+			cond_optimise_exists(c);
+			break;
+
+		case COND_TYPE_MAP:
+			cond_optimise_map(c);
+			break;
+
+		case COND_TYPE_CHILD:
+			fr_cond_optimise(c->data.child);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
@@ -21,6 +21,7 @@ SOURCES	:= \
 	main_loop.c \
 	map_proc.c \
 	map.c \
+	metrics.c \
 	module.c \
 	paircmp.c \
 	pairmove.c \
@@ -28,6 +29,7 @@ SOURCES	:= \
 	pool.c \
 	rcode.c \
 	regex.c \
+	reload.c \
 	request_data.c \
 	request.c \
 	snmp.c \
@@ -166,6 +166,15 @@ static const CONF_PARSER thread_config[] = {
 
 	{ FR_CONF_OFFSET("stats_interval | FR_TYPE_HIDDEN", FR_TYPE_TIME_DELTA, main_config_t, stats_interval), },
 
+	{ FR_CONF_OFFSET("work_stealing", FR_TYPE_BOOL, main_config_t, work_stealing), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("network_cpus", FR_TYPE_STRING, main_config_t, network_cpus) },
+	{ FR_CONF_OFFSET("worker_cpus", FR_TYPE_STRING, main_config_t, worker_cpus) },
+	{ FR_CONF_OFFSET("numa_pairing", FR_TYPE_BOOL, main_config_t, numa_pairing), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("overload_target", FR_TYPE_TIME_DELTA, main_config_t, overload_target), .dflt = "0" },
+	{ FR_CONF_OFFSET("overload_interval", FR_TYPE_TIME_DELTA, main_config_t, overload_interval), .dflt = "0.1" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -436,7 +445,8 @@ static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent,
 
 	memcpy(&value, out, sizeof(value));
 
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, ==, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, >=, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, <=, 32);
 
 	memcpy(out, &value, sizeof(value));
 
@@ -137,6 +137,12 @@ struct main_config_s {
 	uint32_t	max_networks;			//!< for the scheduler
 	uint32_t	max_workers;			//!< for the scheduler
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
+	bool		work_stealing;			//!< for the scheduler
+	char const	*network_cpus;			//!< for the scheduler
+	char const	*worker_cpus;			//!< for the scheduler
+	bool		numa_pairing;			//!< for the scheduler
+	fr_time_delta_t	overload_target;		//!< for the workers
+	fr_time_delta_t	overload_interval;		//!< for the workers
 
 };
 
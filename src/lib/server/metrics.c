@@ -0,0 +1,345 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/lib/server/metrics.c
+ * @brief Collect counters from around the server, and render them as OpenMetrics text.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/metrics.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+
+typedef enum {
+	METRICS_TYPE_COUNTER = 0,
+	METRICS_TYPE_GAUGE,
+	METRICS_TYPE_SUMMARY
+} metrics_type_t;
+
+static char const *metrics_type_name[] = {
+	[METRICS_TYPE_COUNTER] = "counter",
+	[METRICS_TYPE_GAUGE] = "gauge",
+	[METRICS_TYPE_SUMMARY] = "summary"
+};
+
+/** All of the samples for one metric
+ *
+ * OpenMetrics requires the samples of a family to be contiguous, but
+ * sources write samples for many families, so we collect them here
+ * and print them all at the end.
+ */
+typedef struct {
+	char const		*name;			//!< Of the family.
+	char const		*help;			//!< Printed in the "# HELP" line.
+	metrics_type_t		type;			//!< Printed in the "# TYPE" line.
+	char			*samples;		//!< One per line.
+
+	fr_dlist_t		entry;			//!< Entry in the list of families.
+} metrics_family_t;
+
+struct fr_metrics_s {
+	fr_dlist_head_t		families;		//!< In the order they were first written.
+};
+
+struct fr_metrics_source_s {
+	fr_metrics_collect_t	collect;		//!< Called to write samples.
+	void			*uctx;			//!< Passed to collect.
+
+	fr_dlist_t		entry;			//!< Entry in the list of sources.
+};
+
+/*
+ *	Only held while sources are being added or removed, and while
+ *	the metrics are being rendered.  The workers never take it
+ *	when processing requests.
+ */
+static pthread_mutex_t		metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t		metrics_sources;
+static bool			metrics_sources_init;
+
+static double const		metrics_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+static int _metrics_source_free(fr_metrics_source_t *source)
+{
+	pthread_mutex_lock(&metrics_mutex);
+	fr_dlist_remove(&metrics_sources, source);
+	pthread_mutex_unlock(&metrics_mutex);
+
+	return 0;
+}
+
+/** Add a source of metrics
+ *
+ * The source is removed when it's freed.  If the data read by the
+ * callback is freed by another thread, the source must be freed
+ * before that data is.
+ *
+ * @param[in] ctx	to allocate the source in.  Usually the
+ *			structure containing the counters.
+ * @param[in] collect	called each time the metrics are rendered.
+ * @param[in] uctx	to pass to collect.
+ * @return
+ *	- A new source.
+ *	- NULL on error.
+ */
+fr_metrics_source_t *fr_metrics_source_add(TALLOC_CTX *ctx, fr_metrics_collect_t collect, void *uctx)
+{
+	fr_metrics_source_t *source;
+
+	source = talloc_zero(ctx, fr_metrics_source_t);
+	if (!source) return NULL;
+
+	source->collect = collect;
+	source->uctx = uctx;
+
+	pthread_mutex_lock(&metrics_mutex);
+	if (!metrics_sources_init) {
+		fr_dlist_init(&metrics_sources, fr_metrics_source_t, entry);
+		metrics_sources_init = true;
+	}
+	fr_dlist_insert_tail(&metrics_sources, source);
+	pthread_mutex_unlock(&metrics_mutex);
+
+	talloc_set_destructor(source, _metrics_source_free);
+
+	return source;
+}
+
+/** Escape a string so it can be used as a label value
+ *
+ * @param[in] m		being written.  The escaped string is freed with it.
+ * @param[in] in	string to escape.
+ * @return the escaped string.
+ */
+char const *fr_metrics_label_escape(fr_metrics_t *m, char const *in)
+{
+	char const	*p;
+	char		*out, *q;
+
+	for (p = in; *p; p++) if ((*p == '"') || (*p == '\\') || (*p == '\n')) break;
+	if (!*p) return in;
+
+	MEM(out = talloc_array(m, char, (strlen(in) * 2) + 1));
+	for (p = in, q = out; *p; p++) {
+		switch (*p) {
+		case '"':
+		case '\\':
+			*q++ = '\\';
+			*q++ = *p;
+			break;
+
+		case '\n':
+			*q++ = '\\';
+			*q++ = 'n';
+			break;
+
+		default:
+			*q++ = *p;
+			break;
+		}
+	}
+	*q = '\0';
+
+	return out;
+}
+
+/** Find or create the family a sample belongs to
+ *
+ */
+static metrics_family_t *metrics_family(fr_metrics_t *m, char const *name, char const *help, metrics_type_t type)
+{
+	metrics_family_t *family = NULL;
+
+	while ((family = fr_dlist_next(&m->families, family))) {
+		if (strcmp(family->name, name) != 0) continue;
+
+		fr_assert(family->type == type);
+		return family;
+	}
+
+	MEM(family = talloc_zero(m, metrics_family_t));
+	family->name = name;
+	family->help = help;
+	family->type = type;
+	MEM(family->samples = talloc_strdup(family, ""));
+	fr_dlist_insert_tail(&m->families, family);
+
+	return family;
+}
+
+/** Print the labels of a sample, including the braces
+ *
+ * @param[in] ctx	to allocate the labels in.
+ * @param[in] extra	label to add after the others, e.g. quantile="0.5".  May be NULL.
+ * @param[in] fmt	for the other labels.  May be NULL.
+ * @param[in] ap	arguments for fmt.
+ */
+static char *metrics_labels(TALLOC_CTX *ctx, char const *extra, char const *fmt, va_list ap)
+{
+	char *labels;
+
+	if (!fmt || !*fmt) {
+		if (!extra) return talloc_strdup(ctx, "");
+		return talloc_typed_asprintf(ctx, "{%s}", extra);
+	}
+
+	MEM(labels = talloc_strdup(ctx, "{"));
+	MEM(labels = talloc_vasprintf_append_buffer(labels, fmt, ap));
+	if (extra) MEM(labels = talloc_asprintf_append_buffer(labels, ",%s", extra));
+
+	return talloc_strdup_append_buffer(labels, "}");
+}
+
+/** Write the value of a counter
+ *
+ * @param[in] m		to write to.
+ * @param[in] name	of the counter, without the "_total" suffix.
+ * @param[in] help	for the counter.
+ * @param[in] value	of the counter.
+ * @param[in] labels	printf format for the labels of this sample, e.g. worker="%i".
+ *			Strings should be escaped with #fr_metrics_label_escape.
+ */
+void fr_metrics_counter(fr_metrics_t *m, char const *name, char const *help,
+			uint64_t value, char const *labels, ...)
+{
+	metrics_family_t	*family = metrics_family(m, name, help, METRICS_TYPE_COUNTER);
+	va_list			ap;
+	char			*l;
+
+	va_start(ap, labels);
+	l = metrics_labels(family, NULL, labels, ap);
+	va_end(ap);
+
+	MEM(family->samples = talloc_asprintf_append_buffer(family->samples, "%s_total%s %" PRIu64 "\n",
+							    name, l, value));
+	talloc_free(l);
+}
+
+/** Write the value of a gauge
+ *
+ * @param[in] m		to write to.
+ * @param[in] name	of the gauge.
+ * @param[in] help	for the gauge.
+ * @param[in] value	of the gauge.
+ * @param[in] labels	printf format for the labels of this sample.
+ */
+void fr_metrics_gauge(fr_metrics_t *m, char const *name, char const *help,
+		      uint64_t value, char const *labels, ...)
+{
+	metrics_family_t	*family = metrics_family(m, name, help, METRICS_TYPE_GAUGE);
+	va_list			ap;
+	char			*l;
+
+	va_start(ap, labels);
+	l = metrics_labels(family, NULL, labels, ap);
+	va_end(ap);
+
+	MEM(family->samples = talloc_asprintf_append_buffer(family->samples, "%s%s %" PRIu64 "\n",
+							    name, l, value));
+	talloc_free(l);
+}
+
+/** Write a histogram of #fr_time_delta_t values as a summary in seconds
+ *
+ * @param[in] m		to write to.
+ * @param[in] name	of the summary.  Should end in "_seconds".
+ * @param[in] help	for the summary.
+ * @param[in] hist	to summarise.
+ * @param[in] labels	printf format for the labels of this sample.
+ */
+void fr_metrics_summary(fr_metrics_t *m, char const *name, char const *help,
+			fr_hist_t const *hist, char const *labels, ...)
+{
+	metrics_family_t	*family = metrics_family(m, name, help, METRICS_TYPE_SUMMARY);
+	va_list			ap;
+	size_t			i;
+	char			*l;
+	uint64_t		total = atomic_load_explicit(&hist->total, memory_order_relaxed);
+	uint64_t		sum = atomic_load_explicit(&hist->sum, memory_order_relaxed);
+
+	for (i = 0; i < NUM_ELEMENTS(metrics_quantiles); i++) {
+		char extra[32];
+
+		snprintf(extra, sizeof(extra), "quantile=\"%g\"", metrics_quantiles[i]);
+
+		va_start(ap, labels);
+		l = metrics_labels(family, extra, labels, ap);
+		va_end(ap);
+
+		MEM(family->samples = talloc_asprintf_append_buffer(family->samples, "%s%s %.9f\n", name, l,
+								    (double) fr_hist_percentile(hist, metrics_quantiles[i] * 100) /
+								    NSEC));
+		talloc_free(l);
+	}
+
+	va_start(ap, labels);
+	l = metrics_labels(family, NULL, labels, ap);
+	va_end(ap);
+
+	MEM(family->samples = talloc_asprintf_append_buffer(family->samples, "%s_sum%s %.9f\n%s_count%s %" PRIu64 "\n",
+							    name, l, (double) sum / NSEC, name, l, total));
+	talloc_free(l);
+}
+
+/** Collect the metrics from all sources, and render them as OpenMetrics text
+ *
+ * Sources can't be added or removed while this runs, but request
+ * processing is unaffected.
+ *
+ * @param[in] ctx	to allocate the text in.
+ * @return
+ *	- The metrics, terminated with "# EOF".
+ *	- NULL on error.
+ */
+char *fr_metrics_render(TALLOC_CTX *ctx)
+{
+	fr_metrics_t		*m;
+	fr_metrics_source_t	*source = NULL;
+	metrics_family_t	*family = NULL;
+	char			*out;
+
+	MEM(m = talloc_zero(NULL, fr_metrics_t));
+	fr_dlist_talloc_init(&m->families, metrics_family_t, entry);
+
+	pthread_mutex_lock(&metrics_mutex);
+	if (metrics_sources_init) {
+		while ((source = fr_dlist_next(&metrics_sources, source))) source->collect(m, source->uctx);
+	}
+	pthread_mutex_unlock(&metrics_mutex);
+
+	MEM(out = talloc_strdup(ctx, ""));
+	while ((family = fr_dlist_next(&m->families, family))) {
+		MEM(out = talloc_asprintf_append_buffer(out, "# TYPE %s %s\n# HELP %s %s\n%s",
+							family->name, metrics_type_name[family->type],
+							family->name, family->help, family->samples));
+	}
+	MEM(out = talloc_strdup_append_buffer(out, "# EOF\n"));
+
+	talloc_free(m);
+
+	return out;
+}
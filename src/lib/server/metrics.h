@@ -0,0 +1,79 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/metrics.h
+ * @brief Collect counters from around the server, and render them as OpenMetrics text.
+ *
+ * Subsystems register a #fr_metrics_collect_t callback when they're
+ * allocated.  When somebody scrapes the metrics, each callback is run
+ * from the scraping thread, and writes samples with #fr_metrics_counter,
+ * #fr_metrics_gauge and #fr_metrics_summary.
+ *
+ * Callbacks MUST NOT lock anything the workers lock to process requests.
+ * They should only read word sized counters and list lengths, in the
+ * same way that the radmin "stats" commands do.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(metrics_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/hist.h>
+
+#include <stdint.h>
+#include <talloc.h>
+
+typedef struct fr_metrics_s fr_metrics_t;
+typedef struct fr_metrics_source_s fr_metrics_source_t;
+
+/** Write the current value of a subsystem's counters
+ *
+ * @param[in] m		to write samples to.
+ * @param[in] uctx	passed to #fr_metrics_source_add.
+ */
+typedef void (*fr_metrics_collect_t)(fr_metrics_t *m, void *uctx);
+
+fr_metrics_source_t	*fr_metrics_source_add(TALLOC_CTX *ctx, fr_metrics_collect_t collect, void *uctx)
+			CC_HINT(nonnull(2));
+
+char const		*fr_metrics_label_escape(fr_metrics_t *m, char const *in) CC_HINT(nonnull);
+
+void			fr_metrics_counter(fr_metrics_t *m, char const *name, char const *help,
+					   uint64_t value, char const *labels, ...)
+			CC_HINT(nonnull(1,2,3)) CC_HINT(format (printf, 5, 6));
+
+void			fr_metrics_gauge(fr_metrics_t *m, char const *name, char const *help,
+					 uint64_t value, char const *labels, ...)
+			CC_HINT(nonnull(1,2,3)) CC_HINT(format (printf, 5, 6));
+
+void			fr_metrics_summary(fr_metrics_t *m, char const *name, char const *help,
+					   fr_hist_t const *hist, char const *labels, ...)
+			CC_HINT(nonnull(1,2,3,4)) CC_HINT(format (printf, 5, 6));
+
+char			*fr_metrics_render(TALLOC_CTX *ctx);
+
+#ifdef __cplusplus
+}
+#endif
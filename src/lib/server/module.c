@@ -31,6 +31,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/cf_file.h>
 #include <freeradius-devel/server/cond.h>
+#include <freeradius-devel/server/metrics.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/radmin.h>
 #include <freeradius-devel/server/request_data.h>
@@ -161,6 +162,40 @@ static int cmd_show_module_status(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUS
 	return 0;
 }
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+static int cmd_show_module_latency(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	module_instance_t	*mi = ctx;
+	fr_hist_t		*hist;
+
+	if (!mi->latency) return 0;
+
+	MEM(hist = fr_hist_alloc(NULL));
+	fr_hist_group_merge(hist, mi->latency);
+	fr_hist_fprint(fp, NULL, hist);
+	talloc_free(hist);
+
+	return 0;
+}
+#endif
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+/** Write the latency of calls to a module, across all workers
+ *
+ */
+static void module_metrics(fr_metrics_t *m, void *uctx)
+{
+	module_instance_t	*mi = talloc_get_type_abort(uctx, module_instance_t);
+	fr_hist_t		*hist;
+
+	MEM(hist = fr_hist_alloc(NULL));
+	fr_hist_group_merge(hist, mi->latency);
+	fr_metrics_summary(m, "freeradius_module_latency_seconds", "Time taken by calls to a module.",
+			   hist, "module=\"%s\"", fr_metrics_label_escape(m, mi->name));
+	talloc_free(hist);
+}
+#endif
+
 static int cmd_set_module_status(UNUSED FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	module_instance_t *mi = ctx;
@@ -204,6 +239,17 @@ static fr_cmd_table_t cmd_module_table[] = {
 		.read_only = true,
 	},
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "latency",
+		.func = cmd_show_module_latency,
+		.help = "Show the latency of calls to a module, across all workers.",
+		.read_only = true,
+	},
+#endif
+
 	{
 		.parent = "set module",
 		.add_name = true,
@@ -1251,6 +1297,10 @@ static int _module_thread_instantiate(void *instance, void *uctx)
 		}
 	}
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+	if (mi->latency) MEM(ti->latency = fr_hist_group_thread_alloc(ti, mi->latency));
+#endif
+
 	fr_assert(mi->number < talloc_array_length(thread_inst_ctx->array));
 	thread_inst_ctx->array[mi->number] = ti;
 
@@ -1312,6 +1362,11 @@ static int _module_instantiate(void *instance, UNUSED void *ctx)
 
 	if (mi->instantiated) return 0;
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+	MEM(mi->latency = fr_hist_group_alloc(mi));
+	MEM(fr_metrics_source_add(mi, module_metrics, mi));
+#endif
+
 	if (fr_command_register_hook(NULL, mi->name, mi, cmd_module_table) < 0) {
 		ERROR("Failed registering radmin commands for module %s - %s",
 		      mi->name, fr_strerror());
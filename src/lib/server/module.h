@@ -47,6 +47,7 @@ typedef struct module_thread_instance_s  module_thread_instance_t;
 
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/features.h>
+#include <freeradius-devel/util/hist.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -204,6 +205,10 @@ struct module_instance_s {
 							//!< has been set to true.
 	bool				in_name_tree;	//!< Whether this is in the name lookup tree.
 	bool				in_data_tree;	//!< Whether this is in the data lookup tree.
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+	fr_hist_group_t			*latency;	//!< Per-thread histograms of call latency.
+#endif
 };
 
 /** Per thread per instance data
@@ -224,6 +229,11 @@ struct module_thread_instance_s {
 
 	uint64_t			total_calls;	//! total number of times we've been called
 	uint64_t			active_callers; //! number of active callers.  i.e. number of current yields
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+	fr_hist_t			*latency;	//!< Time from calling the module, to it returning
+							///< a result, including any time spent yielded.
+#endif
 };
 
 /** Map string values to module state method
@@ -29,6 +29,7 @@ RCSID("$Id$")
 #define LOG_PREFIX_ARGS pool->log_prefix
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/metrics.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/util/debug.h>
 
@@ -146,6 +147,8 @@ struct fr_pool_s {
 	fr_pool_reconnect_t	reconnect;	//!< Called during connection pool reconnect.
 
 	fr_pool_state_t	state;			//!< Stats and state of the connection pool.
+
+	fr_metrics_source_t *metrics;		//!< Reads state without taking the mutex.
 };
 
 static const CONF_PARSER pool_config[] = {
@@ -913,6 +916,28 @@ void fr_pool_enable_triggers(fr_pool_t *pool, char const *trigger_prefix, VALUE_
 	MEM(fr_pair_list_copy(pool, &pool->trigger_args, trigger_args) >= 0);
 }
 
+/** Write the number of connections in the pool
+ *
+ * Called from whichever thread is scraping the metrics.  We don't take
+ * the pool mutex, as that would make the workers wait for us.
+ */
+static void pool_metrics(fr_metrics_t *m, void *uctx)
+{
+	fr_pool_t	*pool = talloc_get_type_abort(uctx, fr_pool_t);
+	char const	*name = fr_metrics_label_escape(m, pool->log_prefix);
+
+	fr_metrics_gauge(m, "freeradius_pool_connections", "Connections open in a pool.",
+			 pool->state.num, "pool=\"%s\"", name);
+	fr_metrics_gauge(m, "freeradius_pool_connections_active", "Connections reserved from a pool.",
+			 pool->state.active, "pool=\"%s\"", name);
+	fr_metrics_gauge(m, "freeradius_pool_connections_pending", "Connections a pool is opening.",
+			 pool->state.pending, "pool=\"%s\"", name);
+	fr_metrics_gauge(m, "freeradius_pool_connections_max", "Connections a pool is allowed to open.",
+			 pool->max, "pool=\"%s\"", name);
+	fr_metrics_counter(m, "freeradius_pool_connections_opened", "Connections a pool has opened.",
+			   pool->state.count, "pool=\"%s\"", name);
+}
+
 /** Create a new connection pool
  *
  * Allocates structures used by the connection pool, initialises the various
@@ -1071,6 +1096,8 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	 */
 	FR_TIME_DELTA_BOUND_CHECK("connect_timeout", pool->connect_timeout, >=, fr_time_delta_from_msec(100));
 
+	MEM(pool->metrics = fr_metrics_source_add(pool, pool_metrics, pool));
+
 	/*
 	 *	Don't open any connections.  Instead, force the limits
 	 *	to only 1 connection.
@@ -1314,6 +1341,8 @@ void fr_pool_free(fr_pool_t *pool)
 
 	DEBUG2("Removing connection pool");
 
+	TALLOC_FREE(pool->metrics);
+
 	pthread_mutex_lock(&pool->mutex);
 
 	/*
@@ -25,9 +25,19 @@
 
 RCSID("$Id$")
 
+#include <freeradius-devel/server/metrics.h>
 #include <freeradius-devel/server/regex.h>
 #include <freeradius-devel/server/request_data.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/thread_local.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 
 #ifdef HAVE_REGEX
 
@@ -40,6 +50,41 @@ typedef struct {
 	fr_regmatch_t	*regmatch;	//!< Match vectors.
 } fr_regcapture_t;
 
+/*
+ *	The maximum number of expressions each thread caches.
+ */
+#define REGEX_CACHE_SIZE	(256)
+
+/** A compiled expression, and a spare set of match vectors for it
+ *
+ */
+typedef struct {
+	char const	*pattern;	//!< Uncompiled expression.
+	size_t		len;		//!< Of the pattern.
+	uint8_t		flags;		//!< #fr_regex_flags_t, and whether subcaptures are enabled.
+
+	regex_t		*preg;		//!< Compiled expression.
+	fr_regmatch_t	*regmatch;	//!< Unused match vectors, or NULL.
+
+	fr_dlist_t	entry;		//!< In the LRU list.
+} regex_cache_entry_t;
+
+/** Expressions which were expanded at run-time, and then compiled
+ *
+ * Each thread has its own cache, so nothing is locked.
+ */
+typedef struct {
+	fr_hash_table_t	*ht;		//!< Entries, by pattern and flags.
+	fr_dlist_head_t	lru;		//!< Most recently used first.
+
+	uint32_t	id;		//!< For labelling metrics.
+	uint64_t	hits;		//!< Expressions we found in the cache.
+	uint64_t	misses;		//!< Expressions we had to compile.
+	uint64_t	evictions;	//!< Expressions we freed to make room for others.
+} regex_cache_t;
+
+static _Thread_local regex_cache_t *regex_cache;
+
 /** Adds subcapture values to request data
  *
  * Allows use of %{n} expansions.
@@ -82,10 +127,14 @@ void regex_sub_to_request(REQUEST *request, regex_t **preg, fr_regmatch_t **regm
 	MEM(new_rc = talloc(request, fr_regcapture_t));
 
 	/*
-	 *	Steal runtime pregs, leave precompiled ones
+	 *	Reference cached pregs, as they may be evicted
+	 *	before the request is done with them.  Steal runtime
+	 *	pregs, leave precompiled ones.
 	 */
 #if defined(HAVE_REGEX_PCRE) || defined(HAVE_REGEX_PCRE2)
-	if (!(*preg)->precompiled) {
+	if (talloc_get_type(talloc_parent(*preg), regex_cache_entry_t)) {
+		MEM(new_rc->preg = talloc_reference(new_rc, *preg));
+	} else if (!(*preg)->precompiled) {
 		new_rc->preg = talloc_steal(new_rc, *preg);
 		*preg = NULL;
 	} else {
@@ -102,6 +151,196 @@ void regex_sub_to_request(REQUEST *request, regex_t **preg, fr_regmatch_t **regm
 	request_data_talloc_add(request, request, REQUEST_DATA_REGEX, fr_regcapture_t, new_rc, true, false, false);
 }
 
+static uint32_t regex_cache_hash(void const *data)
+{
+	regex_cache_entry_t const *e = data;
+
+	return fr_hash_update(&e->flags, sizeof(e->flags), fr_hash(e->pattern, e->len));
+}
+
+static int regex_cache_cmp(void const *one, void const *two)
+{
+	regex_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->flags > b->flags) - (a->flags < b->flags);
+	if (ret != 0) return ret;
+
+	ret = (a->len > b->len) - (a->len < b->len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->pattern, b->pattern, a->len);
+}
+
+static void regex_cache_metrics(fr_metrics_t *m, void *uctx)
+{
+	regex_cache_t const *cache = uctx;
+
+	fr_metrics_counter(m, "freeradius_regex_cache_hits", "Run-time expressions found in a thread's cache.",
+			   cache->hits, "thread=\"%u\"", cache->id);
+	fr_metrics_counter(m, "freeradius_regex_cache_misses", "Run-time expressions a thread had to compile.",
+			   cache->misses, "thread=\"%u\"", cache->id);
+	fr_metrics_counter(m, "freeradius_regex_cache_evictions", "Run-time expressions a thread evicted from its cache.",
+			   cache->evictions, "thread=\"%u\"", cache->id);
+	fr_metrics_gauge(m, "freeradius_regex_cache_entries", "Run-time expressions in a thread's cache.",
+			 fr_dlist_num_elements(&cache->lru), "thread=\"%u\"", cache->id);
+}
+
+static void _regex_cache_free_on_exit(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Allocate the cache for this thread
+ *
+ */
+static regex_cache_t *regex_cache_init(void)
+{
+	static atomic_uint_fast32_t	num;
+	regex_cache_t			*cache;
+
+	MEM(cache = talloc_zero(NULL, regex_cache_t));
+	MEM(cache->ht = fr_hash_table_create(cache, regex_cache_hash, regex_cache_cmp, NULL));
+	fr_dlist_talloc_init(&cache->lru, regex_cache_entry_t, entry);
+	cache->id = atomic_fetch_add(&num, 1);
+
+	MEM(fr_metrics_source_add(cache, regex_cache_metrics, cache));
+
+	fr_thread_local_set_destructor(regex_cache, _regex_cache_free_on_exit, cache);
+
+	return cache;
+}
+
+/** Compile an expression which was expanded at run-time, or find it in this thread's cache
+ *
+ * Policies often expand the same expression for many requests, so
+ * keeping the compiled expression saves compiling it every time.
+ * Expressions are cached per thread, so nothing is locked.  The least
+ * recently used expression is freed when the cache is full.
+ *
+ * Cached expressions are JIT compiled where possible, as they're
+ * likely to be used again.
+ *
+ * @param[out] out		The compiled expression.  Must NOT be freed,
+ *				and must not be used after the next call to
+ *				this function, unless it's passed to
+ *				#regex_sub_to_request.
+ * @param[out] regmatch		Match vectors for the expression.  Must be
+ *				given back with #regex_cache_release if
+ *				they're not consumed by #regex_sub_to_request.
+ * @param[in] pattern		to compile.
+ * @param[in] len		of pattern.
+ * @param[in] flags		controlling matching.  May be NULL.
+ * @param[in] subcaptures	Whether to compile the regular expression to store
+ *				subcapture data.
+ * @return
+ *	- >= 1 on success.
+ *	- <= 0 on error.  Negative value is offset of parse error.
+ */
+ssize_t regex_cache_compile(regex_t **out, fr_regmatch_t **regmatch, char const *pattern, size_t len,
+			    fr_regex_flags_t const *flags, bool subcaptures)
+{
+	regex_cache_t		*cache = regex_cache;
+	regex_cache_entry_t	find, *e;
+	ssize_t			slen;
+	uint32_t		num;
+
+	*out = NULL;
+	*regmatch = NULL;
+
+	if (unlikely(!cache)) cache = regex_cache_init();
+
+	find = (regex_cache_entry_t) {
+		.pattern = pattern,
+		.len = len,
+		.flags = subcaptures
+	};
+	if (flags) {
+		find.flags |= (flags->global << 1) | (flags->ignore_case << 2) | (flags->multiline << 3) |
+			      (flags->dot_all << 4) | (flags->unicode << 5) | (flags->extended << 6);
+	}
+
+	e = fr_hash_table_finddata(cache->ht, &find);
+	if (e) {
+		cache->hits++;
+		fr_dlist_remove(&cache->lru, e);
+		fr_dlist_insert_head(&cache->lru, e);
+		goto done;
+	}
+
+	cache->misses++;
+
+	/*
+	 *	Make room by freeing the least recently used entry.
+	 *	Requests which are still using its expression hold a
+	 *	reference to it.
+	 */
+	if (fr_dlist_num_elements(&cache->lru) >= REGEX_CACHE_SIZE) {
+		regex_cache_entry_t *old = fr_dlist_tail(&cache->lru);
+
+		fr_hash_table_yank(cache->ht, old);
+		fr_dlist_remove(&cache->lru, old);
+		talloc_free(old);
+		cache->evictions++;
+	}
+
+	MEM(e = talloc_zero(cache, regex_cache_entry_t));
+	e->len = len;
+	e->flags = find.flags;
+	MEM(e->pattern = talloc_memdup(e, pattern, len));
+
+	slen = regex_compile(e, &e->preg, pattern, len, flags, subcaptures, false);
+
+	/*
+	 *	JIT compilation can fail for expressions which are
+	 *	otherwise valid.
+	 */
+	if ((slen == 0) && (len > 0)) slen = regex_compile(e, &e->preg, pattern, len, flags, subcaptures, true);
+	if (slen <= 0) {
+		talloc_free(e);
+		return slen;
+	}
+
+	if (!fr_cond_assert(fr_hash_table_insert(cache->ht, e) == 1)) {
+		talloc_free(e);
+		return -1;
+	}
+	fr_dlist_insert_head(&cache->lru, e);
+
+done:
+	if (!e->regmatch) {
+		num = regex_subcapture_count(e->preg);
+		if (!num) num = REQUEST_MAX_REGEX + 1;	/* +1 for %{0} (whole match) capture group */
+		MEM(e->regmatch = regex_match_data_alloc(e, num));
+	}
+
+	*out = e->preg;
+	*regmatch = e->regmatch;
+	e->regmatch = NULL;
+
+	return len;
+}
+
+/** Give back match vectors which weren't consumed by #regex_sub_to_request
+ *
+ * @param[in] preg	returned by #regex_cache_compile.
+ * @param[in] regmatch	returned by #regex_cache_compile.  May be NULL.
+ */
+void regex_cache_release(regex_t *preg, fr_regmatch_t *regmatch)
+{
+	regex_cache_entry_t *e;
+
+	if (!regmatch) return;
+
+	e = talloc_get_type_abort(talloc_parent(preg), regex_cache_entry_t);
+	if (e->regmatch) {
+		talloc_free(regmatch);
+		return;
+	}
+
+	e->regmatch = regmatch;
+}
+
 #  if defined(HAVE_REGEX_PCRE2)
 /** Extract a subcapture value from the request
  *
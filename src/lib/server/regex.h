@@ -43,6 +43,11 @@ extern "C" {
 
 void	regex_sub_to_request(REQUEST *request, regex_t **preg, fr_regmatch_t **regmatch);
 
+ssize_t	regex_cache_compile(regex_t **out, fr_regmatch_t **regmatch, char const *pattern, size_t len,
+			    fr_regex_flags_t const *flags, bool subcaptures);
+
+void	regex_cache_release(regex_t *preg, fr_regmatch_t *regmatch);
+
 int	regex_request_to_sub(TALLOC_CTX *ctx, char **out, REQUEST *request, uint32_t num);
 
 /*
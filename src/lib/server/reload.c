@@ -0,0 +1,530 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/lib/server/reload.c
+ * @brief Reload module data files in the background.
+ *
+ * Modules such as rlm_files build an index from a data file when they
+ * are instantiated.  This API lets them rebuild the index when the file
+ * changes, without stopping the workers.
+ *
+ * The files are watched with an EVFILT_VNODE filter (inotify when
+ * kqueue is emulated on Linux), in an event loop running in a separate
+ * thread.  When a file changes, that thread builds a complete new copy
+ * of the data, and atomically replaces the pointer the workers use.
+ *
+ * The old data is freed using epoch based reclamation.  Each reader
+ * thread publishes the epoch it entered in, in its own slot.  After the
+ * pointer has been replaced, the epoch is incremented, and the reload
+ * thread waits until no reader is still in an older epoch.  Readers
+ * never block, and never write to shared cache lines.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX "%s - "
+#define LOG_PREFIX_ARGS rl->name
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/reload.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#ifndef O_EVTONLY
+#  define O_EVTONLY O_RDONLY
+#endif
+
+/** Maximum number of threads which can read without taking a lock
+ *
+ * Threads beyond this use a read lock instead.
+ */
+#define FR_RELOAD_MAX_SLOTS	(128)
+
+/** Per-thread reader state
+ *
+ * Padded to a cache line, so that readers don't contend with each other.
+ */
+typedef struct {
+	atomic_uint_fast64_t	epoch;		//!< Epoch the reader entered in, or 0 if
+						///< the reader is not using the data.
+	unsigned int		depth;		//!< Nested fr_reload_enter() calls.  Only
+						///< touched by the owning thread.
+	uint8_t			pad[64 - sizeof(atomic_uint_fast64_t) - sizeof(unsigned int)];
+} fr_reload_slot_t;
+
+/** A file being watched
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the list of files.
+	fr_reload_t		*rl;		//!< What we reload when the file changes.
+	char const		*filename;	//!< Name of the file.
+	int			fd;		//!< Watched file descriptor, or -1.
+} fr_reload_file_t;
+
+struct fr_reload_s {
+	char const		*name;		//!< For log messages.
+	fr_reload_conf_t const	*conf;		//!< Our configuration.
+
+	fr_reload_load_t	loader;		//!< Builds a new copy of the data.
+	void			*uctx;		//!< Passed to loader.
+
+	atomic_uintptr_t	current;	//!< The data the readers use.
+	TALLOC_CTX		*current_ctx;	//!< What to free when the data is replaced.
+	atomic_uint_fast64_t	epoch;		//!< Incremented each time the data is replaced.
+
+	fr_reload_slot_t	slot[FR_RELOAD_MAX_SLOTS];	//!< Reader state.
+	pthread_rwlock_t	overflow;	//!< For readers which don't have a slot.
+
+	fr_dlist_head_t		files;		//!< Files we're watching.
+
+	bool			running;	//!< Whether the reload thread is running.
+	pthread_t		pthread_id;	//!< The reload thread.
+	fr_event_list_t		*el;		//!< Event list for the reload thread.
+	fr_event_timer_t const	*ev;		//!< Delay between a change and reloading.
+	int			signal_pipe[2];	//!< To tell the reload thread to exit.
+};
+
+static _Thread_local int reload_slot = -1;		//!< Our slot index, shared by all fr_reload_t.
+static atomic_int reload_slot_next = ATOMIC_VAR_INIT(0);
+
+CONF_PARSER const fr_reload_config[] = {
+	{ FR_CONF_OFFSET("enable", FR_TYPE_BOOL, fr_reload_conf_t, enable), .dflt = "no" },
+	{ FR_CONF_OFFSET("delay", FR_TYPE_TIME_DELTA, fr_reload_conf_t, delay), .dflt = "1.0" },
+
+	CONF_PARSER_TERMINATOR
+};
+
+/** Return the slot index for this thread
+ *
+ */
+static inline int reload_slot_id(void)
+{
+	if (unlikely(reload_slot < 0)) reload_slot = atomic_fetch_add(&reload_slot_next, 1);
+
+	return reload_slot;
+}
+
+/** Get the current data, and stop it from being freed
+ *
+ * Must be paired with a call to fr_reload_leave().  The caller must not
+ * yield between the two calls, as the reload thread waits for
+ * fr_reload_leave() before freeing old data.
+ *
+ * @param[in] rl	to get the data from.
+ * @return the current data.
+ */
+void *fr_reload_enter(fr_reload_t *rl)
+{
+	fr_reload_slot_t	*slot;
+	int			id;
+
+	/*
+	 *	Nothing is ever replaced, so there's nothing to
+	 *	protect.
+	 */
+	if (!rl->running) return (void *) atomic_load_explicit(&rl->current, memory_order_relaxed);
+
+	id = reload_slot_id();
+	if (unlikely(id >= FR_RELOAD_MAX_SLOTS)) {
+		pthread_rwlock_rdlock(&rl->overflow);
+		return (void *) atomic_load(&rl->current);
+	}
+
+	slot = &rl->slot[id];
+	if (slot->depth++ == 0) atomic_store(&slot->epoch, atomic_load(&rl->epoch));
+
+	return (void *) atomic_load(&rl->current);
+}
+
+/** Tell the reload thread that we've finished with the data
+ *
+ * @param[in] rl	the data was taken from.
+ */
+void fr_reload_leave(fr_reload_t *rl)
+{
+	fr_reload_slot_t	*slot;
+	int			id;
+
+	if (!rl->running) return;
+
+	id = reload_slot_id();
+	if (unlikely(id >= FR_RELOAD_MAX_SLOTS)) {
+		pthread_rwlock_unlock(&rl->overflow);
+		return;
+	}
+
+	slot = &rl->slot[id];
+	fr_assert(slot->depth > 0);
+	if (--slot->depth == 0) atomic_store_explicit(&slot->epoch, 0, memory_order_release);
+}
+
+/** Wait until no reader is using data from before epoch
+ *
+ */
+static void reload_synchronize(fr_reload_t *rl, uint64_t epoch)
+{
+	int		i, num;
+
+	num = atomic_load(&reload_slot_next);
+	if (num > FR_RELOAD_MAX_SLOTS) num = FR_RELOAD_MAX_SLOTS;
+
+	for (i = 0; i < num; i++) {
+		uint64_t	seen;
+
+		/*
+		 *	Readers hold the data for the duration of one
+		 *	module call, so we don't wait for long.
+		 */
+		while (((seen = atomic_load(&rl->slot[i].epoch)) != 0) && (seen < epoch)) {
+			struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000 };
+
+			nanosleep(&ts, NULL);
+		}
+	}
+
+	/*
+	 *	Wait for readers which don't have a slot.
+	 */
+	pthread_rwlock_wrlock(&rl->overflow);
+	pthread_rwlock_unlock(&rl->overflow);
+}
+
+/** Replace the current data, and free the old data once no one is using it
+ *
+ */
+static void reload_swap(fr_reload_t *rl, void *data, TALLOC_CTX *ctx)
+{
+	TALLOC_CTX	*old_ctx = rl->current_ctx;
+	uint64_t	epoch;
+
+	atomic_store(&rl->current, (uintptr_t) data);
+	rl->current_ctx = ctx;
+
+	epoch = atomic_fetch_add(&rl->epoch, 1) + 1;
+
+	reload_synchronize(rl, epoch);
+
+	talloc_free(old_ctx);
+}
+
+/** Build a new copy of the data
+ *
+ */
+static int reload_load(fr_reload_t *rl)
+{
+	TALLOC_CTX	*ctx;
+	void		*data;
+
+	MEM(ctx = talloc_init("%s data", rl->name));
+
+	data = rl->loader(ctx, rl->uctx);
+	if (!data) {
+		talloc_free(ctx);
+		return -1;
+	}
+
+	if (!rl->current_ctx) {
+		atomic_store(&rl->current, (uintptr_t) data);
+		rl->current_ctx = ctx;
+		return 0;
+	}
+
+	reload_swap(rl, data, ctx);
+	return 0;
+}
+
+static void reload_changed(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx);
+
+static void reload_file_unwatch(fr_reload_file_t *file)
+{
+	fr_reload_t	*rl = file->rl;
+
+	if (file->fd < 0) return;
+
+	(void) fr_event_fd_delete(rl->el, file->fd, FR_EVENT_FILTER_VNODE);
+	close(file->fd);
+	file->fd = -1;
+}
+
+static int reload_file_watch(fr_reload_file_t *file)
+{
+	fr_reload_t		*rl = file->rl;
+	fr_event_vnode_func_t	funcs;
+
+	if (file->fd >= 0) return 0;
+
+	file->fd = open(file->filename, O_EVTONLY);
+	if (file->fd < 0) {
+		ERROR("Failed opening %s: %s", file->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	Editors and deployment tools usually write a new file
+	 *	and rename it over the old one, so we watch for the
+	 *	file being deleted or renamed, too.
+	 */
+	memset(&funcs, 0, sizeof(funcs));
+	funcs.delete = reload_changed;
+	funcs.write = reload_changed;
+	funcs.extend = reload_changed;
+	funcs.attrib = reload_changed;
+	funcs.rename = reload_changed;
+
+	if (fr_event_filter_insert(file, rl->el, file->fd, FR_EVENT_FILTER_VNODE, &funcs, NULL, file) < 0) {
+		PERROR("Failed watching %s", file->filename);
+		close(file->fd);
+		file->fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** The files have stopped changing, go reload them
+ *
+ */
+static void reload_timer(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_reload_t		*rl = talloc_get_type_abort(uctx, fr_reload_t);
+	fr_reload_file_t	*file = NULL;
+	bool			missing = false;
+
+	/*
+	 *	The file may have been replaced, in which case we
+	 *	need to watch the new one.  Re-open everything before
+	 *	loading the data, so that we don't miss any changes
+	 *	made while we're loading.
+	 */
+	while ((file = fr_dlist_next(&rl->files, file))) {
+		reload_file_unwatch(file);
+		if (reload_file_watch(file) < 0) missing = true;
+	}
+
+	if (missing) {
+		WARN("Not reloading until all files are available");
+		goto retry;
+	}
+
+	INFO("Reloading");
+
+	if (reload_load(rl) < 0) {
+		PERROR("Failed reloading, continuing with previous data");
+		return;
+	}
+
+	INFO("Reload complete");
+	return;
+
+retry:
+	if (fr_event_timer_in(rl->el, rl->el, &rl->ev, rl->conf->delay, reload_timer, rl) < 0) {
+		PERROR("Failed inserting reload timer");
+	}
+}
+
+/** A file changed, wait for it to stop changing, then reload it
+ *
+ */
+static void reload_changed(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_reload_file_t	*file = talloc_get_type_abort(uctx, fr_reload_file_t);
+	fr_reload_t		*rl = file->rl;
+
+	DEBUG2("File %s changed", file->filename);
+
+	if (fr_event_timer_in(rl->el, rl->el, &rl->ev, rl->conf->delay, reload_timer, rl) < 0) {
+		PERROR("Failed inserting reload timer");
+	}
+}
+
+static void reload_signal(fr_event_list_t *el, int fd, UNUSED int flags, UNUSED void *uctx)
+{
+	uint8_t		buffer[8];
+
+	(void) read(fd, buffer, sizeof(buffer));
+
+	fr_event_loop_exit(el, 1);
+}
+
+static void *reload_thread(void *arg)
+{
+	fr_reload_t	*rl = talloc_get_type_abort(arg, fr_reload_t);
+
+	DEBUG2("Watching files for changes");
+
+	(void) fr_event_loop(rl->el);
+
+	return NULL;
+}
+
+static int _reload_free(fr_reload_t *rl)
+{
+	fr_reload_file_t *file = NULL;
+
+	if (rl->running) {
+		if (write(rl->signal_pipe[1], &(uint8_t){ 0x01 }, 1) < 0) {
+			ERROR("Failed signalling reload thread to exit: %s", fr_syserror(errno));
+		} else {
+			pthread_join(rl->pthread_id, NULL);
+		}
+		rl->running = false;
+	}
+
+	/*
+	 *	The timer and signal pipe events are parented by the
+	 *	event list, and are freed with it.
+	 */
+	if (rl->el) {
+		while ((file = fr_dlist_next(&rl->files, file))) reload_file_unwatch(file);
+		TALLOC_FREE(rl->el);
+	}
+
+	if (rl->signal_pipe[0] >= 0) close(rl->signal_pipe[0]);
+	if (rl->signal_pipe[1] >= 0) close(rl->signal_pipe[1]);
+
+	talloc_free(rl->current_ctx);
+	pthread_rwlock_destroy(&rl->overflow);
+
+	return 0;
+}
+
+/** Allocate a reloader, and load the initial copy of the data
+ *
+ * @param[in] ctx	to allocate the reloader in.
+ * @param[in] name	used in log messages, usually the module name.
+ * @param[in] conf	reload configuration.
+ * @param[in] load	callback to build the data.
+ * @param[in] uctx	passed to load.
+ * @return
+ *	- A new reloader on success.
+ *	- NULL if the data could not be loaded.
+ */
+fr_reload_t *fr_reload_alloc(TALLOC_CTX *ctx, char const *name, fr_reload_conf_t const *conf,
+			     fr_reload_load_t load, void *uctx)
+{
+	fr_reload_t	*rl;
+
+	MEM(rl = talloc_zero(ctx, fr_reload_t));
+	MEM(rl->name = talloc_typed_strdup(rl, name));
+	rl->conf = conf;
+	rl->loader = load;
+	rl->uctx = uctx;
+	rl->signal_pipe[0] = rl->signal_pipe[1] = -1;
+	atomic_init(&rl->current, 0);
+	atomic_init(&rl->epoch, 1);
+	fr_dlist_init(&rl->files, fr_reload_file_t, entry);
+
+	if (pthread_rwlock_init(&rl->overflow, NULL) != 0) {
+		fr_strerror_printf("Failed initialising lock: %s", fr_syserror(errno));
+		talloc_free(rl);
+		return NULL;
+	}
+	talloc_set_destructor(rl, _reload_free);
+
+	if (reload_load(rl) < 0) {
+		talloc_free(rl);
+		return NULL;
+	}
+
+	return rl;
+}
+
+/** Add a file to watch
+ *
+ * @param[in] rl	to reload when the file changes.
+ * @param[in] filename	to watch.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_reload_file_add(fr_reload_t *rl, char const *filename)
+{
+	fr_reload_file_t *file;
+
+	if (rl->running) {
+		fr_strerror_printf("Cannot add files after the reload thread has started");
+		return -1;
+	}
+
+	MEM(file = talloc_zero(rl, fr_reload_file_t));
+	MEM(file->filename = talloc_typed_strdup(file, filename));
+	file->rl = rl;
+	file->fd = -1;
+
+	fr_dlist_insert_tail(&rl->files, file);
+
+	return 0;
+}
+
+/** Start watching the files, if reloading is enabled
+ *
+ * @param[in] rl	to start.
+ * @return
+ *	- 0 on success, or if reloading is disabled.
+ *	- -1 on failure.
+ */
+int fr_reload_start(fr_reload_t *rl)
+{
+	fr_reload_file_t	*file = NULL;
+	int			ret;
+
+	if (!rl->conf->enable || rl->running) return 0;
+
+	rl->el = fr_event_list_alloc(rl, NULL, NULL);
+	if (!rl->el) return -1;
+
+	if (pipe(rl->signal_pipe) < 0) {
+		fr_strerror_printf("Failed opening signal pipe: %s", fr_syserror(errno));
+		return -1;
+	}
+	(void) fr_nonblock(rl->signal_pipe[0]);
+
+	if (fr_event_fd_insert(rl->el, rl->el, rl->signal_pipe[0], reload_signal, NULL, NULL, rl) < 0) return -1;
+
+	while ((file = fr_dlist_next(&rl->files, file))) {
+		if (reload_file_watch(file) < 0) return -1;
+	}
+
+	/*
+	 *	Set this before the thread starts, so that readers
+	 *	see it before any data is replaced.
+	 */
+	rl->running = true;
+
+	ret = pthread_create(&rl->pthread_id, NULL, reload_thread, rl);
+	if (ret != 0) {
+		rl->running = false;
+		fr_strerror_printf("Failed creating reload thread: %s", fr_syserror(ret));
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/lib/server/reload.h
+ * @brief Reload module data files in the background.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(server_reload_h, "$Id$")
+
+#include <freeradius-devel/server/cf_parse.h>
+#include <freeradius-devel/util/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_reload_s fr_reload_t;
+
+/** Configuration for background reloading
+ *
+ */
+typedef struct {
+	bool			enable;		//!< Watch the files, and reload them when they change.
+	fr_time_delta_t		delay;		//!< How long to wait after the last change
+						///< before reloading.
+} fr_reload_conf_t;
+
+extern CONF_PARSER const fr_reload_config[];
+
+/** Build a new copy of the data from the files
+ *
+ * May be called from the reload thread, so it must not touch any
+ * data which the workers modify.
+ *
+ * @param[in] ctx	to allocate the data in.  The data is freed by
+ *			freeing ctx, so any destructors should be
+ *			set on children of ctx.
+ * @param[in] uctx	passed to fr_reload_alloc().
+ * @return
+ *	- The new data on success.
+ *	- NULL on failure.  The previous data continues to be used.
+ */
+typedef void *(*fr_reload_load_t)(TALLOC_CTX *ctx, void *uctx);
+
+fr_reload_t	*fr_reload_alloc(TALLOC_CTX *ctx, char const *name, fr_reload_conf_t const *conf,
+				 fr_reload_load_t load, void *uctx) CC_HINT(nonnull(2,3,4));
+
+int		fr_reload_file_add(fr_reload_t *rl, char const *filename) CC_HINT(nonnull);
+
+int		fr_reload_start(fr_reload_t *rl) CC_HINT(nonnull);
+
+void		*fr_reload_enter(fr_reload_t *rl) CC_HINT(nonnull);
+
+void		fr_reload_leave(fr_reload_t *rl) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -34,6 +34,14 @@ RCSID("$Id$")
  */
 static _Thread_local fr_dlist_head_t *request_free_list; /* macro */
 
+/** Extra space to allocate in each request's pool
+ *
+ * Pairs, value buffers, xlat and tmpl expansions, and anything else
+ * allocated in the request's hierarchy comes out of this space before
+ * falling back to the heap.
+ */
+static _Thread_local size_t request_pool_size;
+
 /** Setup logging and other fields for a request
  *
  * @param[in] file		the request was allocated in.
@@ -208,6 +216,28 @@ static void _request_free_list_free_on_exit(void *arg)
 	talloc_free(list);
 }
 
+/** Set the size of the memory arena allocated with each new request in this thread
+ *
+ * Each REQUEST is a talloc pool.  Everything parented by the request
+ * is bump allocated out of it, and nothing in the pool is returned to
+ * the heap individually.  When the request is done, its children are
+ * freed, the pool resets, and the REQUEST goes back on this thread's
+ * free list to be reused.
+ *
+ * Anything which is moved out of the request with talloc_steal()
+ * keeps working as normal.  The pool just can't be reset until that
+ * chunk is freed, and allocations fall through to the heap until then.
+ *
+ * Only affects requests allocated after this call.
+ *
+ * @param[in] size	of the arena, in addition to the space
+ *			reserved for the interpreter stack and packets.
+ */
+void request_pool_size_set(size_t size)
+{
+	request_pool_size = size;
+}
+
 /** Create a new REQUEST data structure
  *
  */
@@ -246,7 +276,8 @@ REQUEST *_request_alloc(char const *file, int line, TALLOC_CTX *ctx)
 							10,				/* extra */
 							(UNLANG_FRAME_PRE_ALLOC * UNLANG_STACK_MAX) +	/* Stack memory */
 							(sizeof(RADIUS_PACKET) * 2) +	/* packets */
-							128				/* extra */
+							128 +				/* extra */
+							request_pool_size		/* pairs etc. */
 							));
 		talloc_set_destructor(request, _request_free);
 	} else {
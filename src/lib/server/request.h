@@ -179,6 +179,8 @@ struct fr_request_s {
 #define RAD_REQUEST_OPTION_CTX	(1 << 1)
 #define RAD_REQUEST_OPTION_DETAIL (1 << 2)
 
+void		request_pool_size_set(size_t size);
+
 #define		request_alloc(_ctx) _request_alloc( __FILE__, __LINE__, _ctx)
 REQUEST		*_request_alloc(char const *file, int line, TALLOC_CTX *ctx);
 
@@ -47,6 +47,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/metrics.h>
 #include <freeradius-devel/server/state.h>
 #include <freeradius-devel/util/debug.h>
 
@@ -55,6 +56,12 @@ RCSID("$Id$")
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 /** Holds a state value, and associated VALUE_PAIRs and data
  *
  */
@@ -112,28 +119,51 @@ typedef struct {
 	REQUEST			*thawed;			//!< The request that thawed this entry.
 } fr_state_entry_t;
 
+#define STATE_VALUE_LEN		sizeof(struct state_comp)
+
+/** An independently locked partition of the state tree
+ *
+ * Entries are assigned to a shard using one of the random bytes of
+ * their state value, so requests belonging to different authentication
+ * sessions rarely contend for the same mutex.
+ */
+typedef struct {
+	fr_state_tree_t		*state;				//!< Tree this shard belongs to.
+
+	rbtree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+} fr_state_shard_t;
+
 struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
-	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
+	atomic_uint_fast64_t	timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
+	atomic_uint_fast32_t	tracked;			//!< Number of entries across all shards.
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	rbtree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+
+	uint32_t		num_shards;			//!< Number of shards.
+	fr_state_shard_t	**shards;			//!< Each shard is allocated separately so the
+								//!< mutexes are unlikely to share a cache line.
 
 	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
 
-	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	bool			thread_safe;			//!< Whether we lock the shards whilst modifying them.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 
 	fr_dict_attr_t const	*da;				//!< State attribute used.
+
+	uint64_t		tree_id;			//!< Distinguishes trees in the metrics.
 };
 
+static atomic_uint_fast64_t state_tree_counter = ATOMIC_VAR_INIT(0);
+
 #define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_tree_t *state, fr_state_shard_t *shard, fr_state_entry_t *entry);
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -145,31 +175,51 @@ static int state_entry_cmp(void const *one, void const *two)
 	return memcmp(a->state, b->state, sizeof(a->state));
 }
 
-/** Free the state tree
+/** Free a shard, and any entries it contains
  *
  */
-static int _state_tree_free(fr_state_tree_t *state)
+static int _state_shard_free(fr_state_shard_t *shard)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	fr_state_tree_t		*state = shard->state;
+	fr_state_entry_t	*entry;
 
-	DEBUG4("Freeing state tree %p", state);
+	if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
+	while ((entry = fr_dlist_head(&shard->to_expire))) {
 		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
+		state_entry_unlink(state, shard, entry);
 		talloc_free(entry);
 	}
 
 	/*
 	 *	Free the rbtree
 	 */
-	talloc_free(state->tree);
+	talloc_free(shard->tree);
 
 	return 0;
 }
 
+/** Write the number of entries in a state tree
+ *
+ * The counters are atomic, so we don't need to lock any of the shards.
+ */
+static void state_tree_metrics(fr_metrics_t *m, void *uctx)
+{
+	fr_state_tree_t *state = talloc_get_type_abort(uctx, fr_state_tree_t);
+
+	fr_metrics_gauge(m, "freeradius_state_entries", "Entries in a state tree.",
+			 atomic_load_explicit(&state->tracked, memory_order_relaxed),
+			 "tree=\"%" PRIu64 "\"", state->tree_id);
+	fr_metrics_gauge(m, "freeradius_state_entries_max", "Entries a state tree is allowed to hold.",
+			 state->max_sessions, "tree=\"%" PRIu64 "\"", state->tree_id);
+	fr_metrics_counter(m, "freeradius_state_entries_created", "Entries a state tree has created.",
+			   atomic_load_explicit(&state->id, memory_order_relaxed),
+			   "tree=\"%" PRIu64 "\"", state->tree_id);
+	fr_metrics_counter(m, "freeradius_state_entries_timed_out", "Entries a state tree has expired.",
+			   atomic_load_explicit(&state->timed_out, memory_order_relaxed),
+			   "tree=\"%" PRIu64 "\"", state->tree_id);
+}
+
 /** Initialise a new state tree
  *
  * @param[in] ctx		to link the lifecycle of the state tree to.
@@ -178,20 +228,38 @@ static int _state_tree_free(fr_state_tree_t *state)
  * @param[in] max_sessions	we track state for.
  * @param[in] timeout		How long to wait before cleaning up entries.
  * @param[in] server_id		ID byte to use in load-balancing operations.
+ * @param[in] num_shards	Number of independently locked partitions to split
+ *				the tree into.  Ignored (and forced to 1) if
+ *				thread_safe is false.
  * @return
  *	- A new state tree.
  *	- NULL on failure.
  */
 fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
-				    uint32_t max_sessions, uint32_t timeout, uint8_t server_id)
+				    uint32_t max_sessions, uint32_t timeout, uint8_t server_id,
+				    uint32_t num_shards)
 {
 	fr_state_tree_t *state;
+	uint32_t	i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	state->thread_safe = thread_safe;
+
+	/*
+	 *	The shard is selected using a single
+	 *	byte of the state value.
+	 */
+	if (!thread_safe || (num_shards < 1)) num_shards = 1;
+	if (num_shards > UINT8_MAX + 1) num_shards = UINT8_MAX + 1;
+	state->num_shards = num_shards;
+
+	atomic_init(&state->id, 0);
+	atomic_init(&state->timed_out, 0);
+	atomic_init(&state->tracked, 0);
 
 	/*
 	 *	Create a break in the contexts.
@@ -202,50 +270,141 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
+	state->shards = talloc_zero_array(state, fr_state_shard_t *, num_shards);
+	if (!state->shards) {
+	error:
 		talloc_free(state);
 		return NULL;
 	}
 
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, list);
+	for (i = 0; i < num_shards; i++) {
+		fr_state_shard_t *shard;
 
-	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
-	 */
-	state->tree = rbtree_talloc_create(NULL, state_entry_cmp, fr_state_entry_t, NULL, 0);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+		shard = state->shards[i] = talloc_zero(state->shards, fr_state_shard_t);
+		if (!shard) goto error;
+		shard->state = state;
+
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(shard);
+			state->shards[i] = NULL;
+			goto error;
+		}
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, list);
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = rbtree_talloc_create(NULL, state_entry_cmp, fr_state_entry_t, NULL, 0);
+		talloc_set_destructor(shard, _state_shard_free);
+		if (!shard->tree) goto error;
 	}
-	talloc_set_destructor(state, _state_tree_free);
 
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
-	state->thread_safe = thread_safe;
+
+	state->tree_id = atomic_fetch_add_explicit(&state_tree_counter, 1, memory_order_relaxed);
+	if (!fr_metrics_source_add(state, state_tree_metrics, state)) goto error;
+
+	DEBUG4("State tree %p created with %u shard(s)", state, num_shards);
 
 	return state;
 }
 
+/** Return the shard responsible for a given state value
+ *
+ * Uses a byte of the state value which is random for states we generate,
+ * and isn't modified by the virtual server hash.
+ */
+static inline CC_HINT(always_inline) fr_state_shard_t *state_shard(fr_state_tree_t *state,
+								   uint8_t const state_value[])
+{
+	return state->shards[state_value[offsetof(struct state_comp, r_5)] % state->num_shards];
+}
+
 /** Unlink an entry and remove if from the tree
  *
  */
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+static void state_entry_unlink(fr_state_tree_t *state, fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
+	fr_dlist_remove(&shard->to_expire, entry);
 
-	rbtree_deletebydata(state->tree, entry);
+	if (rbtree_deletebydata(shard->tree, entry)) {
+		atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+	}
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
 
+/** Unlink any entries in a shard which have timed out
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @param[in] state	tree the shard belongs to.
+ * @param[in] shard	to clean up.
+ * @param[in] now	current time.
+ * @param[in] skip	entry that must not be removed.
+ * @param[out] to_free	list to add the unlinked entries to.
+ * @return the number of entries unlinked.
+ */
+static uint64_t state_shard_expire(fr_state_tree_t *state, fr_state_shard_t *shard, time_t now,
+				   fr_state_entry_t *skip, fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t	*entry, *next;
+	uint64_t		timed_out = 0;
+
+	for (entry = fr_dlist_head(&shard->to_expire);
+	     entry != NULL;
+	     entry = next) {
+		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
+		next = fr_dlist_next(&shard->to_expire, entry);		/* Advance *before* potential unlinking */
+
+		if (entry == skip) continue;
+
+		/*
+		 *	Too old, we can delete it.
+		 */
+		if (entry->cleanup < now) {
+			state_entry_unlink(state, shard, entry);
+			fr_dlist_insert_tail(to_free, entry);
+			timed_out++;
+			continue;
+		}
+
+		break;
+	}
+
+	if (timed_out) atomic_fetch_add_explicit(&state->timed_out, timed_out, memory_order_relaxed);
+
+	return timed_out;
+}
+
+/** Free entries previously unlinked from a shard
+ *
+ * We do it outside of the mutex as freeing may involve significantly more
+ * work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed also,
+ * and it may have complex destructors associated with it.
+ */
+static void state_entry_list_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t *entry;
+
+	while ((entry = fr_dlist_head(to_free)) != NULL) {
+		fr_dlist_remove(to_free, entry);
+		talloc_free(entry);
+	}
+}
+
 /** Frees any data associated with a state
  *
  */
@@ -284,23 +443,40 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	return 0;
 }
 
-/** Create a new state entry
+/** Create a new state entry and insert it into the tree
+ *
+ * The session-state list, state_ctx and persistable request data are moved
+ * into the new entry before it's inserted, so that the entry is complete by
+ * the time other threads are able to find it.
  *
- * @note Called with the mutex held.
+ * @note Called with the mutex of old_shard held (if not NULL).  Returns with
+ *	no mutexes held.
+ *
+ * @param[in] state	tree to insert the entry into.
+ * @param[in] request	the state belongs to.
+ * @param[in] packet	to add the State attribute to.
+ * @param[in] old_shard	shard which was searched for the State the request
+ *			arrived with, or NULL if it didn't have a State attribute.
+ * @param[in] old	entry, found in old_shard.  May be NULL.
+ * @param[in] data	Persistable request data to move into the entry.
+ * @return
+ *	- The new entry.
+ *	- NULL on failure, in which case the contents of data, and the
+ *	  session-state list are unchanged.
  */
-static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request,
-					    RADIUS_PACKET *packet, fr_state_entry_t *old)
+static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet,
+					    fr_state_shard_t *old_shard, fr_state_entry_t *old, fr_dlist_head_t *data)
 {
 	size_t			i;
 	uint32_t		x;
 	time_t			now = time(NULL);
 	VALUE_PAIR		*vp;
-	fr_state_entry_t	*entry, *next;
+	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 
 	uint8_t			old_state[sizeof(old->state)];
 	int			old_tries = 0;
 	uint64_t		timed_out = 0;
-	bool			too_many = false;
 	fr_dlist_head_t		to_free;
 
 	fr_dlist_init(&to_free, fr_state_entry_t, list);
@@ -308,79 +484,50 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	/*
 	 *	Clean up old entries.
 	 */
-	for (entry = fr_dlist_head(&state->to_expire);
-	     entry != NULL;
-	     entry = next) {
-		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
-
-		if (entry == old) continue;
+	if (old_shard) {
+		timed_out = state_shard_expire(state, old_shard, now, old, &to_free);
 
 		/*
-		 *	Too old, we can delete it.
+		 *	Record the information from the old state, we may base the
+		 *	new state off the old one.
+		 *
+		 *	Once we release the mutex, the state of old becomes indeterminate
+		 *	so we have to grab the values now.
 		 */
-		if (entry->cleanup < now) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
-
-		break;
-	}
-
-	state->timed_out += timed_out;
-
-	if (!old && (rbtree_num_elements(state->tree) >= (uint32_t) state->max_sessions)) too_many = true;
-
-	/*
-	 *	Record the information from the old state, we may base the
-	 *	new state off the old one.
-	 *
-	 *	Once we release the mutex, the state of old becomes indeterminate
-	 *	so we have to grab the values now.
-	 */
-	if (old) {
-		old_tries = old->tries;
+		if (old) {
+			old_tries = old->tries;
 
-		memcpy(old_state, old->state, sizeof(old_state));
+			memcpy(old_state, old->state, sizeof(old_state));
 
-		/*
-		 *	The old one isn't used any more, so we can free it.
-		 */
-		if (fr_dlist_empty(&old->data)) {
-			state_entry_unlink(state, old);
-			fr_dlist_insert_tail(&to_free, old);
+			/*
+			 *	The old one isn't used any more, so we can free it.
+			 */
+			if (fr_dlist_empty(&old->data)) {
+				state_entry_unlink(state, old_shard, old);
+				fr_dlist_insert_tail(&to_free, old);
+			}
 		}
+		PTHREAD_MUTEX_UNLOCK(&old_shard->mutex);
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
 
 	/*
 	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
 	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
+	state_entry_list_free(&to_free);
 
 	/*
 	 *	Have to do this post-cleanup, else we end up returning with
 	 *	a list full of entries to free with none of them being
 	 *	freed which is bad...
+	 *
+	 *	The count may be slightly stale, as other threads could
+	 *	be inserting into other shards, but that's fine.
 	 */
-	if (too_many) {
+	if (!old && (atomic_load_explicit(&state->tracked, memory_order_relaxed) >= state->max_sessions)) {
 		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
 		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
 		return NULL;
 	}
 
@@ -389,14 +536,11 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 *	and would add significantly to contention.
 	 */
 	entry = talloc_zero(NULL, fr_state_entry_t);
-	if (!entry) {
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
+	if (!entry) return NULL;
 
 	request_data_list_init(&entry->data);
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -483,8 +627,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	DEBUG4("State ID %" PRIu64 " created, value 0x%pH, expires %" PRIu64 "s",
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)), (uint64_t)entry->cleanup - now);
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -493,57 +635,114 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 */
 	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	if (!rbtree_insert(state->tree, entry)) {
+	/*
+	 *	Give the entry ownership of the session-state
+	 *	list and persistable request data.
+	 */
+	entry->seq_start = request->seq_start;
+	entry->ctx = request->state_ctx;
+	entry->vps = request->state;
+	fr_dlist_move(&entry->data, data);
+
+	shard = state_shard(state, entry->state);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+
+	/*
+	 *	If the request didn't continue an existing
+	 *	session, no shard has been cleaned up yet.
+	 */
+	if (!old_shard) timed_out = state_shard_expire(state, shard, now, NULL, &to_free);
+
+	if (!rbtree_insert(shard->tree, entry)) {
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
 		RERROR("Failed inserting state entry - Insertion into state tree failed");
 		fr_pair_delete_by_da(&packet->vps, state->da);
+
+		/*
+		 *	Give everything back to the request
+		 */
+		fr_dlist_move(data, &entry->data);
+		entry->ctx = NULL;
+		entry->vps = NULL;
 		talloc_free(entry);
+
+		state_entry_list_free(&to_free);
 		return NULL;
 	}
+	atomic_fetch_add_explicit(&state->tracked, 1, memory_order_relaxed);
 
 	/*
 	 *	Link it to the end of the list, which is implicitely
 	 *	ordered by cleanup time.
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	fr_dlist_insert_tail(&shard->to_expire, entry);
+
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	request->state_ctx = NULL;
+	request->state = NULL;
+
+	if (!old_shard && (timed_out > 0)) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	state_entry_list_free(&to_free);
 
 	return entry;
 }
 
-/** Find the entry, based on the State attribute
+/** Convert a State value into the form used as the key in the state tree
  *
+ * @param[out] out	Where to write the normalised state value.
+ * @param[in] vb	containing the State value.
  */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *request, fr_value_box_t const *vb)
+static void state_value_normalise(uint8_t out[STATE_VALUE_LEN], fr_value_box_t const *vb)
 {
-	fr_state_entry_t *entry, my_entry;
-
 	/*
 	 *	Assume our own State first.
 	 */
-	if (vb->vb_length == sizeof(my_entry.state)) {
-		memcpy(my_entry.state, vb->vb_octets, sizeof(my_entry.state));
+	if (vb->vb_length == STATE_VALUE_LEN) {
+		memcpy(out, vb->vb_octets, STATE_VALUE_LEN);
 
 		/*
 		 *	Too big?  Get the MD5 hash, in order
 		 *	to depend on the entire contents of State.
 		 */
-	} else if (vb->vb_length > sizeof(my_entry.state)) {
-		fr_md5_calc(my_entry.state, vb->vb_octets, vb->vb_length);
+	} else if (vb->vb_length > STATE_VALUE_LEN) {
+		fr_md5_calc(out, vb->vb_octets, vb->vb_length);
 
 		/*
 		 *	Too small?  Use the whole thing, and
 		 *	set the rest of my_entry.state to zero.
 		 */
 	} else {
-		memcpy(my_entry.state, vb->vb_octets, vb->vb_length);
-		memset(&my_entry.state[vb->vb_length], 0, sizeof(my_entry.state) - vb->vb_length);
+		memcpy(out, vb->vb_octets, vb->vb_length);
+		memset(&out[vb->vb_length], 0, STATE_VALUE_LEN - vb->vb_length);
 	}
+}
+
+/** Find the entry, based on the State attribute
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @param[in] shard	the state value belongs to.  Must be the one
+ *			returned by #state_shard for state_value.
+ * @param[in] request	The current request.
+ * @param[in] state_value	Normalised state value as produced by
+ *				#state_value_normalise.
+ */
+static fr_state_entry_t *state_entry_find(fr_state_shard_t *shard, REQUEST *request,
+					  uint8_t const state_value[STATE_VALUE_LEN])
+{
+	fr_state_entry_t *entry, my_entry;
+
+	memcpy(my_entry.state, state_value, sizeof(my_entry.state));
 
 	/*
 	 *	Make it unique for different virtual servers handling the same request
 	 */
 	my_entry.state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	entry = rbtree_finddata(state->tree, &my_entry);
+	entry = rbtree_finddata(shard->tree, &my_entry);
 
 	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
 
@@ -556,19 +755,24 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *reque
 void fr_state_discard(fr_state_tree_t *state, REQUEST *request)
 {
 	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 	VALUE_PAIR		*vp;
+	uint8_t			state_value[STATE_VALUE_LEN];
 
 	vp = fr_pair_find_by_da(request->packet->vps, state->da, TAG_ANY);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	state_value_normalise(state_value, &vp->data);
+	shard = state_shard(state, state_value);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = state_entry_find(shard, request, state_value);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 		return;
 	}
-	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_entry_unlink(state, shard, entry);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -606,8 +810,10 @@ void fr_state_discard(fr_state_tree_t *state, REQUEST *request)
 void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 {
 	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 	TALLOC_CTX		*old_ctx = NULL;
 	VALUE_PAIR		*vp;
+	uint8_t			state_value[STATE_VALUE_LEN];
 
 	fr_assert(request->state == NULL);
 
@@ -621,13 +827,16 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	state_value_normalise(state_value, &vp->data);
+	shard = state_shard(state, state_value);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = state_entry_find(shard, request, state_value);
 	if (entry) {
 		(void)talloc_get_type_abort(entry, fr_state_entry_t);
 		if (entry->thawed) {
 			REDEBUG("State entry has already been thawed by a request %"PRIu64, entry->thawed->number);
-			PTHREAD_MUTEX_UNLOCK(&state->mutex);
+			PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 			return;
 		}
 		if (request->state_ctx) old_ctx = request->state_ctx;	/* Store for later freeing */
@@ -643,7 +852,7 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 		entry->vps = NULL;
 		entry->thawed = request;
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	if (request->state) {
 		RDEBUG2("Restored &session-state");
@@ -672,8 +881,10 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 {
 	fr_state_entry_t	*entry, *old = NULL;
+	fr_state_shard_t	*shard = NULL;
 	fr_dlist_head_t		data;
 	VALUE_PAIR		*vp;
+	uint8_t			state_value[STATE_VALUE_LEN];
 
 	request_data_list_init(&data);
 	request_data_by_persistance(&data, request, true);
@@ -685,32 +896,27 @@ int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 		log_request_pair_list(L_DBG_LVL_2, request, request->state, "&session-state:");
 	}
 
+	fr_assert(request->state_ctx);
+
 	vp = fr_pair_find_by_da(request->packet->vps, state->da, TAG_ANY);
+	if (vp) {
+		state_value_normalise(state_value, &vp->data);
+		shard = state_shard(state, state_value);
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (vp) old = state_entry_find(state, request, &vp->data);
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		old = state_entry_find(shard, request, state_value);
+	}
 
-	entry = state_entry_create(state, request, request->reply, old);
+	/*
+	 *	Releases the shard mutex
+	 */
+	entry = state_entry_create(state, request, request->reply, shard, old, &data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RERROR("Creating state entry failed");
 		request_data_restore(request, &data);	/* Put it back again */
 		return -1;
 	}
 
-	fr_assert(entry->ctx == NULL);
-	fr_assert(request->state_ctx);
-
-	entry->seq_start = request->seq_start;
-	entry->ctx = request->state_ctx;
-	entry->vps = request->state;
-	fr_dlist_move(&entry->data, &data);
-
-	request->state_ctx = NULL;
-	request->state = NULL;
-
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
 	RDEBUG3("RADIUS State - saved");
 	REQUEST_VERIFY(request);
 
@@ -849,7 +1055,7 @@ void fr_state_detach(REQUEST *request, bool will_free)
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -857,7 +1063,7 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	return atomic_load_explicit(&state->timed_out, memory_order_relaxed);
 }
 
 /** Return number of entries we're currently tracking
@@ -865,5 +1071,5 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return (uint32_t)rbtree_num_elements(state->tree);
+	return atomic_load_explicit(&state->tracked, memory_order_relaxed);
 }
@@ -38,6 +38,7 @@ typedef struct fr_trunk_s fr_trunk_t;
 #include <freeradius-devel/server/trunk.h>
 
 #include <freeradius-devel/server/connection.h>
+#include <freeradius-devel/server/metrics.h>
 #include <freeradius-devel/server/trigger.h>
 #include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/misc.h>
@@ -51,6 +52,7 @@ typedef struct fr_trunk_s fr_trunk_t;
 #endif
 
 static atomic_uint_fast64_t request_counter = ATOMIC_VAR_INIT(1);
+static atomic_uint_fast64_t trunk_counter = ATOMIC_VAR_INIT(0);
 
 #ifdef TESTING_TRUNK
 static fr_time_t test_time_base = 1;
@@ -267,6 +269,10 @@ struct fr_trunk_s {
 	bool			managing_connections;	//!< Whether the trunk is allowed to manage
 							///< (open/close) connections.
 	/** @} */
+
+	uint64_t		id;			//!< Distinguishes trunks with the same log_prefix
+							///< in the metrics.
+	fr_metrics_source_t	*metrics;		//!< Freed before anything else in the trunk.
 };
 
 static CONF_PARSER const fr_trunk_config_request[] = {
@@ -4397,6 +4403,13 @@ static int _trunk_free(fr_trunk_t *trunk)
 
 	DEBUG4("Trunk free %p", trunk);
 
+	/*
+	 *	Stop the metrics being read from
+	 *	another thread while we tear down
+	 *	the lists.
+	 */
+	TALLOC_FREE(trunk->metrics);
+
 	trunk->freeing = true;	/* Prevent re-enqueuing */
 
 	/*
@@ -4439,6 +4452,38 @@ static int _trunk_free(fr_trunk_t *trunk)
 	return 0;
 }
 
+/** Write the number of connections in each state, and the size of the backlog
+ *
+ * Called from whichever thread is scraping the metrics.  Only the
+ * sizes of the lists are read, the lists themselves aren't walked.
+ */
+static void trunk_metrics(fr_metrics_t *m, void *uctx)
+{
+	fr_trunk_t	*trunk = talloc_get_type_abort(uctx, fr_trunk_t);
+	char const	*name = fr_metrics_label_escape(m, trunk->log_prefix);
+	size_t		i;
+
+	for (i = 0; i < fr_trunk_connection_states_len; i++) {
+		int state = fr_trunk_connection_states[i].value;
+
+		if (state == FR_TRUNK_CONN_HALTED) continue;
+
+		fr_metrics_gauge(m, "freeradius_trunk_connections", "Connections in a trunk, by state.",
+				 fr_trunk_connection_count_by_state(trunk, state),
+				 "trunk=\"%s\",id=\"%" PRIu64 "\",state=\"%s\"",
+				 name, trunk->id, fr_trunk_connection_states[i].name);
+	}
+
+	fr_metrics_gauge(m, "freeradius_trunk_requests", "Requests allocated from a trunk, and not yet freed.",
+			 trunk->pub.req_alloc, "trunk=\"%s\",id=\"%" PRIu64 "\"", name, trunk->id);
+	fr_metrics_counter(m, "freeradius_trunk_requests_created", "Requests a trunk has allocated memory for.",
+			   trunk->pub.req_alloc_new, "trunk=\"%s\",id=\"%" PRIu64 "\"", name, trunk->id);
+	fr_metrics_counter(m, "freeradius_trunk_requests_reused", "Requests a trunk has reused from its free list.",
+			   trunk->pub.req_alloc_reused, "trunk=\"%s\",id=\"%" PRIu64 "\"", name, trunk->id);
+	fr_metrics_gauge(m, "freeradius_trunk_backlog", "Requests waiting for a trunk connection.",
+			 fr_heap_num_elements(trunk->backlog), "trunk=\"%s\",id=\"%" PRIu64 "\"", name, trunk->id);
+}
+
 /** Allocate a new collection of connections
  *
  * This function should be called first to allocate a new trunk connection.
@@ -4517,6 +4562,9 @@ fr_trunk_t *fr_trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
 	fr_dlist_talloc_init(&trunk->draining_to_free, fr_trunk_connection_t, entry);
 	fr_dlist_talloc_init(&trunk->to_free, fr_trunk_connection_t, entry);
 
+	trunk->id = atomic_fetch_add_explicit(&trunk_counter, 1, memory_order_relaxed);
+	MEM(trunk->metrics = fr_metrics_source_add(trunk, trunk_metrics, trunk));
+
 	DEBUG4("Trunk allocated %p", trunk);
 
 	if (!delay_start) {
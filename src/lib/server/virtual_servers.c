@@ -377,6 +377,15 @@ static int cmd_show_server_list(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx,
 	return 0;
 }
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+static int cmd_show_server_latency(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	unlang_interpret_latency_fprint(fp);
+
+	return 0;
+}
+#endif
+
 static fr_cmd_table_t cmd_table[] = {
 	{
 		.parent = "show",
@@ -393,6 +402,16 @@ static fr_cmd_table_t cmd_table[] = {
 		.read_only = true,
 	},
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+	{
+		.parent = "show server",
+		.name = "latency",
+		.func = cmd_show_server_latency,
+		.help = "Show the latency of each processing section, across all workers.",
+		.read_only = true,
+	},
+#endif
+
 	CMD_TABLE_END
 
 };
@@ -99,4 +99,5 @@ void unlang_free(void)
 {
 	unlang_foreach_free();
 	unlang_subrequest_op_free();
+	unlang_interpret_free();
 }
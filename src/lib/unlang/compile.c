@@ -2628,6 +2628,7 @@ static unlang_t *compile_if_subsection(unlang_t *parent, unlang_compile_t *unlan
 	 *	them up.
 	 */
 	if (!fr_cond_walk(cond, pass2_cond_callback, unlang_ctx)) return NULL;
+	fr_cond_optimise(cond);
 
 	c = compile_section(parent, unlang_ctx, cs, mod_type);
 	if (!c) return NULL;
@@ -3658,6 +3659,150 @@ fail:
 	return NULL;
 }
 
+/** Add an operation to a flattened list of instructions
+ *
+ * @return the index of the operation.
+ */
+static unsigned int flat_op_add(unlang_flat_t *flat, unlang_flat_opcode_t opcode, unlang_t *instruction)
+{
+	unsigned int i = flat->num_ops++;
+
+	if (flat->num_ops > talloc_array_length(flat->ops)) {
+		MEM(flat->ops = talloc_realloc(flat, flat->ops, unlang_flat_op_t, flat->num_ops * 2));
+	}
+
+	flat->ops[i] = (unlang_flat_op_t) {
+		.opcode = opcode,
+		.instruction = instruction,
+		.next = i + 1
+	};
+
+	return i;
+}
+
+/** Point the "leave" operations of a chain of if / elsif sections past its end
+ *
+ * The operations waiting to be patched are linked through their "next" field.
+ */
+static void flat_chain_end(unlang_flat_t *flat, unsigned int *pending)
+{
+	unsigned int i, next;
+
+	for (i = *pending; i != 0; i = next) {
+		next = flat->ops[i].next;
+		flat->ops[i].next = flat->num_ops;
+	}
+
+	*pending = 0;
+}
+
+/** Whether an instruction's children can be written inline into its parent's flattened instructions
+ *
+ */
+static bool flat_inline(unlang_t *c)
+{
+	switch (c->type) {
+#ifdef WITH_UNLANG
+	case UNLANG_TYPE_IF:
+	case UNLANG_TYPE_ELSIF:
+		return true;
+
+	case UNLANG_TYPE_ELSE:
+#endif
+	case UNLANG_TYPE_GROUP:
+		/*
+		 *	Empty groups are run by unlang_group(),
+		 *	which ignores them.
+		 */
+		return (unlang_generic_to_group(c)->children != NULL);
+
+	default:
+		return false;
+	}
+}
+
+static void unlang_flatten(unlang_t *c);
+
+/** Write the children of a group as flattened instructions
+ *
+ */
+static void flat_children(unlang_flat_t *flat, unlang_group_t *g)
+{
+	unlang_t	*c;
+	unsigned int	start, leave, pending = 0;
+
+	for (c = g->children; c != NULL; c = c->next) {
+		/*
+		 *	This is past the end of any chain of if /
+		 *	elsif / else sections.
+		 */
+		if ((c->type != UNLANG_TYPE_ELSIF) && (c->type != UNLANG_TYPE_ELSE)) flat_chain_end(flat, &pending);
+
+		if (!flat_inline(c)) {
+			(void) flat_op_add(flat, UNLANG_FLAT_EXEC, c);
+			unlang_flatten(c);
+			continue;
+		}
+
+		start = flat_op_add(flat, ((c->type == UNLANG_TYPE_IF) || (c->type == UNLANG_TYPE_ELSIF)) ?
+				    UNLANG_FLAT_IF : UNLANG_FLAT_ENTER, c);
+		flat_children(flat, unlang_generic_to_group(c));
+		leave = flat_op_add(flat, UNLANG_FLAT_LEAVE, c);
+
+		flat->ops[start].leave = leave;
+		flat->ops[start].next = leave + 1;
+
+		/*
+		 *	An if / elsif which was true skips the
+		 *	following else / elsif sections.  Where they
+		 *	end isn't known yet.
+		 */
+		if ((flat->ops[start].opcode == UNLANG_FLAT_IF) && c->next &&
+		    ((c->next->type == UNLANG_TYPE_ELSIF) || (c->next->type == UNLANG_TYPE_ELSE))) {
+			flat->ops[leave].next = pending;
+			pending = leave;
+		}
+	}
+
+	flat_chain_end(flat, &pending);
+}
+
+/** Flatten the children of a group, and of any groups beneath it
+ *
+ * Only the children of groups run by unlang_group() are flattened.
+ * Other keywords run their children as a list, so groups beneath
+ * them are flattened individually.
+ */
+static void unlang_flatten(unlang_t *c)
+{
+	unlang_group_t	*g;
+	unlang_t	*child;
+
+	if ((c->type < UNLANG_TYPE_GROUP) || (c->type > UNLANG_TYPE_POLICY)) return;
+
+	g = unlang_generic_to_group(c);
+	if (!g->children) return;
+
+	switch (c->type) {
+	case UNLANG_TYPE_GROUP:
+	case UNLANG_TYPE_REDUNDANT:
+	case UNLANG_TYPE_POLICY:
+#ifdef WITH_UNLANG
+	case UNLANG_TYPE_IF:
+	case UNLANG_TYPE_ELSIF:
+	case UNLANG_TYPE_ELSE:
+	case UNLANG_TYPE_CASE:
+#endif
+		MEM(g->flat = talloc_zero(g, unlang_flat_t));
+		flat_children(g->flat, g);
+		break;
+
+	default:
+		for (child = g->children; child != NULL; child = child->next) unlang_flatten(child);
+		break;
+	}
+}
+
 int unlang_compile(CONF_SECTION *cs, rlm_components_t component, vp_tmpl_rules_t const *rules, void **instruction)
 {
 	unlang_t		*c;
@@ -3703,12 +3848,22 @@ int unlang_compile(CONF_SECTION *cs, rlm_components_t component, vp_tmpl_rules_t
 
 	if (DEBUG_ENABLED4) unlang_dump(c, 2);
 
+	/*
+	 *	Groups, and if / else sections, are run without
+	 *	pushing a stack frame for each.
+	 */
+	unlang_flatten(c);
+
 	/*
 	 *	Associate the unlang with the configuration section.
 	 */
 	cf_data_add(cs, c, NULL, false);
 	if (instruction) *instruction = c;
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+	unlang_generic_to_group(c)->latency_id = unlang_interpret_latency_register(cs);
+#endif
+
 	dump_tree(c, c->debug_name);
 	return 0;
 }
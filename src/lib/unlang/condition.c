@@ -27,18 +27,21 @@ RCSID("$Id$")
 #include "unlang_priv.h"
 #include "group_priv.h"
 
-static unlang_action_t unlang_if(REQUEST *request, rlm_rcode_t *presult)
+/** Evaluate the condition of an if / elsif section
+ *
+ * @param[in] request	The current request.
+ * @param[in] rcode	The current result, for conditions which check it.
+ * @param[in] g		The if / elsif section.
+ * @return whether the condition is true.  Conditions which fail to
+ *	evaluate are false.
+ */
+bool unlang_condition_eval(REQUEST *request, rlm_rcode_t rcode, unlang_group_t const *g)
 {
 	int			condition;
-	unlang_stack_t		*stack = request->stack;
-	unlang_stack_frame_t	*frame = &stack->frame[stack->depth];
-	unlang_t		*instruction = frame->instruction;
-	unlang_group_t		*g;
 
-	g = unlang_generic_to_group(instruction);
 	fr_assert(g->cond != NULL);
 
-	condition = cond_eval(request, *presult, 0, g->cond);
+	condition = cond_eval(request, rcode, 0, g->cond);
 	if (condition < 0) {
 		switch (condition) {
 		case -2:
@@ -54,10 +57,19 @@ static unlang_action_t unlang_if(REQUEST *request, rlm_rcode_t *presult)
 		condition = 0;
 	}
 
+	return (condition != 0);
+}
+
+static unlang_action_t unlang_if(REQUEST *request, rlm_rcode_t *presult)
+{
+	unlang_stack_t		*stack = request->stack;
+	unlang_stack_frame_t	*frame = &stack->frame[stack->depth];
+	unlang_t		*instruction = frame->instruction;
+
 	/*
 	 *	Didn't pass.  Remember that.
 	 */
-	if (!condition) {
+	if (!unlang_condition_eval(request, *presult, unlang_generic_to_group(instruction))) {
 		RDEBUG2("...");
 		return UNLANG_ACTION_EXECUTE_NEXT;
 	}
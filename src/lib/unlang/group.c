@@ -46,6 +46,11 @@ unlang_action_t unlang_group(REQUEST *request, UNUSED rlm_rcode_t *result)
 		return UNLANG_ACTION_EXECUTE_NEXT;
 	}
 
+	if (g->flat) {
+		unlang_interpret_push_flat(request, g->flat, frame->result);
+		return UNLANG_ACTION_PUSHED_CHILD;
+	}
+
 	unlang_interpret_push(request, g->children, frame->result, UNLANG_NEXT_SIBLING, UNLANG_SUB_FRAME);
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
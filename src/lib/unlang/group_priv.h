@@ -31,6 +31,8 @@ extern "C" {
 
 unlang_action_t unlang_group(REQUEST *request, UNUSED rlm_rcode_t *result);
 
+bool unlang_condition_eval(REQUEST *request, rlm_rcode_t rcode, unlang_group_t const *g);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,9 +27,12 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/cond.h>
+#include <freeradius-devel/server/metrics.h>
 #include <freeradius-devel/unlang/xlat.h>
+#include <freeradius-devel/util/thread_local.h>
 
 #include "unlang_priv.h"
+#include "group_priv.h"
 #include "parallel_priv.h"
 #include "module_priv.h"
 
@@ -50,6 +53,119 @@ static fr_table_num_ordered_t const unlang_frame_action_table[] = {
 };
 static size_t unlang_frame_action_table_len = NUM_ELEMENTS(unlang_frame_action_table);
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+/** Latency of a section compiled by unlang_compile()
+ *
+ */
+typedef struct {
+	char const		*name;		//!< server.name1.name2, as printed by radmin.
+	fr_hist_group_t		*group;		//!< Per-thread histograms.
+} unlang_latency_t;
+
+/*
+ *	Sections are compiled before the workers start, so this
+ *	array doesn't change while the workers are reading it.
+ */
+static unlang_latency_t		*unlang_latency;		//!< Indexed by latency_id - 1.
+static _Thread_local fr_hist_t	**unlang_latency_thread;	//!< Indexed by latency_id - 1.
+static fr_metrics_source_t	*unlang_latency_metrics;
+
+/** Register a section, so that the time taken to run it is recorded
+ *
+ * @param[in] cs	which has been compiled.
+ * @return the latency_id for the section's #unlang_group_t.
+ */
+unsigned int unlang_interpret_latency_register(CONF_SECTION *cs)
+{
+	size_t			num = unlang_latency ? talloc_array_length(unlang_latency) : 0;
+	unlang_latency_t	*sl;
+	CONF_ITEM		*parent = cf_parent(cs);
+	char const		*server = NULL, *name2 = cf_section_name2(cs);
+
+	if (parent) {
+		CONF_SECTION *parent_cs = cf_item_to_section(parent);
+
+		server = cf_section_name2(parent_cs);
+		if (!server) server = cf_section_name1(parent_cs);
+	}
+
+	MEM(unlang_latency = talloc_realloc(NULL, unlang_latency, unlang_latency_t, num + 1));
+	sl = &unlang_latency[num];
+
+	MEM(sl->name = talloc_typed_asprintf(unlang_latency, "%s%s%s%s%s",
+					     server ? server : "", server ? "." : "",
+					     cf_section_name1(cs), name2 ? "." : "", name2 ? name2 : ""));
+	MEM(sl->group = fr_hist_group_alloc(unlang_latency));
+
+	return num + 1;
+}
+
+static void _unlang_latency_thread_free(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Return this thread's histogram for a section
+ *
+ */
+static inline fr_hist_t *unlang_latency_thread_hist(unsigned int latency_id)
+{
+	fr_hist_t **array = unlang_latency_thread;
+
+	if (unlikely(!array)) {
+		MEM(array = talloc_zero_array(NULL, fr_hist_t *, talloc_array_length(unlang_latency)));
+		fr_thread_local_set_destructor(unlang_latency_thread, _unlang_latency_thread_free, array);
+	}
+
+	/*
+	 *	Compiled after this thread started.
+	 */
+	if (unlikely(latency_id > talloc_array_length(array))) return NULL;
+
+	if (unlikely(!array[latency_id - 1])) {
+		MEM(array[latency_id - 1] = fr_hist_group_thread_alloc(array, unlang_latency[latency_id - 1].group));
+	}
+
+	return array[latency_id - 1];
+}
+
+/** Print the latency of each section, merged across all threads
+ *
+ * @param[in] fp	to write to.
+ */
+void unlang_interpret_latency_fprint(FILE *fp)
+{
+	size_t i, num = unlang_latency ? talloc_array_length(unlang_latency) : 0;
+
+	for (i = 0; i < num; i++) {
+		fr_hist_t *hist;
+
+		MEM(hist = fr_hist_alloc(NULL));
+		fr_hist_group_merge(hist, unlang_latency[i].group);
+		fr_hist_fprint(fp, unlang_latency[i].name, hist);
+		talloc_free(hist);
+	}
+}
+
+/** Write the latency of each section, merged across all threads
+ *
+ */
+static void unlang_interpret_latency_metrics(fr_metrics_t *m, UNUSED void *uctx)
+{
+	size_t i, num = unlang_latency ? talloc_array_length(unlang_latency) : 0;
+
+	for (i = 0; i < num; i++) {
+		fr_hist_t *hist;
+
+		MEM(hist = fr_hist_alloc(NULL));
+		fr_hist_group_merge(hist, unlang_latency[i].group);
+		fr_metrics_summary(m, "freeradius_section_latency_seconds", "Time taken to run a virtual server section.",
+				   hist, "section=\"%s\"", fr_metrics_label_escape(m, unlang_latency[i].name));
+		talloc_free(hist);
+	}
+}
+#endif
+
 #ifndef NDEBUG
 static void instruction_dump(REQUEST *request, unlang_t const *instruction)
 {
@@ -80,6 +196,8 @@ static void frame_dump(REQUEST *request, unlang_stack_frame_t *frame)
 	} else {
 		RDEBUG2("next           <none>");
 	}
+	if (frame->flat) RDEBUG2("pc             %u of %u", frame->pc, frame->flat->num_ops);
+	RDEBUG2("level_base     %i", frame->level_base);
 	RDEBUG2("result         %s", fr_table_str_by_value(mod_rcode_table, frame->result, "<invalid>"));
 	RDEBUG2("priority       %d", frame->priority);
 	RDEBUG2("top_frame      %s", is_top_frame(frame) ? "yes" : "no");
@@ -95,7 +213,8 @@ static void stack_dump(REQUEST *request)
 	int i;
 	unlang_stack_t *stack = request->stack;
 
-	RDEBUG2("----- Begin stack debug [depth %i, unwind %i] -----", stack->depth, stack->unwind);
+	RDEBUG2("----- Begin stack debug [depth %i, levels %i, unwind %i] -----",
+		stack->depth, stack->levels, stack->unwind);
 	for (i = stack->depth; i >= 0; i--) {
 		unlang_stack_frame_t *frame = &stack->frame[i];
 
@@ -126,9 +245,11 @@ static inline void frame_state_init(unlang_stack_t *stack, unlang_stack_frame_t
 	frame->signal = op->signal;
 
 	/*
-	 *	The frame needs to track state.  Do so here.
+	 *	The frame needs to track state.  Do so here, unless
+	 *	frame_next() kept the state of the previous
+	 *	instruction.
 	 */
-	if (op->frame_state_size) {
+	if (op->frame_state_size && !frame->state) {
 		char const *name = op->frame_state_name ? op->frame_state_name : __location__;
 
 #ifdef HAVE_TALLOC_ZERO_POOLED_OBJECT
@@ -145,6 +266,49 @@ static inline void frame_state_init(unlang_stack_t *stack, unlang_stack_frame_t
 	}
 }
 
+/** Push a new frame onto the stack, with the fields common to all frames set
+ *
+ * @param[in] request		to push the frame onto.
+ * @param[in] default_rcode	The default result.
+ * @param[in] top_frame		Return out of the unlang interpreter when popping this frame.
+ * @return
+ *	- The new frame.
+ *	- NULL if the stack is too deep.  The request has been cancelled.
+ */
+static inline unlang_stack_frame_t *frame_push(REQUEST *request, rlm_rcode_t default_rcode, bool top_frame)
+{
+	unlang_stack_t		*stack = request->stack;
+	unlang_stack_frame_t	*frame;
+
+	/*
+	 *	Groups entered by frames running flattened
+	 *	instructions count, as they would otherwise have
+	 *	been frames.
+	 */
+	if ((stack->depth + stack->levels) >= (UNLANG_STACK_MAX - 1)) {
+		RERROR("Internal sanity check failed: module stack is too deep");
+		unlang_interpret_signal(request, FR_SIGNAL_CANCEL);
+		return NULL;
+	}
+
+	stack->depth++;
+
+	/*
+	 *	Initialize the next stack frame.
+	 */
+	frame = &stack->frame[stack->depth];
+	memset(frame, 0, sizeof(*frame));
+
+	frame->uflags = UNWIND_FLAG_NONE;
+	if (top_frame) top_frame_set(frame);
+
+	frame->result = default_rcode;
+	frame->priority = -1;
+	frame->level_base = stack->levels;
+
+	return frame;
+}
+
 /** Push a new frame onto the stack
  *
  * @param[in] request		to push the frame onto.
@@ -170,19 +334,8 @@ void unlang_interpret_push(REQUEST *request, unlang_t *instruction,
 				    top_frame ? "UNLANG_TOP_FRAME" : "UNLANG_SUB_FRAME");
 #endif
 
-	if (stack->depth >= (UNLANG_STACK_MAX - 1)) {
-		RERROR("Internal sanity check failed: module stack is too deep");
-		unlang_interpret_signal(request, FR_SIGNAL_CANCEL);
-		return;
-	}
-
-	stack->depth++;
-
-	/*
-	 *	Initialize the next stack frame.
-	 */
-	frame = &stack->frame[stack->depth];
-	memset(frame, 0, sizeof(*frame));
+	frame = frame_push(request, default_rcode, top_frame);
+	if (!frame) return;
 
 	frame->instruction = instruction;
 
@@ -192,17 +345,32 @@ void unlang_interpret_push(REQUEST *request, unlang_t *instruction,
 	}
 	/* else frame->next MUST be NULL */
 
-	frame->uflags = UNWIND_FLAG_NONE;
-	if (top_frame) top_frame_set(frame);
-
-	frame->result = default_rcode;
-	frame->priority = -1;
-
 	if (!instruction) return;
 
 	frame_state_init(stack, frame);
 }
 
+/** Push a new frame which runs the flattened children of a group
+ *
+ * The first instruction is found when the frame is evaluated, not
+ * here, so that a leading condition sees the result as it is then.
+ *
+ * @param[in] request		to push the frame onto.
+ * @param[in] flat		children to run.
+ * @param[in] default_rcode	The default result.
+ */
+void unlang_interpret_push_flat(REQUEST *request, unlang_flat_t const *flat, rlm_rcode_t default_rcode)
+{
+	unlang_stack_frame_t	*frame;
+
+	fr_assert(flat->num_ops > 0);
+
+	frame = frame_push(request, default_rcode, UNLANG_SUB_FRAME);
+	if (!frame) return;
+
+	frame->flat = flat;
+}
+
 /** Update the current result after each instruction, and after popping each stack frame
  *
  * @param[in] request		The current request.
@@ -325,7 +493,11 @@ static inline unlang_frame_action_t result_calculate(REQUEST *request, unlang_st
 			frame->priority, stack->unwind, frame->uflags);
 	}
 
-	return frame->next ? UNLANG_FRAME_ACTION_NEXT : UNLANG_FRAME_ACTION_POP;
+	/*
+	 *	Frames running flattened instructions find the end of
+	 *	each group from the instructions.
+	 */
+	return (frame->next || frame->flat) ? UNLANG_FRAME_ACTION_NEXT : UNLANG_FRAME_ACTION_POP;
 }
 
 /** Cleanup any lingering frame state
@@ -343,11 +515,254 @@ static inline void frame_cleanup(unlang_stack_frame_t *frame)
 	if (frame->state) TALLOC_FREE(frame->state);
 }
 
+/** Leave the innermost group entered by a frame running flattened instructions
+ *
+ * The result of the group is merged into the enclosing group, as it
+ * would have been when popping the group's frame.
+ *
+ * @param[in] request		The current request.
+ * @param[in] frame		The current stack frame.
+ * @param[in,out] result	The current section result.
+ * @param[in,out] priority	The current section priority.
+ * @return the same as result_calculate(), for the enclosing group.
+ */
+static inline unlang_frame_action_t flat_leave(REQUEST *request, unlang_stack_frame_t *frame,
+					       rlm_rcode_t *result, int *priority)
+{
+	unlang_stack_t		*stack = request->stack;
+	unlang_stack_level_t	*level;
+
+	fr_assert(stack->levels > frame->level_base);
+
+	level = &stack->level[--stack->levels];
+
+	*result = frame->result;
+	*priority = frame->priority;
+
+	frame->result = level->result;
+	frame->priority = level->priority;
+	frame->instruction = frame->flat->ops[level->leave].instruction;
+
+	REXDENT();
+
+	/*
+	 *	If we're at debug level 1, don't emit the closing
+	 *	brace as the opening brace wasn't emitted.
+	 */
+	if (RDEBUG_ENABLED && !RDEBUG_ENABLED2) {
+		RDEBUG("# %s (%s)", frame->instruction->debug_name,
+		       fr_table_str_by_value(mod_rcode_table, *result, "<invalid>"));
+	} else {
+		RDEBUG2("} # %s (%s)", frame->instruction->debug_name,
+			fr_table_str_by_value(mod_rcode_table, *result, "<invalid>"));
+	}
+
+	return result_calculate(request, frame, result, priority);
+}
+
+/** Leave every group entered by a frame running flattened instructions
+ *
+ * Used when the frame is about to be popped, so that its result is
+ * the one it would have had if each group had its own frame.
+ */
+static inline void flat_unwind(REQUEST *request, unlang_stack_frame_t *frame, rlm_rcode_t *result, int *priority)
+{
+	unlang_stack_t	*stack = request->stack;
+
+	while (stack->levels > frame->level_base) (void) flat_leave(request, frame, result, priority);
+}
+
+/** Handle result_calculate() finishing the current group, for a frame running flattened instructions
+ *
+ * If the stack is unwinding, or the frame hasn't entered a group,
+ * the frame is done.  Otherwise only the innermost group is, and the
+ * frame carries on by leaving it.
+ *
+ * @return
+ *	- UNLANG_FRAME_ACTION_NEXT	leave the innermost group next.
+ *	- UNLANG_FRAME_ACTION_POP	the final result has been calculated for this frame.
+ */
+static inline unlang_frame_action_t flat_pop(REQUEST *request, unlang_stack_frame_t *frame,
+					     rlm_rcode_t *result, int *priority)
+{
+	unlang_stack_t	*stack = request->stack;
+
+	if (stack->unwind || (stack->levels == frame->level_base)) {
+		flat_unwind(request, frame, result, priority);
+		return UNLANG_FRAME_ACTION_POP;
+	}
+
+	frame->pc = stack->level[stack->levels - 1].leave;
+	return UNLANG_FRAME_ACTION_NEXT;
+}
+
+/** Update the current result, for frames running either flattened instructions or a list
+ *
+ */
+static inline unlang_frame_action_t frame_result_calculate(REQUEST *request, unlang_stack_frame_t *frame,
+							   rlm_rcode_t *result, int *priority)
+{
+	unlang_frame_action_t fa;
+
+	fa = result_calculate(request, frame, result, priority);
+	if ((fa == UNLANG_FRAME_ACTION_POP) && frame->flat) return flat_pop(request, frame, result, priority);
+
+	return fa;
+}
+
+/** Run flattened instructions until one needs its operation to be called
+ *
+ * Entering and leaving groups, and evaluating conditions, are done
+ * here, without pushing stack frames.  Module calls and all other
+ * keywords are left in frame->instruction, for frame_eval() to run.
+ *
+ * @param[in] request		The current request.
+ * @param[in] frame		The current stack frame.
+ * @param[in,out] result	The current section result.
+ * @param[in,out] priority	The current section priority.
+ */
+static inline void flat_next(REQUEST *request, unlang_stack_frame_t *frame, rlm_rcode_t *result, int *priority)
+{
+	unlang_stack_t		*stack = request->stack;
+	unlang_flat_t const	*flat = frame->flat;
+	unlang_flat_op_t const	*op;
+	unlang_stack_level_t	*level;
+	unlang_op_t const	*reuse = NULL;
+	void			*state = NULL;
+
+	if (frame->instruction && frame->state && unlang_ops[frame->instruction->type].frame_state_reuse) {
+		reuse = &unlang_ops[frame->instruction->type];
+		state = frame->state;
+		frame->state = NULL;
+	}
+
+	frame_cleanup(frame);
+	frame->instruction = NULL;
+
+	while (frame->pc < flat->num_ops) {
+		op = &flat->ops[frame->pc++];
+
+		switch (op->opcode) {
+		case UNLANG_FLAT_EXEC:
+			frame->instruction = op->instruction;
+
+			if (state && (&unlang_ops[op->instruction->type] == reuse)) {
+				talloc_free_children(state);
+				memset(state, 0, reuse->frame_state_size);
+				frame->state = state;
+				state = NULL;
+			}
+
+			frame_state_init(stack, frame);
+			goto done;
+
+		case UNLANG_FLAT_IF:
+			stack->instructions++;
+			RDEBUG2("%s {", op->instruction->debug_name);
+			RINDENT();
+
+			/*
+			 *	Conditions may look at the current
+			 *	instruction with %{interpreter:...}
+			 */
+			frame->instruction = op->instruction;
+			if (!unlang_condition_eval(request, *result, unlang_generic_to_group(op->instruction))) {
+				frame->instruction = NULL;
+				RDEBUG2("...");
+				REXDENT();
+				RDEBUG2("}");
+				frame->pc = op->next;
+				continue;
+			}
+
+			/*
+			 *	The condition is true, but there's
+			 *	nothing to run.  Still skip over any
+			 *	else / elsif.
+			 */
+			frame->instruction = NULL;
+			if (op->leave == frame->pc) {
+				RDEBUG2("} # %s ... <ignoring empty subsection>", op->instruction->debug_name);
+				REXDENT();
+				RDEBUG2("}");
+				frame->pc = flat->ops[op->leave].next;
+				continue;
+			}
+			goto enter;
+
+		case UNLANG_FLAT_ENTER:
+			stack->instructions++;
+			RDEBUG2("%s {", op->instruction->debug_name);
+			RINDENT();
+
+		enter:
+			if ((stack->depth + stack->levels) >= (UNLANG_STACK_MAX - 1)) {
+				RERROR("Internal sanity check failed: module stack is too deep");
+				unlang_interpret_signal(request, FR_SIGNAL_CANCEL);
+				frame->pc = flat->num_ops;
+				goto done;
+			}
+
+			/*
+			 *	As unlang_group() would, but the
+			 *	result of the enclosing group is kept
+			 *	here instead of in its frame.
+			 */
+			level = &stack->level[stack->levels++];
+			level->result = frame->result;
+			level->priority = frame->priority;
+			level->leave = op->leave;
+
+			frame->priority = -1;
+			*result = frame->result;
+			continue;
+
+		case UNLANG_FLAT_LEAVE:
+			if (flat_leave(request, frame, result, priority) == UNLANG_FRAME_ACTION_NEXT) {
+				frame->pc = op->next;
+			} else if (flat_pop(request, frame, result, priority) == UNLANG_FRAME_ACTION_POP) {
+				frame->pc = flat->num_ops;
+			}
+			frame->instruction = NULL;
+			continue;
+		}
+	}
+
+done:
+	talloc_free(state);
+}
+
 /** Advance to the next sibling instruction
  *
+ * Sections are often lists of instructions of the same type, e.g.
+ * module calls.  Where the operation allows it, the frame state
+ * of one is cleared and reused by the next, instead of being freed
+ * and allocated again.
+ *
+ * @param[in] request		The current request.
+ * @param[in] frame		The current stack frame.
+ * @param[in,out] result	The current section result.
+ * @param[in,out] priority	The current section priority.
  */
-static inline void frame_next(unlang_stack_t *stack, unlang_stack_frame_t *frame)
+static inline void frame_next(REQUEST *request, unlang_stack_frame_t *frame, rlm_rcode_t *result, int *priority)
 {
+	unlang_stack_t		*stack = request->stack;
+	unlang_op_t const	*op;
+	void			*state = NULL;
+
+	if (frame->flat) {
+		flat_next(request, frame, result, priority);
+		return;
+	}
+
+	op = &unlang_ops[frame->instruction->type];
+
+	if (frame->state && op->frame_state_reuse &&
+	    frame->next && (frame->next->type == frame->instruction->type)) {
+		state = frame->state;
+		frame->state = NULL;
+	}
+
 	frame_cleanup(frame);
 	frame->instruction = frame->next;
 
@@ -355,6 +770,12 @@ static inline void frame_next(unlang_stack_t *stack, unlang_stack_frame_t *frame
 
 	frame->next = frame->instruction->next;
 
+	if (state) {
+		talloc_free_children(state);
+		memset(state, 0, op->frame_state_size);
+		frame->state = state;
+	}
+
 	frame_state_init(stack, frame);
 }
 
@@ -371,6 +792,7 @@ static inline void frame_pop(unlang_stack_t *stack)
 	frame = &stack->frame[stack->depth];
 
 	frame_cleanup(frame);
+	stack->levels = frame->level_base;
 
 	frame = &stack->frame[--stack->depth];
 
@@ -408,6 +830,12 @@ static inline unlang_frame_action_t frame_eval(REQUEST *request, unlang_stack_fr
 {
 	unlang_stack_t	*stack = request->stack;
 
+	/*
+	 *	A frame running flattened instructions finds its
+	 *	first instruction when it's first evaluated.
+	 */
+	if (frame->flat && !frame->instruction && (frame->pc == 0)) flat_next(request, frame, result, priority);
+
 	/*
 	 *	Loop over all the instructions in this list.
 	 */
@@ -445,6 +873,7 @@ static inline unlang_frame_action_t frame_eval(REQUEST *request, unlang_stack_fr
 				frame->priority);
 
 			unwind_all(stack);
+			if (frame->flat) flat_unwind(request, frame, result, priority);
 			return UNLANG_FRAME_ACTION_POP;
 		}
 
@@ -460,6 +889,7 @@ static inline unlang_frame_action_t frame_eval(REQUEST *request, unlang_stack_fr
 			unlang_ops[instruction->type].name);
 
 		fr_assert(frame->interpret != NULL);
+		stack->instructions++;
 		action = frame->interpret(request, result);
 
 		RDEBUG4("** [%i] %s << %s (%d)", stack->depth, __FUNCTION__,
@@ -496,6 +926,7 @@ static inline unlang_frame_action_t frame_eval(REQUEST *request, unlang_stack_fr
 			frame->priority = *priority;
 			frame->next = NULL;
 			fr_assert(stack->unwind != UNWIND_FLAG_NONE);
+			if (frame->flat) flat_unwind(request, frame, result, priority);
 			return UNLANG_FRAME_ACTION_POP;
 
 		/*
@@ -571,7 +1002,7 @@ static inline unlang_frame_action_t frame_eval(REQUEST *request, unlang_stack_fr
 
 			*priority = instruction->actions[*result];
 
-			if (result_calculate(request, frame, result, priority) == UNLANG_FRAME_ACTION_POP) {
+			if (frame_result_calculate(request, frame, result, priority) == UNLANG_FRAME_ACTION_POP) {
 				return UNLANG_FRAME_ACTION_POP;
 			}
 			/* FALL-THROUGH */
@@ -587,7 +1018,7 @@ static inline unlang_frame_action_t frame_eval(REQUEST *request, unlang_stack_fr
 			break;
 		} /* switch over return code from the interpreter function */
 
-		frame_next(stack, frame);
+		frame_next(request, frame, result, priority);
 	}
 
 	RDEBUG4("** [%i] %s - done current subsection with (%s %d)",
@@ -699,7 +1130,7 @@ rlm_rcode_t unlang_interpret(REQUEST *request)
 				}
 			}
 
-			fa = result_calculate(request, frame, &stack->result, &priority);
+			fa = frame_result_calculate(request, frame, &stack->result, &priority);
 
 			/*
 			 *	If we're continuing after popping a frame
@@ -711,7 +1142,7 @@ rlm_rcode_t unlang_interpret(REQUEST *request)
 					stack->depth, __FUNCTION__,
 					fr_table_str_by_value(mod_rcode_table, stack->result, "<invalid>"),
 					priority);
-				frame_next(stack, frame);
+				frame_next(request, frame, &stack->result, &priority);
 			/*
 			 *	Else if we're really done with this frame
 			 *	print some helpful debug...
@@ -759,6 +1190,11 @@ rlm_rcode_t unlang_interpret(REQUEST *request)
 	RDEBUG4("** [%i] %s - interpreter exiting, returning %s", stack->depth, __FUNCTION__,
 		fr_table_str_by_value(mod_rcode_table, frame->result, "<invalid>"));
 	stack->result = frame->result;
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+	if (frame->latency) fr_hist_record(frame->latency, fr_time() - frame->start);
+#endif
+
 	stack->depth--;
 	DUMP_STACK;
 
@@ -790,6 +1226,10 @@ static unlang_group_t empty_group = {
 void unlang_interpret_push_section(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t default_rcode, bool top_frame)
 {
 	unlang_t	*instruction = NULL;
+#ifdef WITH_LATENCY_HISTOGRAMS
+	unlang_stack_t	*stack = request->stack;
+	int		depth = stack->depth;
+#endif
 
 	/*
 	 *	Interpretable unlang instructions are stored as CONF_DATA
@@ -805,6 +1245,20 @@ void unlang_interpret_push_section(REQUEST *request, CONF_SECTION *cs, rlm_rcode
 
 
 	unlang_interpret_push_instruction(request, instruction, default_rcode, top_frame);
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+	/*
+	 *	Time the section from here, until its top frame is
+	 *	popped at the end of unlang_interpret().
+	 */
+	if (top_frame && instruction && unlang_generic_to_group(instruction)->latency_id &&
+	    (stack->depth == (depth + 2))) {
+		unlang_stack_frame_t *frame = &stack->frame[depth + 1];
+
+		frame->latency = unlang_latency_thread_hist(unlang_generic_to_group(instruction)->latency_id);
+		if (frame->latency) frame->start = fr_time();
+	}
+#endif
 }
 
 /** Push an instruction onto the request stack for later interpretation.
@@ -1109,6 +1563,17 @@ int unlang_interpret_stack_depth(REQUEST *request)
 	return stack->depth;
 }
 
+/** Return how many instructions the request's stack has executed
+ *
+ * Used to calculate the cost of each instruction in benchmarks.
+ */
+uint64_t unlang_interpret_instructions(REQUEST *request)
+{
+	unlang_stack_t	*stack = request->stack;
+
+	return stack->instructions;
+}
+
 /** Get the current rcode for the frame
  *
  * This can be useful for getting the result of unlang_function_t pushed
@@ -1195,29 +1660,38 @@ static ssize_t unlang_interpret_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t
 {
 	unlang_stack_t		*stack = request->stack;
 	int			depth = stack->depth;
+	int			levels = stack->levels;
 	unlang_stack_frame_t	*frame;
 	unlang_t const		*instruction;
 
 	fr_skip_whitespace(fmt);
 
+	frame = &stack->frame[depth];
+	instruction = frame->instruction;
+
 	/*
-	 *	Find the correct stack frame.
+	 *	Find the correct stack frame.  Groups entered by
+	 *	frames running flattened instructions count as
+	 *	frames, as they would be if they weren't flattened.
 	 */
 	while (*fmt == '.') {
-		if (depth <= 1) {
+		if ((depth + levels) <= 1) {
 			return snprintf(*out, outlen, "<underflow>");
 		}
 
 		fmt++;
+
+		if (levels > frame->level_base) {
+			levels--;
+			instruction = frame->flat->ops[stack->level[levels].leave].instruction;
+			continue;
+		}
+
 		depth--;
+		frame = &stack->frame[depth];
+		instruction = frame->instruction;
 	}
 
-	/*
-	 *	Get the current instruction.
-	 */
-	frame = &stack->frame[depth];
-	instruction = frame->instruction;
-
 	/*
 	 *	Nothing there...
 	 */
@@ -1244,7 +1718,7 @@ static ssize_t unlang_interpret_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t
 	 *	How deep the current stack is.
 	 */
 	if (strcmp(fmt, "depth") == 0) {
-		return snprintf(*out, outlen, "%d", depth);
+		return snprintf(*out, outlen, "%d", depth + levels);
 	}
 
 	/*
@@ -1286,4 +1760,18 @@ static ssize_t unlang_interpret_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t
 void unlang_interpret_init(void)
 {
 	(void) xlat_register(NULL, "interpreter", unlang_interpret_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+	if (!unlang_latency_metrics) {
+		MEM(unlang_latency_metrics = fr_metrics_source_add(NULL, unlang_interpret_latency_metrics, NULL));
+	}
+#endif
+}
+
+void unlang_interpret_free(void)
+{
+#ifdef WITH_LATENCY_HISTOGRAMS
+	TALLOC_FREE(unlang_latency_metrics);
+	TALLOC_FREE(unlang_latency);
+#endif
 }
@@ -29,6 +29,7 @@ extern "C" {
 #endif
 
 #include <freeradius-devel/unlang/action.h>
+#include <freeradius-devel/util/hist.h>
 
 #define UNLANG_TOP_FRAME (true)
 #define UNLANG_SUB_FRAME (false)
@@ -84,6 +85,10 @@ typedef struct {
 	size_t			frame_state_pool_objects;	//!< How many sub-allocations we expect.
 
 	size_t			frame_state_pool_size;		//!< The total size of the pool to alloc.
+
+	bool			frame_state_reuse;		//!< Consecutive instructions of this type can
+								///< share frame state.  The state is zeroed,
+								///< and its children freed, between them.
 } unlang_op_t;
 
 /** Return whether a request is currently scheduled
@@ -117,8 +122,14 @@ void		unlang_interpret_signal(REQUEST *request, fr_state_signal_t action);
 
 int		unlang_interpret_stack_depth(REQUEST *request);
 
+uint64_t	unlang_interpret_instructions(REQUEST *request);
+
 rlm_rcode_t	unlang_interpret_stack_result(REQUEST *request);
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+void		unlang_interpret_latency_fprint(FILE *fp);
+#endif
+
 void		unlang_interpret_init(void);
 #ifdef __cplusplus
 }
@@ -573,6 +573,16 @@ static inline void safe_unlock(module_instance_t *instance)
 	if (instance->mutex) pthread_mutex_unlock(instance->mutex);
 }
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+/*
+ *	Record how long the module took to return a result
+ */
+static inline void module_latency_record(unlang_frame_state_module_t *state)
+{
+	if (state->thread->latency) fr_hist_record(state->thread->latency, fr_time() - state->start);
+}
+#endif
+
 /** Send a signal (usually stop) to a request
  *
  * This is typically called via an "async" action, i.e. an action
@@ -682,6 +692,10 @@ static unlang_action_t unlang_module_resume(REQUEST *request, rlm_rcode_t *presu
 
 	state->thread->active_callers--;
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+	module_latency_record(state);
+#endif
+
 	/*
 	 *	The module is done.  But, running it pushed one or
 	 *	more asynchronous calls onto the stack.  These need to
@@ -793,6 +807,10 @@ static unlang_action_t unlang_module(REQUEST *request, rlm_rcode_t *presult)
 	 */
 	state->thread->total_calls++;
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+	if (state->thread->latency) state->start = fr_time();
+#endif
+
 	caller = request->module;
 	request->module = sp->module_instance->name;
 	safe_lock(sp->module_instance);	/* Noop unless instance->mutex set */
@@ -828,6 +846,10 @@ static unlang_action_t unlang_module(REQUEST *request, rlm_rcode_t *presult)
 		return UNLANG_ACTION_YIELD;
 	}
 
+#ifdef WITH_LATENCY_HISTOGRAMS
+	module_latency_record(state);
+#endif
+
 done:
 	fr_assert(unlang_indent == request->log.unlang_indent);
 	fr_assert(rcode >= RLM_MODULE_REJECT);
@@ -861,5 +883,6 @@ void unlang_module_init(void)
 				.signal = unlang_module_signal,
 				.frame_state_size = sizeof(unlang_frame_state_module_t),
 				.frame_state_name = "unlang_frame_state_module_t",
+				.frame_state_reuse = true
 			   });
 }
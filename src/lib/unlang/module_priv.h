@@ -49,6 +49,9 @@ typedef struct {
 	void				*rctx;			//!< for resume / signal
 	fr_unlang_module_resume_t	resume;			//!< resumption handler
 	fr_unlang_module_signal_t	signal;			//!< for signal handlers
+#ifdef WITH_LATENCY_HISTOGRAMS
+	fr_time_t			start;			//!< When the module was called.
+#endif
 } unlang_frame_state_module_t;
 
 static inline unlang_module_t *unlang_generic_to_module(unlang_t *p)
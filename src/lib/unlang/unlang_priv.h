@@ -123,6 +123,44 @@ struct unlang_s {
 	int			actions[RLM_MODULE_NUMCODES];	//!< Priorities for the various return codes.
 };
 
+/** Operations in a flattened list of instructions
+ *
+ * Groups, and if / elsif / else sections, are written inline into the
+ * list of their parent, so that running them doesn't need a new stack
+ * frame.  Every other keyword, and module calls, are run with
+ * #UNLANG_FLAT_EXEC by their #unlang_op_t, as they are in the tree.
+ */
+typedef enum {
+	UNLANG_FLAT_EXEC = 0,			//!< Run an instruction.
+	UNLANG_FLAT_ENTER,			//!< Enter a group.  Its children follow inline.
+	UNLANG_FLAT_IF,				//!< Evaluate an if / elsif condition.  If it's true
+						///< enter the group, otherwise jump to the next section.
+	UNLANG_FLAT_LEAVE			//!< Leave a group, and merge its result into the
+						///< enclosing group.
+} unlang_flat_opcode_t;
+
+/** One operation in a flattened list of instructions
+ *
+ */
+typedef struct {
+	unlang_flat_opcode_t	opcode;		//!< What to do.
+	unlang_t		*instruction;	//!< The instruction to run, or the group being
+						///< entered or left.
+	unsigned int		leave;		//!< #UNLANG_FLAT_ENTER, #UNLANG_FLAT_IF - Index of the
+						///< matching #UNLANG_FLAT_LEAVE.
+	unsigned int		next;		//!< #UNLANG_FLAT_IF - Where to jump if the condition is false.
+						///< #UNLANG_FLAT_LEAVE - Where to jump after leaving the group.
+						///< Past any else / elsif sections, for if / elsif.
+} unlang_flat_op_t;
+
+/** The children of a group, flattened by unlang_compile()
+ *
+ */
+typedef struct {
+	unlang_flat_op_t	*ops;		//!< The operations, run in order unless they jump.
+	unsigned int		num_ops;	//!< How many operations there are.
+} unlang_flat_t;
+
 /** Generic representation of a grouping
  *
  * Can represent IF statements, maps, update sections etc...
@@ -134,6 +172,13 @@ typedef struct {
 	unlang_t		*tail;		//!< of the children list.
 	CONF_SECTION		*cs;
 	int			num_children;
+	unlang_flat_t		*flat;		//!< The children, flattened.  NULL if the
+						///< children are run as a tree.
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+	unsigned int		latency_id;	//!< Where to record the latency of a section compiled
+						///< by unlang_compile().  0 for all other groups.
+#endif
 
 	/*
 	 *	Hackity-hack.  We should probably just have a common
@@ -222,8 +267,30 @@ typedef struct {
 								///< result stored in the lower stack frame should
 								///< be replaced.
 	uint8_t			uflags;				//!< Unwind markers
+
+	unlang_flat_t const	*flat;				//!< Flattened instructions this frame is running.
+								///< If NULL, the frame follows instruction->next.
+	unsigned int		pc;				//!< Index of the next operation in flat.
+	int			level_base;			//!< stack->levels when this frame was pushed.
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+	fr_hist_t		*latency;			//!< Records how long this top frame took to run.
+	fr_time_t		start;				//!< When this top frame was pushed.
+#endif
 } unlang_stack_frame_t;
 
+/** A group entered by a frame running flattened instructions
+ *
+ * These take the place of the stack frames which would have been pushed
+ * for the group, and hold the result of the enclosing group until it's
+ * left.
+ */
+typedef struct {
+	rlm_rcode_t		result;				//!< Result of the enclosing group.
+	int			priority;			//!< Priority of the enclosing group.
+	unsigned int		leave;				//!< Index of the #UNLANG_FLAT_LEAVE for the group.
+} unlang_stack_level_t;
+
 /** An unlang stack associated with a request
  *
  */
@@ -232,7 +299,12 @@ typedef struct {
 	int			depth;				//!< Current depth we're executing at.
 	uint8_t			unwind;				//!< Unwind to this frame if it exists.
 								///< This is used for break and return.
+	uint64_t		instructions;			//!< How many instructions have been executed.
+	int			levels;				//!< Groups entered by all frames.  Frames and levels
+								///< together are limited to #UNLANG_STACK_MAX.
 	unlang_stack_frame_t	frame[UNLANG_STACK_MAX];	//!< The stack...
+	unlang_stack_level_t	level[UNLANG_STACK_MAX];	//!< Groups entered by frames running
+								///< flattened instructions.
 } unlang_stack_t;
 
 #define UNWIND_FLAG_NONE		0x00			//!< No flags.
@@ -329,9 +401,17 @@ static inline unlang_t *unlang_tmpl_to_generic(unlang_tmpl_t *p)
 void		unlang_interpret_push(REQUEST *request, unlang_t *instruction,
 				      rlm_rcode_t default_rcode, bool do_next_sibling, bool top_frame);
 
+void		unlang_interpret_push_flat(REQUEST *request, unlang_flat_t const *flat, rlm_rcode_t default_rcode);
+
 int		unlang_op_init(void);
 
 void		unlang_op_free(void);
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+unsigned int	unlang_interpret_latency_register(CONF_SECTION *cs);
+#endif
+
+void		unlang_interpret_free(void);
 /** @} */
 
 /** @name io shims
@@ -779,10 +779,24 @@ int xlat_register_redundant(CONF_SECTION *cs)
 
 
 /*
- *	Regular xlat functions
+ *	Async xlat functions which parse their own arguments
  */
 
 
+/** Reduce the arguments of an xlat function to a single box
+ *
+ * A single argument is left as it is, so that integers, IP addresses
+ * and octets produced by other expansions aren't printed and re-parsed.
+ * Multiple arguments are concatenated into a string.
+ */
+static int xlat_arg_single(TALLOC_CTX *ctx, fr_value_box_t **in)
+{
+	if (!(*in)->next) return 0;
+
+	return fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true);
+}
+
+
 /** Dynamically change the debugging level for the current request
  *
  * Example:
@@ -792,24 +806,45 @@ int xlat_register_redundant(CONF_SECTION *cs)
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_func_debug(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
-			       UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-			       REQUEST *request, char const *fmt)
+static xlat_action_t xlat_func_debug(TALLOC_CTX *ctx, fr_cursor_t *out,
+				     REQUEST *request, UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+				     fr_value_box_t **in)
 {
-	int level = 0;
+	fr_value_box_t	*vb;
+	fr_value_box_t	box;
+	int		level;
 
 	/*
 	 *  Expand to previous (or current) level
 	 */
-	snprintf(*out, outlen, "%d", request->log.lvl);
+	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT32, NULL, false));
+	vb->vb_uint32 = request->log.lvl;
 
 	/*
 	 *  Assume we just want to get the current value and NOT set it to 0
 	 */
-	if (!*fmt)
-		goto done;
+	if (!*in) goto done;
+
+	if (xlat_arg_single(ctx, in) < 0) {
+		RPEDEBUG("Failed concatenating input");
+		talloc_free(vb);
+		return XLAT_ACTION_FAIL;
+	}
+
+	/*
+	 *  Strings are parsed as they always were, so anything
+	 *  which isn't a number turns debugging off.
+	 */
+	if ((*in)->type == FR_TYPE_STRING) {
+		if (!*(*in)->vb_strvalue) goto done;
+
+		level = atoi((*in)->vb_strvalue);
+	} else if (fr_value_box_cast(NULL, &box, FR_TYPE_INT32, NULL, *in) < 0) {
+		level = 0;
+	} else {
+		level = box.vb_int32;
+	}
 
-	level = atoi(fmt);
 	if (level == 0) {
 		request->log.lvl = RAD_REQUEST_LVL_NONE;
 	} else {
@@ -818,7 +853,9 @@ static ssize_t xlat_func_debug(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen
 	}
 
 done:
-	return strlen(*out);
+	fr_cursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
 }
 
 
@@ -839,16 +876,28 @@ done:
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_func_debug_attr(UNUSED TALLOC_CTX *ctx, UNUSED char **out, UNUSED size_t outlen,
-				    UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-				    REQUEST *request, char const *fmt)
+static xlat_action_t xlat_func_debug_attr(TALLOC_CTX *ctx, UNUSED fr_cursor_t *out,
+					  REQUEST *request, UNUSED void const *xlat_inst,
+					  UNUSED void *xlat_thread_inst, fr_value_box_t **in)
 {
 	VALUE_PAIR	*vp;
 	fr_cursor_t	cursor;
 	vp_tmpl_t	*vpt;
+	char const	*fmt;
+
+	if (!RDEBUG_ENABLED2) return XLAT_ACTION_DONE;	/* NOOP if debugging isn't enabled */
 
-	if (!RDEBUG_ENABLED2) return 0;	/* NOOP if debugging isn't enabled */
+	if (!*in) {
+		REDEBUG("Missing attribute reference");
+		return XLAT_ACTION_FAIL;
+	}
+
+	if (fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true) < 0) {
+		RPEDEBUG("Failed concatenating input");
+		return XLAT_ACTION_FAIL;
+	}
 
+	fmt = (*in)->vb_strvalue;
 	fr_skip_whitespace(fmt);
 
 	if (tmpl_afrom_attr_str(request, NULL, &vpt, fmt,
@@ -857,7 +906,7 @@ static ssize_t xlat_func_debug_attr(UNUSED TALLOC_CTX *ctx, UNUSED char **out, U
 					.prefix = VP_ATTR_REF_PREFIX_AUTO
 				}) <= 0) {
 		RPEDEBUG("Invalid input");
-		return -1;
+		return XLAT_ACTION_FAIL;
 	}
 
 	RIDEBUG("Attributes matching \"%s\"", fmt);
@@ -939,7 +988,7 @@ static ssize_t xlat_func_debug_attr(UNUSED TALLOC_CTX *ctx, UNUSED char **out, U
 
 	talloc_free(vpt);
 
-	return 0;
+	return XLAT_ACTION_DONE;
 }
 
 
@@ -969,28 +1018,37 @@ if ("%{explode:&Tmp-String-1 ,}" != 3) {
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_func_explode(TALLOC_CTX *ctx, char **out, size_t outlen,
-				 UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-				 REQUEST *request, char const *fmt)
+static xlat_action_t xlat_func_explode(TALLOC_CTX *ctx, fr_cursor_t *out,
+				       REQUEST *request, UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+				       fr_value_box_t **in)
 {
 	vp_tmpl_t	*vpt = NULL;
 	VALUE_PAIR	*vp;
 	fr_cursor_t	cursor, to_merge;
 	VALUE_PAIR	*head = NULL;
 	ssize_t		slen;
-	int		count = 0;
-	char const	*p = fmt;
+	uint32_t	count = 0;
+	char const	*p;
 	char		delim;
+	fr_value_box_t	*vb;
+
+	if (!*in) goto arg_error;
+
+	if (fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true) < 0) {
+		RPEDEBUG("Failed concatenating input");
+		return XLAT_ACTION_FAIL;
+	}
 
 	/*
 	 *  Trim whitespace
 	 */
+	p = (*in)->vb_strvalue;
 	fr_skip_whitespace(p);
 
 	slen = tmpl_afrom_attr_substr(ctx, NULL, &vpt, p, -1, &(vp_tmpl_rules_t){ .dict_def = request->dict });
 	if (slen <= 0) {
 		RPEDEBUG("Invalid input");
-		return -1;
+		return XLAT_ACTION_FAIL;
 	}
 
 	p += slen;
@@ -999,7 +1057,7 @@ static ssize_t xlat_func_explode(TALLOC_CTX *ctx, char **out, size_t outlen,
 	arg_error:
 		talloc_free(vpt);
 		REDEBUG("explode needs exactly two arguments: &ref <delim>");
-		return -1;
+		return XLAT_ACTION_FAIL;
 	}
 
 	if (*p == '\0' || p[1]) goto arg_error;
@@ -1099,11 +1157,19 @@ static ssize_t xlat_func_explode(TALLOC_CTX *ctx, char **out, size_t outlen,
 	fr_cursor_merge(&cursor, &to_merge);
 	talloc_free(vpt);
 
-	return snprintf(*out, outlen, "%i", count);
+	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT32, NULL, false));
+	vb->vb_uint32 = count;
+	fr_cursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
 }
 
 
 /** Print data as integer, not as VALUE.
+ *
+ * The argument is usually the name of an attribute, but values
+ * produced by other expansions are also converted directly, e.g.
+ * %{integer:%{Framed-IP-Address}}.
  *
  * Example:
 @verbatim
@@ -1114,48 +1180,86 @@ update request {
 @endverbatim
  * @ingroup xlat_functions
  */
-static ssize_t xlat_func_integer(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
-				 UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-				 REQUEST *request, char const *fmt)
+static xlat_action_t xlat_func_integer(TALLOC_CTX *ctx, fr_cursor_t *out,
+				       REQUEST *request, UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+				       fr_value_box_t **in)
 {
-	VALUE_PAIR	*vp;
+	fr_value_box_t const	*in_vb;
+	fr_value_box_t		*vb;
+	VALUE_PAIR		*vp;
 
-	uint64_t	int64 = 0;	/* Needs to be initialised to zero */
-	uint32_t	int32 = 0;	/* Needs to be initialised to zero */
+	uint64_t		int64 = 0;	/* Needs to be initialised to zero */
+	uint32_t		int32 = 0;	/* Needs to be initialised to zero */
 
-	fr_skip_whitespace(fmt);
+	if (!*in) return XLAT_ACTION_DONE;
 
-	if ((xlat_fmt_get_vp(&vp, request, fmt) < 0) || !vp) return 0;
+	if (xlat_arg_single(ctx, in) < 0) {
+		RPEDEBUG("Failed concatenating input");
+		return XLAT_ACTION_FAIL;
+	}
+	in_vb = *in;
+
+	/*
+	 *	Strings are usually the name of an attribute,
+	 *	in which case we convert its value.
+	 */
+	if (in_vb->type == FR_TYPE_STRING) {
+		char const *p = in_vb->vb_strvalue;
+
+		fr_skip_whitespace(p);
+
+		switch (xlat_fmt_get_vp(&vp, request, p)) {
+		case 0:
+			in_vb = &vp->data;
+			break;
+
+		case -4:		/* Not an attribute reference, so convert the string itself */
+			break;
 
-	switch (vp->vp_type) {
+		default:		/* No such attribute */
+			return XLAT_ACTION_DONE;
+		}
+	}
+
+	switch (in_vb->type) {
 	case FR_TYPE_DATE:
 	case FR_TYPE_STRING:
-	{
-		fr_value_box_t vb;
-
-		if (fr_value_box_cast(NULL, &vb, FR_TYPE_UINT64, NULL, &vp->data) < 0) {
+		MEM(vb = fr_value_box_alloc_null(ctx));
+		if (fr_value_box_cast(vb, vb, FR_TYPE_UINT64, NULL, in_vb) < 0) {
 			RPEDEBUG("Invalid input for printing as an integer");
-			return -1;
+			talloc_free(vb);
+			return XLAT_ACTION_FAIL;
 		}
-
-		return snprintf(*out, outlen, "%" PRIu64, vb.vb_uint64);
-	}
+		break;
 
 	case FR_TYPE_OCTETS:
-		if (vp->vp_length > 8) {
-			break;
-		}
+		if (in_vb->vb_length > 8) goto invalid;
 
-		if (vp->vp_length > 4) {
-			memcpy(&int64, vp->vp_octets, vp->vp_length);
-			return snprintf(*out, outlen, "%" PRIu64, htonll(int64));
+		if (in_vb->vb_length > 4) {
+			memcpy(&int64, in_vb->vb_octets, in_vb->vb_length);
+			MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT64, NULL, false));
+			vb->vb_uint64 = htonll(int64);
+			break;
 		}
 
-		memcpy(&int32, vp->vp_octets, vp->vp_length);
-		return snprintf(*out, outlen, "%i", htonl(int32));
+		memcpy(&int32, in_vb->vb_octets, in_vb->vb_length);
+		MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT32, NULL, false));
+		vb->vb_uint32 = htonl(int32);
+		break;
 
+	/*
+	 *	Copied as they are, but without the enumv, so that
+	 *	the number and not the name of the value is printed.
+	 */
+	case FR_TYPE_UINT8:
+	case FR_TYPE_UINT16:
+	case FR_TYPE_UINT32:
 	case FR_TYPE_UINT64:
-		return snprintf(*out, outlen, "%" PRIu64, vp->vp_uint64);
+	case FR_TYPE_INT32:
+		MEM(vb = fr_value_box_alloc_null(ctx));
+		fr_value_box_copy(vb, vb, in_vb);
+		vb->enumv = NULL;
+		break;
 
 	/*
 	 *	IP addresses are treated specially, as parsing functions assume the value
@@ -1163,49 +1267,58 @@ static ssize_t xlat_func_integer(UNUSED TALLOC_CTX *ctx, char **out, size_t outl
 	 */
 	case FR_TYPE_IPV4_ADDR:
 	case FR_TYPE_IPV4_PREFIX:	/* Same addr field */
-		return snprintf(*out, outlen, "%u", ntohl(vp->vp_ipv4addr));
-
-	case FR_TYPE_UINT32:
-		return snprintf(*out, outlen, "%u", vp->vp_uint32);
-
-	case FR_TYPE_UINT8:
-		return snprintf(*out, outlen, "%u", (unsigned int) vp->vp_uint8);
-
-	case FR_TYPE_UINT16:
-		return snprintf(*out, outlen, "%u", (unsigned int) vp->vp_uint16);
+		MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT32, NULL, false));
+		vb->vb_uint32 = ntohl(in_vb->vb_ip.addr.v4.s_addr);
+		break;
 
 	/*
 	 *	Ethernet is weird... It's network related, so it
 	 *	should be bigendian.
 	 */
 	case FR_TYPE_ETHERNET:
-		int64 = vp->vp_ether[0];
+		int64 = in_vb->vb_ether[0];
 		int64 <<= 8;
-		int64 |= vp->vp_ether[1];
+		int64 |= in_vb->vb_ether[1];
 		int64 <<= 8;
-		int64 |= vp->vp_ether[2];
+		int64 |= in_vb->vb_ether[2];
 		int64 <<= 8;
-		int64 |= vp->vp_ether[3];
+		int64 |= in_vb->vb_ether[3];
 		int64 <<= 8;
-		int64 |= vp->vp_ether[4];
+		int64 |= in_vb->vb_ether[4];
 		int64 <<= 8;
-		int64 |= vp->vp_ether[5];
-		return snprintf(*out, outlen, "%" PRIu64, int64);
-
-	case FR_TYPE_INT32:
-		return snprintf(*out, outlen, "%i", vp->vp_int32);
+		int64 |= in_vb->vb_ether[5];
+		MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT64, NULL, false));
+		vb->vb_uint64 = int64;
+		break;
 
+	/*
+	 *	There's no 128 bit integer type, so these have to
+	 *	be printed.
+	 */
 	case FR_TYPE_IPV6_ADDR:
 	case FR_TYPE_IPV6_PREFIX:
-		return fr_snprint_uint128(*out, outlen, ntohlll(*(uint128_t const *) &vp->vp_ipv6addr));
+	{
+		char buffer[64];
 
-	default:
+		fr_snprint_uint128(buffer, sizeof(buffer), ntohlll(*(uint128_t const *) &in_vb->vb_ip.addr.v6.s6_addr));
+		MEM(vb = fr_value_box_alloc_null(ctx));
+		if (fr_value_box_strdup(vb, vb, NULL, buffer, false) < 0) {
+			talloc_free(vb);
+			return XLAT_ACTION_FAIL;
+		}
+	}
 		break;
+
+	default:
+	invalid:
+		REDEBUG("Type '%s' cannot be converted to integer",
+			fr_table_str_by_value(fr_value_box_type_table, in_vb->type, "???"));
+		return XLAT_ACTION_FAIL;
 	}
 
-	REDEBUG("Type '%s' cannot be converted to integer", fr_table_str_by_value(fr_value_box_type_table, vp->vp_type, "???"));
+	fr_cursor_append(out, vb);
 
-	return -1;
+	return XLAT_ACTION_DONE;
 }
 
 
@@ -1325,6 +1438,7 @@ static ssize_t xlat_func_lpad(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
 	 *	big, we're done.
 	 */
 	len = tmpl_aexpand(ctx, &to_pad, request, vpt, NULL, NULL);
+	talloc_free(vpt);
 	if (len <= 0) return -1;
 
 	/*
@@ -1365,23 +1479,41 @@ static ssize_t xlat_func_lpad(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_func_map(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
-			     UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-			     REQUEST *request, char const *fmt)
+static xlat_action_t xlat_func_map(TALLOC_CTX *ctx, fr_cursor_t *out,
+				   REQUEST *request, UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+				   fr_value_box_t **in)
 {
 	vp_map_t	*map = NULL;
 	int		ret;
+	fr_value_box_t	*vb;
 
 	vp_tmpl_rules_t parse_rules = {
 		.dict_def = request->dict,
 		.prefix = VP_ATTR_REF_PREFIX_AUTO
 	};
 
-	if (map_afrom_attr_str(request, &map, fmt, &parse_rules, &parse_rules) < 0) {
-		RPEDEBUG("Failed parsing \"%s\" as map", fmt);
-		return -1;
+	if (!*in) {
+		REDEBUG("Missing map");
+		return XLAT_ACTION_FAIL;
+	}
+
+	if (fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true) < 0) {
+		RPEDEBUG("Failed concatenating input");
+		return XLAT_ACTION_FAIL;
 	}
 
+	if (map_afrom_attr_str(request, &map, (*in)->vb_strvalue, &parse_rules, &parse_rules) < 0) {
+		RPEDEBUG("Failed parsing \"%s\" as map", (*in)->vb_strvalue);
+		return XLAT_ACTION_FAIL;
+	}
+
+	/*
+	 *	"0" or "1", as a string, as it's always been.
+	 */
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	fr_value_box_strdup_shallow(vb, NULL, "0", false);
+	fr_cursor_append(out, vb);
+
 	switch (map->lhs->type) {
 	case TMPL_TYPE_ATTR:
 	case TMPL_TYPE_LIST:
@@ -1391,7 +1523,8 @@ static ssize_t xlat_func_map(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 	default:
 		REDEBUG("Unexpected type %s in left hand side of expression",
 			fr_table_str_by_value(tmpl_type_table, map->lhs->type, "<INVALID>"));
-		return strlcpy(*out, "0", outlen);
+		talloc_free(map);
+		return XLAT_ACTION_DONE;
 	}
 
 	switch (map->rhs->type) {
@@ -1407,16 +1540,17 @@ static ssize_t xlat_func_map(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 	default:
 		REDEBUG("Unexpected type %s in right hand side of expression",
 			fr_table_str_by_value(tmpl_type_table, map->rhs->type, "<INVALID>"));
-		return strlcpy(*out, "0", outlen);
+		talloc_free(map);
+		return XLAT_ACTION_DONE;
 	}
 
 	RINDENT();
 	ret = map_to_request(request, map, map_to_vp, NULL);
 	REXDENT();
 	talloc_free(map);
-	if (ret < 0) return strlcpy(*out, "0", outlen);
+	if (ret == 0) fr_value_box_strdup_shallow(vb, NULL, "1", false);
 
-	return strlcpy(*out, "1", outlen);
+	return XLAT_ACTION_DONE;
 }
 
 
@@ -1431,9 +1565,9 @@ static ssize_t xlat_func_map(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_func_next_time(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
-				   UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-				   REQUEST *request, char const *fmt)
+static xlat_action_t xlat_func_next_time(TALLOC_CTX *ctx, fr_cursor_t *out,
+					 REQUEST *request, UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+					 fr_value_box_t **in)
 {
 	long		num;
 
@@ -1441,16 +1575,27 @@ static ssize_t xlat_func_next_time(UNUSED TALLOC_CTX *ctx, char **out, size_t ou
 	char		*q;
 	time_t		now;
 	struct tm	*local, local_buff;
+	fr_value_box_t	*vb;
+
+	if (!*in) {
+		REDEBUG("nexttime: Missing period specifier (h|d|w|m|y)");
+		return XLAT_ACTION_FAIL;
+	}
+
+	if (fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true) < 0) {
+		RPEDEBUG("Failed concatenating input");
+		return XLAT_ACTION_FAIL;
+	}
 
 	now = time(NULL);
 	local = localtime_r(&now, &local_buff);
 
-	p = fmt;
+	p = (*in)->vb_strvalue;
 
 	num = strtoul(p, &q, 10);
 	if (!q || *q == '\0') {
 		REDEBUG("nexttime: <int> must be followed by period specifier (h|d|w|m|y)");
-		return -1;
+		return XLAT_ACTION_FAIL;
 	}
 
 	if (p == q) {
@@ -1492,10 +1637,14 @@ static ssize_t xlat_func_next_time(UNUSED TALLOC_CTX *ctx, char **out, size_t ou
 
 	default:
 		REDEBUG("nexttime: Invalid period specifier '%c', must be h|d|w|m|y", *p);
-		return -1;
+		return XLAT_ACTION_FAIL;
 	}
 
-	return snprintf(*out, outlen, "%" PRIu64, (uint64_t)(mktime(local) - now));
+	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT64, NULL, false));
+	vb->vb_uint64 = (uint64_t)(mktime(local) - now);
+	fr_cursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
 }
 
 
@@ -1533,6 +1682,7 @@ static ssize_t xlat_func_rpad(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
 	 *	big, we're done.
 	 */
 	len = tmpl_aexpand(ctx, &to_pad, request, vpt, NULL, NULL);
+	talloc_free(vpt);
 	if (len <= 0) return 0;
 
 	if ((size_t) len >= pad) {
@@ -1555,6 +1705,8 @@ static ssize_t xlat_func_rpad(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
 
 
 /** xlat expand string attribute value
+ *
+ * Values of other types are returned as they are.
  *
  * @ingroup xlat_functions
  */
@@ -1598,8 +1750,6 @@ static ssize_t xlat_func_xlat(TALLOC_CTX *ctx, char **out, size_t outlen,
 	return slen;
 }
 
-
-
 /*
  *	Async xlat functions
  */
@@ -3320,20 +3470,20 @@ int xlat_init(void)
 		return -1;
 	}
 
-#define XLAT_REGISTER(_x) xlat_register(NULL, STRINGIFY(_x), xlat_func_ ## _x, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true); \
+#define XLAT_REGISTER(_x) xlat_async_register(NULL, STRINGIFY(_x), xlat_func_ ## _x); \
 	xlat_internal(STRINGIFY(_x));
 
-	xlat_register(NULL, "debug", xlat_func_debug, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
-	xlat_internal("debug");
+	XLAT_REGISTER(debug);
 	XLAT_REGISTER(debug_attr);
-	xlat_register(NULL, "explode", xlat_func_explode, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
+	xlat_async_register(NULL, "explode", xlat_func_explode);
 	XLAT_REGISTER(integer);
 	xlat_register(NULL, "lpad", xlat_func_lpad, NULL, NULL, 0, 0, true);
 	XLAT_REGISTER(map);
-	xlat_register(NULL, "nexttime", xlat_func_next_time, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
+	xlat_async_register(NULL, "nexttime", xlat_func_next_time);
 	xlat_register(NULL, "rpad", xlat_func_rpad, NULL, NULL, 0, 0, true);
 	xlat_register(NULL, "trigger", trigger_xlat, NULL, NULL, 0, 0, false);	/* On behalf of trigger.c */
-	XLAT_REGISTER(xlat);
+	xlat_register(NULL, "xlat", xlat_func_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
+	xlat_internal("xlat");
 
 
 	xlat_async_register(NULL, "base64", xlat_func_base64_encode);
@@ -1,5 +1,6 @@
 SUBMAKEFILES := \
 	libfreeradius-util.mk \
 	dbuff_tests.mk \
+	dict_cache_tests.mk \
 	sbuff_tests.mk
 
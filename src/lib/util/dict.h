@@ -432,6 +432,8 @@ int			fr_dict_global_ctx_dir_set(char const *dict_dir);
 
 void			fr_dict_global_read_only(void);
 
+void			fr_dict_global_compile(bool compile);
+
 char const		*fr_dict_global_dir(void);
 
 fr_dict_t		*fr_dict_unconst(fr_dict_t const *dict);
@@ -0,0 +1,638 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Compiled dictionary files
+ *
+ * A compiled dictionary holds every statement from a dictionary file, and
+ * from the files it $INCLUDEs, already split into arguments.  Loading it
+ * skips reading, splitting and walking the source files, which is where
+ * most of the time spent loading dictionaries goes.
+ *
+ * The compiled file is mapped into memory, and the statements are passed
+ * directly to the tokenizer.  It records the SHA1 digest of each source
+ * file, and is ignored if any of them have changed.
+ *
+ * The format is native endian, and is only meant to be read by the same
+ * build of the server which wrote it.
+ *
+ * @file src/lib/util/dict_cache.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/dict_priv.h>
+#include <freeradius-devel/util/sha1.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DICT_CACHE_MAGIC	"FRDICT\0\0"
+#define DICT_CACHE_VERSION	(1)
+#define DICT_CACHE_BYTE_ORDER	(0x01020304)
+
+/** Start of the compiled file
+ *
+ * Followed by the file, record, and string tables, in that order.
+ */
+typedef struct {
+	char		magic[8];			//!< #DICT_CACHE_MAGIC.
+	uint32_t	version;			//!< #DICT_CACHE_VERSION.
+	uint32_t	byte_order;			//!< #DICT_CACHE_BYTE_ORDER, as written.
+	uint32_t	num_files;			//!< Entries in the file table.
+	uint32_t	num_records;			//!< Entries in the record table.
+	uint32_t	strings_len;			//!< Length of the string table.
+} dict_cache_header_t;
+
+/** A source file
+ *
+ */
+typedef struct {
+	uint32_t	name;				//!< Offset of the filename in the string table.
+	uint8_t		present;			//!< Whether the file existed.  Optional
+							///< $INCLUDE- files may not.
+	uint8_t		pad[3];
+	uint8_t		digest[SHA1_DIGEST_LENGTH];	//!< Of the file contents.
+} dict_cache_file_t;
+
+/** A single statement
+ *
+ */
+typedef struct {
+	uint32_t	file;				//!< Index of the file in the file table.
+	uint32_t	line;				//!< Line number in the file.
+	uint32_t	argc;				//!< Number of arguments, or 0 for the end
+							///< of an $INCLUDE.
+	uint32_t	argv;				//!< Offset of the arguments in the string table.
+							///< The arguments are consecutive, and each is
+							///< '\0' terminated.
+} dict_cache_record_t;
+
+struct dict_cache_s {
+	dict_cache_file_t	*files;			//!< File table.
+	uint32_t		num_files;
+
+	dict_cache_record_t	*records;		//!< Record table.
+	uint32_t		num_records;
+
+	char			*strings;		//!< String table.
+	uint32_t		strings_len;
+
+	uint8_t			*map;			//!< Mapped file, if we're reading.
+	size_t			map_len;		//!< Length of the mapping.
+};
+
+static int _dict_cache_free(dict_cache_t *cache)
+{
+	if (cache->map) munmap(cache->map, cache->map_len);
+
+	return 0;
+}
+
+/** Calculate the digest of a source file
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ *	- -2 if the file doesn't exist.
+ */
+static int dict_cache_digest(uint8_t digest[static SHA1_DIGEST_LENGTH], char const *filename)
+{
+	fr_sha1_ctx	sha1;
+	uint8_t		buffer[8192];
+	ssize_t		len;
+	int		fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT) return -2;
+
+		fr_strerror_printf("Failed opening %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	fr_sha1_init(&sha1);
+	while ((len = read(fd, buffer, sizeof(buffer))) > 0) fr_sha1_update(&sha1, buffer, len);
+	if (len < 0) {
+		fr_strerror_printf("Failed reading %s: %s", filename, fr_syserror(errno));
+		close(fd);
+		return -1;
+	}
+	fr_sha1_final(digest, &sha1);
+
+	close(fd);
+
+	return 0;
+}
+
+/** Allocate a cache to record statements into
+ *
+ * @param[in] ctx	to allocate the cache in.
+ * @return
+ *	- A new cache.
+ *	- NULL on error.
+ */
+dict_cache_t *dict_cache_alloc(TALLOC_CTX *ctx)
+{
+	dict_cache_t *cache;
+
+	cache = talloc_zero(ctx, dict_cache_t);
+	if (!cache) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+
+	cache->files = talloc_array(cache, dict_cache_file_t, 16);
+	cache->records = talloc_array(cache, dict_cache_record_t, 1024);
+	cache->strings = talloc_array(cache, char, 16384);
+	if (!cache->files || !cache->records || !cache->strings) {
+		talloc_free(cache);
+		goto oom;
+	}
+
+	return cache;
+}
+
+/** Append data to the string table
+ *
+ * @return
+ *	- The offset of the data.
+ *	- -1 on error.
+ */
+static int64_t dict_cache_strings_add(dict_cache_t *cache, char const *data, size_t len)
+{
+	uint32_t	offset = cache->strings_len;
+	size_t		size = talloc_array_length(cache->strings);
+
+	if ((offset + len) > UINT32_MAX) {
+		fr_strerror_printf("Compiled dictionary is too large");
+		return -1;
+	}
+
+	if ((offset + len) > size) {
+		char *strings;
+
+		while ((offset + len) > size) size *= 2;
+
+		strings = talloc_realloc(cache, cache->strings, char, size);
+		if (!strings) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+		cache->strings = strings;
+	}
+
+	memcpy(cache->strings + offset, data, len);
+	cache->strings_len += len;
+
+	return offset;
+}
+
+/** Add a source file
+ *
+ * @param[in] cache	to add the file to.
+ * @param[in] filename	of the source file.
+ * @return
+ *	- The index of the file, to pass to dict_cache_line_add().
+ *	- -1 on error.
+ */
+int dict_cache_file_add(dict_cache_t *cache, char const *filename)
+{
+	dict_cache_file_t	*file;
+	int64_t			offset;
+	int			ret;
+
+	if (cache->num_files == talloc_array_length(cache->files)) {
+		dict_cache_file_t *files;
+
+		files = talloc_realloc(cache, cache->files, dict_cache_file_t, cache->num_files * 2);
+		if (!files) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+		cache->files = files;
+	}
+
+	offset = dict_cache_strings_add(cache, filename, strlen(filename) + 1);
+	if (offset < 0) return -1;
+
+	file = &cache->files[cache->num_files];
+	memset(file, 0, sizeof(*file));
+	file->name = offset;
+
+	ret = dict_cache_digest(file->digest, filename);
+	if (ret == -1) return -1;
+	file->present = (ret == 0);
+
+	return cache->num_files++;
+}
+
+static int dict_cache_record_add(dict_cache_t *cache, int file, int line, int argc, int64_t offset)
+{
+	dict_cache_record_t *record;
+
+	if (cache->num_records == talloc_array_length(cache->records)) {
+		dict_cache_record_t *records;
+
+		records = talloc_realloc(cache, cache->records, dict_cache_record_t, cache->num_records * 2);
+		if (!records) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+		cache->records = records;
+	}
+
+	record = &cache->records[cache->num_records++];
+	record->file = file;
+	record->line = line;
+	record->argc = argc;
+	record->argv = offset;
+
+	return 0;
+}
+
+/** Record a statement
+ *
+ * Must be called before the statement is processed, as processing
+ * modifies the arguments.
+ *
+ * @param[in] cache	to add the statement to.
+ * @param[in] file	index returned by dict_cache_file_add().
+ * @param[in] line	the statement is on.
+ * @param[in] argc	number of arguments.
+ * @param[in] argv	the arguments.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int dict_cache_line_add(dict_cache_t *cache, int file, int line, int argc, char **argv)
+{
+	int64_t	offset = cache->strings_len;
+	int	i;
+
+	if (!fr_cond_assert(argc > 0)) return -1;
+
+	for (i = 0; i < argc; i++) {
+		if (dict_cache_strings_add(cache, argv[i], strlen(argv[i]) + 1) < 0) return -1;
+	}
+
+	return dict_cache_record_add(cache, file, line, argc, offset);
+}
+
+/** Record the end of an $INCLUDE
+ *
+ * @param[in] cache	to add the marker to.
+ * @param[in] file	index of the file containing the $INCLUDE.
+ * @param[in] line	of the $INCLUDE.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int dict_cache_include_end(dict_cache_t *cache, int file, int line)
+{
+	return dict_cache_record_add(cache, file, line, 0, 0);
+}
+
+static int dict_cache_write_all(int fd, void const *data, size_t len)
+{
+	uint8_t const *p = data, *end = p + len;
+
+	while (p < end) {
+		ssize_t slen;
+
+		slen = write(fd, p, end - p);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += slen;
+	}
+
+	return 0;
+}
+
+/** Write the compiled dictionary
+ *
+ * The file is written under a temporary name, and then renamed, so
+ * that readers never see a partially written file.
+ *
+ * @param[in] cache	to write.
+ * @param[in] filename	to write to.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int dict_cache_write(dict_cache_t *cache, char const *filename)
+{
+	dict_cache_header_t	header;
+	char			*tmp;
+	int			fd;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DICT_CACHE_MAGIC, sizeof(header.magic));
+	header.version = DICT_CACHE_VERSION;
+	header.byte_order = DICT_CACHE_BYTE_ORDER;
+	header.num_files = cache->num_files;
+	header.num_records = cache->num_records;
+	header.strings_len = cache->strings_len;
+
+	tmp = talloc_asprintf(NULL, "%s.XXXXXX", filename);
+	if (!tmp) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		fr_strerror_printf("Failed creating %s: %s", tmp, fr_syserror(errno));
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if ((fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) < 0) ||
+	    (dict_cache_write_all(fd, &header, sizeof(header)) < 0) ||
+	    (dict_cache_write_all(fd, cache->files, sizeof(cache->files[0]) * cache->num_files) < 0) ||
+	    (dict_cache_write_all(fd, cache->records, sizeof(cache->records[0]) * cache->num_records) < 0) ||
+	    (dict_cache_write_all(fd, cache->strings, cache->strings_len) < 0)) {
+		fr_strerror_printf("Failed writing %s: %s", tmp, fr_syserror(errno));
+	error:
+		close(fd);
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if (rename(tmp, filename) < 0) {
+		fr_strerror_printf("Failed renaming %s to %s: %s", tmp, filename, fr_syserror(errno));
+		goto error;
+	}
+
+	close(fd);
+	talloc_free(tmp);
+
+	return 0;
+}
+
+/** Check that every statement in a compiled dictionary can be replayed
+ *
+ * The statements are applied to the dictionary as they're read, and
+ * a partially applied dictionary can't be undone.  So everything which
+ * could make the replay fail part way through, other than the contents
+ * of the statements, is checked before any of them are applied.
+ *
+ * @param[in] cache	to check.
+ * @param[in] max_argc	the number of arguments the tokenizer accepts.
+ * @return
+ *	- 0 if the statements are valid.
+ *	- -1 if they're not.
+ */
+static int dict_cache_verify(dict_cache_t const *cache, int max_argc)
+{
+	uint32_t	i, j;
+	uint32_t	depth = 0;
+
+	for (i = 0; i < cache->num_records; i++) {
+		dict_cache_record_t const	*record = &cache->records[i];
+		char const			*p, *end;
+
+		if ((record->file >= cache->num_files) || (record->argc > (uint32_t) max_argc)) return -1;
+
+		/*
+		 *	End of an $INCLUDE.  There must be one
+		 *	for each $INCLUDE, and no more.
+		 */
+		if (record->argc == 0) {
+			if (depth == 0) return -1;
+			depth--;
+			continue;
+		}
+
+		if (record->argv >= cache->strings_len) return -1;
+
+		p = cache->strings + record->argv;
+		end = cache->strings + cache->strings_len;
+
+		for (j = 0; j < record->argc; j++) {
+			if (p >= end) return -1;
+			p += strlen(p) + 1;	/* String table is '\0' terminated */
+		}
+
+		/*
+		 *	Files can't $INCLUDE themselves, so the
+		 *	nesting can't be deeper than the number
+		 *	of files.
+		 */
+		if (strncasecmp(cache->strings + record->argv, "$INCLUDE", 8) == 0) {
+			if (++depth >= cache->num_files) return -1;
+		}
+	}
+
+	return (depth == 0) ? 0 : -1;
+}
+
+/** Map a compiled dictionary, and check that it's current
+ *
+ * @param[in] ctx	to allocate the cache in.
+ * @param[in] filename	of the compiled dictionary.
+ * @param[in] max_argc	the number of arguments the tokenizer accepts.
+ * @return
+ *	- The mapped dictionary.
+ *	- NULL if the file doesn't exist, is invalid, or any of the
+ *	  source files have changed.
+ */
+dict_cache_t *dict_cache_open(TALLOC_CTX *ctx, char const *filename, int max_argc)
+{
+	dict_cache_t			*cache;
+	dict_cache_header_t const	*header;
+	struct stat			statbuf;
+	size_t				len;
+	uint32_t			i;
+	int				fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening %s: %s", filename, fr_syserror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &statbuf) < 0) {
+		fr_strerror_printf("Failed examining %s: %s", filename, fr_syserror(errno));
+	error:
+		close(fd);
+		return NULL;
+	}
+
+	/*
+	 *	Same checks as for the source files.
+	 */
+	if (!S_ISREG(statbuf.st_mode)) {
+		fr_strerror_printf("Compiled dictionary is not a regular file: %s", filename);
+		goto error;
+	}
+
+#ifdef S_IWOTH
+	if ((statbuf.st_mode & S_IWOTH) != 0) {
+		fr_strerror_printf("Compiled dictionary is globally writable: %s", filename);
+		goto error;
+	}
+#endif
+
+	if ((size_t) statbuf.st_size < sizeof(*header)) {
+		fr_strerror_printf("Compiled dictionary is truncated: %s", filename);
+		goto error;
+	}
+
+	MEM(cache = talloc_zero(ctx, dict_cache_t));
+
+	/*
+	 *	The tokenizer modifies the arguments in place, so map
+	 *	the file privately, and writably.
+	 */
+	cache->map_len = statbuf.st_size;
+	cache->map = mmap(NULL, cache->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (cache->map == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping %s: %s", filename, fr_syserror(errno));
+		cache->map = NULL;
+		talloc_free(cache);
+		return NULL;
+	}
+	talloc_set_destructor(cache, _dict_cache_free);
+
+	header = (dict_cache_header_t const *) cache->map;
+	if ((memcmp(header->magic, DICT_CACHE_MAGIC, sizeof(header->magic)) != 0) ||
+	    (header->version != DICT_CACHE_VERSION) ||
+	    (header->byte_order != DICT_CACHE_BYTE_ORDER)) {
+		fr_strerror_printf("Compiled dictionary %s was written by a different version of the server",
+				   filename);
+	invalid:
+		talloc_free(cache);
+		return NULL;
+	}
+
+	len = sizeof(*header) +
+	      ((uint64_t) header->num_files * sizeof(dict_cache_file_t)) +
+	      ((uint64_t) header->num_records * sizeof(dict_cache_record_t)) +
+	      header->strings_len;
+	if ((len != cache->map_len) || !header->strings_len) {
+		fr_strerror_printf("Compiled dictionary %s is truncated", filename);
+		goto invalid;
+	}
+
+	cache->num_files = header->num_files;
+	cache->num_records = header->num_records;
+	cache->strings_len = header->strings_len;
+	cache->files = (dict_cache_file_t *) (cache->map + sizeof(*header));
+	cache->records = (dict_cache_record_t *) (cache->files + cache->num_files);
+	cache->strings = (char *) (cache->records + cache->num_records);
+
+	/*
+	 *	Everything after this can trust the string table to
+	 *	be terminated.
+	 */
+	if (cache->strings[cache->strings_len - 1] != '\0') {
+		fr_strerror_printf("Compiled dictionary %s is corrupt", filename);
+		goto invalid;
+	}
+
+	if (dict_cache_verify(cache, max_argc) < 0) {
+		fr_strerror_printf("Compiled dictionary %s is corrupt", filename);
+		goto invalid;
+	}
+
+	/*
+	 *	Only use the compiled dictionary if it was compiled
+	 *	from the files we'd read now.
+	 */
+	for (i = 0; i < cache->num_files; i++) {
+		dict_cache_file_t const	*file = &cache->files[i];
+		uint8_t			digest[SHA1_DIGEST_LENGTH];
+		char const		*name;
+		int			ret;
+
+		if (file->name >= cache->strings_len) {
+			fr_strerror_printf("Compiled dictionary %s is corrupt", filename);
+			goto invalid;
+		}
+		name = cache->strings + file->name;
+
+		ret = dict_cache_digest(digest, name);
+		if (ret == -1) goto invalid;
+
+		if ((file->present != (ret == 0)) ||
+		    (file->present && (memcmp(digest, file->digest, sizeof(digest)) != 0))) {
+			fr_strerror_printf("Dictionary %s has changed since %s was compiled", name, filename);
+			goto invalid;
+		}
+	}
+
+	return cache;
+}
+
+/** Return the number of statements in a compiled dictionary
+ *
+ */
+uint32_t dict_cache_num_records(dict_cache_t const *cache)
+{
+	return cache->num_records;
+}
+
+/** Return a statement from a compiled dictionary
+ *
+ * @param[in] cache	to read from.
+ * @param[in] i		index of the statement.
+ * @param[out] filename	the statement was read from.
+ * @param[out] line	the statement was on.
+ * @param[out] argv	the arguments.  Point into the mapping, and may
+ *			be modified.
+ * @param[in] max_argc	the number of entries in argv.
+ * @return
+ *	- The number of arguments.
+ *	- 0 if this is the end of an $INCLUDE.
+ *	- -1 if the statement is invalid.
+ */
+int dict_cache_record(dict_cache_t *cache, uint32_t i, char **filename, int *line, char **argv, int max_argc)
+{
+	dict_cache_record_t const	*record = &cache->records[i];
+	char				*p, *end;
+	uint32_t			j;
+
+	if ((record->file >= cache->num_files) || (record->argc > (uint32_t) max_argc) ||
+	    (record->argv >= cache->strings_len)) {
+		fr_strerror_printf("Compiled dictionary is corrupt");
+		return -1;
+	}
+
+	*filename = cache->strings + cache->files[record->file].name;
+	*line = record->line;
+
+	p = cache->strings + record->argv;
+	end = cache->strings + cache->strings_len;
+
+	for (j = 0; j < record->argc; j++) {
+		if (p >= end) {
+			fr_strerror_printf("Compiled dictionary is corrupt");
+			return -1;
+		}
+		argv[j] = p;
+		p += strlen(p) + 1;
+	}
+
+	return record->argc;
+}
@@ -0,0 +1,229 @@
+#include <freeradius-devel/util/acutest.h>
+
+#include <freeradius-devel/util/dict_priv.h>
+#include <freeradius-devel/util/conf.h>
+
+#include <sys/stat.h>
+
+/*
+ *	Tests for compiled dictionaries.  Each test writes an
+ *	internal dictionary to a temporary directory, and loads it,
+ *	with or without a compiled copy next to it.
+ */
+static char	test_dir[] = "/tmp/dict_cache_tests.XXXXXX";
+static char	test_dict_dir[PATH_MAX];
+static char	test_dict_file[PATH_MAX];
+static char	test_cache_file[PATH_MAX];
+
+static void test_setup(char const *contents)
+{
+	FILE *fp;
+
+	if (!test_dict_dir[0]) {
+		TEST_ASSERT(mkdtemp(test_dir) != NULL);
+
+		snprintf(test_dict_dir, sizeof(test_dict_dir), "%s/internal", test_dir);
+		snprintf(test_dict_file, sizeof(test_dict_file), "%s/" FR_DICTIONARY_FILE, test_dict_dir);
+		snprintf(test_cache_file, sizeof(test_cache_file), "%s" FR_DICTIONARY_CACHE_SUFFIX, test_dict_file);
+
+		TEST_ASSERT(mkdir(test_dict_dir, 0700) == 0);
+	}
+
+	unlink(test_cache_file);
+
+	fp = fopen(test_dict_file, "w");
+	TEST_ASSERT(fp != NULL);
+	fputs(contents, fp);
+	fclose(fp);
+}
+
+/** Load the internal dictionary from the test directory
+ *
+ * @param[out] gctx	Global dictionary context, to free after the dictionary.
+ * @param[in] compile	Write a compiled copy of the dictionary.
+ * @return the dictionary.
+ */
+static fr_dict_t *test_load(fr_dict_gctx_t const **gctx, bool compile)
+{
+	fr_dict_t	*dict = NULL;
+
+	*gctx = fr_dict_global_ctx_init(NULL, test_dir);
+	TEST_ASSERT(*gctx != NULL);
+	fr_dict_global_ctx_set(*gctx);
+	fr_dict_global_compile(compile);
+
+	if (!TEST_CHECK(fr_dict_internal_afrom_file(&dict, "internal") == 0)) {
+		TEST_MSG("Failed loading dictionary: %s", fr_strerror());
+		return NULL;
+	}
+
+	return dict;
+}
+
+static void test_free(fr_dict_t *dict, fr_dict_gctx_t const *gctx)
+{
+	fr_dict_free(&dict);
+	TEST_CHECK(fr_dict_global_ctx_free(gctx) == 0);
+}
+
+/** Write a compiled dictionary which defines an attribute the text file doesn't
+ *
+ * If the attribute is found after loading, the compiled copy was used.
+ */
+static void test_write_cache_only(bool include_end)
+{
+	dict_cache_t	*cache;
+	char		*argv[] = { "ATTRIBUTE", "Cache-Only", "3001", "string" };
+	int		file;
+
+	cache = dict_cache_alloc(NULL);
+	TEST_ASSERT(cache != NULL);
+
+	file = dict_cache_file_add(cache, test_dict_file);
+	TEST_ASSERT(file >= 0);
+
+	TEST_CHECK(dict_cache_line_add(cache, file, 1, 4, argv) == 0);
+
+	/*
+	 *	End of an $INCLUDE with no $INCLUDE
+	 */
+	if (include_end) TEST_CHECK(dict_cache_include_end(cache, file, 2) == 0);
+
+	TEST_CHECK(dict_cache_write(cache, test_cache_file) == 0);
+	talloc_free(cache);
+}
+
+#define TEST_DICT "ATTRIBUTE	Cache-Text	3000	string\n"
+
+static void test_compile_then_load(void)
+{
+	fr_dict_gctx_t const	*gctx;
+	fr_dict_t		*dict;
+	struct stat		statbuf;
+
+	test_setup(TEST_DICT);
+
+	TEST_CASE("Compiling writes the compiled dictionary");
+	dict = test_load(&gctx, true);
+	TEST_ASSERT(dict != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Text") != NULL);
+	test_free(dict, gctx);
+
+	TEST_CHECK(stat(test_cache_file, &statbuf) == 0);
+
+	TEST_CASE("The compiled dictionary is valid, and current");
+	{
+		dict_cache_t *cache;
+
+		cache = dict_cache_open(NULL, test_cache_file, 16);
+		TEST_CHECK(cache != NULL);
+		TEST_MSG("Failed opening compiled dictionary: %s", fr_strerror());
+		if (cache) TEST_CHECK(dict_cache_num_records(cache) == 1);
+		talloc_free(cache);
+	}
+
+	TEST_CASE("Loading from the compiled dictionary");
+	dict = test_load(&gctx, false);
+	TEST_ASSERT(dict != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Text") != NULL);
+	test_free(dict, gctx);
+}
+
+static void test_load_from_cache(void)
+{
+	fr_dict_gctx_t const	*gctx;
+	fr_dict_t		*dict;
+
+	test_setup(TEST_DICT);
+	test_write_cache_only(false);
+
+	dict = test_load(&gctx, false);
+	TEST_ASSERT(dict != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Only") != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Text") == NULL);
+	test_free(dict, gctx);
+}
+
+static void test_stale_digest(void)
+{
+	fr_dict_gctx_t const	*gctx;
+	fr_dict_t		*dict;
+	FILE			*fp;
+
+	test_setup(TEST_DICT);
+	test_write_cache_only(false);
+
+	fp = fopen(test_dict_file, "a");
+	TEST_ASSERT(fp != NULL);
+	fputs("ATTRIBUTE	Cache-Text-2	3002	string\n", fp);
+	fclose(fp);
+
+	TEST_CHECK(dict_cache_open(NULL, test_cache_file, 16) == NULL);
+
+	dict = test_load(&gctx, false);
+	TEST_ASSERT(dict != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Only") == NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Text") != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Text-2") != NULL);
+	test_free(dict, gctx);
+}
+
+static void test_truncated(void)
+{
+	fr_dict_gctx_t const	*gctx;
+	fr_dict_t		*dict;
+	struct stat		statbuf;
+
+	test_setup(TEST_DICT);
+	test_write_cache_only(false);
+
+	TEST_ASSERT(stat(test_cache_file, &statbuf) == 0);
+	TEST_ASSERT(truncate(test_cache_file, statbuf.st_size - 1) == 0);
+
+	TEST_CHECK(dict_cache_open(NULL, test_cache_file, 16) == NULL);
+
+	dict = test_load(&gctx, false);
+	TEST_ASSERT(dict != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Only") == NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Text") != NULL);
+	test_free(dict, gctx);
+}
+
+/*
+ *	The first record is valid, so a cache which was only checked
+ *	as it was replayed would have added Cache-Only before failing.
+ */
+static void test_corrupt_record(void)
+{
+	fr_dict_gctx_t const	*gctx;
+	fr_dict_t		*dict;
+
+	test_setup(TEST_DICT);
+	test_write_cache_only(true);
+
+	TEST_CHECK(dict_cache_open(NULL, test_cache_file, 16) == NULL);
+
+	dict = test_load(&gctx, false);
+	TEST_ASSERT(dict != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Only") == NULL);
+	TEST_CHECK(fr_dict_attr_by_name(dict, "Cache-Text") != NULL);
+	test_free(dict, gctx);
+}
+
+static void test_cleanup(void)
+{
+	unlink(test_cache_file);
+	unlink(test_dict_file);
+	rmdir(test_dict_dir);
+	rmdir(test_dir);
+}
+
+TEST_LIST = {
+	{ "Compile then load",		test_compile_then_load },
+	{ "Load from cache",		test_load_from_cache },
+	{ "Reject stale digest",	test_stale_digest },
+	{ "Reject truncated file",	test_truncated },
+	{ "Reject corrupt record",	test_corrupt_record },
+	{ "Cleanup",			test_cleanup },
+	{ NULL }
+};
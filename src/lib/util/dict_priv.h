@@ -103,6 +103,8 @@ struct fr_dict {
 
 struct fr_dict_gctx_s {
 	bool			read_only;
+	bool			compile;		//!< Write a compiled copy of each dictionary
+							///< file we read.
 	char			*dict_dir_default;	//!< The default location for loading dictionaries if one
 							///< wasn't provided.
 
@@ -208,6 +210,30 @@ fr_dict_t		*dict_by_da(fr_dict_attr_t const *da);
 
 fr_dict_t		*dict_by_attr_name(fr_dict_attr_t const **found, char const *name);
 
+/** @name Compiled dictionaries
+ *
+ * @{
+ */
+typedef struct dict_cache_s dict_cache_t;
+
+dict_cache_t		*dict_cache_alloc(TALLOC_CTX *ctx);
+
+int			dict_cache_file_add(dict_cache_t *cache, char const *filename);
+
+int			dict_cache_line_add(dict_cache_t *cache, int file, int line, int argc, char **argv);
+
+int			dict_cache_include_end(dict_cache_t *cache, int file, int line);
+
+int			dict_cache_write(dict_cache_t *cache, char const *filename);
+
+dict_cache_t		*dict_cache_open(TALLOC_CTX *ctx, char const *filename, int max_argc);
+
+uint32_t		dict_cache_num_records(dict_cache_t const *cache);
+
+int			dict_cache_record(dict_cache_t *cache, uint32_t i,
+					  char **filename, int *line, char **argv, int max_argc);
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
@@ -91,6 +91,9 @@ typedef struct {
 
 	dict_enum_fixup_t	*enum_fixup;
 	dict_group_fixup_t	*group_fixup;
+
+	dict_cache_t		*cache;			//!< Records the statements we read, if we're
+							///< compiling the dictionary.
 } dict_tokenize_ctx_t;
 
 /*
@@ -1595,6 +1598,485 @@ static int fr_dict_finalise(dict_tokenize_ctx_t *ctx)
 	return 0;
 }
 
+/** Process a single statement from a dictionary
+ *
+ * $INCLUDE is handled by the caller, as it depends on where the statement
+ * came from.
+ *
+ * @param[in] ctx		Contains the current state of the dictionary parser.
+ * @param[in] argv		The statement, split into arguments.
+ * @param[in] argc		Number of arguments.
+ * @param[in,out] base_flags	Set by FLAGS, for the rest of the current file.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int dict_read_process_line(dict_tokenize_ctx_t *ctx, char **argv, int argc,
+				  fr_dict_attr_flags_t *base_flags)
+{
+	fr_dict_attr_t const	*da;
+	char			*p;
+
+	/*
+	 *	Perhaps this is an attribute.
+	 */
+	if (strcasecmp(argv[0], "ATTRIBUTE") == 0) {
+		if (dict_read_process_attribute(ctx,
+						argv + 1, argc - 1,
+						base_flags) == -1) return -1;
+		return 0;
+	}
+
+	/*
+	 *	Process VALUE lines.
+	 */
+	if (strcasecmp(argv[0], "VALUE") == 0) {
+		if (dict_read_process_value(ctx, argv + 1, argc - 1) == -1) return -1;
+		return 0;
+	}
+
+	/*
+	 *	Process FLAGS lines.
+	 */
+	if (strcasecmp(argv[0], "FLAGS") == 0) {
+		if (dict_read_process_flags(ctx->dict, argv + 1, argc - 1, base_flags) == -1) return -1;
+		return 0;
+	}
+
+	/*
+	 *	Perhaps this is a MEMBER of a struct
+	 *
+	 *	@todo - create child ctx, so that we can have
+	 *	nested structs.
+	 */
+	if (strcasecmp(argv[0], "MEMBER") == 0) {
+		if (dict_read_process_member(ctx,
+					     argv + 1, argc - 1,
+					     base_flags) == -1) return -1;
+		return 0;
+	}
+
+	/*
+	 *	Process STRUCT lines.
+	 */
+	if (strcasecmp(argv[0], "STRUCT") == 0) {
+		if (dict_read_process_struct(ctx, argv + 1, argc - 1) == -1) return -1;
+		return 0;
+	}
+
+	/*
+	 *	Reset the previous attribute when we see
+	 *	VENDOR or PROTOCOL or BEGIN/END-VENDOR, etc.
+	 */
+	ctx->value_attr = NULL;
+	ctx->relative_attr = NULL;
+
+	/*
+	 *	Process VENDOR lines.
+	 */
+	if (strcasecmp(argv[0], "VENDOR") == 0) {
+		if (dict_read_process_vendor(ctx->dict, argv + 1, argc - 1) == -1) return -1;
+		return 0;
+	}
+
+	/*
+	 *	Process PROTOCOL line.  Defines a new protocol.
+	 */
+	if (strcasecmp(argv[0], "PROTOCOL") == 0) {
+		if (argc < 2) {
+			fr_strerror_printf_push("Invalid PROTOCOL entry");
+			return -1;
+		}
+		if (dict_read_process_protocol(argv + 1, argc - 1) == -1) return -1;
+		return 0;
+	}
+
+	/*
+	 *	Switches the current protocol context
+	 */
+	if (strcasecmp(argv[0], "BEGIN-PROTOCOL") == 0) {
+		fr_dict_t *found;
+
+		if (argc != 2) {
+			fr_strerror_printf_push("Invalid BEGIN-PROTOCOL entry");
+			return -1;
+		}
+
+		/*
+		 *	If we're not parsing in the context of the internal
+		 *	dictionary, then we don't allow BEGIN-PROTOCOL
+		 *	statements.
+		 */
+		if (ctx->dict != dict_gctx->internal) {
+			fr_strerror_printf_push("Nested BEGIN-PROTOCOL statements are not allowed");
+			return -1;
+		}
+
+		found = dict_by_protocol_name(argv[1]);
+		if (!found) {
+			fr_strerror_printf("Unknown protocol '%s'", argv[1]);
+			return -1;
+		}
+
+		/*
+		 *	Add a temporary fixup pool
+		 *
+		 *	@todo - make a nested ctx?
+		 */
+		if (!ctx->fixup_pool) ctx->fixup_pool = talloc_pool(NULL, DICT_FIXUP_POOL_SIZE);
+
+
+		// check if there's a linked library for the
+		// protocol.  The values can be unknown (we
+		// try to load one), or non-existent, or
+		// known.  For the last two, we don't try to
+		// load anything.
+
+		ctx->dict = found;
+
+		if (dict_gctx_push(ctx, ctx->dict->root) < 0) return -1;
+		ctx->stack[ctx->stack_depth].nest = FR_TYPE_MAX;
+		return 0;
+	}
+
+	/*
+	 *	Switches back to the previous protocol context
+	 */
+	if (strcasecmp(argv[0], "END-PROTOCOL") == 0) {
+		fr_dict_t const *found;
+
+		if (argc != 2) {
+			fr_strerror_printf("Invalid END-PROTOCOL entry");
+			return -1;
+		}
+
+		found = dict_by_protocol_name(argv[1]);
+		if (!found) {
+			fr_strerror_printf("END-PROTOCOL %s does not refer to a valid protocol", argv[1]);
+			return -1;
+		}
+
+		if (found != ctx->dict) {
+			fr_strerror_printf("END-PROTOCOL %s does not match previous BEGIN-PROTOCOL %s",
+					   argv[1], found->root->name);
+			return -1;
+		}
+
+		/*
+		 *	Pop the stack until we get to a PROTOCOL nesting.
+		 */
+		while ((ctx->stack_depth > 0) && (ctx->stack[ctx->stack_depth].nest != FR_TYPE_MAX)) {
+			if (ctx->stack[ctx->stack_depth].nest != FR_TYPE_INVALID) {
+				fr_strerror_printf_push("END-PROTOCOL %s with mismatched BEGIN-??? %s", argv[1],
+					ctx->stack[ctx->stack_depth].da->name);
+				return -1;
+			}
+
+			ctx->stack_depth--;
+		}
+
+		if (ctx->stack_depth == 0) {
+			fr_strerror_printf_push("END-PROTOCOL %s with no previous BEGIN-PROTOCOL", argv[1]);
+			return -1;
+		}
+
+		if (found->root != ctx->stack[ctx->stack_depth].da) {
+			fr_strerror_printf_push("END-PROTOCOL %s does not match previous BEGIN-PROTOCOL %s", argv[1],
+						ctx->stack[ctx->stack_depth].da->name);
+			return -1;
+		}
+
+		/*
+		 *	Applies fixups to any attributes added
+		 *	to the protocol dictionary.  Note that
+		 *	the finalise function prints out the
+		 *	original filename / line of the
+		 *	error. So we don't need to do that
+		 *	here.
+		 */
+		if (fr_dict_finalise(ctx) < 0) return -1;
+
+		ctx->stack_depth--;
+		ctx->dict = ctx->stack[ctx->stack_depth].dict;
+		return 0;
+	}
+
+	/*
+	 *	Switches TLV parent context
+	 */
+	if (strcasecmp(argv[0], "BEGIN-TLV") == 0) {
+		fr_dict_attr_t const *common;
+
+		if (argc != 2) {
+			fr_strerror_printf_push("Invalid BEGIN-TLV entry");
+			return -1;
+		}
+
+		da = dict_attr_by_name(ctx->dict, argv[1]);
+		if (!da) {
+			fr_strerror_printf_push("Unknown attribute '%s'", argv[1]);
+			return -1;
+		}
+
+		if (da->type != FR_TYPE_TLV) {
+			fr_strerror_printf_push("Attribute '%s' should be a 'tlv', but is a '%s'",
+						argv[1],
+						fr_table_str_by_value(fr_value_box_type_table, da->type, "?Unknown?"));
+			return -1;
+		}
+
+		common = fr_dict_parent_common(ctx->stack[ctx->stack_depth].da, da, true);
+		if (!common ||
+		    (common->type == FR_TYPE_VSA)) {
+			fr_strerror_printf_push("Attribute '%s' should be a child of '%s'",
+						argv[1], ctx->stack[ctx->stack_depth].da->name);
+			return -1;
+		}
+
+		if (dict_gctx_push(ctx, da) < 0) return -1;
+		ctx->stack[ctx->stack_depth].nest = FR_TYPE_TLV;
+		return 0;
+	} /* BEGIN-TLV */
+
+	/*
+	 *	Switches back to previous TLV parent
+	 */
+	if (strcasecmp(argv[0], "END-TLV") == 0) {
+		if (argc != 2) {
+			fr_strerror_printf_push("Invalid END-TLV entry");
+			return -1;
+		}
+
+		da = dict_attr_by_name(ctx->dict, argv[1]);
+		if (!da) {
+			fr_strerror_printf_push("Unknown attribute '%s'", argv[1]);
+			return -1;
+		}
+
+		/*
+		 *	Pop the stack until we get to a TLV nesting.
+		 */
+		while ((ctx->stack_depth > 0) && (ctx->stack[ctx->stack_depth].nest != FR_TYPE_TLV)) {
+			if (ctx->stack[ctx->stack_depth].nest != FR_TYPE_INVALID) {
+				fr_strerror_printf_push("END-TLV %s with mismatched BEGIN-??? %s", argv[1],
+					ctx->stack[ctx->stack_depth].da->name);
+				return -1;
+			}
+
+			ctx->stack_depth--;
+		}
+
+		if (ctx->stack_depth == 0) {
+			fr_strerror_printf_push("END-TLV %s with no previous BEGIN-TLV", argv[1]);
+			return -1;
+		}
+
+		if (da != ctx->stack[ctx->stack_depth].da) {
+			fr_strerror_printf_push("END-TLV %s does not match previous BEGIN-TLV %s", argv[1],
+						ctx->stack[ctx->stack_depth].da->name);
+			return -1;
+		}
+
+		ctx->stack_depth--;
+		return 0;
+	} /* END-VENDOR */
+
+	if (strcasecmp(argv[0], "BEGIN-VENDOR") == 0) {
+		fr_dict_vendor_t const	*vendor;
+		fr_dict_attr_flags_t	flags;
+
+		fr_dict_attr_t const	*vsa_da;
+		fr_dict_attr_t const	*vendor_da;
+		fr_dict_attr_t		*new;
+		fr_dict_attr_t		*mutable;
+
+		if (argc < 2) {
+			fr_strerror_printf_push("Invalid BEGIN-VENDOR entry");
+			return -1;
+		}
+
+		vendor = fr_dict_vendor_by_name(ctx->dict, argv[1]);
+		if (!vendor) {
+			fr_strerror_printf_push("Unknown vendor '%s'", argv[1]);
+			return -1;
+		}
+
+		/*
+		 *	Check for extended attr VSAs
+		 *
+		 *	BEGIN-VENDOR foo parent=Foo-Encapsulation-Attr
+		 */
+		if (argc > 2) {
+			if (strncmp(argv[2], "parent=", 7) != 0) {
+				fr_strerror_printf_push("Invalid format %s", argv[2]);
+				return -1;
+			}
+
+			p = argv[2] + 7;
+			da = dict_attr_by_name(ctx->dict, p);
+			if (!da) {
+				fr_strerror_printf_push("Invalid format for BEGIN-VENDOR: Unknown "
+							"parent attribute '%s'", p);
+				return -1;
+			}
+
+			if (da->type != FR_TYPE_VSA) {
+				fr_strerror_printf_push("Invalid parent for BEGIN-VENDOR.  "
+							"Attribute '%s' should be 'vsa' but is '%s'", p,
+							fr_table_str_by_value(fr_value_box_type_table, da->type, "?Unknown?"));
+				return -1;
+			}
+
+			if (da->parent->type != FR_TYPE_EXTENDED) {
+				fr_strerror_printf_push("Invalid format for BEGIN-VENDOR.  "
+							"Attribute '%s' should be parented from an attribute of type 'extended', but is '%s'", p,
+							fr_table_str_by_value(fr_value_box_type_table, da->type, "?Unknown?"));
+				return -1;
+			}
+
+			vsa_da = da;
+
+		} else if (!ctx->dict->vsa_parent) {
+			fr_strerror_printf_push("BEGIN-VENDOR is forbidden for protocol %s",
+						ctx->dict->root->name);
+			return -1;
+
+		} else {
+			/*
+			 *	Check that the protocol-specific VSA parent exists.
+			 */
+			vsa_da = dict_attr_child_by_num(ctx->stack[ctx->stack_depth].da, ctx->dict->vsa_parent);
+			if (!vsa_da) {
+				fr_strerror_printf_push("Failed finding VSA parent for Vendor %s",
+							vendor->name);
+				return -1;
+			}
+		}
+
+		/*
+		 *	Create a VENDOR attribute on the fly, either in the context
+		 *	of the VSA (26) attribute.
+		 */
+		vendor_da = dict_attr_child_by_num(vsa_da, vendor->pen);
+		if (!vendor_da) {
+			memset(&flags, 0, sizeof(flags));
+
+			flags.type_size = ctx->dict->default_type_size;
+			flags.length = ctx->dict->default_type_length;
+
+			/*
+			 *	See if this vendor has
+			 *	specific sizes for type /
+			 *	length.
+			 *
+			 *	@todo - Make this more protocol agnostic!
+			 */
+			if ((vsa_da->type == FR_TYPE_VSA) &&
+			    (vsa_da->parent->flags.is_root)) {
+				fr_dict_vendor_t const *dv;
+
+				dv = fr_dict_vendor_by_num(ctx->dict, vendor->pen);
+				if (dv) {
+					flags.type_size = dv->type;
+					flags.length = dv->length;
+				}
+			}
+
+			memcpy(&mutable, &vsa_da, sizeof(mutable));
+			new = dict_attr_alloc(mutable, ctx->stack[ctx->stack_depth].da, argv[1],
+					      vendor->pen, FR_TYPE_VENDOR, &flags);
+			if (dict_attr_child_add(mutable, new) < 0) {
+				talloc_free(new);
+				return -1;
+			}
+
+			vendor_da = new;
+		}
+
+		if (dict_gctx_push(ctx, vendor_da) < 0) return -1;
+		ctx->stack[ctx->stack_depth].nest = FR_TYPE_VENDOR;
+		return 0;
+	} /* BEGIN-VENDOR */
+
+	if (strcasecmp(argv[0], "END-VENDOR") == 0) {
+		fr_dict_vendor_t const *vendor;
+
+		if (argc != 2) {
+			fr_strerror_printf_push("Invalid END-VENDOR entry");
+			return -1;
+		}
+
+		vendor = fr_dict_vendor_by_name(ctx->dict, argv[1]);
+		if (!vendor) {
+			fr_strerror_printf_push("Unknown vendor '%s'", argv[1]);
+			return -1;
+		}
+
+		/*
+		 *	Pop the stack until we get to a VENDOR nesting.
+		 */
+		while ((ctx->stack_depth > 0) && (ctx->stack[ctx->stack_depth].nest != FR_TYPE_VENDOR)) {
+			if (ctx->stack[ctx->stack_depth].nest != FR_TYPE_INVALID) {
+				fr_strerror_printf_push("END-VENDOR %s with mismatched BEGIN-??? %s", argv[1],
+					ctx->stack[ctx->stack_depth].da->name);
+				return -1;
+			}
+
+			ctx->stack_depth--;
+		}
+
+		if (ctx->stack_depth == 0) {
+			fr_strerror_printf_push("END-VENDOR %s with no previous BEGIN-VENDOR", argv[1]);
+			return -1;
+		}
+
+		if (vendor->pen != ctx->stack[ctx->stack_depth].da->attr) {
+			fr_strerror_printf_push("END-VENDOR %s does not match previous BEGIN-VENDOR %s", argv[1],
+						ctx->stack[ctx->stack_depth].da->name);
+			return -1;
+		}
+
+		ctx->stack_depth--;
+		return 0;
+	} /* END-VENDOR */
+
+	/*
+	 *	Any other string: We don't recognize it.
+	 */
+	fr_strerror_printf_push("Invalid keyword '%s'", argv[0]);
+	return -1;
+}
+
+/** Check the parser state after an $INCLUDE
+ *
+ * @param[in] ctx		Contains the current state of the dictionary parser.
+ * @param[in] stack_depth	before the $INCLUDE.
+ * @param[in] fn		The file containing the $INCLUDE.
+ * @param[in] line		of the $INCLUDE.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int dict_include_end(dict_tokenize_ctx_t *ctx, int stack_depth, char const *fn, int line)
+{
+	if (ctx->stack_depth < stack_depth) {
+		fr_strerror_printf_push("unexpected END-??? in $INCLUDE at %s[%d]", fn, line);
+		return -1;
+	}
+
+	while (ctx->stack_depth > stack_depth) {
+		if (ctx->stack[ctx->stack_depth].nest == FR_TYPE_INVALID) {
+			ctx->stack_depth--;
+			continue;
+		}
+
+		fr_strerror_printf_push("BEGIN-??? without END-... in file $INCLUDEd from %s[%d]", fn, line);
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Parse a dictionary file
  *
  * @param[in] ctx	Contains the current state of the dictionary parser.
@@ -1622,7 +2104,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 	struct stat		statbuf;
 	char			*argv[MAX_ARGV];
 	int			argc;
-	fr_dict_attr_t const	*da;
+	int			cache_file = -1;
 
 	/*
 	 *	Base flags are only set for the current file
@@ -1679,6 +2161,15 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 
 	ctx->stack[ctx->stack_depth].filename = fn;
 
+	/*
+	 *	Record the file even if it doesn't exist, so that
+	 *	we notice if an optional $INCLUDE- is created.
+	 */
+	if (ctx->cache) {
+		cache_file = dict_cache_file_add(ctx->cache, fn);
+		if (cache_file < 0) return -1;
+	}
+
 	if ((fp = fopen(fn, "r")) == NULL) {
 		if (!src_file) {
 			fr_strerror_printf_push("Couldn't open dictionary %s: %s", fr_syserror(errno), fn);
@@ -1755,65 +2246,22 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		}
 
 		/*
-		 *	Perhaps this is an attribute.
-		 */
-		if (strcasecmp(argv[0], "ATTRIBUTE") == 0) {
-			if (dict_read_process_attribute(ctx,
-							argv + 1, argc - 1,
-							&base_flags) == -1) goto error;
-			continue;
-		}
-
-		/*
-		 *	Process VALUE lines.
-		 */
-		if (strcasecmp(argv[0], "VALUE") == 0) {
-			if (dict_read_process_value(ctx, argv + 1, argc - 1) == -1) goto error;
-			continue;
-		}
-
-		/*
-		 *	Process FLAGS lines.
-		 */
-		if (strcasecmp(argv[0], "FLAGS") == 0) {
-			if (dict_read_process_flags(ctx->dict, argv + 1, argc - 1, &base_flags) == -1) goto error;
-			continue;
-		}
-
-		/*
-		 *	Perhaps this is a MEMBER of a struct
-		 *
-		 *	@todo - create child ctx, so that we can have
-		 *	nested structs.
+		 *	Record the statement before processing it, as
+		 *	processing modifies the arguments.
 		 */
-		if (strcasecmp(argv[0], "MEMBER") == 0) {
-			if (dict_read_process_member(ctx,
-						     argv + 1, argc - 1,
-						     &base_flags) == -1) goto error;
-			continue;
-		}
-
-		/*
-		 *	Process STRUCT lines.
-		 */
-		if (strcasecmp(argv[0], "STRUCT") == 0) {
-			if (dict_read_process_struct(ctx, argv + 1, argc - 1) == -1) goto error;
-			continue;
-		}
+		if (ctx->cache && (dict_cache_line_add(ctx->cache, cache_file, line, argc, argv) < 0)) goto error;
 
 		/*
 		 *	See if we need to import another dictionary.
+		 *
+		 *	Allow "$INCLUDE" or "$INCLUDE-", but not
+		 *	anything else.
 		 */
-		if (strncasecmp(argv[0], "$INCLUDE", 8) == 0) {
+		if ((strncasecmp(argv[0], "$INCLUDE", 8) == 0) &&
+		    ((argv[0][8] == '\0') || ((argv[0][8] == '-') && (argv[0][9] == '\0')))) {
 			int rcode;
 			int stack_depth = ctx->stack_depth;
 
-			/*
-			 *	Allow "$INCLUDE" or "$INCLUDE-", but
-			 *	not anything else.
-			 */
-			if ((argv[0][8] != '\0') && ((argv[0][8] != '-') || (argv[0][9] != '\0'))) goto invalid_keyword;
-
 			/*
 			 *	Included files operate on a copy of the context.
 			 *
@@ -1837,22 +2285,12 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 				return -1;
 			}
 
-			if (ctx->stack_depth < stack_depth) {
-				fr_strerror_printf_push("unexpected END-??? in $INCLUDE at %s[%d]", fn, line);
+			if (dict_include_end(ctx, stack_depth, fn, line) < 0) {
 				fclose(fp);
 				return -1;
 			}
 
-			while (ctx->stack_depth > stack_depth) {
-				if (ctx->stack[ctx->stack_depth].nest == FR_TYPE_INVALID) {
-					ctx->stack_depth--;
-					continue;
-				}
-
-				fr_strerror_printf_push("BEGIN-??? without END-... in file $INCLUDEd from %s[%d]", fn, line);
-				fclose(fp);
-				return -1;
-			}
+			if (ctx->cache && (dict_cache_include_end(ctx->cache, cache_file, line) < 0)) goto error;
 
 			/*
 			 *	Reset the filename.
@@ -1861,401 +2299,74 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 			continue;
 		} /* $INCLUDE */
 
-		/*
-		 *	Reset the previous attribute when we see
-		 *	VENDOR or PROTOCOL or BEGIN/END-VENDOR, etc.
-		 */
-		ctx->value_attr = NULL;
-		ctx->relative_attr = NULL;
-
-		/*
-		 *	Process VENDOR lines.
-		 */
-		if (strcasecmp(argv[0], "VENDOR") == 0) {
-			if (dict_read_process_vendor(ctx->dict, argv + 1, argc - 1) == -1) goto error;
-			continue;
-		}
-
-		/*
-		 *	Process PROTOCOL line.  Defines a new protocol.
-		 */
-		if (strcasecmp(argv[0], "PROTOCOL") == 0) {
-			if (argc < 2) {
-				fr_strerror_printf_push("Invalid PROTOCOL entry");
-				goto error;
-			}
-			if (dict_read_process_protocol(argv + 1, argc - 1) == -1) goto error;
-			continue;
-		}
-
-		/*
-		 *	Switches the current protocol context
-		 */
-		if (strcasecmp(argv[0], "BEGIN-PROTOCOL") == 0) {
-			fr_dict_t *found;
-
-			if (argc != 2) {
-				fr_strerror_printf_push("Invalid BEGIN-PROTOCOL entry");
-				goto error;
-			}
-
-			/*
-			 *	If we're not parsing in the context of the internal
-			 *	dictionary, then we don't allow BEGIN-PROTOCOL
-			 *	statements.
-			 */
-			if (ctx->dict != dict_gctx->internal) {
-				fr_strerror_printf_push("Nested BEGIN-PROTOCOL statements are not allowed");
-				goto error;
-			}
+		if (dict_read_process_line(ctx, argv, argc, &base_flags) < 0) goto error;
+	}
 
-			found = dict_by_protocol_name(argv[1]);
-			if (!found) {
-				fr_strerror_printf("Unknown protocol '%s'", argv[1]);
-				goto error;
-			}
+	/*
+	 *	Note that we do NOT walk back up the stack to check
+	 *	for missing END-FOO to match BEGIN-FOO.  The context
+	 *	was copied from the parent, so there are guaranteed to
+	 *	be missing things.
+	 */
 
-			/*
-			 *	Add a temporary fixup pool
-			 *
-			 *	@todo - make a nested ctx?
-			 */
-			if (!ctx->fixup_pool) ctx->fixup_pool = talloc_pool(NULL, DICT_FIXUP_POOL_SIZE);
+	fclose(fp);
+	return 0;
+}
 
+/** Replay the statements from a compiled dictionary
+ *
+ * Mirrors _dict_from_file(), but the statements have already been read,
+ * split, and had their $INCLUDEs expanded.
+ *
+ * @param[in] ctx	Contains the current state of the dictionary parser.
+ * @param[in] cache	The compiled dictionary.
+ * @param[in,out] i	Index of the next statement.  Left pointing after the
+ *			end of the $INCLUDE we were called for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int _dict_from_cache(dict_tokenize_ctx_t *ctx, dict_cache_t *cache, uint32_t *i)
+{
+	uint32_t		num = dict_cache_num_records(cache);
+	char			*fn;
+	int			line;
+	char			*argv[MAX_ARGV];
+	int			argc;
+	fr_dict_attr_flags_t	base_flags;
 
-			// check if there's a linked library for the
-			// protocol.  The values can be unknown (we
-			// try to load one), or non-existent, or
-			// known.  For the last two, we don't try to
-			// load anything.
+	memset(&base_flags, 0, sizeof(base_flags));
 
-			ctx->dict = found;
-
-			if (dict_gctx_push(ctx, ctx->dict->root) < 0) goto error;
-			ctx->stack[ctx->stack_depth].nest = FR_TYPE_MAX;
-			continue;
-		}
+	while (*i < num) {
+		argc = dict_cache_record(cache, (*i)++, &fn, &line, argv, MAX_ARGV);
+		if (argc < 0) return -1;
 
 		/*
-		 *	Switches back to the previous protocol context
+		 *	End of the file we were $INCLUDEd for.
 		 */
-		if (strcasecmp(argv[0], "END-PROTOCOL") == 0) {
-			fr_dict_t const *found;
-
-			if (argc != 2) {
-				fr_strerror_printf("Invalid END-PROTOCOL entry");
-				goto error;
-			}
-
-			found = dict_by_protocol_name(argv[1]);
-			if (!found) {
-				fr_strerror_printf("END-PROTOCOL %s does not refer to a valid protocol", argv[1]);
-				goto error;
-			}
-
-			if (found != ctx->dict) {
-				fr_strerror_printf("END-PROTOCOL %s does not match previous BEGIN-PROTOCOL %s",
-						   argv[1], found->root->name);
-				goto error;
-			}
+		if (argc == 0) return 0;
 
-			/*
-			 *	Pop the stack until we get to a PROTOCOL nesting.
-			 */
-			while ((ctx->stack_depth > 0) && (ctx->stack[ctx->stack_depth].nest != FR_TYPE_MAX)) {
-				if (ctx->stack[ctx->stack_depth].nest != FR_TYPE_INVALID) {
-					fr_strerror_printf_push("END-PROTOCOL %s with mismatched BEGIN-??? %s", argv[1],
-						ctx->stack[ctx->stack_depth].da->name);
-					goto error;
-				}
-
-				ctx->stack_depth--;
-			}
-
-			if (ctx->stack_depth == 0) {
-				fr_strerror_printf_push("END-PROTOCOL %s with no previous BEGIN-PROTOCOL", argv[1]);
-				goto error;
-			}
+		ctx->stack[ctx->stack_depth].filename = fn;
+		ctx->stack[ctx->stack_depth].line = line;
 
-			if (found->root != ctx->stack[ctx->stack_depth].da) {
-				fr_strerror_printf_push("END-PROTOCOL %s does not match previous BEGIN-PROTOCOL %s", argv[1],
-							ctx->stack[ctx->stack_depth].da->name);
-				goto error;
-			}
+		if (strncasecmp(argv[0], "$INCLUDE", 8) == 0) {
+			int stack_depth = ctx->stack_depth;
 
-			/*
-			 *	Applies fixups to any attributes added
-			 *	to the protocol dictionary.  Note that
-			 *	the finalise function prints out the
-			 *	original filename / line of the
-			 *	error. So we don't need to do that
-			 *	here.
-			 */
-			if (fr_dict_finalise(ctx) < 0) {
-				fclose(fp);
+			if (_dict_from_cache(ctx, cache, i) < 0) {
+				fr_strerror_printf_push("from $INCLUDE at %s[%d]", fn, line);
 				return -1;
 			}
 
-			ctx->stack_depth--;
-			ctx->dict = ctx->stack[ctx->stack_depth].dict;
+			if (dict_include_end(ctx, stack_depth, fn, line) < 0) return -1;
 			continue;
 		}
 
-		/*
-		 *	Switches TLV parent context
-		 */
-		if (strcasecmp(argv[0], "BEGIN-TLV") == 0) {
-			fr_dict_attr_t const *common;
-
-			if (argc != 2) {
-				fr_strerror_printf_push("Invalid BEGIN-TLV entry");
-				goto error;
-			}
-
-			da = dict_attr_by_name(ctx->dict, argv[1]);
-			if (!da) {
-				fr_strerror_printf_push("Unknown attribute '%s'", argv[1]);
-				goto error;
-			}
-
-			if (da->type != FR_TYPE_TLV) {
-				fr_strerror_printf_push("Attribute '%s' should be a 'tlv', but is a '%s'",
-							argv[1],
-							fr_table_str_by_value(fr_value_box_type_table, da->type, "?Unknown?"));
-				goto error;
-			}
-
-			common = fr_dict_parent_common(ctx->stack[ctx->stack_depth].da, da, true);
-			if (!common ||
-			    (common->type == FR_TYPE_VSA)) {
-				fr_strerror_printf_push("Attribute '%s' should be a child of '%s'",
-							argv[1], ctx->stack[ctx->stack_depth].da->name);
-				goto error;
-			}
-
-			if (dict_gctx_push(ctx, da) < 0) goto error;
-			ctx->stack[ctx->stack_depth].nest = FR_TYPE_TLV;
-			continue;
-		} /* BEGIN-TLV */
-
-		/*
-		 *	Switches back to previous TLV parent
-		 */
-		if (strcasecmp(argv[0], "END-TLV") == 0) {
-			if (argc != 2) {
-				fr_strerror_printf_push("Invalid END-TLV entry");
-				goto error;
-			}
-
-			da = dict_attr_by_name(ctx->dict, argv[1]);
-			if (!da) {
-				fr_strerror_printf_push("Unknown attribute '%s'", argv[1]);
-				goto error;
-			}
-
-			/*
-			 *	Pop the stack until we get to a TLV nesting.
-			 */
-			while ((ctx->stack_depth > 0) && (ctx->stack[ctx->stack_depth].nest != FR_TYPE_TLV)) {
-				if (ctx->stack[ctx->stack_depth].nest != FR_TYPE_INVALID) {
-					fr_strerror_printf_push("END-TLV %s with mismatched BEGIN-??? %s", argv[1],
-						ctx->stack[ctx->stack_depth].da->name);
-					goto error;
-				}
-
-				ctx->stack_depth--;
-			}
-
-			if (ctx->stack_depth == 0) {
-				fr_strerror_printf_push("END-TLV %s with no previous BEGIN-TLV", argv[1]);
-				goto error;
-			}
-
-			if (da != ctx->stack[ctx->stack_depth].da) {
-				fr_strerror_printf_push("END-TLV %s does not match previous BEGIN-TLV %s", argv[1],
-							ctx->stack[ctx->stack_depth].da->name);
-				goto error;
-			}
-
-			ctx->stack_depth--;
-			continue;
-		} /* END-VENDOR */
-
-		if (strcasecmp(argv[0], "BEGIN-VENDOR") == 0) {
-			fr_dict_vendor_t const	*vendor;
-			fr_dict_attr_flags_t	flags;
-
-			fr_dict_attr_t const	*vsa_da;
-			fr_dict_attr_t const	*vendor_da;
-			fr_dict_attr_t		*new;
-			fr_dict_attr_t		*mutable;
-
-			if (argc < 2) {
-				fr_strerror_printf_push("Invalid BEGIN-VENDOR entry");
-				goto error;
-			}
-
-			vendor = fr_dict_vendor_by_name(ctx->dict, argv[1]);
-			if (!vendor) {
-				fr_strerror_printf_push("Unknown vendor '%s'", argv[1]);
-				goto error;
-			}
-
-			/*
-			 *	Check for extended attr VSAs
-			 *
-			 *	BEGIN-VENDOR foo parent=Foo-Encapsulation-Attr
-			 */
-			if (argc > 2) {
-				if (strncmp(argv[2], "parent=", 7) != 0) {
-					fr_strerror_printf_push("Invalid format %s", argv[2]);
-					goto error;
-				}
-
-				p = argv[2] + 7;
-				da = dict_attr_by_name(ctx->dict, p);
-				if (!da) {
-					fr_strerror_printf_push("Invalid format for BEGIN-VENDOR: Unknown "
-								"parent attribute '%s'", p);
-					goto error;
-				}
-
-				if (da->type != FR_TYPE_VSA) {
-					fr_strerror_printf_push("Invalid parent for BEGIN-VENDOR.  "
-								"Attribute '%s' should be 'vsa' but is '%s'", p,
-								fr_table_str_by_value(fr_value_box_type_table, da->type, "?Unknown?"));
-					goto error;
-				}
-
-				if (da->parent->type != FR_TYPE_EXTENDED) {
-					fr_strerror_printf_push("Invalid format for BEGIN-VENDOR.  "
-								"Attribute '%s' should be parented from an attribute of type 'extended', but is '%s'", p,
-								fr_table_str_by_value(fr_value_box_type_table, da->type, "?Unknown?"));
-					goto error;
-				}
-
-				vsa_da = da;
-
-			} else if (!ctx->dict->vsa_parent) {
-				fr_strerror_printf_push("BEGIN-VENDOR is forbidden for protocol %s",
-							ctx->dict->root->name);
-				goto error;
-
-			} else {
-				/*
-				 *	Check that the protocol-specific VSA parent exists.
-				 */
-				vsa_da = dict_attr_child_by_num(ctx->stack[ctx->stack_depth].da, ctx->dict->vsa_parent);
-				if (!vsa_da) {
-					fr_strerror_printf_push("Failed finding VSA parent for Vendor %s",
-								vendor->name);
-					goto error;
-				}
-			}
-
-			/*
-			 *	Create a VENDOR attribute on the fly, either in the context
-			 *	of the VSA (26) attribute.
-			 */
-			vendor_da = dict_attr_child_by_num(vsa_da, vendor->pen);
-			if (!vendor_da) {
-				memset(&flags, 0, sizeof(flags));
-
-				flags.type_size = ctx->dict->default_type_size;
-				flags.length = ctx->dict->default_type_length;
-
-				/*
-				 *	See if this vendor has
-				 *	specific sizes for type /
-				 *	length.
-				 *
-				 *	@todo - Make this more protocol agnostic!
-				 */
-				if ((vsa_da->type == FR_TYPE_VSA) &&
-				    (vsa_da->parent->flags.is_root)) {
-					fr_dict_vendor_t const *dv;
-
-					dv = fr_dict_vendor_by_num(ctx->dict, vendor->pen);
-					if (dv) {
-						flags.type_size = dv->type;
-						flags.length = dv->length;
-					}
-				}
-
-				memcpy(&mutable, &vsa_da, sizeof(mutable));
-				new = dict_attr_alloc(mutable, ctx->stack[ctx->stack_depth].da, argv[1],
-						      vendor->pen, FR_TYPE_VENDOR, &flags);
-				if (dict_attr_child_add(mutable, new) < 0) {
-					talloc_free(new);
-					goto error;
-				}
-
-				vendor_da = new;
-			}
-
-			if (dict_gctx_push(ctx, vendor_da) < 0) goto error;
-			ctx->stack[ctx->stack_depth].nest = FR_TYPE_VENDOR;
-			continue;
-		} /* BEGIN-VENDOR */
-
-		if (strcasecmp(argv[0], "END-VENDOR") == 0) {
-			fr_dict_vendor_t const *vendor;
-
-			if (argc != 2) {
-				fr_strerror_printf_push("Invalid END-VENDOR entry");
-				goto error;
-			}
-
-			vendor = fr_dict_vendor_by_name(ctx->dict, argv[1]);
-			if (!vendor) {
-				fr_strerror_printf_push("Unknown vendor '%s'", argv[1]);
-				goto error;
-			}
-
-			/*
-			 *	Pop the stack until we get to a VENDOR nesting.
-			 */
-			while ((ctx->stack_depth > 0) && (ctx->stack[ctx->stack_depth].nest != FR_TYPE_VENDOR)) {
-				if (ctx->stack[ctx->stack_depth].nest != FR_TYPE_INVALID) {
-					fr_strerror_printf_push("END-VENDOR %s with mismatched BEGIN-??? %s", argv[1],
-						ctx->stack[ctx->stack_depth].da->name);
-					goto error;
-				}
-
-				ctx->stack_depth--;
-			}
-
-			if (ctx->stack_depth == 0) {
-				fr_strerror_printf_push("END-VENDOR %s with no previous BEGIN-VENDOR", argv[1]);
-				goto error;
-			}
-
-			if (vendor->pen != ctx->stack[ctx->stack_depth].da->attr) {
-				fr_strerror_printf_push("END-VENDOR %s does not match previous BEGIN-VENDOR %s", argv[1],
-							ctx->stack[ctx->stack_depth].da->name);
-				goto error;
-			}
-
-			ctx->stack_depth--;
-			continue;
-		} /* END-VENDOR */
-
-		/*
-		 *	Any other string: We don't recognize it.
-		 */
-	invalid_keyword:
-		fr_strerror_printf_push("Invalid keyword '%s'", argv[0]);
-		goto error;
+		if (dict_read_process_line(ctx, argv, argc, &base_flags) < 0) {
+			fr_strerror_printf_push("Error reading %s[%d]", fn, line);
+			return -1;
+		}
 	}
 
-	/*
-	 *	Note that we do NOT walk back up the stack to check
-	 *	for missing END-FOO to match BEGIN-FOO.  The context
-	 *	was copied from the parent, so there are guaranteed to
-	 *	be missing things.
-	 */
-
-	fclose(fp);
 	return 0;
 }
 
@@ -2265,6 +2376,7 @@ static int dict_from_file(fr_dict_t *dict,
 {
 	int rcode;
 	dict_tokenize_ctx_t ctx;
+	char *cache_file;
 
 	memset(&ctx, 0, sizeof(ctx));
 	ctx.dict = dict;
@@ -2272,10 +2384,64 @@ static int dict_from_file(fr_dict_t *dict,
 	ctx.stack[0].da = dict->root;
 	ctx.stack[0].nest = FR_TYPE_MAX;
 
+	if (!FR_DIR_IS_RELATIVE(filename)) {
+		cache_file = talloc_asprintf(NULL, "%s" FR_DICTIONARY_CACHE_SUFFIX, filename);
+	} else {
+		cache_file = talloc_asprintf(NULL, "%s%c%s" FR_DICTIONARY_CACHE_SUFFIX, dir_name, FR_DIR_SEP, filename);
+	}
+	if (!cache_file) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	/*
+	 *	Either record what we read, so that we can write a
+	 *	compiled copy, or use the compiled copy if there is
+	 *	one, and it's up to date.
+	 */
+	if (dict_gctx && dict_gctx->compile) {
+		ctx.cache = dict_cache_alloc(NULL);
+		if (!ctx.cache) {
+			talloc_free(cache_file);
+			return -1;
+		}
+	} else {
+		dict_cache_t	*cache;
+		uint32_t	i = 0;
+
+		/*
+		 *	The statements are checked when the cache is
+		 *	opened, and the source files are the ones they
+		 *	were read from.  So any error from here on is
+		 *	one which parsing the source files would also
+		 *	produce.
+		 */
+		cache = dict_cache_open(NULL, cache_file, MAX_ARGV);
+		if (cache) {
+			rcode = _dict_from_cache(&ctx, cache, &i);
+			if ((rcode == 0) && (i != dict_cache_num_records(cache))) {
+				fr_strerror_printf("Compiled dictionary %s is corrupt", cache_file);
+				rcode = -1;
+			}
+			talloc_free(cache);
+			talloc_free(cache_file);
+			if (rcode < 0) return rcode;
+
+			return fr_dict_finalise(&ctx);
+		}
+
+		/*
+		 *	Missing or out of date.  Read the source files.
+		 */
+		fr_strerror_printf(NULL);
+	}
+
 	rcode = _dict_from_file(&ctx,
 				dir_name, filename, src_file, src_line);
 	if (rcode < 0) {
 		// free up the various fixups
+		talloc_free(ctx.cache);
+		talloc_free(cache_file);
 		return rcode;
 	}
 
@@ -2286,7 +2452,13 @@ static int dict_from_file(fr_dict_t *dict,
 	 *	Fixups should have been applied already to any protocol
 	 *	dictionaries.
 	 */
-	return fr_dict_finalise(&ctx);
+	rcode = fr_dict_finalise(&ctx);
+	if ((rcode == 0) && ctx.cache) rcode = dict_cache_write(ctx.cache, cache_file);
+
+	talloc_free(ctx.cache);
+	talloc_free(cache_file);
+
+	return rcode;
 }
 
 /** (Re-)Initialize the special internal dictionary
@@ -2727,6 +2727,21 @@ void fr_dict_global_read_only(void)
 	dict_gctx->read_only = true;
 }
 
+/** Write a compiled copy of each dictionary file as it's read
+ *
+ * The compiled copy is written next to the dictionary file, with a
+ * ".cache" suffix.  Dictionaries are always read from the source
+ * files while this is enabled.
+ *
+ * @param[in] compile	whether to write compiled dictionaries.
+ */
+void fr_dict_global_compile(bool compile)
+{
+	if (!dict_gctx) return;
+
+	dict_gctx->compile = compile;
+}
+
 /** Coerce to non-const
  *
  */
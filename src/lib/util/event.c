@@ -44,6 +44,24 @@ RCSID("$Id$")
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+/*
+ *	On Linux kqueue is provided by libkqueue, which emulates
+ *	each kevent filter on top of epoll, and adds bookkeeping
+ *	(and often an extra syscall) for every socket event it
+ *	returns.  Socket I/O filters go straight to a native
+ *	epoll instance instead, which is itself registered with
+ *	the kqueue.  EVFILT_USER, EVFILT_PROC and EVFILT_VNODE
+ *	stay with kqueue, and kevent() remains the call we block
+ *	in, so timer handling is unchanged.
+ *
+ *	Build with -DWITHOUT_EVENT_EPOLL to use kqueue for
+ *	everything.
+ */
+#if defined(HAVE_SYS_EPOLL_H) && !defined(WITHOUT_EVENT_EPOLL)
+#  define WITH_EVENT_EPOLL 1
+#  include <sys/epoll.h>
+#endif
+
 #define FR_EV_BATCH_FDS (256)
 
 DIAG_OFF(unused-macros)
@@ -251,6 +269,10 @@ struct fr_event_fd {
 
 	bool			is_registered;		//!< Whether this fr_event_fd_t's FD has been registered with
 							///< kevent.  Mostly for debugging.
+#ifdef WITH_EVENT_EPOLL
+	bool			use_epoll;		//!< Filters are managed by the epoll instance, not kevent.
+	uint32_t		epoll_events;		//!< EPOLLIN/EPOLLOUT currently registered for this FD.
+#endif
 	bool			in_fd_to_free;		//!< Whether this event is in the fd_to_free list.
 
 	void			*uctx;			//!< Context pointer to pass to each file descriptor callback.
@@ -326,6 +348,12 @@ struct fr_event_list {
 
 	struct kevent		events[FR_EV_BATCH_FDS]; /* so it doesn't go on the stack every time */
 
+#ifdef WITH_EVENT_EPOLL
+	int			epfd;			//!< epoll instance for socket I/O, registered with kq.
+	int			num_ep_events;		//!< Number of epoll events waiting to be serviced.
+	struct epoll_event	ep_events[FR_EV_BATCH_FDS];
+#endif
+
 	bool			in_handler;		//!< Deletes should be deferred until after the
 							///< handlers complete.
 
@@ -625,6 +653,67 @@ static int fr_event_fd_type_set(fr_event_fd_t *ef, int fd)
 	return 0;
 }
 
+#ifdef WITH_EVENT_EPOLL
+/** Synchronise the epoll registration of an FD with its active I/O functions
+ *
+ * @param[in] el	the FD is registered with.
+ * @param[in] ef	to update.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set by epoll_ctl().
+ */
+static int fr_event_epoll_update(fr_event_list_t *el, fr_event_fd_t *ef)
+{
+	struct epoll_event	epev = { .data.ptr = ef };
+	uint32_t		events = 0;
+	int			op;
+
+	if (ef->active.io.read && (ef->active.io.read != fr_event_fd_noop)) events |= EPOLLIN;
+	if (ef->active.io.write && (ef->active.io.write != fr_event_fd_noop)) events |= EPOLLOUT;
+
+	if (events == ef->epoll_events) return 0;
+
+	if (!events) {
+		op = EPOLL_CTL_DEL;
+	} else if (!ef->epoll_events) {
+		op = EPOLL_CTL_ADD;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	/*
+	 *	EPOLLRDHUP gives us the equivalent of EV_EOF.
+	 */
+	epev.events = events | EPOLLRDHUP;
+	if (epoll_ctl(el->epfd, op, ef->fd, &epev) < 0) return -1;
+
+	ef->epoll_events = events;
+
+	return 0;
+}
+#endif
+
+/** Apply a set of filter changes produced by #fr_event_build_evset
+ *
+ * @param[in] el	the FD is registered with.
+ * @param[in] ef	the changes apply to.
+ * @param[in] evset	changes to apply.
+ * @param[in] count	number of changes in evset.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static inline int fr_event_evset_apply(fr_event_list_t *el, fr_event_fd_t *ef, struct kevent const evset[], int count)
+{
+	if (!count) return 0;
+
+#ifdef WITH_EVENT_EPOLL
+	if (ef->use_epoll) return fr_event_epoll_update(el, ef);
+#endif
+
+	return kevent(el->kq, evset, count, NULL, 0, NULL) < 0 ? -1 : 0;
+}
+
 /** Remove a file descriptor from the event loop and rbtree but don't explicitly free it
  *
  *
@@ -659,7 +748,7 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 			/*
 			 *	If this fails, assert on debug builds.
 			 */
-			ret = kevent(el->kq, evset, count, NULL, 0, NULL);
+			ret = fr_event_evset_apply(el, ef, evset, count);
 			if (!fr_cond_assert_msg(ret >= 0,
 						"FD %i was closed without being removed from the KQ: %s",
 						ef->fd, fr_syserror(errno))) {
@@ -849,7 +938,7 @@ int fr_event_filter_update(fr_event_list_t *el, int fd, fr_event_filter_t filter
 		return -1;
 	}
 
-	if (count && unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
+	if (unlikely(fr_event_evset_apply(el, ef, evset, count) < 0)) {
 		fr_strerror_printf("Failed updating filters for FD %i: %s", ef->fd, fr_syserror(errno));
 		goto error;
 	}
@@ -948,9 +1037,18 @@ int fr_event_filter_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 			goto free;
 		}
 
+#ifdef WITH_EVENT_EPOLL
+		/*
+		 *	epoll can't watch regular files, so only
+		 *	sockets bypass libkqueue.
+		 */
+		ef->use_epoll = (filter == FR_EVENT_FILTER_IO) &&
+				(ef->type & (FR_EVENT_FD_SOCKET | FR_EVENT_FD_PCAP));
+#endif
+
 		count = fr_event_build_evset(evset, sizeof(evset)/sizeof(*evset), &ef->active, ef, funcs, &ef->active);
 		if (count < 0) goto free;
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (unlikely(fr_event_evset_apply(el, ef, evset, count) < 0)) {
 			fr_strerror_printf("Failed inserting filters for FD %i: %s", fd, fr_syserror(errno));
 			goto free;
 		}
@@ -980,7 +1078,7 @@ int fr_event_filter_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 			memcpy(&ef->active, &active, sizeof(ef->active));
 			return -1;
 		}
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (unlikely(fr_event_evset_apply(el, ef, evset, count) < 0)) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto error;
 		}
@@ -1577,6 +1675,11 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	int			num_fd_events;
 	bool			timer_event_ready = false;
 	fr_event_timer_t	*ev;
+#ifdef WITH_EVENT_EPOLL
+	int			i;
+
+	el->num_ep_events = 0;
+#endif
 
 	el->num_fd_events = 0;
 
@@ -1672,6 +1775,33 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 
 	EVENT_DEBUG("%s - kevent returned %u FD events", __FUNCTION__, el->num_fd_events);
 
+#ifdef WITH_EVENT_EPOLL
+	/*
+	 *	If the epoll instance is readable, pull the socket
+	 *	events out of it, and remove its kevent from the
+	 *	list so the service loop doesn't see it.
+	 */
+	for (i = 0; i < el->num_fd_events; i++) {
+		if ((el->events[i].filter != EVFILT_READ) || (el->events[i].udata != el)) continue;
+
+		el->events[i] = el->events[--el->num_fd_events];
+
+		el->num_ep_events = epoll_wait(el->epfd, el->ep_events, FR_EV_BATCH_FDS, 0);
+		if (unlikely(el->num_ep_events < 0)) {
+			if (errno != EINTR) {
+				fr_strerror_printf("Failed calling epoll_wait: %s", fr_syserror(errno));
+				return -1;
+			}
+			el->num_ep_events = 0;
+		}
+
+		EVENT_DEBUG("%s - epoll returned %u FD events", __FUNCTION__, el->num_ep_events);
+
+		num_fd_events = el->num_fd_events + el->num_ep_events;
+		break;
+	}
+#endif
+
 	/*
 	 *	If there are no FD events, we must have woken up from a timer
 	 */
@@ -1881,6 +2011,51 @@ service:
 		}
 	}
 
+#ifdef WITH_EVENT_EPOLL
+	/*
+	 *	Run the socket events retrieved from epoll.
+	 *	These are always FR_EVENT_FILTER_IO.
+	 */
+	for (i = 0; i < el->num_ep_events; i++) {
+		fr_event_fd_t	*ef;
+		uint32_t	events = el->ep_events[i].events;
+
+		ef = talloc_get_type_abort(el->ep_events[i].data.ptr, fr_event_fd_t);
+		if (!ef->is_registered) continue;	/* Was deleted between corral and service */
+
+		/*
+		 *	Errors and EOF are both passed to the error
+		 *	handler, as with EV_ERROR and EV_EOF above.
+		 */
+		if (unlikely(events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))) {
+			int		fd_errno = 0;
+			socklen_t	len = sizeof(fd_errno);
+
+#if defined(SO_GET_FILTER)
+			if (!(events & EPOLLERR) && (ef->type == FR_EVENT_FD_PCAP)) goto ep_service;
+#endif
+			(void) getsockopt(ef->fd, SOL_SOCKET, SO_ERROR, &fd_errno, &len);
+
+			if (ef->error) ef->error(el, ef->fd, (events & EPOLLERR) ? EV_ERROR : EV_EOF, fd_errno, ef->uctx);
+			TALLOC_FREE(ef);
+			continue;
+		}
+
+#if defined(SO_GET_FILTER)
+	ep_service:
+#endif
+		/*
+		 *	io.read can delete the event, in which case
+		 *	we *DON'T* want to call the write event.
+		 */
+		if (events & EPOLLIN) {
+			ef->active.io.read(el, ef->fd, 0, ef->uctx);
+			if (!ef->is_registered) continue;
+		}
+		if (events & EPOLLOUT) ef->active.io.write(el, ef->fd, 0, ef->uctx);
+	}
+#endif
+
 	/*
 	 *	Process any deferred frees performed
 	 *	by the I/O handlers.
@@ -2005,6 +2180,9 @@ static int _event_list_free(fr_event_list_t *el)
 	talloc_free_children(el);
 
 	if (el->kq >= 0) close(el->kq);
+#ifdef WITH_EVENT_EPOLL
+	if (el->epfd >= 0) close(el->epfd);
+#endif
 
 	return 0;
 }
@@ -2030,6 +2208,9 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 	}
 	el->time = fr_time;
 	el->kq = -1;	/* So destructor can be used before kqueue() provides us with fd */
+#ifdef WITH_EVENT_EPOLL
+	el->epfd = -1;
+#endif
 	talloc_set_destructor(el, _event_list_free);
 
 	el->times = fr_heap_talloc_create(el, fr_event_timer_cmp, fr_event_timer_t, heap_id);
@@ -2067,6 +2248,24 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		goto error;
 	}
 
+#ifdef WITH_EVENT_EPOLL
+	el->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->epfd < 0) {
+		fr_strerror_printf("Failed allocating epoll instance: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	udata of el marks this as the epoll instance,
+	 *	see fr_event_corral().
+	 */
+	EV_SET(&kev, el->epfd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, el);
+	if (kevent(el->kq, &kev, 1, NULL, 0, NULL) < 0) {
+		fr_strerror_printf("Failed adding epoll instance to kqueue: %s", fr_syserror(errno));
+		goto error;
+	}
+#endif
+
 	return el;
 }
 
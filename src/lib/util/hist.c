@@ -0,0 +1,258 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Log-linear latency histograms
+ *
+ * @file src/lib/util/hist.c
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/hist.h>
+
+#include <inttypes.h>
+
+/** A set of per-thread histograms which can be merged
+ *
+ */
+struct fr_hist_group_s {
+	pthread_mutex_t		mutex;			//!< Protects the list, and retired.
+	fr_dlist_head_t		list;			//!< Of per-thread histograms.
+	fr_hist_t		retired;		//!< Totals from histograms which have been freed.
+};
+
+/** Largest value which maps to a bucket
+ *
+ */
+static uint64_t hist_bucket_max(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < FR_HIST_SUB_BUCKETS) return idx;
+
+	shift = (idx >> FR_HIST_SUB_BITS) - 1;
+
+	return (((uint64_t) (FR_HIST_SUB_BUCKETS | (idx & (FR_HIST_SUB_BUCKETS - 1)))) << shift) +
+		((((uint64_t) 1) << shift) - 1);
+}
+
+/** Allocate a histogram which doesn't belong to a group
+ *
+ * Usually used as the output of #fr_hist_group_merge.
+ *
+ * @param[in] ctx	to allocate the histogram in.
+ * @return
+ *	- A new histogram.
+ *	- NULL on error.
+ */
+fr_hist_t *fr_hist_alloc(TALLOC_CTX *ctx)
+{
+	return talloc_zero(ctx, fr_hist_t);
+}
+
+/** Add the counts from one histogram to another
+ *
+ * @param[in] out	to add counts to.  Must not be written to by
+ *			any other thread.
+ * @param[in] in	to read counts from.  May be being written
+ *			to by its owner.
+ */
+void fr_hist_merge(fr_hist_t *out, fr_hist_t const *in)
+{
+	unsigned int	i;
+	uint64_t	max;
+
+	for (i = 0; i < FR_HIST_BUCKETS; i++) {
+		fr_hist_add(&out->count[i], atomic_load_explicit(&in->count[i], memory_order_relaxed));
+	}
+
+	fr_hist_add(&out->total, atomic_load_explicit(&in->total, memory_order_relaxed));
+	fr_hist_add(&out->sum, atomic_load_explicit(&in->sum, memory_order_relaxed));
+
+	max = atomic_load_explicit(&in->max, memory_order_relaxed);
+	if (max > atomic_load_explicit(&out->max, memory_order_relaxed)) {
+		atomic_store_explicit(&out->max, max, memory_order_relaxed);
+	}
+}
+
+/** Return the value below which a percentage of the recorded values fall
+ *
+ * The value is the upper bound of the bucket the percentile lies in,
+ * so it may over-estimate, but never under-estimates.
+ *
+ * @param[in] hist		to examine.
+ * @param[in] percentile	between 0 and 100.
+ * @return
+ *	- The value.
+ *	- 0 if nothing has been recorded.
+ */
+uint64_t fr_hist_percentile(fr_hist_t const *hist, double percentile)
+{
+	unsigned int	i;
+	uint64_t	total, target, seen = 0, max;
+
+	total = atomic_load_explicit(&hist->total, memory_order_relaxed);
+	if (!total) return 0;
+
+	target = (uint64_t) ((percentile / 100.0) * total + 0.5);
+	if (target < 1) target = 1;
+
+	max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+
+	for (i = 0; i < FR_HIST_BUCKETS; i++) {
+		uint64_t bucket_max;
+
+		seen += atomic_load_explicit(&hist->count[i], memory_order_relaxed);
+		if (seen < target) continue;
+
+		bucket_max = hist_bucket_max(i);
+
+		return (bucket_max < max) ? bucket_max : max;
+	}
+
+	return max;
+}
+
+/** Print a summary of a histogram of #fr_time_delta_t values
+ *
+ * Values are printed in microseconds, one per line, as "<name>\t<value>".
+ *
+ * @param[in] fp	to write to.
+ * @param[in] prefix	to add to the names, separated by a '.'.  May be NULL.
+ * @param[in] hist	to print.
+ */
+void fr_hist_fprint(FILE *fp, char const *prefix, fr_hist_t const *hist)
+{
+	uint64_t	total, sum;
+	char const	*dot = prefix ? "." : "";
+
+	if (!prefix) prefix = "";
+
+	total = atomic_load_explicit(&hist->total, memory_order_relaxed);
+	sum = atomic_load_explicit(&hist->sum, memory_order_relaxed);
+
+	fprintf(fp, "%s%scount\t%" PRIu64 "\n", prefix, dot, total);
+	if (!total) return;
+
+	fprintf(fp, "%s%smean_us\t%.3f\n", prefix, dot, ((double) sum / total) / 1000);
+	fprintf(fp, "%s%sp50_us\t%.3f\n", prefix, dot, (double) fr_hist_percentile(hist, 50) / 1000);
+	fprintf(fp, "%s%sp90_us\t%.3f\n", prefix, dot, (double) fr_hist_percentile(hist, 90) / 1000);
+	fprintf(fp, "%s%sp99_us\t%.3f\n", prefix, dot, (double) fr_hist_percentile(hist, 99) / 1000);
+	fprintf(fp, "%s%sp99.9_us\t%.3f\n", prefix, dot, (double) fr_hist_percentile(hist, 99.9) / 1000);
+	fprintf(fp, "%s%smax_us\t%.3f\n", prefix, dot,
+		(double) atomic_load_explicit(&hist->max, memory_order_relaxed) / 1000);
+}
+
+static int _hist_group_free(fr_hist_group_t *group)
+{
+	fr_hist_t *hist;
+
+	pthread_mutex_lock(&group->mutex);
+	while ((hist = fr_dlist_head(&group->list))) {
+		fr_dlist_remove(&group->list, hist);
+		hist->group = NULL;
+	}
+	pthread_mutex_unlock(&group->mutex);
+
+	pthread_mutex_destroy(&group->mutex);
+
+	return 0;
+}
+
+/** Allocate a group of per-thread histograms
+ *
+ * @param[in] ctx	to allocate the group in.
+ * @return
+ *	- A new group.
+ *	- NULL on error.
+ */
+fr_hist_group_t *fr_hist_group_alloc(TALLOC_CTX *ctx)
+{
+	fr_hist_group_t *group;
+
+	group = talloc_zero(ctx, fr_hist_group_t);
+	if (!group) return NULL;
+
+	pthread_mutex_init(&group->mutex, NULL);
+	fr_dlist_talloc_init(&group->list, fr_hist_t, entry);
+	talloc_set_destructor(group, _hist_group_free);
+
+	return group;
+}
+
+/** Fold the counts of a thread's histogram into its group before it's freed
+ *
+ */
+static int _hist_thread_free(fr_hist_t *hist)
+{
+	fr_hist_group_t *group = hist->group;
+
+	if (!group) return 0;
+
+	pthread_mutex_lock(&group->mutex);
+	fr_dlist_remove(&group->list, hist);
+	fr_hist_merge(&group->retired, hist);
+	pthread_mutex_unlock(&group->mutex);
+
+	return 0;
+}
+
+/** Allocate a histogram for the current thread, and add it to a group
+ *
+ * When the histogram is freed, its counts are kept by the group.
+ *
+ * @param[in] ctx	to allocate the histogram in.  Should be
+ *			freed when the thread exits.
+ * @param[in] group	to add the histogram to.
+ * @return
+ *	- A new histogram.
+ *	- NULL on error.
+ */
+fr_hist_t *fr_hist_group_thread_alloc(TALLOC_CTX *ctx, fr_hist_group_t *group)
+{
+	fr_hist_t *hist;
+
+	hist = talloc_zero(ctx, fr_hist_t);
+	if (!hist) return NULL;
+
+	hist->group = group;
+	talloc_set_destructor(hist, _hist_thread_free);
+
+	pthread_mutex_lock(&group->mutex);
+	fr_dlist_insert_tail(&group->list, hist);
+	pthread_mutex_unlock(&group->mutex);
+
+	return hist;
+}
+
+/** Merge all of the histograms in a group
+ *
+ * The per-thread histograms are read while their owners continue to
+ * write to them, so the result is only approximately consistent.
+ *
+ * @param[in] out	to add the counts to.
+ * @param[in] group	to merge.
+ */
+void fr_hist_group_merge(fr_hist_t *out, fr_hist_group_t *group)
+{
+	fr_hist_t *hist = NULL;
+
+	pthread_mutex_lock(&group->mutex);
+	fr_hist_merge(out, &group->retired);
+	while ((hist = fr_dlist_next(&group->list, hist))) fr_hist_merge(out, hist);
+	pthread_mutex_unlock(&group->mutex);
+}
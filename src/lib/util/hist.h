@@ -0,0 +1,142 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Log-linear latency histograms
+ *
+ * Values are split into power of two ranges, and each range is split
+ * into #FR_HIST_SUB_BUCKETS linear buckets, in the style of HdrHistogram.
+ * Recording a value is a bit scan and three counter updates, and
+ * the reported percentiles are within 1/#FR_HIST_SUB_BUCKETS of the
+ * recorded value.
+ *
+ * Each histogram has a single writer.  Histograms belonging to multiple
+ * threads are tracked by a #fr_hist_group_t, and are merged when somebody
+ * asks for the result.
+ *
+ * @file src/lib/util/hist.h
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSIDH(hist_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <talloc.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/*
+ *	Module calls and virtual server sections record their latency
+ *	unless the server is built with -DWITHOUT_LATENCY_HISTOGRAMS.
+ */
+#ifndef WITHOUT_LATENCY_HISTOGRAMS
+#  define WITH_LATENCY_HISTOGRAMS (1)
+#endif
+
+#define FR_HIST_SUB_BITS	4					//!< log2 of the buckets per power of two.
+#define FR_HIST_SUB_BUCKETS	(1 << FR_HIST_SUB_BITS)
+#define FR_HIST_MAX_BITS	40					//!< Largest value is 2^40, ~18 minutes in ns.
+#define FR_HIST_BUCKETS		((FR_HIST_MAX_BITS - FR_HIST_SUB_BITS + 1) << FR_HIST_SUB_BITS)
+
+typedef struct fr_hist_group_s fr_hist_group_t;
+
+/** A histogram
+ *
+ * Only the owning thread may call #fr_hist_record.  Any thread may read it.
+ */
+typedef struct {
+	atomic_uint_fast64_t	count[FR_HIST_BUCKETS];		//!< Values recorded in each bucket.
+	atomic_uint_fast64_t	total;				//!< Number of values recorded.
+	atomic_uint_fast64_t	sum;				//!< Sum of the values recorded.
+	atomic_uint_fast64_t	max;				//!< Largest value recorded.
+
+	fr_hist_group_t		*group;				//!< We belong to, if any.
+	fr_dlist_t		entry;				//!< Entry in the group's list.
+} fr_hist_t;
+
+/** Find the bucket for a value
+ *
+ */
+static inline unsigned int fr_hist_index(uint64_t value)
+{
+	unsigned int	shift;
+
+	if (value < FR_HIST_SUB_BUCKETS) return value;
+
+	shift = fr_high_bit_pos(value) - 1 - FR_HIST_SUB_BITS;
+	if (shift > (FR_HIST_MAX_BITS - FR_HIST_SUB_BITS - 1)) return FR_HIST_BUCKETS - 1;
+
+	return ((shift + 1) << FR_HIST_SUB_BITS) + ((value >> shift) & (FR_HIST_SUB_BUCKETS - 1));
+}
+
+/** Add to a counter which only one thread writes to
+ *
+ * There's no competing writer, so we don't need a locked read-modify-write.
+ */
+static inline void fr_hist_add(atomic_uint_fast64_t *counter, uint64_t value)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+			      memory_order_relaxed);
+}
+
+/** Record a value
+ *
+ * @param[in] hist	to record the value in.  Must be owned by the calling thread.
+ * @param[in] value	to record, usually a #fr_time_delta_t.
+ */
+static inline void fr_hist_record(fr_hist_t *hist, uint64_t value)
+{
+	fr_hist_add(&hist->count[fr_hist_index(value)], 1);
+	fr_hist_add(&hist->total, 1);
+	fr_hist_add(&hist->sum, value);
+
+	if (value > atomic_load_explicit(&hist->max, memory_order_relaxed)) {
+		atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+	}
+}
+
+fr_hist_t	*fr_hist_alloc(TALLOC_CTX *ctx);
+
+void		fr_hist_merge(fr_hist_t *out, fr_hist_t const *in);
+
+uint64_t	fr_hist_percentile(fr_hist_t const *hist, double percentile);
+
+void		fr_hist_fprint(FILE *fp, char const *prefix, fr_hist_t const *hist);
+
+fr_hist_group_t	*fr_hist_group_alloc(TALLOC_CTX *ctx);
+
+fr_hist_t	*fr_hist_group_thread_alloc(TALLOC_CTX *ctx, fr_hist_group_t *group);
+
+void		fr_hist_group_merge(fr_hist_t *out, fr_hist_group_t *group);
+
+#ifdef __cplusplus
+}
+#endif
@@ -10,6 +10,7 @@ SOURCES		:= \
 		   base64.c \
 		   cursor.c \
 		   debug.c \
+		   dict_cache.c \
 		   dict_print.c \
 		   dict_tokenize.c \
 		   dict_unknown.c \
@@ -25,6 +26,7 @@ SOURCES		:= \
 		   getaddrinfo.c \
 		   hash.c \
 		   heap.c \
+		   hist.c \
 		   hmac_md5.c \
 		   hmac_sha1.c \
 		   inet.c \
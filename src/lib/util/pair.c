@@ -82,6 +82,32 @@ VALUE_PAIR *fr_pair_alloc(TALLOC_CTX *ctx)
 	return vp;
 }
 
+/** Initialise the da and type fields of a new pair
+ *
+ */
+static VALUE_PAIR *fr_pair_init_da(VALUE_PAIR *vp, fr_dict_attr_t const *da)
+{
+	/*
+	 *	If we get passed an unknown da, we need to ensure that
+	 *	it's parented by "vp".
+	 */
+	if (da->flags.is_unknown) {
+		fr_dict_attr_t const *unknown;
+
+		unknown = fr_dict_unknown_acopy(vp, da);
+		da = unknown;
+	}
+
+	/*
+	 *	Use the 'da' to initialize more fields.
+	 */
+	vp->da = da;
+	vp->vp_type = da->type;
+	vp->data.enumv = da;
+
+	return vp;
+}
+
 /** Dynamically allocate a new attribute and fill in the da field
  *
  * Allocates a new attribute and a new dictionary attr if no DA is provided.
@@ -112,25 +138,64 @@ VALUE_PAIR *fr_pair_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da)
 		return NULL;
 	}
 
-	/*
-	 *	If we get passed an unknown da, we need to ensure that
-	 *	it's parented by "vp".
-	 */
-	if (da->flags.is_unknown) {
-		fr_dict_attr_t const *unknown;
+	return fr_pair_init_da(vp, da);
+}
 
-		unknown = fr_dict_unknown_acopy(vp, da);
-		da = unknown;
+/** Dynamically allocate a new attribute, with space for its value
+ *
+ * The #VALUE_PAIR is allocated as a talloc pool large enough to hold
+ * a value of len bytes (plus a terminating \0 for strings).  When the
+ * value is assigned with ctx set to the #VALUE_PAIR, the buffer is
+ * carved out of the pool, so the pair and its value cost a single
+ * allocation instead of two.
+ *
+ * This is intended for decoders, which know the length of the value
+ * before they allocate the pair.
+ *
+ * @param[in] ctx	for allocated memory, usually a pointer to a #RADIUS_PACKET
+ * @param[in] da	Specifies the dictionary attribute to build the #VALUE_PAIR from.
+ * @param[in] len	of the value which will be assigned to the pair.
+ * @return
+ *	- A new #VALUE_PAIR.
+ *	- NULL if an error occurred.
+ */
+VALUE_PAIR *fr_pair_afrom_da_len(TALLOC_CTX *ctx, fr_dict_attr_t const *da, size_t len)
+{
+	VALUE_PAIR *vp;
+
+	if (!da) {
+		fr_strerror_printf("Invalid arguments");
+		return NULL;
 	}
 
 	/*
-	 *	Use the 'da' to initialize more fields.
+	 *	Fixed size values live inside the VALUE_PAIR, so
+	 *	there's nothing to pre-allocate.
 	 */
-	vp->da = da;
-	vp->vp_type = da->type;
-	vp->data.enumv = da;
+	switch (da->type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		if (len > 0) break;
+		/* FALL-THROUGH */
 
-	return vp;
+	default:
+		return fr_pair_afrom_da(ctx, da);
+	}
+
+	vp = talloc_pooled_object(ctx, VALUE_PAIR, 1, len + 1);
+	if (!vp) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+	memset(vp, 0, sizeof(*vp));
+
+	vp->op = T_OP_EQ;
+	vp->tag = TAG_ANY;
+	vp->type = VT_NONE;
+
+	talloc_set_destructor(vp, _fr_pair_free);
+
+	return fr_pair_init_da(vp, da);
 }
 
 /** Create a new valuepair
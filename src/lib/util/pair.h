@@ -211,6 +211,8 @@ VALUE_PAIR	*fr_pair_alloc(TALLOC_CTX *ctx);
 
 VALUE_PAIR	*fr_pair_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da);
 
+VALUE_PAIR	*fr_pair_afrom_da_len(TALLOC_CTX *ctx, fr_dict_attr_t const *da, size_t len);
+
 
 VALUE_PAIR	*fr_pair_afrom_child_num(TALLOC_CTX *ctx, fr_dict_attr_t const *parent, unsigned int attr);
 
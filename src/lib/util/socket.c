@@ -46,6 +46,10 @@
 #  include <sys/capability.h>
 #endif
 
+#ifdef HAVE_LINUX_FILTER_H
+#  include <linux/filter.h>
+#endif
+
 /** Resolve a named service to a port
  *
  * @param[in] proto	The protocol. Either IPPROTO_TCP or IPPROTO_UDP.
@@ -1023,3 +1027,66 @@ skip_cap:
 #endif
 	return 0;
 }
+
+/** Steer packets in an SO_REUSEPORT group by source IP address
+ *
+ * Attaches a classic BPF program to the reuseport group which sockfd
+ * belongs to.  The program picks the socket by taking the (last 32
+ * bits of the) source IP address modulo num.  All packets from one
+ * client then land on the same socket, no matter which source port
+ * they are sent from.
+ *
+ * Sockets are numbered in the order they were bound to the address,
+ * so all num sockets should be bound before any packets arrive.
+ *
+ * @param[in] sockfd	a socket in the reuseport group.
+ * @param[in] af	address family of the group, AF_INET or AF_INET6.
+ * @param[in] num	the number of sockets in the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, or if steering is unsupported on this platform.
+ */
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_LINUX_FILTER_H)
+int fr_socket_reuseport_steer(int sockfd, int af, unsigned int num)
+{
+	struct sock_filter	code[3];
+	struct sock_fprog	prog = { .len = NUM_ELEMENTS(code), .filter = code };
+	uint32_t		offset;
+
+	switch (af) {
+	case AF_INET:
+		offset = 12;	/* ip->saddr */
+		break;
+
+	case AF_INET6:
+		offset = 20;	/* last 32 bits of ip6->saddr */
+		break;
+
+	default:
+		fr_strerror_printf("Unsupported address family %i", af);
+		return -1;
+	}
+
+	if (num == 0) {
+		fr_strerror_printf("Invalid number of sockets");
+		return -1;
+	}
+
+	code[0] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + offset);
+	code[1] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, num);
+	code[2] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		fr_strerror_printf("Failed attaching reuseport program: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#else
+int fr_socket_reuseport_steer(UNUSED int sockfd, UNUSED int af, UNUSED unsigned int num)
+{
+	fr_strerror_printf("Steering SO_REUSEPORT groups is not supported on this platform");
+	return -1;
+}
+#endif
@@ -256,3 +256,295 @@ done:
 
 	return received;
 }
+
+#ifndef HAVE_RECVMMSG
+/** Emulates the real recvmmsg in userland
+ *
+ * As with the sendmmsg emulation in missing.c, this doesn't save any
+ * system calls, but means the batching code below works everywhere.
+ *
+ * Only the first read may block.  Subsequent reads are done with
+ * MSG_DONTWAIT, so we return as soon as the socket is drained.
+ *
+ * @param[in] sockfd	to read packets from.
+ * @param[in] msgvec	a pointer to an array of mmsghdr structures.
+ *			The size of this array is specified in vlen.
+ * @param[in] vlen	Length of msgvec.
+ * @param[in] flags	same as for recvmsg(2).
+ * @param[in] timeout	ignored.
+ * @return
+ *	- >= 0 The number of messages received.
+ *	- < 0 on error.  Only returned if first operation errors.
+ */
+static int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, UNUSED struct timespec *timeout)
+{
+	unsigned int i;
+
+	for (i = 0; i < vlen; i++) {
+		ssize_t slen;
+
+		slen = recvmsg(sockfd, &msgvec[i].msg_hdr, (i == 0) ? flags : (flags | MSG_DONTWAIT));
+		if (slen < 0) {
+			msgvec[i].msg_len = 0;
+
+			if (i == 0) return -1;
+			return i;
+		}
+		msgvec[i].msg_len = (unsigned int)slen;	/* Number of bytes received */
+	}
+
+	return i;
+}
+#endif
+
+/*
+ *	Enough for IP_PKTINFO / IPV6_PKTINFO and SO_TIMESTAMP.
+ */
+#define UDP_BATCH_CBUF_SIZE	(128)
+
+/** A datagram received by #udp_batch_recv
+ *
+ */
+typedef struct {
+	struct sockaddr_storage	src;			//!< Source address, written by recvmmsg().
+	struct sockaddr_storage	dst;			//!< Destination address.
+	socklen_t		dst_len;		//!< Length of the destination address.
+	int			if_index;		//!< Interface the datagram was received on.
+	fr_time_t		when;			//!< When the datagram was received.
+	struct iovec		iov;			//!< Points into the batch buffer.
+	uint8_t			cbuf[UDP_BATCH_CBUF_SIZE];	//!< Control messages.
+} udp_batch_entry_t;
+
+struct fr_udp_batch_s {
+	unsigned int		num;			//!< Maximum datagrams to read per recvmmsg() call.
+	unsigned int		count;			//!< Datagrams returned by the last recvmmsg() call.
+	unsigned int		next;			//!< Next datagram to hand to the caller.
+
+	size_t			max_packet_size;	//!< Size of each datagram buffer.
+
+	struct mmsghdr		*mmsgvec;		//!< Passed to recvmmsg().
+	udp_batch_entry_t	*entries;		//!< Per-datagram addresses and metadata.
+	uint8_t			*buffer;		//!< num * max_packet_size bytes of datagram data.
+};
+
+/** Allocate state for batched UDP reads
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] num		Maximum number of datagrams to read with one system call.
+ * @param[in] max_packet_size	Largest datagram we expect to receive.
+ * @return
+ *	- A new batch on success.
+ *	- NULL on failure.
+ */
+fr_udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size)
+{
+	fr_udp_batch_t	*batch;
+	unsigned int	i;
+
+	if (!num || !max_packet_size) {
+		fr_strerror_printf("Invalid arguments: batch size and packet size must be non-zero");
+		return NULL;
+	}
+
+	batch = talloc_zero(ctx, fr_udp_batch_t);
+	if (!batch) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		talloc_free(batch);
+		return NULL;
+	}
+
+	batch->num = num;
+	batch->max_packet_size = max_packet_size;
+
+	batch->mmsgvec = talloc_zero_array(batch, struct mmsghdr, num);
+	batch->entries = talloc_zero_array(batch, udp_batch_entry_t, num);
+	batch->buffer = talloc_array(batch, uint8_t, num * max_packet_size);
+	if (!batch->mmsgvec || !batch->entries || !batch->buffer) goto oom;
+
+	for (i = 0; i < num; i++) {
+		batch->entries[i].iov.iov_base = batch->buffer + (i * max_packet_size);
+		batch->entries[i].iov.iov_len = max_packet_size;
+		batch->mmsgvec[i].msg_hdr.msg_iov = &batch->entries[i].iov;
+		batch->mmsgvec[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return batch;
+}
+
+/** Refill a batch from the socket
+ *
+ * @param[in] batch	to fill.
+ * @param[in] sockfd	to read from.
+ * @param[in] flags	UDP_FLAGS_CONNECTED if the socket is connected.
+ * @param[in] want_dst	whether we need the destination address of each datagram.
+ * @return
+ *	- > 0 number of datagrams read.
+ *	- 0 if no data was available.
+ *	- < 0 on error.
+ */
+static int udp_batch_fill(fr_udp_batch_t *batch, int sockfd, int flags, bool want_dst)
+{
+	struct sockaddr_storage	si;
+	socklen_t		si_len = sizeof(si);
+	bool			connected = ((flags & UDP_FLAGS_CONNECTED) != 0);
+	fr_time_t		now;
+	unsigned int		i;
+	int			ret;
+
+	batch->count = batch->next = 0;
+
+	for (i = 0; i < batch->num; i++) {
+		struct msghdr *hdr = &batch->mmsgvec[i].msg_hdr;
+
+		hdr->msg_name = connected ? NULL : &batch->entries[i].src;
+		hdr->msg_namelen = connected ? 0 : sizeof(batch->entries[i].src);
+		hdr->msg_control = batch->entries[i].cbuf;
+		hdr->msg_controllen = sizeof(batch->entries[i].cbuf);
+		hdr->msg_flags = 0;
+		batch->mmsgvec[i].msg_len = 0;
+	}
+
+	ret = recvmmsg(sockfd, batch->mmsgvec, batch->num, MSG_DONTWAIT, NULL);
+	if (ret < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN) || (errno == EINTR)) return 0;
+
+		fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+		return -1;
+	}
+	if (ret == 0) return 0;
+
+	want_dst = want_dst && !connected;
+
+	/*
+	 *	recvmsg doesn't provide the destination port, so
+	 *	get the bound address once for the whole batch.
+	 */
+	if (want_dst && (getsockname(sockfd, (struct sockaddr *)&si, &si_len) < 0)) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	Everything in the batch arrived before we read it,
+	 *	so one timestamp is good enough if the kernel
+	 *	didn't give us one.
+	 */
+	now = fr_time();
+
+	for (i = 0; i < (unsigned int)ret; i++) {
+		udp_batch_entry_t *entry = &batch->entries[i];
+
+		entry->when = 0;
+		entry->if_index = 0;
+
+		if (want_dst) {
+			memcpy(&entry->dst, &si, si_len);
+			entry->dst_len = si_len;
+#ifdef WITH_UDPFROMTO
+			udpfromto_cmsg_parse(&batch->mmsgvec[i].msg_hdr, (struct sockaddr *)&entry->dst,
+					     &entry->dst_len, &entry->if_index, &entry->when);
+#endif
+		}
+
+		if (!entry->when) entry->when = now;
+	}
+
+	batch->count = ret;
+
+	return ret;
+}
+
+/** Read a UDP packet, using recvmmsg() to read ahead
+ *
+ * Behaves exactly like #udp_recv, except that when no datagrams are
+ * buffered, up to batch->num datagrams are read from the socket with a
+ * single system call.  Subsequent calls return the buffered datagrams
+ * before the socket is read again.
+ *
+ * Callers MUST check #udp_batch_pending before waiting for the socket to
+ * become readable again, as buffered datagrams won't trigger an event.
+ *
+ * @param[in] batch	state allocated by #udp_batch_alloc.
+ * @param[in] sockfd	we're reading from.
+ * @param[out] data	pointer where data will be written
+ * @param[in] data_len	length of data to read
+ * @param[in] flags	for things
+ * @param[out] src_ipaddr of the packet.
+ * @param[out] src_port of the packet.
+ * @param[out] dst_ipaddr of the packet.
+ * @param[out] dst_port of the packet.
+ * @param[out] if_index	of the interface that received the packet.
+ * @param[out] when	the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 if no data was available.
+ *	- < 0 on failure.
+ */
+ssize_t udp_batch_recv(fr_udp_batch_t *batch, int sockfd, void *data, size_t data_len, int flags,
+		       fr_ipaddr_t *src_ipaddr, uint16_t *src_port,
+		       fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
+		       fr_time_t *when)
+{
+	udp_batch_entry_t	*entry;
+	struct mmsghdr		*msg;
+	size_t			len;
+	uint16_t		port;
+
+	/*
+	 *	Peeking doesn't consume data, so there's nothing
+	 *	to batch.
+	 */
+	if ((flags & UDP_FLAGS_PEEK) != 0) {
+		return udp_recv(sockfd, data, data_len, flags, src_ipaddr, src_port,
+				dst_ipaddr, dst_port, if_index, when);
+	}
+
+	if (batch->next >= batch->count) {
+		int ret;
+
+		ret = udp_batch_fill(batch, sockfd, flags, (dst_ipaddr != NULL));
+		if (ret <= 0) return ret;
+	}
+
+	entry = &batch->entries[batch->next];
+	msg = &batch->mmsgvec[batch->next++];
+
+	/*
+	 *	As with recvfrom(), anything which doesn't fit
+	 *	is discarded.
+	 */
+	len = msg->msg_len;
+	if (len > data_len) len = data_len;
+	memcpy(data, entry->iov.iov_base, len);
+
+	if (when) *when = entry->when;
+
+	/*
+	 *	Connected sockets already know src/dst IP/port
+	 */
+	if ((flags & UDP_FLAGS_CONNECTED) != 0) return len;
+
+	if (fr_ipaddr_from_sockaddr(&entry->src, msg->msg_hdr.msg_namelen, src_ipaddr, &port) < 0) {
+		fr_strerror_printf_push("Failed converting sockaddr to ipaddr");
+		return -1;
+	}
+	*src_port = port;
+
+	if (dst_ipaddr) {
+		fr_ipaddr_from_sockaddr(&entry->dst, entry->dst_len, dst_ipaddr, &port);
+		*dst_port = port;
+	}
+
+	if (if_index) *if_index = entry->if_index;
+
+	return len;
+}
+
+/** Return the number of datagrams read from the socket, but not yet returned by #udp_batch_recv
+ *
+ */
+unsigned int udp_batch_pending(fr_udp_batch_t const *batch)
+{
+	return batch->count - batch->next;
+}
@@ -33,12 +33,18 @@ extern "C" {
 #  include <freeradius-devel/util/udpfromto.h>
 #endif
 #include <freeradius-devel/util/inet.h>
+#include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/util/time.h>
 
 #define UDP_FLAGS_NONE		(0)
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+/** State for reading multiple datagrams with one recvmmsg() call
+ *
+ */
+typedef struct fr_udp_batch_s fr_udp_batch_t;
+
 ssize_t udp_send(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t const *src_ipaddr, uint16_t src_port, int if_index,
 		 fr_ipaddr_t const *dst_ipaddr, uint16_t dst_port);
@@ -52,6 +58,15 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
 		 fr_time_t *when);
 
+fr_udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size);
+
+ssize_t udp_batch_recv(fr_udp_batch_t *batch, int sockfd, void *data, size_t data_len, int flags,
+		       fr_ipaddr_t *src_ipaddr, uint16_t *src_port,
+		       fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
+		       fr_time_t *when);
+
+unsigned int udp_batch_pending(fr_udp_batch_t const *batch);
+
 #ifdef __cplusplus
 }
 #endif
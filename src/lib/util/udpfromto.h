@@ -37,6 +37,7 @@ extern "C" {
 #include <netinet/in.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 
 int	udpfromto_init(int s);
 
@@ -49,6 +50,9 @@ int	sendfromto(int s, void *buf, size_t len, int flags,
 		   struct sockaddr *from, socklen_t fromlen,
 		   struct sockaddr *to, socklen_t tolen,
 		   int if_index);
+
+void	udpfromto_cmsg_parse(struct msghdr *msgh, struct sockaddr *to, socklen_t *to_len,
+			     int *if_index, fr_time_t *when);
 #endif
 
 #ifdef __cplusplus
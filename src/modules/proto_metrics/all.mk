@@ -0,0 +1,3 @@
+SUBMAKEFILES := \
+	proto_metrics.mk \
+	proto_metrics_tests.mk
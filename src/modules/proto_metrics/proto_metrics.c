@@ -0,0 +1,608 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file proto_metrics.c
+ * @brief Serve the server's metrics over HTTP, in OpenMetrics text format.
+ *
+ * Requests are answered on the network thread, and never reach a
+ * worker.  The response is rendered by #fr_metrics_render, which only
+ * reads counters, so scraping doesn't slow down request processing.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/metrics.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/io/application.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/network.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <netdb.h>
+
+#define METRICS_MAX_REQUEST	(4096)
+#define METRICS_CONTENT_TYPE	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+extern fr_app_t proto_metrics;
+
+/** An instance of a proto_metrics listen section
+ *
+ */
+typedef struct {
+	CONF_SECTION			*server_cs;		//!< server we're listening in.
+
+	fr_ipaddr_t			ipaddr;			//!< IP address to listen on.
+	char const			*interface;		//!< Interface to bind to.
+	char const			*port_name;		//!< Name of the port for getservent().
+	uint16_t			port;			//!< Port to listen on.
+
+	uint32_t			max_connections;	//!< Maximum simultaneous scrapers.
+	fr_time_delta_t			idle_timeout;		//!< Close connections which don't send a request.
+
+	char const			*name;			//!< of the listening socket.
+	fr_listen_t			*listen;		//!< Accepts new connections.
+
+	/*
+	 *	Only touched by the network thread which owns the
+	 *	listening socket.
+	 */
+	fr_network_t			*nr;			//!< To add connections to.
+	uint32_t			num_connections;	//!< Currently open.
+} proto_metrics_t;
+
+/** A connection from a scraper
+ *
+ */
+typedef struct {
+	proto_metrics_t			*inst;			//!< we were accepted by.
+	fr_listen_t			*listen;		//!< for this connection.
+	fr_network_t			*nr;			//!< the connection was added to.
+	fr_event_list_t			*el;			//!< of the network.
+	fr_event_timer_t const		*ev;			//!< idle timeout.
+
+	char				*response;		//!< waiting to be written.
+	size_t				written;		//!< bytes of the response written so far.
+
+	size_t				used;			//!< bytes in the buffer.
+	char				buffer[METRICS_MAX_REQUEST];
+} proto_metrics_connection_t;
+
+static const CONF_PARSER proto_metrics_config[] = {
+	{ FR_CONF_OFFSET("ipaddr", FR_TYPE_COMBO_IP_ADDR, proto_metrics_t, ipaddr), .dflt = "127.0.0.1" },
+	{ FR_CONF_OFFSET("ipv4addr", FR_TYPE_IPV4_ADDR, proto_metrics_t, ipaddr) },
+	{ FR_CONF_OFFSET("ipv6addr", FR_TYPE_IPV6_ADDR, proto_metrics_t, ipaddr) },
+
+	{ FR_CONF_OFFSET("interface", FR_TYPE_STRING, proto_metrics_t, interface) },
+	{ FR_CONF_OFFSET("port_name", FR_TYPE_STRING, proto_metrics_t, port_name) },
+	{ FR_CONF_OFFSET("port", FR_TYPE_UINT16, proto_metrics_t, port) },
+
+	{ FR_CONF_OFFSET("max_connections", FR_TYPE_UINT32, proto_metrics_t, max_connections), .dflt = "16" },
+	{ FR_CONF_OFFSET("idle_timeout", FR_TYPE_TIME_DELTA, proto_metrics_t, idle_timeout), .dflt = "10.0" },
+
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_app_io_t proto_metrics_connection_io;
+
+static void metrics_idle_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx);
+
+/** Write as much of the response as the socket will take
+ *
+ * @return
+ *	- 1 if the whole response has been written.
+ *	- 0 if the socket is full.
+ *	- -1 on error.
+ */
+static int metrics_flush(proto_metrics_connection_t *conn)
+{
+	size_t len = talloc_array_length(conn->response) - 1;
+
+	while (conn->written < len) {
+		ssize_t slen;
+
+		slen = write(conn->listen->fd, conn->response + conn->written, len - conn->written);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return 0;
+
+			ERROR("%s - Failed writing response, wrote %zu of %zu bytes: %s",
+			      conn->listen->name, conn->written, len, fr_syserror(errno));
+			return -1;
+		}
+
+		conn->written += slen;
+	}
+
+	TALLOC_FREE(conn->response);
+
+	return 1;
+}
+
+/** Write more of the response, and close the connection once it's all written
+ *
+ */
+static void metrics_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	proto_metrics_connection_t *conn = talloc_get_type_abort(uctx, proto_metrics_connection_t);
+	size_t written = conn->written;
+
+	switch (metrics_flush(conn)) {
+	case 0:
+		/*
+		 *	Only slow scrapers are timed out, not ones
+		 *	with a lot of metrics to read.
+		 */
+		if ((conn->written > written) &&
+		    (fr_event_timer_in(conn, conn->el, &conn->ev, conn->inst->idle_timeout,
+				       metrics_idle_timeout, conn) < 0)) {
+			PERROR("%s - Failed adding idle timeout", conn->listen->name);
+		}
+		return;
+
+	default:
+		(void) fr_network_socket_delete(conn->nr, conn->listen);
+		return;
+	}
+}
+
+static void metrics_write_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+				int fd_errno, void *uctx)
+{
+	proto_metrics_connection_t *conn = talloc_get_type_abort(uctx, proto_metrics_connection_t);
+
+	DEBUG2("%s - Write error: %s", conn->listen->name, fr_syserror(fd_errno));
+
+	(void) fr_network_socket_delete(conn->nr, conn->listen);
+}
+
+/** Write a response
+ *
+ * The socket is non-blocking, and we're in the network thread, so
+ * we can't wait for the client to drain it.  Whatever doesn't fit is
+ * kept on the connection, and written when the socket becomes
+ * writable.
+ *
+ * @return
+ *	- 1 if the whole response has been written.
+ *	- 0 if the rest will be written later.
+ *	- -1 on error.
+ */
+static int metrics_write(proto_metrics_connection_t *conn, char const *status, char const *content_type,
+			 char const *body, size_t body_len)
+{
+	size_t		len;
+	int		ret;
+
+	MEM(conn->response = talloc_typed_asprintf(conn, "HTTP/1.1 %s\r\n"
+						   "Content-Type: %s\r\n"
+						   "Content-Length: %zu\r\n"
+						   "Connection: close\r\n"
+						   "\r\n", status, content_type, body_len));
+	len = talloc_array_length(conn->response) - 1;
+
+	if (body) {
+		MEM(conn->response = talloc_realloc(conn, conn->response, char, len + body_len + 1));
+		memcpy(conn->response + len, body, body_len);
+		conn->response[len + body_len] = '\0';
+	}
+	conn->written = 0;
+
+	ret = metrics_flush(conn);
+	if (ret != 0) return ret;
+
+	/*
+	 *	We don't need to read anything else from the
+	 *	scraper, so the network's read callback is
+	 *	replaced with ours.
+	 */
+	if (fr_event_fd_insert(conn, conn->el, conn->listen->fd, NULL, metrics_writable, metrics_write_error, conn) < 0) {
+		PERROR("%s - Failed inserting write callback", conn->listen->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Answer a request from a scraper
+ *
+ */
+static int metrics_respond(proto_metrics_connection_t *conn)
+{
+	int		ret;
+	char		*p, *method, *path;
+	char		*body;
+
+	/*
+	 *	"GET /metrics HTTP/1.1"
+	 */
+	method = conn->buffer;
+	p = strchr(method, ' ');
+	if (!p) goto bad_request;
+	*p++ = '\0';
+
+	path = p;
+	p = strchr(path, ' ');
+	if (!p) goto bad_request;
+	*p = '\0';
+
+	p = strchr(path, '?');
+	if (p) *p = '\0';
+
+	if ((strcmp(method, "GET") != 0) && (strcmp(method, "HEAD") != 0)) {
+		static char const msg[] = "Only GET and HEAD are allowed\n";
+
+		return metrics_write(conn, "405 Method Not Allowed", "text/plain", msg, sizeof(msg) - 1);
+	}
+
+	if ((strcmp(path, "/metrics") != 0) && (strcmp(path, "/") != 0)) {
+		static char const msg[] = "Metrics are available at /metrics\n";
+
+		return metrics_write(conn, "404 Not Found", "text/plain", msg, sizeof(msg) - 1);
+	}
+
+	DEBUG3("%s - Rendering metrics", conn->listen->name);
+
+	body = fr_metrics_render(conn);
+	if (!body) {
+		static char const msg[] = "Failed rendering metrics\n";
+
+		return metrics_write(conn, "500 Internal Server Error", "text/plain", msg, sizeof(msg) - 1);
+	}
+
+	if (strcmp(method, "HEAD") == 0) {
+		ret = metrics_write(conn, "200 OK", METRICS_CONTENT_TYPE, NULL, talloc_array_length(body) - 1);
+	} else {
+		ret = metrics_write(conn, "200 OK", METRICS_CONTENT_TYPE, body, talloc_array_length(body) - 1);
+	}
+	talloc_free(body);
+	return ret;
+
+bad_request:
+	{
+		static char const msg[] = "Malformed request\n";
+
+		return metrics_write(conn, "400 Bad Request", "text/plain", msg, sizeof(msg) - 1);
+	}
+}
+
+/** Read a request from a scraper
+ *
+ * We never return a packet to the network, so nothing is sent to a
+ * worker.  Once the response has been written, we return an error so
+ * that the network closes the connection.  If the response didn't
+ * fit in the socket buffer, the connection is closed when the rest of
+ * it has been written.
+ */
+static ssize_t mod_connection_read(fr_listen_t *li, UNUSED void **packet_ctx, UNUSED fr_time_t *recv_time_p,
+				   UNUSED uint8_t *buffer, UNUSED size_t buffer_len, UNUSED size_t *leftover,
+				   UNUSED uint32_t *priority, UNUSED bool *is_dup)
+{
+	proto_metrics_connection_t	*conn = talloc_get_type_abort(li->thread_instance, proto_metrics_connection_t);
+	ssize_t				data_size;
+
+	/*
+	 *	Still writing the response.
+	 */
+	if (conn->response) return 0;
+
+	data_size = read(li->fd, conn->buffer + conn->used, sizeof(conn->buffer) - conn->used - 1);
+	if (data_size == 0) return -1;
+	if (data_size < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return 0;
+
+		DEBUG2("%s - Read error: %s", li->name, fr_syserror(errno));
+		return -1;
+	}
+
+	conn->used += data_size;
+	conn->buffer[conn->used] = '\0';
+
+	/*
+	 *	Wait for the end of the headers.  We don't care
+	 *	what's in them.
+	 */
+	if (!strstr(conn->buffer, "\r\n\r\n") && !strstr(conn->buffer, "\n\n")) {
+		if (conn->used < (sizeof(conn->buffer) - 1)) return 0;
+
+		if (metrics_write(conn, "431 Request Header Fields Too Large", "text/plain", NULL, 0) == 0) return 0;
+		return -1;
+	}
+
+	if (metrics_respond(conn) == 0) return 0;
+
+	return -1;
+}
+
+static void metrics_idle_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	proto_metrics_connection_t *conn = talloc_get_type_abort(uctx, proto_metrics_connection_t);
+
+	DEBUG2("%s - Idle timeout", conn->listen->name);
+
+	(void) fr_network_socket_delete(conn->nr, conn->listen);
+}
+
+static void mod_connection_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
+{
+	proto_metrics_connection_t *conn = talloc_get_type_abort(li->thread_instance, proto_metrics_connection_t);
+
+	conn->nr = nr;
+	conn->el = el;
+
+	if (fr_event_timer_in(conn, el, &conn->ev, conn->inst->idle_timeout, metrics_idle_timeout, conn) < 0) {
+		PERROR("%s - Failed adding idle timeout", li->name);
+	}
+}
+
+static int mod_connection_close(fr_listen_t *li)
+{
+	proto_metrics_connection_t *conn = talloc_get_type_abort(li->thread_instance, proto_metrics_connection_t);
+
+	close(li->fd);
+	li->fd = -1;
+
+	conn->inst->num_connections--;
+
+	/*
+	 *	The network has finished with the listener, and the
+	 *	connection is parented by it.
+	 */
+	talloc_free(li);
+
+	return 0;
+}
+
+static char const *mod_connection_name(fr_listen_t *li)
+{
+	return li->name;
+}
+
+static fr_app_io_t proto_metrics_connection_io = {
+	.magic			= RLM_MODULE_INIT,
+	.name			= "metrics",
+	.default_message_size	= METRICS_MAX_REQUEST,
+
+	.read			= mod_connection_read,
+	.close			= mod_connection_close,
+	.event_list_set		= mod_connection_event_list_set,
+	.get_name		= mod_connection_name,
+};
+
+/** Accept a connection from a scraper, and add it to our network
+ *
+ */
+static ssize_t mod_accept(fr_listen_t *li, UNUSED void **packet_ctx, UNUSED fr_time_t *recv_time_p,
+			  UNUSED uint8_t *buffer, UNUSED size_t buffer_len, UNUSED size_t *leftover,
+			  UNUSED uint32_t *priority, UNUSED bool *is_dup)
+{
+	proto_metrics_t			*inst = talloc_get_type_abort(li->thread_instance, proto_metrics_t);
+	proto_metrics_connection_t	*conn;
+	fr_listen_t			*child;
+	struct sockaddr_storage		src;
+	socklen_t			salen = sizeof(src);
+	fr_ipaddr_t			src_ipaddr;
+	uint16_t			src_port = 0;
+	int				fd;
+
+	fd = accept(li->fd, (struct sockaddr *) &src, &salen);
+	if (fd < 0) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+			ERROR("%s - Failed accepting connection: %s", inst->name, fr_syserror(errno));
+		}
+		return 0;
+	}
+
+	if (inst->num_connections >= inst->max_connections) {
+		RATE_LIMIT_GLOBAL(WARN, "%s - Refusing connection, max_connections (%u) reached",
+				  inst->name, inst->max_connections);
+		close(fd);
+		return 0;
+	}
+
+	if (fr_nonblock(fd) < 0) {
+		PERROR("%s - Failed setting connection non-blocking", inst->name);
+		close(fd);
+		return 0;
+	}
+
+	MEM(child = talloc_zero(inst, fr_listen_t));
+	MEM(conn = talloc_zero(child, proto_metrics_connection_t));
+	conn->inst = inst;
+	conn->listen = child;
+
+	child->fd = fd;
+	child->app_io = &proto_metrics_connection_io;
+	child->app_io_instance = inst;
+	child->thread_instance = conn;
+	child->app = &proto_metrics;
+	child->app_instance = inst;
+	child->server_cs = inst->server_cs;
+	child->connected = true;
+	child->default_message_size = METRICS_MAX_REQUEST;
+	child->num_messages = 2;
+
+	if (fr_ipaddr_from_sockaddr(&src, salen, &src_ipaddr, &src_port) < 0) {
+		child->name = talloc_typed_asprintf(child, "proto_metrics from unknown client to %s", inst->name);
+	} else {
+		child->name = fr_app_io_socket_name(child, &proto_metrics_connection_io,
+						    &src_ipaddr, src_port, &inst->ipaddr, inst->port, NULL);
+	}
+
+	if (fr_network_listen_add(inst->nr, child) < 0) {
+		PERROR("%s - Failed adding connection", inst->name);
+		close(fd);
+		talloc_free(child);
+		return 0;
+	}
+
+	inst->num_connections++;
+
+	DEBUG2("%s - Accepted connection", child->name);
+
+	return 0;
+}
+
+static void mod_listen_event_list_set(fr_listen_t *li, UNUSED fr_event_list_t *el, void *nr)
+{
+	proto_metrics_t *inst = talloc_get_type_abort(li->thread_instance, proto_metrics_t);
+
+	inst->nr = nr;
+}
+
+static int mod_listen_close(fr_listen_t *li)
+{
+	close(li->fd);
+	li->fd = -1;
+
+	return 0;
+}
+
+static char const *mod_listen_name(fr_listen_t *li)
+{
+	return li->name;
+}
+
+static fr_app_io_t proto_metrics_listen_io = {
+	.magic			= RLM_MODULE_INIT,
+	.name			= "metrics",
+	.default_message_size	= 256,
+
+	.read			= mod_accept,
+	.close			= mod_listen_close,
+	.event_list_set		= mod_listen_event_list_set,
+	.get_name		= mod_listen_name,
+};
+
+/** Open the listening socket, and add it to a network
+ *
+ * We don't use the master IO handler, as there are no packets for
+ * the workers, and no clients to track.
+ *
+ * @param[in] instance	Ctx data for this application.
+ * @param[in] sc	to add our file descriptor to.
+ * @param[in] conf	Listen section parsed to give us instance.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_open(void *instance, fr_schedule_t *sc, CONF_SECTION *conf)
+{
+	proto_metrics_t	*inst = talloc_get_type_abort(instance, proto_metrics_t);
+	fr_listen_t	*li;
+	uint16_t	port = inst->port;
+	int		sockfd;
+
+	sockfd = fr_socket_server_tcp(&inst->ipaddr, &port, inst->port_name, true);
+	if (sockfd < 0) {
+		cf_log_perr(conf, "Failed opening metrics socket");
+		return -1;
+	}
+
+	if (fr_socket_bind(sockfd, &inst->ipaddr, &port, inst->interface) < 0) {
+		close(sockfd);
+		cf_log_perr(conf, "Failed binding metrics socket");
+		return -1;
+	}
+
+	if (listen(sockfd, 8) < 0) {
+		close(sockfd);
+		cf_log_err(conf, "Failed listening on metrics socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	inst->name = fr_app_io_socket_name(inst, &proto_metrics_listen_io, NULL, 0,
+					   &inst->ipaddr, inst->port, inst->interface);
+
+	MEM(li = talloc_zero(inst, fr_listen_t));
+	li->fd = sockfd;
+	li->name = inst->name;
+	li->app_io = &proto_metrics_listen_io;
+	li->app_io_instance = inst;
+	li->thread_instance = inst;
+	li->app = &proto_metrics;
+	li->app_instance = inst;
+	li->server_cs = inst->server_cs;
+	li->default_message_size = proto_metrics_listen_io.default_message_size;
+	li->num_messages = 2;
+
+	if (!fr_schedule_listen_add(sc, li)) {
+		close(sockfd);
+		talloc_free(li);
+		return -1;
+	}
+
+	inst->listen = li;
+
+	DEBUG("Listening on metrics address %s bound to virtual server %s",
+	      inst->name, cf_section_name2(inst->server_cs));
+
+	return 0;
+}
+
+/** Bootstrap the application
+ *
+ * @param[in] instance	Ctx data for this application.
+ * @param[in] conf	Listen section parsed to give us instance.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_bootstrap(void *instance, CONF_SECTION *conf)
+{
+	proto_metrics_t *inst = talloc_get_type_abort(instance, proto_metrics_t);
+
+	inst->server_cs = cf_item_to_section(cf_parent(conf));
+
+	if (!inst->port) {
+		struct servent *s;
+
+		if (!inst->port_name) {
+			cf_log_err(conf, "No 'port' was specified in the 'listen' section");
+			return -1;
+		}
+
+		s = getservbyname(inst->port_name, "tcp");
+		if (!s) {
+			cf_log_err(conf, "Unknown value for 'port_name = %s", inst->port_name);
+			return -1;
+		}
+
+		inst->port = ntohs(s->s_port);
+	}
+
+	FR_INTEGER_BOUND_CHECK("max_connections", inst->max_connections, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_connections", inst->max_connections, <=, 1024);
+
+	FR_TIME_DELTA_BOUND_CHECK("idle_timeout", inst->idle_timeout, >=, fr_time_delta_from_sec(1));
+	FR_TIME_DELTA_BOUND_CHECK("idle_timeout", inst->idle_timeout, <=, fr_time_delta_from_sec(600));
+
+	return 0;
+}
+
+fr_app_t proto_metrics = {
+	.magic			= RLM_MODULE_INIT,
+	.name			= "metrics",
+	.config			= proto_metrics_config,
+	.inst_size		= sizeof(proto_metrics_t),
+
+	.bootstrap		= mod_bootstrap,
+	.open			= mod_open,
+};
@@ -0,0 +1,438 @@
+#include <freeradius-devel/util/acutest.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ *	Connections are added to, and removed from, a network we
+ *	don't have.  Removal is recorded instead.
+ */
+#define fr_network_socket_delete test_network_socket_delete
+
+#include "proto_metrics.c"
+
+/*
+ *	Tests for the metrics listener, and the text it serves.
+ *	Each test plays the part of a scraper, writing requests to
+ *	one end of a socket pair, and reading the responses from it.
+ */
+typedef struct {
+	TALLOC_CTX		*ctx;
+	fr_event_list_t		*el;
+	proto_metrics_t		*inst;
+	fr_listen_t		*li;
+	int			fd[2];			//!< [0] for the listener, [1] for the "scraper".
+} test_metrics_t;
+
+#define DEBUG_LVL_SET if (test_verbose_level__ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
+
+static fr_listen_t	*test_deleted;
+
+int test_network_socket_delete(UNUSED fr_network_t *nr, fr_listen_t *li)
+{
+	test_deleted = li;
+
+	return 0;
+}
+
+/** Accept a connection, in the same way mod_accept does, without a network
+ *
+ */
+static void test_conn_alloc(test_metrics_t *t, fr_time_delta_t idle_timeout)
+{
+	proto_metrics_connection_t	*conn;
+
+	DEBUG_LVL_SET;
+
+	test_deleted = NULL;
+
+	t->ctx = talloc_init_const("test");
+	MEM(t->el = fr_event_list_alloc(t->ctx, NULL, NULL));
+
+	TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, t->fd) == 0);
+	fr_nonblock(t->fd[0]);
+	fr_nonblock(t->fd[1]);
+
+	MEM(t->inst = talloc_zero(t->ctx, proto_metrics_t));
+	t->inst->name = "test";
+	t->inst->idle_timeout = idle_timeout;
+	t->inst->max_connections = 1;
+	t->inst->num_connections = 1;
+
+	MEM(t->li = talloc_zero(t->inst, fr_listen_t));
+	MEM(conn = talloc_zero(t->li, proto_metrics_connection_t));
+	conn->inst = t->inst;
+	conn->listen = t->li;
+
+	t->li->fd = t->fd[0];
+	t->li->name = "test connection";
+	t->li->app_io = &proto_metrics_connection_io;
+	t->li->app_io_instance = t->inst;
+	t->li->thread_instance = conn;
+	t->li->connected = true;
+
+	mod_connection_event_list_set(t->li, t->el, NULL);
+}
+
+static void test_conn_free(test_metrics_t *t)
+{
+	/*
+	 *	Removes the listener's events before its
+	 *	socket is closed.
+	 */
+	talloc_free(t->ctx);
+	close(t->fd[0]);
+	close(t->fd[1]);
+}
+
+/** Service the events which are ready now
+ *
+ * @return the number of events which were ready.
+ */
+static int test_service(fr_event_list_t *el)
+{
+	int	events;
+
+	events = fr_event_corral(el, fr_time(), false);
+	if (events > 0) fr_event_service(el);
+
+	return events;
+}
+
+static void test_scraper_write(test_metrics_t *t, char const *data)
+{
+	TEST_CHECK(write(t->fd[1], data, strlen(data)) == (ssize_t)strlen(data));
+}
+
+/** Read everything the listener has written so far
+ *
+ */
+static char *test_scraper_read(TALLOC_CTX *ctx, test_metrics_t *t)
+{
+	char	*out;
+	char	buffer[8192];
+	ssize_t	slen;
+
+	MEM(out = talloc_strdup(ctx, ""));
+	while ((slen = read(t->fd[1], buffer, sizeof(buffer) - 1)) > 0) {
+		buffer[slen] = '\0';
+		MEM(out = talloc_strdup_append_buffer(out, buffer));
+	}
+
+	return out;
+}
+
+static ssize_t test_listener_read(test_metrics_t *t)
+{
+	void		*packet_ctx = NULL;
+	fr_time_t	recv_time = 0;
+	uint8_t		buffer[1];
+	size_t		leftover = 0;
+	uint32_t	priority = 0;
+	bool		is_dup = false;
+
+	return mod_connection_read(t->li, &packet_ctx, &recv_time, buffer, sizeof(buffer),
+				   &leftover, &priority, &is_dup);
+}
+
+/** Check the status line, and Content-Length, of a response
+ *
+ * @return the body of the response.
+ */
+static char const *test_response_check(char const *response, char const *status, size_t *content_length)
+{
+	char const	*p, *body;
+	char		status_line[128];
+
+	snprintf(status_line, sizeof(status_line), "HTTP/1.1 %s\r\n", status);
+	TEST_CHECK(strncmp(response, status_line, strlen(status_line)) == 0);
+	TEST_MSG("Expected \"%s\", got \"%.40s\"", status, response);
+
+	p = strstr(response, "Content-Length: ");
+	TEST_CHECK(p != NULL);
+	if (!p) return NULL;
+	*content_length = strtoul(p + strlen("Content-Length: "), NULL, 10);
+
+	TEST_CHECK(strstr(response, "Connection: close\r\n") != NULL);
+
+	body = strstr(response, "\r\n\r\n");
+	TEST_CHECK(body != NULL);
+	if (!body) return NULL;
+
+	return body + 4;
+}
+
+/** Send a complete request, and check the status of the response
+ *
+ */
+static void test_request(char const *request, char const *status)
+{
+	test_metrics_t	t;
+	char		*response;
+	char const	*body;
+	size_t		content_length = 0;
+
+	test_conn_alloc(&t, fr_time_delta_from_sec(10));
+
+	test_scraper_write(&t, request);
+	TEST_CHECK(test_listener_read(&t) < 0);
+
+	response = test_scraper_read(t.ctx, &t);
+	body = test_response_check(response, status, &content_length);
+	if (body) {
+		TEST_CHECK(strlen(body) == content_length);
+		TEST_MSG("Content-Length %zu, body %zu bytes", content_length, strlen(body));
+	}
+
+	test_conn_free(&t);
+}
+
+static void test_metrics_collect(fr_metrics_t *m, void *uctx)
+{
+	fr_hist_t *hist = talloc_get_type_abort(uctx, fr_hist_t);
+
+	fr_metrics_counter(m, "test_requests", "Requests received.", 3, "worker=\"%i\"", 0);
+	fr_metrics_gauge(m, "test_queued", "Requests queued.", 2,
+			 "name=\"%s\"", fr_metrics_label_escape(m, "a\"b\\c\nd"));
+	fr_metrics_counter(m, "test_requests", "Requests received.", 5, "worker=\"%i\"", 1);
+	fr_metrics_summary(m, "test_latency_seconds", "Time taken.", hist, "worker=\"%i\"", 0);
+}
+
+static void test_render(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_metrics_source_t	*source;
+	fr_hist_t		*hist;
+	char			*out;
+
+	static char const	expected[] = "# TYPE test_requests counter\n"
+					     "# HELP test_requests Requests received.\n"
+					     "test_requests_total{worker=\"0\"} 3\n"
+					     "test_requests_total{worker=\"1\"} 5\n"
+					     "# TYPE test_queued gauge\n"
+					     "# HELP test_queued Requests queued.\n"
+					     "test_queued{name=\"a\\\"b\\\\c\\nd\"} 2\n"
+					     "# TYPE test_latency_seconds summary\n"
+					     "# HELP test_latency_seconds Time taken.\n"
+					     "test_latency_seconds{worker=\"0\",quantile=\"0.5\"} ";
+
+	TEST_CASE("No sources");
+	out = fr_metrics_render(ctx);
+	TEST_CHECK(out && (strcmp(out, "# EOF\n") == 0));
+	TEST_MSG("Got \"%s\"", out);
+
+	MEM(hist = fr_hist_alloc(ctx));
+	fr_hist_record(hist, NSEC);
+	MEM(source = fr_metrics_source_add(ctx, test_metrics_collect, hist));
+
+	TEST_CASE("Samples are grouped by family, with TYPE and HELP lines");
+	out = fr_metrics_render(ctx);
+	TEST_ASSERT(out != NULL);
+	TEST_CHECK(strncmp(out, expected, sizeof(expected) - 1) == 0);
+	TEST_MSG("Got \"%s\"", out);
+
+	TEST_CASE("Summaries have quantiles, a sum and a count");
+	TEST_CHECK(strstr(out, "test_latency_seconds{worker=\"0\",quantile=\"0.999\"} ") != NULL);
+	TEST_CHECK(strstr(out, "test_latency_seconds_sum{worker=\"0\"} 1.000000000\n"
+			       "test_latency_seconds_count{worker=\"0\"} 1\n"
+			       "# EOF\n") != NULL);
+	TEST_MSG("Got \"%s\"", out);
+
+	TEST_CASE("Sources are removed when freed");
+	talloc_free(source);
+	out = fr_metrics_render(ctx);
+	TEST_CHECK(out && (strcmp(out, "# EOF\n") == 0));
+
+	talloc_free(ctx);
+}
+
+static void test_partial_read(void)
+{
+	test_metrics_t	t;
+	char		*response;
+	char const	*body;
+	size_t		content_length = 0;
+
+	test_conn_alloc(&t, fr_time_delta_from_sec(10));
+
+	TEST_CASE("Nothing is written until the end of the headers");
+	test_scraper_write(&t, "GET /metrics HTTP/1.1\r\n");
+	TEST_CHECK(test_listener_read(&t) == 0);
+	test_scraper_write(&t, "Host: localhost\r\n\r");
+	TEST_CHECK(test_listener_read(&t) == 0);
+	TEST_CHECK(read(t.fd[1], &(char){ 0 }, 1) < 0);
+
+	TEST_CASE("The response is written once the headers end");
+	test_scraper_write(&t, "\n");
+	TEST_CHECK(test_listener_read(&t) < 0);
+
+	response = test_scraper_read(t.ctx, &t);
+	body = test_response_check(response, "200 OK", &content_length);
+	TEST_CHECK(strstr(response, "Content-Type: " METRICS_CONTENT_TYPE "\r\n") != NULL);
+	if (body) {
+		TEST_CHECK(strlen(body) == content_length);
+		TEST_CHECK(strcmp(body + strlen(body) - strlen("# EOF\n"), "# EOF\n") == 0);
+	}
+
+	TEST_CASE("The scraper closing the connection closes ours");
+	test_conn_free(&t);
+
+	test_conn_alloc(&t, fr_time_delta_from_sec(10));
+	TEST_CHECK(shutdown(t.fd[1], SHUT_WR) == 0);
+	TEST_CHECK(test_listener_read(&t) < 0);
+	test_conn_free(&t);
+}
+
+static void test_requests(void)
+{
+	TEST_CASE("Headers ending in a bare LF");
+	test_request("GET /metrics HTTP/1.0\n\n", "200 OK");
+
+	TEST_CASE("The root path, with a query string");
+	test_request("GET /?name=value HTTP/1.1\r\n\r\n", "200 OK");
+
+	TEST_CASE("Malformed request line");
+	test_request("GET\r\n\r\n", "400 Bad Request");
+	test_request("GET /metrics\r\n\r\n", "400 Bad Request");
+
+	TEST_CASE("Unknown path");
+	test_request("GET /status HTTP/1.1\r\n\r\n", "404 Not Found");
+
+	TEST_CASE("Methods other than GET and HEAD");
+	test_request("POST /metrics HTTP/1.1\r\nContent-Length: 0\r\n\r\n", "405 Method Not Allowed");
+}
+
+static void test_header_too_large(void)
+{
+	test_metrics_t	t;
+	char		*request, *response;
+	size_t		content_length = 1;
+
+	test_conn_alloc(&t, fr_time_delta_from_sec(10));
+
+	MEM(request = talloc_array(t.ctx, char, METRICS_MAX_REQUEST + 1));
+	memset(request, 'A', METRICS_MAX_REQUEST);
+	request[METRICS_MAX_REQUEST] = '\0';
+
+	test_scraper_write(&t, request);
+	TEST_CHECK(test_listener_read(&t) < 0);
+
+	response = test_scraper_read(t.ctx, &t);
+	test_response_check(response, "431 Request Header Fields Too Large", &content_length);
+	TEST_CHECK(content_length == 0);
+
+	test_conn_free(&t);
+}
+
+static void test_head(void)
+{
+	test_metrics_t	t;
+	char		*response;
+	char const	*body;
+	size_t		content_length = 0;
+
+	test_conn_alloc(&t, fr_time_delta_from_sec(10));
+
+	test_scraper_write(&t, "HEAD /metrics HTTP/1.1\r\n\r\n");
+	TEST_CHECK(test_listener_read(&t) < 0);
+
+	response = test_scraper_read(t.ctx, &t);
+	body = test_response_check(response, "200 OK", &content_length);
+
+	TEST_CASE("The length of the metrics is sent, but not the metrics");
+	TEST_CHECK(content_length == strlen("# EOF\n"));
+	TEST_CHECK(body && (*body == '\0'));
+
+	test_conn_free(&t);
+}
+
+#define TEST_GAUGES	(20000)
+
+static void test_metrics_collect_many(fr_metrics_t *m, UNUSED void *uctx)
+{
+	int i;
+
+	for (i = 0; i < TEST_GAUGES; i++) {
+		fr_metrics_gauge(m, "test_gauge", "A gauge with a lot of samples.", i, "sample=\"%i\"", i);
+	}
+}
+
+static void test_partial_write(void)
+{
+	test_metrics_t		t;
+	fr_metrics_source_t	*source;
+	char			*response;
+	char const		*body;
+	size_t			content_length = 0;
+	int			i;
+
+	test_conn_alloc(&t, fr_time_delta_from_sec(10));
+	MEM(source = fr_metrics_source_add(t.ctx, test_metrics_collect_many, NULL));
+
+	TEST_CASE("A response larger than the socket buffer is written as it drains");
+	test_scraper_write(&t, "GET /metrics HTTP/1.1\r\n\r\n");
+	TEST_CHECK(test_listener_read(&t) == 0);
+	TEST_CHECK(test_deleted == NULL);
+
+	TEST_CASE("Reads are ignored while the response is written");
+	test_scraper_write(&t, "GET /metrics HTTP/1.1\r\n\r\n");
+	TEST_CHECK(test_listener_read(&t) == 0);
+
+	MEM(response = talloc_strdup(t.ctx, ""));
+	for (i = 0; (i < 10000) && !test_deleted; i++) {
+		char *more;
+
+		more = test_scraper_read(t.ctx, &t);
+		MEM(response = talloc_strdup_append_buffer(response, more));
+		talloc_free(more);
+
+		test_service(t.el);
+	}
+	MEM(response = talloc_strdup_append_buffer(response, test_scraper_read(t.ctx, &t)));
+
+	TEST_CASE("The connection is closed once the whole response has been written");
+	TEST_CHECK(test_deleted == t.li);
+
+	body = test_response_check(response, "200 OK", &content_length);
+	if (body) {
+		TEST_CHECK(strlen(body) == content_length);
+		TEST_MSG("Content-Length %zu, received %zu bytes", content_length, strlen(body));
+		TEST_CHECK(strstr(body, "test_gauge{sample=\"19999\"} 19999\n# EOF\n") != NULL);
+	}
+
+	talloc_free(source);
+	test_conn_free(&t);
+}
+
+static void test_idle_timeout(void)
+{
+	test_metrics_t	t;
+	int		i;
+
+	test_conn_alloc(&t, fr_time_delta_from_msec(50));
+
+	TEST_CASE("Connections are kept open until the idle timeout");
+	test_scraper_write(&t, "GET /metrics HTTP/1.1\r\n");
+	TEST_CHECK(test_listener_read(&t) == 0);
+	test_service(t.el);
+	TEST_CHECK(test_deleted == NULL);
+
+	TEST_CASE("Connections which don't send a whole request are closed");
+	for (i = 0; (i < 100) && !test_deleted; i++) {
+		usleep(10000);
+		test_service(t.el);
+	}
+	TEST_CHECK(test_deleted == t.li);
+
+	test_conn_free(&t);
+}
+
+TEST_LIST = {
+	{ "Render - OpenMetrics output",		test_render },
+	{ "Read - Partial reads",			test_partial_read },
+	{ "Read - Status codes",			test_requests },
+	{ "Read - Headers too large",			test_header_too_large },
+	{ "Read - HEAD",				test_head },
+	{ "Write - Partial writes",			test_partial_write },
+	{ "Timeout - Idle connections",			test_idle_timeout },
+	{ NULL }
+};
@@ -44,6 +44,9 @@ static CONF_PARSER const limit_config[] = {
 	{ FR_CONF_OFFSET("max_clients", FR_TYPE_UINT32, proto_radius_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", FR_TYPE_UINT32, proto_radius_t, io.max_pending_packets), .dflt = "256" } ,
 
+	{ FR_CONF_OFFSET("num_sockets", FR_TYPE_UINT32, proto_radius_t, io.num_sockets), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("steer_by_source", FR_TYPE_BOOL, proto_radius_t, io.steer_by_source), .dflt = "no" } ,
+
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
 	 */
@@ -689,6 +692,19 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 
 	FR_TIME_DELTA_BOUND_CHECK("cleanup_delay", inst->io.cleanup_delay, <=, fr_time_delta_from_sec(30));
 
+	FR_INTEGER_BOUND_CHECK("num_sockets", inst->io.num_sockets, >=, 1);
+	FR_INTEGER_BOUND_CHECK("num_sockets", inst->io.num_sockets, <=, 32);
+
+	/*
+	 *	Only UDP sockets can share an address.  Connected
+	 *	transports are already spread across the network
+	 *	threads, one connection at a time.
+	 */
+	if ((inst->io.num_sockets > 1) && (strcmp(inst->io.transport, "udp") != 0)) {
+		cf_log_err(conf, "'num_sockets' can only be used with 'transport = udp'");
+		return -1;
+	}
+
 	/*
 	 *	No Access-Request packets, then no cleanup delay.
 	 */
@@ -59,6 +59,9 @@ typedef struct {
 							//!< authenticating server to be identified in packet
 							//!< captures.
 
+	uint32_t	state_shards;			//!< Number of independently locked partitions
+							//!< of the state tree.
+
 	fr_state_tree_t	*state_tree;			//!< State tree to link multiple requests/responses.
 
 	CONF_SECTION	*recv_access_request;
@@ -79,6 +82,7 @@ static const CONF_PARSER session_config[] = {
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, proto_radius_auth_t, session_timeout), .dflt = "15" },
 	{ FR_CONF_OFFSET("max", FR_TYPE_UINT32, proto_radius_auth_t, max_session), .dflt = "4096" },
 	{ FR_CONF_OFFSET("state_server_id", FR_TYPE_UINT8, proto_radius_auth_t, state_server_id) },
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, proto_radius_auth_t, state_shards), .dflt = "16" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -731,8 +735,11 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *process_app_cs)
 {
 	proto_radius_auth_t	*inst = instance;
 
+	FR_INTEGER_BOUND_CHECK("session.shards", inst->state_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("session.shards", inst->state_shards, <=, 256);
+
 	inst->state_tree = fr_state_tree_init(inst, attr_state, main_config->spawn_workers, inst->max_session,
-					      inst->session_timeout, inst->state_server_id);
+					      inst->session_timeout, inst->state_server_id, inst->state_shards);
 
 	return 0;
 }
@@ -44,6 +44,12 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	fr_udp_batch_t			*batch;			//!< for reading multiple packets per syscall.
+	fr_event_list_t			*el;			//!< for scheduling reads of batched packets.
+	fr_network_t			*nr;			//!< network handler.
+	fr_listen_t			*parent;		//!< master IO handler.
+	fr_event_timer_t const		*ev;			//!< pending read of batched packets.
+
 	fr_stats_t			stats;			//!< statistics for this socket
 } proto_radius_udp_thread_t;
 
@@ -61,6 +67,8 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			recv_batch;		//!< Maximum number of packets to read per syscall.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
@@ -96,6 +104,7 @@ static const CONF_PARSER udp_listen_config[] = {
 
 	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, proto_radius_udp_t, recv_buff) },
 	{ FR_CONF_OFFSET_IS_SET("send_buff", FR_TYPE_UINT32, proto_radius_udp_t, send_buff) },
+	{ FR_CONF_OFFSET("recv_batch", FR_TYPE_UINT32, proto_radius_udp_t, recv_batch), .dflt = "16" },
 
 	{ FR_CONF_OFFSET("accept_conflicting_packets", FR_TYPE_BOOL, proto_radius_udp_t, dedup_authenticator) } ,
 	{ FR_CONF_OFFSET("dynamic_clients", FR_TYPE_BOOL, proto_radius_udp_t, dynamic_clients) } ,
@@ -108,6 +117,18 @@ static const CONF_PARSER udp_listen_config[] = {
 };
 
 
+/** Tell the network side to read packets we've already pulled from the socket
+ *
+ * The socket may have been drained by recvmmsg(), so there won't be
+ * another read event for the packets still in the batch.
+ */
+static void mod_batch_read(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(uctx, proto_radius_udp_thread_t);
+
+	fr_network_listen_read(thread->nr, thread->parent);
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover, UNUSED uint32_t *priority, UNUSED bool *is_dup)
 {
 	proto_radius_udp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_udp_t);
@@ -133,10 +154,33 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, buffer, buffer_len, flags,
-			     &address->src_ipaddr, &address->src_port,
-			     &address->dst_ipaddr, &address->dst_port,
-			     &address->if_index, recv_time_p);
+	if (thread->batch) {
+		data_size = udp_batch_recv(thread->batch, thread->sockfd, buffer, buffer_len, flags,
+					   &address->src_ipaddr, &address->src_port,
+					   &address->dst_ipaddr, &address->dst_port,
+					   &address->if_index, recv_time_p);
+
+		/*
+		 *	The network side stops calling us if we
+		 *	return 0, or after it's read a number of
+		 *	packets.  Make sure it comes back for the
+		 *	rest of the batch.
+		 */
+		if (udp_batch_pending(thread->batch) && thread->el && !thread->ev &&
+		    (fr_event_timer_in(thread, thread->el, &thread->ev, 0, mod_batch_read, thread) < 0)) {
+			/*
+			 *	Shouldn't happen, but if it does the
+			 *	packets are read on the next event for
+			 *	this socket.
+			 */
+			DEBUG2("proto_radius_udp failed scheduling read of batched packets: %s", fr_strerror());
+		}
+	} else {
+		data_size = udp_recv(thread->sockfd, buffer, buffer_len, flags,
+				     &address->src_ipaddr, &address->src_port,
+				     &address->dst_ipaddr, &address->dst_port,
+				     &address->if_index, recv_time_p);
+	}
 	if (data_size < 0) {
 		DEBUG2("proto_radius_udp got read error: %s", fr_strerror());
 		return data_size;
@@ -354,6 +398,21 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Connected sockets are opened by the master socket,
+	 *	and only see traffic from one client.  Don't bother
+	 *	batching reads for them.
+	 */
+	if ((inst->recv_batch > 1) && !thread->connection) {
+		thread->batch = udp_batch_alloc(thread, inst->recv_batch, inst->max_packet_size);
+		if (!thread->batch) {
+			close(sockfd);
+			PERROR("Failed allocating receive batch");
+			goto error;
+		}
+		thread->parent = talloc_parent(li);
+	}
+
 	ci = cf_parent(inst->cs); /* listen { ... } */
 	fr_assert(ci != NULL);
 	ci = cf_parent(ci);
@@ -422,6 +481,21 @@ static int mod_compare(void const *instance, UNUSED void *thread_instance, UNUSE
 }
 
 
+/** Set the event list for a new socket
+ *
+ * @param[in] li the listener
+ * @param[in] el the event list
+ * @param[in] nr context from the network side
+ */
+static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	thread->el = el;
+	thread->nr = nr;
+}
+
+
 static char const *mod_name(fr_listen_t *li)
 {
 	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
@@ -457,6 +531,9 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 		FR_INTEGER_BOUND_CHECK("send_buff", inst->send_buff, <=, (1 << 30));
 	}
 
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, <=, 1024);
+
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
@@ -553,6 +630,7 @@ fr_app_io_t proto_radius_udp = {
 	.compare		= mod_compare,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
+	.event_list_set		= mod_event_list_set,
 	.client_find		= mod_client_find,
 	.get_name      		= mod_name,
 };
@@ -0,0 +1,481 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_htrie.c
+ * @brief Sharded hash table based cache.
+ *
+ * Entries are distributed over a number of independently locked shards
+ * by the hash of their key.  Each shard has its own hash table and
+ * expiry heap, so requests operating on different keys very rarely
+ * contend for the same mutex.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/debug.h>
+#include "../../rlm_cache.h"
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+typedef struct {
+	fr_hash_table_t		*cache;		//!< Hash table for looking up cache keys.
+	fr_heap_t		*heap;		//!< For managing entry expiry.
+
+	pthread_mutex_t		mutex;		//!< Protect the shard from multiple readers/writers.
+} rlm_cache_htrie_shard_t;
+
+typedef struct {
+	uint32_t		num_shards;	//!< How many independently locked shards we have.
+
+	rlm_cache_htrie_shard_t	**shards;	//!< Array of shards, indexed by key hash.  Each
+						//!< shard is allocated separately so the mutexes
+						//!< are unlikely to share a cache line.
+
+	atomic_uint_fast32_t	num_entries;	//!< Total number of entries across all shards.
+} rlm_cache_htrie_t;
+
+typedef struct {
+	rlm_cache_entry_t	fields;		//!< Entry data.
+	int32_t			heap_id;	//!< Offset used for heap.
+	uint32_t		hash;		//!< Hash of the key, so we don't need to recalculate it.
+} rlm_cache_htrie_entry_t;
+
+/** Tracks which shard a request currently has locked
+ *
+ * Allocated in acquire and freed in release.  The shard mutex is taken lazily
+ * the first time the request operates on a key, and held until release, as
+ * entries returned by find must remain valid until then.
+ */
+typedef struct {
+	rlm_cache_htrie_shard_t	*shard;		//!< The shard we hold the mutex for, or NULL.
+} rlm_cache_htrie_handle_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_cache_htrie_t, num_shards), .dflt = "16" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Hash an entry's key
+ *
+ */
+static uint32_t cache_entry_hash(void const *data)
+{
+	rlm_cache_htrie_entry_t const *c = data;
+
+	return c->hash;
+}
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Compare two entries by expiry time
+ *
+ * There may be multiple entries with the same expiry time.
+ */
+static int8_t cache_heap_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	return (a->expires > b->expires) - (a->expires < b->expires);
+}
+
+/** Return the shard responsible for a key hash
+ *
+ */
+static inline CC_HINT(always_inline) rlm_cache_htrie_shard_t *cache_shard(rlm_cache_htrie_t *driver, uint32_t hash)
+{
+	/*
+	 *	The hash table uses the low bits of the hash
+	 *	to pick buckets, so use the high bits here.
+	 */
+	return driver->shards[(hash >> 16) % driver->num_shards];
+}
+
+/** Ensure the handle holds the mutex for the shard owning the hash
+ *
+ */
+static rlm_cache_htrie_shard_t *cache_shard_lock(rlm_cache_htrie_t *driver, REQUEST *request,
+						 rlm_cache_htrie_handle_t *handle, uint32_t hash)
+{
+	rlm_cache_htrie_shard_t *shard = cache_shard(driver, hash);
+
+	if (handle->shard == shard) return shard;
+
+	/*
+	 *	rlm_cache only ever operates on one key per
+	 *	acquire/release cycle, but be safe.
+	 */
+	if (handle->shard) pthread_mutex_unlock(&handle->shard->mutex);
+
+	pthread_mutex_lock(&shard->mutex);
+	handle->shard = shard;
+
+	RDEBUG3("Mutex acquired for shard %u", (hash >> 16) % driver->num_shards);
+
+	return shard;
+}
+
+/** Remove an entry from the shard it lives in, and free it
+ *
+ */
+static void cache_entry_remove(rlm_cache_htrie_t *driver, rlm_cache_htrie_shard_t *shard, rlm_cache_entry_t *c)
+{
+	fr_heap_extract(shard->heap, c);
+	fr_hash_table_delete(shard->cache, c);
+	atomic_fetch_sub_explicit(&driver->num_entries, 1, memory_order_relaxed);
+	talloc_free(c);
+}
+
+/** Free any entries left in a shard on detach
+ *
+ */
+static int _cache_entry_free(UNUSED void *ctx, void *data)
+{
+	talloc_free(data);
+
+	return 0;
+}
+
+/** Cleanup a cache_htrie instance
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_htrie_t	*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	uint32_t		i;
+
+	if (!driver->shards) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_htrie_shard_t *shard = driver->shards[i];
+
+		if (!shard) continue;
+
+		if (shard->cache) {
+			fr_hash_table_walk(shard->cache, _cache_entry_free, NULL);
+			fr_hash_table_free(shard->cache);
+		}
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	return 0;
+}
+
+/** Create a new cache_htrie instance
+ *
+ * @param instance	A uint8_t array of inst_size if inst_size > 0, else NULL,
+ *			this should contain the result of parsing the driver's
+ *			CONF_PARSER array that it specified in the interface struct.
+ * @param conf		section holding driver specific #CONF_PAIR (s).
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+{
+	rlm_cache_htrie_t	*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	uint32_t		i;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, 1024);
+
+	MEM(driver->shards = talloc_zero_array(driver, rlm_cache_htrie_shard_t *, driver->num_shards));
+	atomic_init(&driver->num_entries, 0);
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_htrie_shard_t *shard;
+
+		MEM(shard = driver->shards[i] = talloc_zero(driver->shards, rlm_cache_htrie_shard_t));
+
+		/*
+		 *	The cache.
+		 */
+		shard->cache = fr_hash_table_create(shard, cache_entry_hash, cache_entry_cmp, NULL);
+		if (!shard->cache) {
+			ERROR("Failed to create cache");
+			return -1;
+		}
+
+		/*
+		 *	The heap of entries to expire.
+		 */
+		shard->heap = fr_heap_talloc_create(shard, cache_heap_cmp, rlm_cache_htrie_entry_t, heap_id);
+		if (!shard->heap) {
+			ERROR("Failed to create heap for the cache");
+			return -1;
+		}
+
+		if (pthread_mutex_init(&shard->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    REQUEST *request)
+{
+	rlm_cache_htrie_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_htrie_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       REQUEST *request, void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htrie_t	*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	rlm_cache_htrie_shard_t	*shard;
+	rlm_cache_entry_t	*c;
+	uint32_t		hash = fr_hash(key, key_len);
+
+	shard = cache_shard_lock(driver, request, handle, hash);
+
+	/*
+	 *	Clear out old entries
+	 */
+	c = fr_heap_peek(shard->heap);
+	if (c && (c->expires < fr_time_to_unix_time(request->packet->timestamp))) cache_entry_remove(driver, shard, c);
+
+	/*
+	 *	Is there an entry for this key?
+	 */
+	c = fr_hash_table_finddata(shard->cache, &(rlm_cache_htrie_entry_t){
+						.fields = { .key = key, .key_len = key_len },
+						.hash = hash
+					 });
+	if (!c) {
+		*out = NULL;
+		return CACHE_MISS;
+	}
+	*out = c;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htrie_t	*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	rlm_cache_htrie_shard_t	*shard;
+	rlm_cache_entry_t	*c;
+	uint32_t		hash = fr_hash(key, key_len);
+
+	if (!request) return CACHE_ERROR;
+
+	shard = cache_shard_lock(driver, request, handle, hash);
+
+	c = fr_hash_table_finddata(shard->cache, &(rlm_cache_htrie_entry_t){
+						.fields = { .key = key, .key_len = key_len },
+						.hash = hash
+					 });
+	if (!c) return CACHE_MISS;
+
+	cache_entry_remove(driver, shard, c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, void *handle,
+					 rlm_cache_entry_t const *c)
+{
+	cache_status_t		status;
+
+	rlm_cache_htrie_t	*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	rlm_cache_htrie_shard_t	*shard;
+	rlm_cache_htrie_entry_t	*my_c;
+
+	if (!request) return CACHE_ERROR;
+
+	memcpy(&my_c, &c, sizeof(my_c));
+
+	my_c->hash = fr_hash(c->key, c->key_len);
+	shard = cache_shard_lock(driver, request, handle, my_c->hash);
+
+	/*
+	 *	Allow overwriting
+	 */
+	if (!fr_hash_table_insert(shard->cache, my_c)) {
+		status = cache_entry_expire(config, instance, request, handle, c->key, c->key_len);
+		if ((status != CACHE_OK) && !fr_cond_assert(0)) return CACHE_ERROR;
+
+		if (!fr_hash_table_insert(shard->cache, my_c)) {
+			RERROR("Failed adding entry");
+
+			return CACHE_ERROR;
+		}
+	}
+
+	if (fr_heap_insert(shard->heap, my_c) < 0) {
+		fr_hash_table_delete(shard->cache, my_c);
+		RERROR("Failed adding entry to expiry heap");
+
+		return CACHE_ERROR;
+	}
+
+	atomic_fetch_add_explicit(&driver->num_entries, 1, memory_order_relaxed);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
+					  REQUEST *request, void *handle,
+					  rlm_cache_entry_t *c)
+{
+	rlm_cache_htrie_t	*driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+	rlm_cache_htrie_shard_t	*shard;
+
+#ifdef NDEBUG
+	if (!request) return CACHE_ERROR;
+#endif
+
+	shard = cache_shard_lock(driver, request, handle, ((rlm_cache_htrie_entry_t *)c)->hash);
+
+	if (!fr_cond_assert(fr_heap_extract(shard->heap, c) == 0)) {
+		RERROR("Entry not in heap");
+		return CACHE_ERROR;
+	}
+
+	if (fr_heap_insert(shard->heap, c) < 0) {
+		fr_hash_table_delete(shard->cache, c);	/* make sure we don't leak entries... */
+		atomic_fetch_sub_explicit(&driver->num_entries, 1, memory_order_relaxed);
+		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
+		return CACHE_ERROR;
+	}
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * Doesn't lock any shards, so the value may be slightly stale.
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  REQUEST *request, UNUSED void *handle)
+{
+	rlm_cache_htrie_t *driver = talloc_get_type_abort(instance, rlm_cache_htrie_t);
+
+	if (!request) return CACHE_ERROR;
+
+	return atomic_load_explicit(&driver->num_entries, memory_order_relaxed);
+}
+
+/** Allocate a handle to track which shard we have locked
+ *
+ * No shard is locked until we know which key is being operated on.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+			 REQUEST *request)
+{
+	rlm_cache_htrie_handle_t *h;
+
+	MEM(h = talloc_zero(request, rlm_cache_htrie_handle_t));
+	*handle = h;
+
+	return 0;
+}
+
+/** Release the shard mutex held by the handle (if any), and free the handle
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, REQUEST *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_htrie_handle_t *h = talloc_get_type_abort(handle, rlm_cache_htrie_handle_t);
+
+	if (h->shard) {
+		pthread_mutex_unlock(&h->shard->mutex);
+		RDEBUG3("Mutex released");
+	}
+
+	talloc_free(h);
+}
+
+extern rlm_cache_driver_t rlm_cache_htrie;
+rlm_cache_driver_t rlm_cache_htrie = {
+	.name		= "rlm_cache_htrie",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_htrie_t),
+	.config		= driver_config,
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
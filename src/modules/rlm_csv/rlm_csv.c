@@ -58,13 +58,23 @@ typedef struct {
 
 	char const     	**field_names;
 	int		*field_offsets; /* field X from the file maps to array entry Y here */
-	rbtree_t	*tree;
-	fr_trie_t	*trie;
+
+	fr_reload_conf_t reload_conf;
+	fr_reload_t	*reload;	//!< Holds the current #rlm_csv_data_t.
 
 	vp_tmpl_t	*key;
 	vp_map_t	*map;		//!< if there is an "update" section in the configuration.
 } rlm_csv_t;
 
+/** The entries read from the file
+ *
+ * Replaced as a whole when the file is reloaded.
+ */
+typedef struct {
+	rbtree_t	*tree;
+	fr_trie_t	*trie;
+} rlm_csv_data_t;
+
 typedef struct rlm_csv_entry_s rlm_csv_entry_t;
 struct rlm_csv_entry_s {
 	rlm_csv_entry_t *next;
@@ -83,6 +93,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("index_field", FR_TYPE_STRING | FR_TYPE_REQUIRED | FR_TYPE_NOT_EMPTY, rlm_csv_t, index_field_name) },
 	{ FR_CONF_OFFSET("data_type", FR_TYPE_STRING, rlm_csv_t, data_type_name) },
 	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL, rlm_csv_t, key) },
+
+	{ FR_CONF_OFFSET("reload", FR_TYPE_SUBSECTION, rlm_csv_t, reload_conf), .subcs = (void const *) fr_reload_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -97,7 +109,7 @@ static int csv_entry_cmp(void const *one, void const *two)
 /*
  *	Allow for quotation marks.
  */
-static bool buf2entry(rlm_csv_t *inst, char *buf, char **out)
+static bool buf2entry(rlm_csv_t const *inst, char *buf, char **out)
 {
 	char *p, *q;
 
@@ -168,26 +180,26 @@ static bool buf2entry(rlm_csv_t *inst, char *buf, char **out)
 /*
  *	Convert a buffer to a CSV entry
  */
-static rlm_csv_entry_t *file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buffer)
+static rlm_csv_entry_t *file2csv(rlm_csv_data_t *data, rlm_csv_t const *inst, int lineno, char *buffer)
 {
 	rlm_csv_entry_t *e;
 	int i;
 	char *p, *q;
 
-	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst, uint8_t,
+	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(data, uint8_t,
 						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0]))));
 	talloc_set_type(e, rlm_csv_entry_t);
 
 	for (p = buffer, i = 0; p != NULL; p = q, i++) {
 		if (!buf2entry(inst, p, &q)) {
-			cf_log_err(conf, "Malformed entry in file %s line %d", inst->filename, lineno);
+			fr_strerror_printf("Malformed entry in file %s line %d", inst->filename, lineno);
 			return NULL;
 		}
 
 		if (q) *(q++) = '\0';
 
 		if (i >= inst->num_fields) {
-			cf_log_err(conf, "Too many fields at file %s line %d", inst->filename, lineno);
+			fr_strerror_printf("Too many fields at file %s line %d", inst->filename, lineno);
 			return NULL;
 		}
 
@@ -199,8 +211,9 @@ static rlm_csv_entry_t *file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno
 
 			e->key = talloc_zero(e, fr_value_box_t);
 			if (fr_value_box_from_str(e->key, e->key, &type, NULL, p, -1, 0, false) < 0) {
-				cf_log_err(conf, "Failed parsing key field in file %s line %d - %s", inst->filename, lineno,
-					   fr_strerror());
+				fr_strerror_printf_push("Failed parsing key field in file %s line %d",
+							inst->filename, lineno);
+				return NULL;
 			}
 			continue;
 		}
@@ -214,30 +227,30 @@ static rlm_csv_entry_t *file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno
 	}
 
 	if (i < inst->num_fields) {
-		cf_log_err(conf, "Too few fields in file %s at line %d (%d < %d)", inst->filename, lineno, i, inst->num_fields);
+		fr_strerror_printf("Too few fields in file %s at line %d (%d < %d)", inst->filename, lineno, i, inst->num_fields);
 		return NULL;
 	}
 
 	if ((inst->data_type == FR_TYPE_IPV4_ADDR) || (inst->data_type == FR_TYPE_IPV4_PREFIX)) {
-		if (fr_trie_insert(inst->trie, &e->key->vb_ip.addr.v4.s_addr, e->key->vb_ip.prefix, e) < 0) {
-			cf_log_err(conf, "Failed inserting entry for file %s line %d: %s",
-				   inst->filename, lineno, fr_strerror());
+		if (fr_trie_insert(data->trie, &e->key->vb_ip.addr.v4.s_addr, e->key->vb_ip.prefix, e) < 0) {
+			fr_strerror_printf_push("Failed inserting entry for file %s line %d",
+						inst->filename, lineno);
 			return NULL;
 		}
 
 	} else if ((inst->data_type == FR_TYPE_IPV6_ADDR) || (inst->data_type == FR_TYPE_IPV6_PREFIX)) {
-		if (fr_trie_insert(inst->trie, &e->key->vb_ip.addr.v6.s6_addr, e->key->vb_ip.prefix, e) < 0) {
-			cf_log_err(conf, "Failed inserting entry for file %s line %d: %s",
-				   inst->filename, lineno, fr_strerror());
+		if (fr_trie_insert(data->trie, &e->key->vb_ip.addr.v6.s6_addr, e->key->vb_ip.prefix, e) < 0) {
+			fr_strerror_printf_push("Failed inserting entry for file %s line %d",
+						inst->filename, lineno);
 			return NULL;
 		}
 
-	} else if (!rbtree_insert(inst->tree, e)) {
+	} else if (!rbtree_insert(data->tree, e)) {
 		/*
 		 *	@todo - allow duplicate keys later
 		 */
-		cf_log_err(conf, "Failed inserting entry for file %s line %d: duplicate entry",
-			      inst->filename, lineno);
+		fr_strerror_printf("Failed inserting entry for file %s line %d: duplicate entry",
+				   inst->filename, lineno);
 		return NULL;
 	}
 
@@ -367,6 +380,65 @@ static int csv_maps_verify(CONF_SECTION *cs, void *mod_inst, UNUSED void *proc_i
 	return 0;
 }
 
+/** Read the entries from the CSV file
+ *
+ * Called when the module is bootstrapped, and from the reload thread.
+ * The field names can't change without a restart, as the maps have
+ * already been checked against them.
+ */
+static void *csv_load(TALLOC_CTX *ctx, void *uctx)
+{
+	rlm_csv_t const	*inst = uctx;
+	rlm_csv_data_t	*data;
+	FILE		*fp;
+	int		lineno = 1;
+	char		buffer[8192];
+
+	MEM(data = talloc_zero(ctx, rlm_csv_data_t));
+
+	if ((inst->data_type == FR_TYPE_IPV4_ADDR) || (inst->data_type == FR_TYPE_IPV4_PREFIX) ||
+	    (inst->data_type == FR_TYPE_IPV6_ADDR) || (inst->data_type == FR_TYPE_IPV6_PREFIX)) {
+		MEM(data->trie = fr_trie_alloc(data));
+	} else {
+		MEM(data->tree = rbtree_talloc_create(data, csv_entry_cmp, rlm_csv_entry_t, NULL, 0));
+	}
+
+	fp = fopen(inst->filename, "r");
+	if (!fp) {
+		fr_strerror_printf("Error opening filename %s: %s", inst->filename, fr_syserror(errno));
+		return NULL;
+	}
+
+	if (inst->header) {
+		char *q;
+
+		if (!fgets(buffer, sizeof(buffer), fp) || !(q = strchr(buffer, '\n'))) {
+			fr_strerror_printf("Error reading filename %s: Unexpected EOF", inst->filename);
+		error:
+			fclose(fp);
+			return NULL;
+		}
+		*q = '\0';
+
+		if (strcmp(buffer, inst->fields) != 0) {
+			fr_strerror_printf("Header of file %s changed from \"%s\" to \"%s\"",
+					   inst->filename, inst->fields, buffer);
+			goto error;
+		}
+		lineno++;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		if (!file2csv(data, inst, lineno, buffer)) goto error;
+
+		lineno++;
+	}
+
+	fclose(fp);
+
+	return data;
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -385,7 +457,6 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	char *q;
 	char *fields;
 	FILE *fp;
-	int lineno;
 	char buffer[8192];
 
 	inst->name = cf_section_name2(conf);
@@ -407,30 +478,18 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	}
 
 	/*
+	 *	If there is a header in the file, then read that first.
+	 *
 	 *	@todo - also define data types for each field.  And do
 	 *	type-specific comparisons.
 	 */
-	if ((inst->data_type == FR_TYPE_IPV4_ADDR) || (inst->data_type == FR_TYPE_IPV4_PREFIX) ||
-	    (inst->data_type == FR_TYPE_IPV6_ADDR) || (inst->data_type == FR_TYPE_IPV6_PREFIX)) {
-		MEM(inst->trie = fr_trie_alloc(inst));
-	} else {
-		MEM(inst->tree = rbtree_talloc_create(inst, csv_entry_cmp, rlm_csv_entry_t, NULL, 0));
-	}
-
-	/*
-	 *	Read the file line by line.
-	 */
-	fp = fopen(inst->filename, "r");
-	if (!fp) {
-		cf_log_err(conf, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
-		return -1;
-	}
-	lineno = 1;
-
-	/*
-	 *	If there is a header in the file, then read that first.
-	 */
 	if (inst->header) {
+		fp = fopen(inst->filename, "r");
+		if (!fp) {
+			cf_log_err(conf, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
+			return -1;
+		}
+
 		p = fgets(buffer, sizeof(buffer), fp);
 		if (!p) {
 		error_eof:
@@ -449,7 +508,7 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 		 *	header from the file.
 		 */
 		inst->fields = talloc_strdup(inst, buffer);
-		lineno++;
+		fclose(fp);
 	}
 
 	/*
@@ -462,7 +521,6 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 
 	if (inst->num_fields < 2) {
 		cf_log_err(conf, "The CSV file MUST have at least a key field and data field");
-		fclose(fp);
 		return -1;
 	}
 
@@ -499,7 +557,6 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 			if ((*q == '\'') || (*q == '"')) {
 				cf_log_err(conf, "Field %d name cannot have quotation marks.",
 					   i + 1);
-				fclose(fp);
 				return -1;
 			}
 
@@ -511,7 +568,6 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 			if (isspace((int) *q)) {
 				cf_log_err(conf, "Field %d name cannot have spaces.",
 					   i + 1);
-				fclose(fp);
 				return -1;
 			}
 
@@ -555,28 +611,25 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	}
 
 	if (inst->index_field < 0) {
-		fclose(fp);
 		cf_log_err(conf, "index_field '%s' does not appear in the list of field names",
 			   inst->index_field_name);
 		return -1;
 	}
 
 	/*
-	 *	Read the rest of the file.
+	 *	Read the entries, and reload them if the file changes.
 	 */
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-		rlm_csv_entry_t *e;
-
-		e = file2csv(conf, inst, lineno, buffer);
-		if (!e) {
-			fclose(fp);
-			return -1;
-		}
-
-		lineno++;
+	inst->reload = fr_reload_alloc(inst, inst->name, &inst->reload_conf, csv_load, inst);
+	if (!inst->reload) {
+		cf_log_perr(conf, "Failed reading %s", inst->filename);
+		return -1;
 	}
 
-	fclose(fp);
+	if ((fr_reload_file_add(inst->reload, inst->filename) < 0) ||
+	    (fr_reload_start(inst->reload) < 0)) {
+		cf_log_perr(conf, "Failed watching %s for changes", inst->filename);
+		return -1;
+	}
 
 	/*
 	 *	And register the map function.
@@ -700,21 +753,27 @@ static rlm_rcode_t mod_map_apply(rlm_csv_t *inst, REQUEST *request,
 				fr_value_box_t const *key, vp_map_t const *maps)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_UPDATED;
+	rlm_csv_data_t		*data;
 	rlm_csv_entry_t		*e;
 	vp_map_t const		*map;
 
+	/*
+	 *	The entry is only valid until we leave.
+	 */
+	data = fr_reload_enter(inst->reload);
+
 	if ((inst->data_type == FR_TYPE_IPV4_ADDR) || (inst->data_type == FR_TYPE_IPV4_PREFIX)) {
-		e = fr_trie_lookup(inst->trie, &key->vb_ip.addr.v4.s_addr, key->vb_ip.prefix);
+		e = fr_trie_lookup(data->trie, &key->vb_ip.addr.v4.s_addr, key->vb_ip.prefix);
 
 	} else if ((inst->data_type == FR_TYPE_IPV6_ADDR) || (inst->data_type == FR_TYPE_IPV6_PREFIX)) {
-		e = fr_trie_lookup(inst->trie, &key->vb_ip.addr.v6.s6_addr, key->vb_ip.prefix);
+		e = fr_trie_lookup(data->trie, &key->vb_ip.addr.v6.s6_addr, key->vb_ip.prefix);
 
 	} else {
 		rlm_csv_entry_t my_e;
 
 		memcpy(&my_e.key, &key, sizeof(key)); /* const issues */
 
-		e = rbtree_finddata(inst->tree, &my_e);
+		e = rbtree_finddata(data->tree, &my_e);
 	}
 	if (!e) {
 		rcode = RLM_MODULE_NOOP;
@@ -767,6 +826,8 @@ static rlm_rcode_t mod_map_apply(rlm_csv_t *inst, REQUEST *request,
 	REXDENT();
 
 finish:
+	fr_reload_leave(inst->reload);
+
 	return rcode;
 }
 
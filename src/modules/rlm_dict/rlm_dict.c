@@ -27,60 +27,131 @@ RCSID("$Id$")
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/util/debug.h>
 
+/** Concatenate the arguments of an xlat into a single string
+ *
+ * @return
+ *	- 1 if there is an argument.
+ *	- 0 if there are no arguments.
+ *	- -1 on error.
+ */
+static int xlat_dict_arg(TALLOC_CTX *ctx, REQUEST *request, fr_value_box_t **in)
+{
+	if (!*in) return 0;
+
+	if (fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true) < 0) {
+		RPEDEBUG("Failed concatenating input");
+		return -1;
+	}
+
+	return 1;
+}
+
+/** Find the attribute an xlat argument refers to
+ *
+ * @return
+ *	- The VALUE_PAIR.
+ *	- NULL if there is no such attribute in the request.
+ */
+static VALUE_PAIR *xlat_dict_arg_vp(TALLOC_CTX *ctx, REQUEST *request, fr_value_box_t **in)
+{
+	VALUE_PAIR	*vp;
+	char const	*fmt;
+
+	if (xlat_dict_arg(ctx, request, in) <= 0) return NULL;
+
+	fmt = (*in)->vb_strvalue;
+	fr_skip_whitespace(fmt);
+
+	if (xlat_fmt_get_vp(&vp, request, fmt) < 0) return NULL;
+
+	return vp;
+}
+
 /** Xlat for %{attr_by_num:\<number\>}
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_dict_attr_by_num(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
-				     UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-				     REQUEST *request, char const *fmt)
+static xlat_action_t xlat_dict_attr_by_num(TALLOC_CTX *ctx, fr_cursor_t *out,
+					   REQUEST *request, UNUSED void const *xlat_inst,
+					   UNUSED void *xlat_thread_inst, fr_value_box_t **in)
 {
 	char			*q;
+	char const		*fmt = "";
 	unsigned int		number;
 	fr_dict_attr_t const	*da;
+	fr_value_box_t		*vb;
 
-	*out = NULL;
+	switch (xlat_dict_arg(ctx, request, in)) {
+	case -1:
+		return XLAT_ACTION_FAIL;
+
+	case 1:
+		fmt = (*in)->vb_strvalue;
+		break;
+	}
 
 	number = (unsigned int)strtoul(fmt, &q, 10);
 	if ((q == fmt) || (*q != '\0')) {
 		REDEBUG("Trailing garbage \"%s\" in attribute number string \"%s\"", q, fmt);
-		return -1;
+		return XLAT_ACTION_FAIL;
 	}
 
 	da = fr_dict_attr_child_by_num(fr_dict_root(request->dict), number);
 	if (!da) {
 		REDEBUG("No attribute found with number %u", number);
-		return -1;
+		return XLAT_ACTION_FAIL;
 	}
 
-	*out = talloc_typed_strdup(ctx, da->name);
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	if (fr_value_box_strdup(vb, vb, NULL, da->name, false) < 0) {
+		talloc_free(vb);
+		return XLAT_ACTION_FAIL;
+	}
+	fr_cursor_append(out, vb);
 
-	return talloc_array_length(*out) - 1;
+	return XLAT_ACTION_DONE;
 }
 
 /** Xlat for %{attr_by_oid:\<oid\>}
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_dict_attr_by_oid(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
-				     UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-				     REQUEST *request, char const *fmt)
+static xlat_action_t xlat_dict_attr_by_oid(TALLOC_CTX *ctx, fr_cursor_t *out,
+					   REQUEST *request, UNUSED void const *xlat_inst,
+					   UNUSED void *xlat_thread_inst, fr_value_box_t **in)
 {
 	unsigned int		attr = 0;
 	fr_dict_attr_t const	*parent = fr_dict_root(request->dict);
 	fr_dict_attr_t const	*da;
-	ssize_t		ret;
+	ssize_t			ret;
+	char const		*fmt = "";
+	fr_value_box_t		*vb;
+
+	switch (xlat_dict_arg(ctx, request, in)) {
+	case -1:
+		return XLAT_ACTION_FAIL;
+
+	case 1:
+		fmt = (*in)->vb_strvalue;
+		break;
+	}
 
 	ret = fr_dict_attr_by_oid(fr_dict_internal(), &parent, &attr, fmt);
 	if (ret <= 0) {
 		REMARKER(fmt, -(ret), "%s", fr_strerror());
-		return ret;
+		return (ret < 0) ? XLAT_ACTION_FAIL : XLAT_ACTION_DONE;
 	}
 
 	da = fr_dict_attr_child_by_num(parent, attr);
 
-	*out = talloc_typed_strdup(ctx, da->name);
-	return talloc_array_length(*out) - 1;
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	if (fr_value_box_strdup(vb, vb, NULL, da->name, false) < 0) {
+		talloc_free(vb);
+		return XLAT_ACTION_FAIL;
+	}
+	fr_cursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
 }
 
 
@@ -88,77 +159,94 @@ static ssize_t xlat_dict_attr_by_oid(TALLOC_CTX *ctx, char **out, UNUSED size_t
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_vendor(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
-			   UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-			   REQUEST *request, char const *fmt)
+static xlat_action_t xlat_vendor(TALLOC_CTX *ctx, fr_cursor_t *out,
+				 REQUEST *request, UNUSED void const *xlat_inst,
+				 UNUSED void *xlat_thread_inst, fr_value_box_t **in)
 {
-	VALUE_PAIR *vp;
-	fr_dict_vendor_t const *vendor;
-
-	fr_skip_whitespace(fmt);
+	VALUE_PAIR		*vp;
+	fr_dict_vendor_t const	*vendor;
+	fr_value_box_t		*vb;
 
-	if ((xlat_fmt_get_vp(&vp, request, fmt) < 0) || !vp) return 0;
+	vp = xlat_dict_arg_vp(ctx, request, in);
+	if (!vp) return XLAT_ACTION_DONE;
 
 	vendor = fr_dict_vendor_by_da(vp->da);
-	if (!vendor) return 0;
+	if (!vendor) return XLAT_ACTION_DONE;
+
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	if (fr_value_box_strdup(vb, vb, NULL, vendor->name, false) < 0) {
+		talloc_free(vb);
+		return XLAT_ACTION_FAIL;
+	}
+	fr_cursor_append(out, vb);
 
-	*out = talloc_typed_strdup(ctx, vendor->name);
-	return talloc_array_length(*out) - 1;
+	return XLAT_ACTION_DONE;
 }
 
 /** Return the vendor number of an attribute reference
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_vendor_num(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
-			       UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-			       REQUEST *request, char const *fmt)
+static xlat_action_t xlat_vendor_num(TALLOC_CTX *ctx, fr_cursor_t *out,
+				     REQUEST *request, UNUSED void const *xlat_inst,
+				     UNUSED void *xlat_thread_inst, fr_value_box_t **in)
 {
-	VALUE_PAIR *vp;
+	VALUE_PAIR	*vp;
+	fr_value_box_t	*vb;
 
-	fr_skip_whitespace(fmt);
+	vp = xlat_dict_arg_vp(ctx, request, in);
+	if (!vp) return XLAT_ACTION_DONE;
 
-	if ((xlat_fmt_get_vp(&vp, request, fmt) < 0) || !vp) return 0;
+	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT32, NULL, false));
+	vb->vb_uint32 = fr_dict_vendor_num_by_da(vp->da);
+	fr_cursor_append(out, vb);
 
-	*out = talloc_typed_asprintf(ctx, "%i", fr_dict_vendor_num_by_da(vp->da));
-	return talloc_array_length(*out) - 1;
+	return XLAT_ACTION_DONE;
 }
 
 /** Return the attribute name of an attribute reference
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_attr(TALLOC_CTX *ctx, char **out, size_t outlen,
-			 UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-			 REQUEST *request, char const *fmt)
+static xlat_action_t xlat_attr(TALLOC_CTX *ctx, fr_cursor_t *out,
+			       REQUEST *request, UNUSED void const *xlat_inst,
+			       UNUSED void *xlat_thread_inst, fr_value_box_t **in)
 {
-	VALUE_PAIR *vp;
+	VALUE_PAIR	*vp;
+	fr_value_box_t	*vb;
 
-	fr_skip_whitespace(fmt);
+	vp = xlat_dict_arg_vp(ctx, request, in);
+	if (!vp) return XLAT_ACTION_DONE;
 
-	if ((xlat_fmt_get_vp(&vp, request, fmt) < 0) || !vp) return 0;
-	strlcpy(*out, vp->da->name, outlen);
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	if (fr_value_box_strdup(vb, vb, NULL, vp->da->name, false) < 0) {
+		talloc_free(vb);
+		return XLAT_ACTION_FAIL;
+	}
+	fr_cursor_append(out, vb);
 
-	*out = talloc_typed_strdup(ctx, vp->da->name);
-	return talloc_array_length(*out) - 1;
+	return XLAT_ACTION_DONE;
 }
 
 /** Return the attribute number of an attribute reference
  *
  * @ingroup xlat_functions
  */
-static ssize_t xlat_attr_num(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
-			     UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-			     REQUEST *request, char const *fmt)
+static xlat_action_t xlat_attr_num(TALLOC_CTX *ctx, fr_cursor_t *out,
+				   REQUEST *request, UNUSED void const *xlat_inst,
+				   UNUSED void *xlat_thread_inst, fr_value_box_t **in)
 {
-	VALUE_PAIR *vp;
+	VALUE_PAIR	*vp;
+	fr_value_box_t	*vb;
 
-	fr_skip_whitespace(fmt);
+	vp = xlat_dict_arg_vp(ctx, request, in);
+	if (!vp) return XLAT_ACTION_DONE;
 
-	if ((xlat_fmt_get_vp(&vp, request, fmt) < 0) || !vp) return 0;
+	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT32, NULL, false));
+	vb->vb_uint32 = vp->da->attr;
+	fr_cursor_append(out, vb);
 
-	*out = talloc_typed_asprintf(ctx, "%i", vp->da->attr);
-	return talloc_array_length(*out) - 1;
+	return XLAT_ACTION_DONE;
 }
 
 /*
@@ -173,12 +261,12 @@ static ssize_t xlat_attr_num(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
  */
 static int mod_bootstrap(void *instance, UNUSED CONF_SECTION *conf)
 {
-	xlat_register(instance, "attr_by_num", xlat_dict_attr_by_num, NULL, NULL, 0, 0, true);
-	xlat_register(instance, "attr_by_oid", xlat_dict_attr_by_oid, NULL, NULL, 0, 0, true);
-	xlat_register(instance, "vendor", xlat_vendor, NULL, NULL, 0, 0, true);
-	xlat_register(instance, "vendor_num", xlat_vendor_num, NULL, NULL, 0, 0, true);
-	xlat_register(instance, "attr", xlat_attr, NULL, NULL, 0, 0, true);
-	xlat_register(instance, "attr_num", xlat_attr_num, NULL, NULL, 0, 0, true);
+	xlat_async_register(instance, "attr_by_num", xlat_dict_attr_by_num);
+	xlat_async_register(instance, "attr_by_oid", xlat_dict_attr_by_oid);
+	xlat_async_register(instance, "vendor", xlat_vendor);
+	xlat_async_register(instance, "vendor_num", xlat_vendor_num);
+	xlat_async_register(instance, "attr", xlat_attr);
+	xlat_async_register(instance, "attr_num", xlat_attr_num);
 
 	return 0;
 }
@@ -511,26 +511,36 @@ redo:
  *
  * @ingroup xlat_functions
  */
-static ssize_t expr_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
-			 UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-			 REQUEST *request, char const *fmt)
+static xlat_action_t expr_xlat(TALLOC_CTX *ctx, fr_cursor_t *out,
+			       REQUEST *request, UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+			       fr_value_box_t **in)
 {
 	int64_t		result;
-	char const 	*p;
+	char const 	*p = "";
+	fr_value_box_t	*vb;
 
-	p = fmt;
+	if (*in) {
+		if (fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true) < 0) {
+			RPEDEBUG("Failed concatenating input");
+			return XLAT_ACTION_FAIL;
+		}
+		p = (*in)->vb_strvalue;
+	}
 
 	if (!get_expression(request, &p, &result, TOKEN_NONE)) {
-		return -1;
+		return XLAT_ACTION_FAIL;
 	}
 
 	if (*p) {
 		REDEBUG("Invalid text after expression: %s", p);
-		return -1;
+		return XLAT_ACTION_FAIL;
 	}
 
-	snprintf(*out, outlen, "%lld", (long long int) result);
-	return strlen(*out);
+	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_INT64, NULL, false));
+	vb->vb_int64 = result;
+	fr_cursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
 }
 
 /*
@@ -552,7 +562,7 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 		inst->xlat_name = cf_section_name1(conf);
 	}
 
-	xlat_register(inst, inst->xlat_name, expr_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
+	xlat_async_register(inst, inst->xlat_name, expr_xlat);
 
 	return 0;
 }
@@ -32,38 +32,90 @@ RCSID("$Id$")
 #include <ctype.h>
 #include <fcntl.h>
 
+/** DEFAULT entries which can only match a particular attribute and value
+ *
+ */
+typedef struct {
+	VALUE_PAIR const	*vp;		//!< Check item, the attribute and value to look for.
+	uint32_t		*entries;	//!< Indexes into files_index_t.defaults, in file order.
+} files_key_t;
+
+/** A users file, compiled for fast lookups
+ *
+ * Named entries are found by a hash lookup on the expanded key.
+ *
+ * Most DEFAULT entries have a check item like `NAS-Port-Type == Ethernet`,
+ * which can only match if the packet contains that attribute and value.
+ * Those entries are indexed by attribute and value, so that we only run
+ * paircmp() on the entries which have a chance of matching.
+ */
+typedef struct {
+	fr_hash_table_t		*users;		//!< PAIR_LIST, keyed by name.  Entries for
+						///< the same name are linked in file order.
+
+	PAIR_LIST const		**defaults;	//!< DEFAULT entries in file order.
+	uint32_t		num_defaults;	//!< Number of DEFAULT entries.
+
+	uint8_t			*unkeyed;	//!< Per DEFAULT entry, 1 if it has no usable key,
+						///< and must always be checked.
+	fr_hash_table_t		*keyed;		//!< files_key_t, keyed by attribute and value.
+} files_index_t;
+
+/** All of the users files
+ *
+ * Replaced as a whole when any of the files change.
+ */
+typedef struct {
+	files_index_t *common;
+
+	/* autz */
+	files_index_t *users;
+
+	/* authenticate */
+	files_index_t *auth_users;
+
+	/* preacct */
+	files_index_t *acct_users;
+
+#ifdef WITH_PROXY
+	/* pre-proxy */
+	files_index_t *preproxy_users;
+
+	/* post-proxy */
+	files_index_t *postproxy_users;
+#endif
+
+	/* post-authenticate */
+	files_index_t *postauth_users;
+} rlm_files_data_t;
+
 typedef struct {
 	vp_tmpl_t *key;
 
 	char const *filename;
-	rbtree_t *common;
 
 	/* autz */
 	char const *usersfile;
-	rbtree_t *users;
-
 
 	/* authenticate */
 	char const *auth_usersfile;
-	rbtree_t *auth_users;
 
 	/* preacct */
 	char const *acct_usersfile;
-	rbtree_t *acct_users;
 
 #ifdef WITH_PROXY
 	/* pre-proxy */
 	char const *preproxy_usersfile;
-	rbtree_t *preproxy_users;
 
 	/* post-proxy */
 	char const *postproxy_usersfile;
-	rbtree_t *postproxy_users;
 #endif
 
 	/* post-authenticate */
 	char const *postauth_usersfile;
-	rbtree_t *postauth_users;
+
+	fr_reload_conf_t reload_conf;
+	fr_reload_t *reload;		//!< Holds the current rlm_files_data_t.
 } rlm_files_t;
 
 static fr_dict_t const *dict_freeradius;
@@ -77,10 +129,12 @@ fr_dict_autoload_t rlm_files_dict[] = {
 };
 
 static fr_dict_attr_t const *attr_fall_through;
+static fr_dict_attr_t const *attr_user_password;
 
 extern fr_dict_attr_autoload_t rlm_files_dict_attr[];
 fr_dict_attr_autoload_t rlm_files_dict_attr[] = {
 	{ .out = &attr_fall_through, .name = "Fall-Through", .type = FR_TYPE_BOOL, .dict = &dict_freeradius },
+	{ .out = &attr_user_password, .name = "User-Password", .type = FR_TYPE_STRING, .dict = &dict_radius },
 
 	{ NULL }
 };
@@ -107,26 +161,194 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("auth_usersfile", FR_TYPE_FILE_INPUT, rlm_files_t, auth_usersfile) },
 	{ FR_CONF_OFFSET("postauth_usersfile", FR_TYPE_FILE_INPUT, rlm_files_t, postauth_usersfile) },
 	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL | FR_TYPE_NOT_EMPTY, rlm_files_t, key), .dflt = "%{%{Stripped-User-Name}:-%{User-Name}}", .quote = T_DOUBLE_QUOTED_STRING },
+
+	{ FR_CONF_OFFSET("reload", FR_TYPE_SUBSECTION, rlm_files_t, reload_conf), .subcs = (void const *) fr_reload_config },
 	CONF_PARSER_TERMINATOR
 };
 
 
+static uint32_t pairlist_hash(void const *data)
+{
+	return fr_hash_string(((PAIR_LIST const *)data)->name);
+}
+
 static int pairlist_cmp(void const *a, void const *b)
 {
 	return strcmp(((PAIR_LIST const *)a)->name, ((PAIR_LIST const *)b)->name);
 }
 
-static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
+/** Whether we can hash values of this type
+ *
+ * The types are the ones where paircmp_pairs() does a simple
+ * equality check for '=='.
+ */
+static bool key_type_ok(fr_type_t type)
+{
+	switch (type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+	case FR_TYPE_UINT8:
+	case FR_TYPE_UINT16:
+	case FR_TYPE_UINT32:
+	case FR_TYPE_UINT64:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static uint32_t key_hash(void const *data)
+{
+	VALUE_PAIR const	*vp = ((files_key_t const *)data)->vp;
+	uint32_t		hash;
+	uint64_t		num;
+
+	hash = fr_hash(&vp->da, sizeof(vp->da));
+
+	switch (vp->vp_type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		return fr_hash_update(vp->vp_octets, vp->vp_length, hash);
+
+	case FR_TYPE_UINT8:
+		num = vp->vp_uint8;
+		break;
+
+	case FR_TYPE_UINT16:
+		num = vp->vp_uint16;
+		break;
+
+	case FR_TYPE_UINT32:
+		num = vp->vp_uint32;
+		break;
+
+	case FR_TYPE_UINT64:
+		num = vp->vp_uint64;
+		break;
+
+	default:
+		fr_assert(0);
+		return hash;
+	}
+
+	return fr_hash_update(&num, sizeof(num), hash);
+}
+
+static int key_cmp(void const *one, void const *two)
+{
+	VALUE_PAIR const *a = ((files_key_t const *)one)->vp;
+	VALUE_PAIR const *b = ((files_key_t const *)two)->vp;
+
+	if (a->da < b->da) return -1;
+	if (a->da > b->da) return +1;
+
+	return fr_value_box_cmp(&a->data, &b->data);
+}
+
+/** Find a check item which a DEFAULT entry can be indexed by
+ *
+ * The check item has to be a plain `Attr == value` comparison against
+ * a packet attribute.  Anything which paircmp() treats specially
+ * (registered comparisons, tags, xlat expansions, User-Password)
+ * can't be used, as the entry may match even when the packet doesn't
+ * contain the same attribute and value.
+ */
+static VALUE_PAIR const *default_key(PAIR_LIST const *entry)
+{
+	fr_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+
+	for (vp = fr_cursor_init(&cursor, &entry->check);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		if (vp->op != T_OP_CMP_EQ) continue;
+		if (vp->type != VT_DATA) continue;
+		if (vp->da->flags.has_tag) continue;
+		if (vp->da == attr_user_password) continue;
+		if (fr_dict_by_da(vp->da) != dict_radius) continue;
+		if (!key_type_ok(vp->vp_type)) continue;
+		if (paircmp_find(vp->da)) continue;
+
+		return vp;
+	}
+
+	return NULL;
+}
+
+/** Build the DEFAULT entry index
+ *
+ * @param[in] idx	to populate.
+ * @param[in] defaults	list of DEFAULT entries, in file order.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int default_index_build(files_index_t *idx, PAIR_LIST *defaults)
+{
+	PAIR_LIST	*entry;
+	uint32_t	i, num_keyed = 0;
+
+	for (entry = defaults; entry; entry = entry->next) idx->num_defaults++;
+	if (!idx->num_defaults) return 0;
+
+	MEM(idx->defaults = talloc_array(idx, PAIR_LIST const *, idx->num_defaults));
+	MEM(idx->unkeyed = talloc_zero_array(idx, uint8_t, idx->num_defaults));
+
+	idx->keyed = fr_hash_table_create(idx, key_hash, key_cmp, NULL);
+	if (!idx->keyed) return -1;
+
+	for (entry = defaults, i = 0; entry; entry = entry->next, i++) {
+		files_key_t	*key;
+		VALUE_PAIR const *vp;
+
+		idx->defaults[i] = entry;
+
+		vp = default_key(entry);
+		if (!vp) {
+			idx->unkeyed[i] = 1;
+			continue;
+		}
+		num_keyed++;
+
+		key = fr_hash_table_finddata(idx->keyed, &(files_key_t){ .vp = vp });
+		if (!key) {
+			MEM(key = talloc_zero(idx->keyed, files_key_t));
+			key->vp = vp;
+			MEM(key->entries = talloc_array(key, uint32_t, 0));
+
+			if (!fr_hash_table_insert(idx->keyed, key)) {
+				talloc_free(key);
+				return -1;
+			}
+		}
+
+		/*
+		 *	Entries are added in file order, so the
+		 *	array is already sorted.
+		 */
+		MEM(key->entries = talloc_realloc(key, key->entries, uint32_t,
+						  talloc_array_length(key->entries) + 1));
+		key->entries[talloc_array_length(key->entries) - 1] = i;
+	}
+
+	DEBUG3("Indexed %u of %u DEFAULT entries by %u attribute values",
+	       num_keyed, idx->num_defaults, fr_hash_table_num_elements(idx->keyed));
+
+	return 0;
+}
+
+static int getusersfile(TALLOC_CTX *ctx, char const *filename, files_index_t **pidx)
 {
 	int rcode;
 	VALUE_PAIR *vp;
 	PAIR_LIST *users = NULL;
 	PAIR_LIST *entry, *next;
 	PAIR_LIST *user_list, *default_list, **default_tail;
-	rbtree_t *tree;
+	files_index_t *idx;
 
 	if (!filename) {
-		*ptree = NULL;
+		*pidx = NULL;
 		return 0;
 	}
 
@@ -205,9 +427,11 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 		entry = entry->next;
 	}
 
-	tree = rbtree_create(ctx, pairlist_cmp, NULL, RBTREE_FLAG_NONE);
-	if (!tree) {
+	MEM(idx = talloc_zero(ctx, files_index_t));
+	idx->users = fr_hash_table_create(idx, pairlist_hash, pairlist_cmp, NULL);
+	if (!idx->users) {
 		pairlist_free(&users);
+		talloc_free(idx);
 		return -1;
 	}
 
@@ -230,28 +454,11 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 		 *	DEFAULT entries get their own list.
 		 */
 		if (strcmp(entry->name, "DEFAULT") == 0) {
-			if (!default_list) {
-				default_list = entry;
-
-				/*
-				 *	Insert the first DEFAULT into the tree.
-				 */
-				if (!rbtree_insert(tree, entry)) {
-				error:
-					pairlist_free(&entry);
-					pairlist_free(&next);
-					talloc_free(tree);
-					return -1;
-				}
-
-			} else {
-				/*
-				 *	Tack this entry onto the tail
-				 *	of the DEFAULT list.
-				 */
-				*default_tail = entry;
-			}
-
+			/*
+			 *	Tack this entry onto the tail
+			 *	of the DEFAULT list.
+			 */
+			*default_tail = entry;
 			default_tail = &entry->next;
 			continue;
 		}
@@ -259,12 +466,19 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 		/*
 		 *	Not DEFAULT, must be a normal user.
 		 */
-		user_list = rbtree_finddata(tree, entry);
+		user_list = fr_hash_table_finddata(idx->users, entry);
 		if (!user_list) {
 			/*
 			 *	Insert the first one.
 			 */
-			if (!rbtree_insert(tree, entry)) goto error;
+			if (!fr_hash_table_insert(idx->users, entry)) {
+			error:
+				pairlist_free(&entry);
+				pairlist_free(&next);
+				pairlist_free(&default_list);
+				talloc_free(idx);
+				return -1;
+			}
 		} else {
 			/*
 			 *	Find the tail of this list, and add it
@@ -276,7 +490,22 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 		}
 	}
 
-	*ptree = tree;
+	/*
+	 *	Index the DEFAULT entries by their check items.
+	 */
+	if (default_index_build(idx, default_list) < 0) {
+		entry = next = NULL;
+		goto error;
+	}
+
+	/*
+	 *	Lookups must not modify the tables, as they're shared
+	 *	between the workers.
+	 */
+	fr_hash_table_fill(idx->users);
+	if (idx->keyed) fr_hash_table_fill(idx->keyed);
+
+	*pidx = idx;
 
 	return 0;
 }
@@ -284,14 +513,20 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree)
 
 
 /*
- *	(Re-)read the "users" file into memory.
+ *	(Re-)read the "users" files into memory.
+ *
+ *	Called when the module is instantiated, and from the
+ *	reload thread.
  */
-static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+static void *files_load(TALLOC_CTX *ctx, void *uctx)
 {
-	rlm_files_t *inst = instance;
+	rlm_files_t const *inst = uctx;
+	rlm_files_data_t *data;
+
+	MEM(data = talloc_zero(ctx, rlm_files_data_t));
 
 #undef READFILE
-#define READFILE(_x, _y) do { if (getusersfile(inst, inst->_x, &inst->_y) != 0) { ERROR("Failed reading %s", inst->_x); return -1;} } while (0)
+#define READFILE(_x, _y) do { if (getusersfile(data, inst->_x, &data->_y) != 0) { fr_strerror_printf("Failed reading %s", inst->_x); return NULL;} } while (0)
 
 	READFILE(filename, common);
 	READFILE(usersfile, users);
@@ -305,21 +540,89 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
 	READFILE(auth_usersfile, auth_users);
 	READFILE(postauth_usersfile, postauth_users);
 
+	return data;
+}
+
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_files_t *inst = instance;
+	char const *name;
+
+	name = cf_section_name2(conf);
+	if (!name) name = cf_section_name1(conf);
+
+	inst->reload = fr_reload_alloc(inst, name, &inst->reload_conf, files_load, inst);
+	if (!inst->reload) {
+		PERROR("Failed loading users files");
+		return -1;
+	}
+
+#undef WATCHFILE
+#define WATCHFILE(_x) do { if (inst->_x && (fr_reload_file_add(inst->reload, inst->_x) < 0)) { PERROR("Failed watching %s", inst->_x); return -1;} } while (0)
+
+	WATCHFILE(filename);
+	WATCHFILE(usersfile);
+	WATCHFILE(acct_usersfile);
+
+#ifdef WITH_PROXY
+	WATCHFILE(preproxy_usersfile);
+	WATCHFILE(postproxy_usersfile);
+#endif
+
+	WATCHFILE(auth_usersfile);
+	WATCHFILE(postauth_usersfile);
+
+	if (fr_reload_start(inst->reload) < 0) {
+		PERROR("Failed watching users files for changes");
+		return -1;
+	}
+
 	return 0;
 }
 
+/** Mark the DEFAULT entries which might match the packet
+ *
+ * @param[out] candidate	one byte per DEFAULT entry, set to 1 if
+ *				the entry has to be checked.
+ * @param[in] idx		the compiled users file.
+ * @param[in] list		the packet attributes.
+ */
+static void default_candidates(uint8_t *candidate, files_index_t const *idx, VALUE_PAIR *list)
+{
+	fr_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+
+	memcpy(candidate, idx->unkeyed, idx->num_defaults);
+
+	for (vp = fr_cursor_init(&cursor, &list);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		files_key_t	*key;
+		size_t		i, num;
+
+		if (!key_type_ok(vp->vp_type)) continue;
+
+		key = fr_hash_table_finddata(idx->keyed, &(files_key_t){ .vp = vp });
+		if (!key) continue;
+
+		num = talloc_array_length(key->entries);
+		for (i = 0; i < num; i++) candidate[key->entries[i]] = 1;
+	}
+}
+
 /*
  *	Common code called by everything below.
  */
-static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char const *filename, rbtree_t *tree,
+static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char const *filename, files_index_t const *idx,
 			       RADIUS_PACKET *packet, RADIUS_PACKET *reply)
 {
 	char const	*name;
 	VALUE_PAIR	*check_tmp = NULL;
 	VALUE_PAIR	*reply_tmp = NULL;
-	PAIR_LIST const *user_pl, *default_pl;
+	PAIR_LIST const *user_pl;
+	uint32_t	def = 0;
 	bool		found = false;
-	PAIR_LIST	my_pl;
+	uint8_t		*candidate = NULL;
 	char		buffer[256];
 
 	if (tmpl_expand(&name, buffer, sizeof(buffer), request, inst->key, NULL, NULL) < 0) {
@@ -327,17 +630,24 @@ static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char c
 		return RLM_MODULE_FAIL;
 	}
 
-	if (!tree) return RLM_MODULE_NOOP;
+	if (!idx) return RLM_MODULE_NOOP;
 
-	my_pl.name = name;
-	user_pl = rbtree_finddata(tree, &my_pl);
-	my_pl.name = "DEFAULT";
-	default_pl = rbtree_finddata(tree, &my_pl);
+	user_pl = fr_hash_table_finddata(idx->users, &(PAIR_LIST){ .name = name });
+
+	/*
+	 *	Skip the DEFAULT entries which can't possibly match.
+	 */
+	if (idx->num_defaults) {
+		MEM(candidate = talloc_array(request, uint8_t, idx->num_defaults));
+		default_candidates(candidate, idx, packet->vps);
+
+		while ((def < idx->num_defaults) && !candidate[def]) def++;
+	}
 
 	/*
 	 *	Find the entry for the user.
 	 */
-	while (user_pl || default_pl) {
+	while (user_pl || (def < idx->num_defaults)) {
 		fr_cursor_t cursor;
 		VALUE_PAIR *vp;
 		PAIR_LIST const *pl;
@@ -345,22 +655,15 @@ static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char c
 		/*
 		 *	Figure out which entry to match on.
 		 */
-
-		if (!default_pl && user_pl) {
-			pl = user_pl;
-			user_pl = user_pl->next;
-
-		} else if (!user_pl && default_pl) {
-			pl = default_pl;
-			default_pl = default_pl->next;
-
-		} else if (user_pl->order < default_pl->order) {
+		if (user_pl &&
+		    ((def >= idx->num_defaults) || (user_pl->order < idx->defaults[def]->order))) {
 			pl = user_pl;
 			user_pl = user_pl->next;
 
 		} else {
-			pl = default_pl;
-			default_pl = default_pl->next;
+			pl = idx->defaults[def++];
+
+			while ((def < idx->num_defaults) && !candidate[def]) def++;
 		}
 
 		MEM(fr_pair_list_copy(request, &check_tmp, pl->check) >= 0);
@@ -394,6 +697,8 @@ static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char c
 		}
 	}
 
+	talloc_free(candidate);
+
 	/*
 	 *	Remove server internal parameters.
 	 */
@@ -419,10 +724,16 @@ static rlm_rcode_t file_common(rlm_files_t const *inst, REQUEST *request, char c
 static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
 {
 	rlm_files_t const *inst = instance;
+	rlm_files_data_t const *data;
+	rlm_rcode_t rcode;
 
-	return file_common(inst, request, inst->filename,
-			   inst->users ? inst->users : inst->common,
-			   request->packet, request->reply);
+	data = fr_reload_enter(inst->reload);
+	rcode = file_common(inst, request, inst->filename,
+			    data->users ? data->users : data->common,
+			    request->packet, request->reply);
+	fr_reload_leave(inst->reload);
+
+	return rcode;
 }
 
 
@@ -434,48 +745,78 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *t
 static rlm_rcode_t CC_HINT(nonnull) mod_preacct(void *instance, UNUSED void *thread, REQUEST *request)
 {
 	rlm_files_t const *inst = instance;
+	rlm_files_data_t const *data;
+	rlm_rcode_t rcode;
+
+	data = fr_reload_enter(inst->reload);
+	rcode = file_common(inst, request, inst->acct_usersfile,
+			    data->acct_users ? data->acct_users : data->common,
+			    request->packet, request->reply);
+	fr_reload_leave(inst->reload);
 
-	return file_common(inst, request, inst->acct_usersfile,
-			   inst->acct_users ? inst->acct_users : inst->common,
-			   request->packet, request->reply);
+	return rcode;
 }
 
 #ifdef WITH_PROXY
 static rlm_rcode_t CC_HINT(nonnull) mod_pre_proxy(void *instance, UNUSED void *thread, REQUEST *request)
 {
 	rlm_files_t const *inst = instance;
+	rlm_files_data_t const *data;
+	rlm_rcode_t rcode;
 
-	return file_common(inst, request, inst->preproxy_usersfile,
-			   inst->preproxy_users ? inst->preproxy_users : inst->common,
-			   request->packet, request->proxy->packet);
+	data = fr_reload_enter(inst->reload);
+	rcode = file_common(inst, request, inst->preproxy_usersfile,
+			    data->preproxy_users ? data->preproxy_users : data->common,
+			    request->packet, request->proxy->packet);
+	fr_reload_leave(inst->reload);
+
+	return rcode;
 }
 
 static rlm_rcode_t CC_HINT(nonnull) mod_post_proxy(void *instance, UNUSED void *thread, REQUEST *request)
 {
 	rlm_files_t const *inst = instance;
+	rlm_files_data_t const *data;
+	rlm_rcode_t rcode;
+
+	data = fr_reload_enter(inst->reload);
+	rcode = file_common(inst, request, inst->postproxy_usersfile,
+			    data->postproxy_users ? data->postproxy_users : data->common,
+			    request->proxy->reply, request->reply);
+	fr_reload_leave(inst->reload);
 
-	return file_common(inst, request, inst->postproxy_usersfile,
-			   inst->postproxy_users ? inst->postproxy_users : inst->common,
-			   request->proxy->reply, request->reply);
+	return rcode;
 }
 #endif
 
 static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
 {
 	rlm_files_t const *inst = instance;
+	rlm_files_data_t const *data;
+	rlm_rcode_t rcode;
 
-	return file_common(inst, request, inst->auth_usersfile,
-			   inst->auth_users ? inst->auth_users : inst->common,
-			   request->packet, request->reply);
+	data = fr_reload_enter(inst->reload);
+	rcode = file_common(inst, request, inst->auth_usersfile,
+			    data->auth_users ? data->auth_users : data->common,
+			    request->packet, request->reply);
+	fr_reload_leave(inst->reload);
+
+	return rcode;
 }
 
 static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
 {
 	rlm_files_t const *inst = instance;
+	rlm_files_data_t const *data;
+	rlm_rcode_t rcode;
+
+	data = fr_reload_enter(inst->reload);
+	rcode = file_common(inst, request, inst->postauth_usersfile,
+			    data->postauth_users ? data->postauth_users : data->common,
+			    request->packet, request->reply);
+	fr_reload_leave(inst->reload);
 
-	return file_common(inst, request, inst->postauth_usersfile,
-			   inst->postauth_users ? inst->postauth_users : inst->common,
-			   request->packet, request->reply);
+	return rcode;
 }
 
 
@@ -414,6 +414,99 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 	return rcode;
 }
 
+/** Expand the filter and base DN used to find group objects the user is a member of
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int ldap_cacheable_groupobj_expand(rlm_ldap_t const *inst, REQUEST *request,
+					  char *filter, size_t filter_len,
+					  char const **base_dn, char *base_dn_buff, size_t base_dn_len)
+{
+	char const *filters[] = { inst->groupobj_filter, inst->groupobj_membership_filter };
+
+	if (fr_ldap_xlat_filter(request,
+				 filters, NUM_ELEMENTS(filters),
+				 filter, filter_len) < 0) {
+		return -1;
+	}
+
+	if (tmpl_expand(base_dn, base_dn_buff, base_dn_len, request,
+			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Failed creating base_dn");
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Add group objects found by a membership search to the control list
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn the search was performed on.
+ * @param[in] result of the search.
+ * @return One of the RLM_MODULE_* values.
+ */
+rlm_rcode_t rlm_ldap_cacheable_groupobj_process(rlm_ldap_t const *inst, REQUEST *request,
+						fr_ldap_connection_t const *conn, LDAPMessage *result)
+{
+	int ldap_errno;
+	LDAPMessage *entry;
+	VALUE_PAIR *vp;
+	char *dn;
+
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+
+		return RLM_MODULE_OK;
+	}
+
+	RDEBUG2("Adding cacheable group object memberships");
+	do {
+		if (inst->cacheable_group_dn) {
+			dn = ldap_get_dn(conn->handle, entry);
+			if (!dn) {
+				ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+				REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+				return RLM_MODULE_OK;
+			}
+			fr_ldap_util_normalise_dn(dn, dn);
+
+			MEM(pair_add_control(&vp, inst->cache_da) == 0);
+			fr_pair_value_strcpy(vp, dn);
+
+			RINDENT();
+			RDEBUG2("&control:%pP", vp);
+			REXDENT();
+			ldap_memfree(dn);
+		}
+
+		if (inst->cacheable_group_name) {
+			struct berval **values;
+
+			values = ldap_get_values_len(conn->handle, entry, inst->groupobj_name_attr);
+			if (!values) continue;
+
+			MEM(pair_add_control(&vp, inst->cache_da) == 0);
+			fr_pair_value_bstrncpy(vp, values[0]->bv_val, values[0]->bv_len);
+
+			RINDENT();
+			RDEBUG2("&control:%pP", vp);
+			REXDENT();
+
+			ldap_value_free_len(values);
+		}
+	} while ((entry = ldap_next_entry(conn->handle, entry)));
+
+	return RLM_MODULE_OK;
+}
+
 /** Convert group membership information into attributes
  *
  * @param[in] inst rlm_ldap configuration.
@@ -425,22 +518,16 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 {
 	rlm_rcode_t rcode = RLM_MODULE_OK;
 	fr_ldap_rcode_t status;
-	int ldap_errno;
 
 	LDAPMessage *result = NULL;
-	LDAPMessage *entry;
 
 	char const *base_dn;
 	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
 
-	char const *filters[] = { inst->groupobj_filter, inst->groupobj_membership_filter };
 	char filter[LDAP_MAX_FILTER_STR_LEN + 1];
 
 	char const *attrs[] = { inst->groupobj_name_attr, NULL };
 
-	VALUE_PAIR *vp;
-	char *dn;
-
 	fr_assert(inst->groupobj_base_dn);
 
 	if (!inst->groupobj_membership_filter) {
@@ -449,16 +536,8 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 		return RLM_MODULE_OK;
 	}
 
-	if (fr_ldap_xlat_filter(request,
-				 filters, NUM_ELEMENTS(filters),
-				 filter, sizeof(filter)) < 0) {
-		return RLM_MODULE_INVALID;
-	}
-
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Failed creating base_dn");
-
+	if (ldap_cacheable_groupobj_expand(inst, request, filter, sizeof(filter),
+					   &base_dn, base_dn_buff, sizeof(base_dn_buff)) < 0) {
 		return RLM_MODULE_INVALID;
 	}
 
@@ -477,56 +556,58 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 		goto finish;
 	}
 
-	entry = ldap_first_entry((*pconn)->handle, result);
-	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+	rcode = rlm_ldap_cacheable_groupobj_process(inst, request, *pconn, result);
 
-		goto finish;
-	}
+finish:
+	if (result) ldap_msgfree(result);
 
-	RDEBUG2("Adding cacheable group object memberships");
-	do {
-		if (inst->cacheable_group_dn) {
-			dn = ldap_get_dn((*pconn)->handle, entry);
-			if (!dn) {
-				ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-				REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+	return rcode;
+}
 
-				goto finish;
-			}
-			fr_ldap_util_normalise_dn(dn, dn);
+/** Start a search for group objects the user is a member of on a trunk
+ *
+ * Once the search completes, pass the result to #rlm_ldap_cacheable_groupobj_process.
+ *
+ * @param[in] ctx to allocate the query in.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] ttrunk to search on.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return
+ *	- The query.
+ *	- NULL if there's nothing to search for, or on error.
+ */
+fr_ldap_query_t *rlm_ldap_cacheable_groupobj_async(TALLOC_CTX *ctx, rlm_ldap_t const *inst, REQUEST *request,
+						   fr_ldap_trunk_t *ttrunk, rlm_rcode_t *rcode)
+{
+	fr_ldap_query_t *query;
 
-			MEM(pair_add_control(&vp, inst->cache_da) == 0);
-			fr_pair_value_strcpy(vp, dn);
+	char const *base_dn;
+	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
 
-			RINDENT();
-			RDEBUG2("&control:%pP", vp);
-			REXDENT();
-			ldap_memfree(dn);
-		}
+	char filter[LDAP_MAX_FILTER_STR_LEN + 1];
 
-		if (inst->cacheable_group_name) {
-			struct berval **values;
+	fr_assert(inst->groupobj_base_dn);
 
-			values = ldap_get_values_len((*pconn)->handle, entry, inst->groupobj_name_attr);
-			if (!values) continue;
+	*rcode = RLM_MODULE_OK;
 
-			MEM(pair_add_control(&vp, inst->cache_da) == 0);
-			fr_pair_value_bstrncpy(vp, values[0]->bv_val, values[0]->bv_len);
+	if (!inst->groupobj_membership_filter) {
+		RDEBUG2("Skipping caching group objects as directive 'group.membership_filter' is not set");
 
-			RINDENT();
-			RDEBUG2("&control:%pP", vp);
-			REXDENT();
+		return NULL;
+	}
 
-			ldap_value_free_len(values);
-		}
-	} while ((entry = ldap_next_entry((*pconn)->handle, entry)));
+	if (ldap_cacheable_groupobj_expand(inst, request, filter, sizeof(filter),
+					   &base_dn, base_dn_buff, sizeof(base_dn_buff)) < 0) {
+		*rcode = RLM_MODULE_INVALID;
+		return NULL;
+	}
 
-finish:
-	if (result) ldap_msgfree(result);
+	query = fr_ldap_trunk_search(ctx, request, ttrunk, base_dn, inst->groupobj_scope, filter,
+				     inst->groupobj_attrs, NULL, NULL);
+	if (!query) *rcode = RLM_MODULE_FAIL;
 
-	return rcode;
+	return query;
 }
 
 /** Query the LDAP directory to check if a group object includes a user object as a member
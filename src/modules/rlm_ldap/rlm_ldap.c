@@ -36,6 +36,7 @@ USES_APPLE_DEPRECATED_API
 #include "rlm_ldap.h"
 
 #include <freeradius-devel/server/map_proc.h>
+#include <freeradius-devel/unlang/base.h>
 
 static CONF_PARSER sasl_mech_dynamic[] = {
 	{ FR_CONF_OFFSET("mech", FR_TYPE_TMPL | FR_TYPE_NOT_EMPTY, fr_ldap_sasl_t_dynamic_t, mech) },
@@ -223,6 +224,9 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_POINTER("global", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) global_config },
 
 	{ FR_CONF_OFFSET("tls", FR_TYPE_SUBSECTION, rlm_ldap_t, handle_config), .subcs = (void const *) tls_config },
+
+	{ FR_CONF_OFFSET("async", FR_TYPE_BOOL, rlm_ldap_t, async), .dflt = "no" },
+	{ FR_CONF_OFFSET("trunk", FR_TYPE_SUBSECTION, rlm_ldap_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -703,61 +707,48 @@ finish:
 	return 0;
 }
 
-static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+/** Convert the result of binding as a user to a module rcode
+ *
+ */
+static rlm_rcode_t ldap_user_bind_rcode(REQUEST *request, fr_ldap_rcode_t status, char const *dn)
 {
-	rlm_rcode_t		rcode;
-	fr_ldap_rcode_t		status;
-	char const		*dn;
-	rlm_ldap_t const	*inst = instance;
-	fr_ldap_connection_t		*conn;
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		RDEBUG2("Bind as user \"%s\" was successful", dn);
+		return RLM_MODULE_OK;
 
-	char			sasl_mech_buff[LDAP_MAX_DN_STR_LEN];
-	char			sasl_proxy_buff[LDAP_MAX_DN_STR_LEN];
-	char			sasl_realm_buff[LDAP_MAX_DN_STR_LEN];
-	fr_ldap_sasl_t		sasl;
-	VALUE_PAIR *username, *password;
+	case LDAP_PROC_NOT_PERMITTED:
+		return RLM_MODULE_DISALLOW;
 
-	username = fr_pair_find_by_da(request->packet->vps, attr_user_name, TAG_ANY);
-	password = fr_pair_find_by_da(request->packet->vps, attr_user_password, TAG_ANY);
+	case LDAP_PROC_REJECT:
+		return RLM_MODULE_REJECT;
 
-	/*
-	 *	We can only authenticate user requests which HAVE
-	 *	a User-Name attribute.
-	 */
-	if (!username) {
-		REDEBUG("Attribute \"User-Name\" is required for authentication");
+	case LDAP_PROC_BAD_DN:
 		return RLM_MODULE_INVALID;
-	}
 
-	if (!password) {
-		RWDEBUG("You have set \"Auth-Type := LDAP\" somewhere");
-		RWDEBUG("without checking if User-Password is present");
-		RWDEBUG("*********************************************");
-		RWDEBUG("* THAT CONFIGURATION IS WRONG.  DELETE IT.   ");
-		RWDEBUG("* YOU ARE PREVENTING THE SERVER FROM WORKING");
-		RWDEBUG("*********************************************");
+	case LDAP_PROC_NO_RESULT:
+		return RLM_MODULE_NOTFOUND;
 
-		REDEBUG("Attribute \"User-Password\" is required for authentication");
-		return RLM_MODULE_INVALID;
+	default:
+		return RLM_MODULE_FAIL;
 	}
+}
 
-	/*
-	 *	Make sure the supplied password isn't empty
-	 */
-	if (password->vp_length == 0) {
-		REDEBUG("User-Password must not be empty");
-		return RLM_MODULE_INVALID;
-	}
+/** Find the user, and bind as them, using a connection from the pool
+ *
+ */
+static rlm_rcode_t mod_authenticate_sync(rlm_ldap_t const *inst, REQUEST *request,
+					 VALUE_PAIR *username, VALUE_PAIR *password)
+{
+	rlm_rcode_t		rcode;
+	fr_ldap_rcode_t		status;
+	char const		*dn;
+	fr_ldap_connection_t		*conn;
 
-	/*
-	 *	Log the password
-	 */
-	if (RDEBUG_ENABLED3) {
-		RDEBUG("Login attempt with password \"%pV\"", &password->data);
-	} else {
-		RDEBUG2("Login attempt with password");
-	}
+	char			sasl_mech_buff[LDAP_MAX_DN_STR_LEN];
+	char			sasl_proxy_buff[LDAP_MAX_DN_STR_LEN];
+	char			sasl_realm_buff[LDAP_MAX_DN_STR_LEN];
+	fr_ldap_sasl_t		sasl;
 
 	conn = mod_conn_get(inst, request);
 	if (!conn) return RLM_MODULE_FAIL;
@@ -812,35 +803,218 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 			      inst->user_sasl.mech ? &sasl : NULL,
 			      0,
 			      NULL, NULL);
-	switch (status) {
-	case LDAP_PROC_SUCCESS:
-		rcode = RLM_MODULE_OK;
-		RDEBUG2("Bind as user \"%s\" was successful", dn);
-		break;
+	rcode = ldap_user_bind_rcode(request, status, dn);
 
-	case LDAP_PROC_NOT_PERMITTED:
-		rcode = RLM_MODULE_DISALLOW;
-		break;
+finish:
+	ldap_mod_conn_release(inst, request, conn);
 
-	case LDAP_PROC_REJECT:
-		rcode = RLM_MODULE_REJECT;
-		break;
+	return rcode;
+}
 
-	case LDAP_PROC_BAD_DN:
-		rcode = RLM_MODULE_INVALID;
-		break;
+typedef enum {
+	LDAP_AUTH_FIND_USER = 0,			//!< Searching for the user's DN.
+	LDAP_AUTH_BIND					//!< Binding as the user.
+} ldap_auth_stage_t;
 
-	case LDAP_PROC_NO_RESULT:
-		rcode = RLM_MODULE_NOTFOUND;
-		break;
+/** Resume context for authentication run on the thread's trunks
+ *
+ */
+typedef struct {
+	ldap_auth_stage_t	stage;			//!< What the query in progress is for.
+	fr_ldap_query_t		*query;			//!< Query in progress.
+	char const		*dn;			//!< The user's DN.
+	char const		*password;		//!< To bind with.
+} ldap_auth_ctx_t;
 
-	default:
-		rcode = RLM_MODULE_FAIL;
+static rlm_rcode_t mod_authenticate_resume(void *instance, void *thread, REQUEST *request, void *rctx);
+
+/** Abandon the search or bind if the request is cancelled
+ *
+ */
+static void mod_authenticate_signal(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request,
+				    void *rctx, fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	talloc_free(rctx);
+}
+
+/** Bind as the user, and yield until the bind completes
+ *
+ */
+static rlm_rcode_t ldap_auth_bind(rlm_ldap_thread_t *t, REQUEST *request, ldap_auth_ctx_t *auth_ctx)
+{
+	auth_ctx->stage = LDAP_AUTH_BIND;
+	auth_ctx->query = fr_ldap_trunk_bind(auth_ctx, request, t->bind_trunk,
+					     auth_ctx->dn, auth_ctx->password, NULL, NULL);
+	if (!auth_ctx->query) {
+		talloc_free(auth_ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, mod_authenticate_resume, mod_authenticate_signal, auth_ctx);
+}
+
+/** Process the result of the user search or bind
+ *
+ */
+static rlm_rcode_t mod_authenticate_resume(void *instance, void *thread, REQUEST *request, void *rctx)
+{
+	rlm_ldap_t const	*inst = talloc_get_type_abort_const(instance, rlm_ldap_t);
+	rlm_ldap_thread_t	*t = talloc_get_type_abort(thread, rlm_ldap_thread_t);
+	ldap_auth_ctx_t		*auth_ctx = talloc_get_type_abort(rctx, ldap_auth_ctx_t);
+	fr_ldap_query_t		*query = auth_ctx->query;
+	rlm_rcode_t		rcode = RLM_MODULE_FAIL;
+
+	auth_ctx->query = NULL;
+
+	switch (auth_ctx->stage) {
+	case LDAP_AUTH_FIND_USER:
+		switch (query->ret) {
+		case LDAP_PROC_SUCCESS:
+			break;
+
+		case LDAP_PROC_BAD_DN:
+		case LDAP_PROC_NO_RESULT:
+			rcode = RLM_MODULE_NOTFOUND;
+			goto finish;
+
+		default:
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+
+		auth_ctx->dn = rlm_ldap_find_user_process(inst, request, query->ldap_conn, query->result, &rcode);
+		if (!auth_ctx->dn) goto finish;
+		talloc_free(query);
+
+		return ldap_auth_bind(t, request, auth_ctx);
+
+	case LDAP_AUTH_BIND:
+		rcode = ldap_user_bind_rcode(request, query->ret, auth_ctx->dn);
 		break;
-	};
+	}
 
 finish:
-	ldap_mod_conn_release(inst, request, conn);
+	talloc_free(auth_ctx);
+
+	return rcode;
+}
+
+/** Find the user, and bind as them, using the thread's trunks
+ *
+ * Searches are multiplexed on the trunk connections, so the worker can continue
+ * processing other requests while waiting for the directory to respond.
+ */
+static rlm_rcode_t mod_authenticate_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request,
+					  VALUE_PAIR *username, VALUE_PAIR *password)
+{
+	ldap_auth_ctx_t		*auth_ctx;
+	VALUE_PAIR		*vp;
+	rlm_rcode_t		rcode;
+
+	RDEBUG2("Login attempt by \"%pV\"", &username->data);
+
+	MEM(auth_ctx = talloc_zero(request, ldap_auth_ctx_t));
+	auth_ctx->password = password->vp_strvalue;
+
+	vp = fr_pair_find_by_da(request->control, attr_ldap_userdn, TAG_ANY);
+	if (vp) {
+		RDEBUG2("Using user DN from request \"%pV\"", &vp->data);
+		auth_ctx->dn = vp->vp_strvalue;
+
+		return ldap_auth_bind(t, request, auth_ctx);
+	}
+
+	auth_ctx->stage = LDAP_AUTH_FIND_USER;
+	auth_ctx->query = rlm_ldap_find_user_async(auth_ctx, inst, request, t->trunk, NULL, &rcode);
+	if (!auth_ctx->query) {
+		talloc_free(auth_ctx);
+		return rcode;
+	}
+
+	return unlang_module_yield(request, mod_authenticate_resume, mod_authenticate_signal, auth_ctx);
+}
+
+static rlm_rcode_t mod_authenticate(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, REQUEST *request)
+{
+	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_thread_t	*t = talloc_get_type_abort(thread, rlm_ldap_thread_t);
+	VALUE_PAIR *username, *password;
+
+	username = fr_pair_find_by_da(request->packet->vps, attr_user_name, TAG_ANY);
+	password = fr_pair_find_by_da(request->packet->vps, attr_user_password, TAG_ANY);
+
+	/*
+	 *	We can only authenticate user requests which HAVE
+	 *	a User-Name attribute.
+	 */
+	if (!username) {
+		REDEBUG("Attribute \"User-Name\" is required for authentication");
+		return RLM_MODULE_INVALID;
+	}
+
+	if (!password) {
+		RWDEBUG("You have set \"Auth-Type := LDAP\" somewhere");
+		RWDEBUG("without checking if User-Password is present");
+		RWDEBUG("*********************************************");
+		RWDEBUG("* THAT CONFIGURATION IS WRONG.  DELETE IT.   ");
+		RWDEBUG("* YOU ARE PREVENTING THE SERVER FROM WORKING");
+		RWDEBUG("*********************************************");
+
+		REDEBUG("Attribute \"User-Password\" is required for authentication");
+		return RLM_MODULE_INVALID;
+	}
+
+	/*
+	 *	Make sure the supplied password isn't empty
+	 */
+	if (password->vp_length == 0) {
+		REDEBUG("User-Password must not be empty");
+		return RLM_MODULE_INVALID;
+	}
+
+	/*
+	 *	Log the password
+	 */
+	if (RDEBUG_ENABLED3) {
+		RDEBUG("Login attempt with password \"%pV\"", &password->data);
+	} else {
+		RDEBUG2("Login attempt with password");
+	}
+
+	/*
+	 *	SASL binds need several round trips, which the
+	 *	trunk doesn't support, so use the pool.
+	 */
+	if (!t->bind_trunk || inst->user_sasl.mech) return mod_authenticate_sync(inst, request, username, password);
+
+	return mod_authenticate_async(inst, t, request, username, password);
+}
+
+/** Apply the attributes from an LDAP profile
+ *
+ */
+static rlm_rcode_t ldap_map_profile_process(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t *conn,
+					    LDAPMessage *result, fr_ldap_map_exp_t const *expanded)
+{
+	rlm_rcode_t	rcode = RLM_MODULE_OK;
+	LDAPMessage	*entry;
+	int		ldap_errno;
+
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+
+		return RLM_MODULE_NOTFOUND;
+	}
+
+	RDEBUG2("Processing profile attributes");
+	RINDENT();
+	if (fr_ldap_map_do(request, conn, inst->valuepair_attr, expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
+	REXDENT();
 
 	return rcode;
 }
@@ -861,11 +1035,9 @@ information.
 static rlm_rcode_t rlm_ldap_map_profile(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
 					char const *dn, fr_ldap_map_exp_t const *expanded)
 {
-	rlm_rcode_t	rcode = RLM_MODULE_OK;
+	rlm_rcode_t	rcode;
 	fr_ldap_rcode_t	status;
-	LDAPMessage	*result = NULL, *entry = NULL;
-	int		ldap_errno;
-	LDAP		*handle = (*pconn)->handle;
+	LDAPMessage	*result = NULL;
 	char const	*filter;
 	char		filter_buff[LDAP_MAX_FILTER_STR_LEN];
 
@@ -898,34 +1070,84 @@ static rlm_rcode_t rlm_ldap_map_profile(rlm_ldap_t const *inst, REQUEST *request
 	fr_assert(*pconn);
 	fr_assert(result);
 
-	entry = ldap_first_entry(handle, result);
-	if (!entry) {
-		ldap_get_option(handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+	rcode = ldap_map_profile_process(inst, request, *pconn, result, expanded);
+	ldap_msgfree(result);
 
-		rcode = RLM_MODULE_NOTFOUND;
+	return rcode;
+}
 
-		goto free_result;
+/** Start a search for an LDAP profile on a trunk
+ *
+ * @param[in] ctx to allocate the query in.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] ttrunk to search on.
+ * @param[in] dn of profile object to apply.
+ * @param[in] expanded Structure containing a list of xlat expanded attribute names and mapping
+ *	information.  Must remain valid until the search completes.
+ * @param[out] rcode One of the RLM_MODULE_* values.
+ * @return
+ *	- The query.
+ *	- NULL if there's no profile to apply, or on error.
+ */
+static fr_ldap_query_t *ldap_map_profile_async(TALLOC_CTX *ctx, rlm_ldap_t const *inst, REQUEST *request,
+					       fr_ldap_trunk_t *ttrunk, char const *dn,
+					       fr_ldap_map_exp_t const *expanded, rlm_rcode_t *rcode)
+{
+	fr_ldap_query_t	*query;
+	char const	*filter;
+	char		filter_buff[LDAP_MAX_FILTER_STR_LEN];
+
+	fr_assert(inst->profile_filter); 	/* We always have a default filter set */
+
+	*rcode = RLM_MODULE_OK;
+
+	if (!dn || !*dn) return NULL;
+
+	if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request,
+			inst->profile_filter, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Failed creating profile filter");
+
+		*rcode = RLM_MODULE_INVALID;
+		return NULL;
 	}
 
-	RDEBUG2("Processing profile attributes");
-	RINDENT();
-	if (fr_ldap_map_do(request, *pconn, inst->valuepair_attr, expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
-	REXDENT();
+	query = fr_ldap_trunk_search(ctx, request, ttrunk, dn, LDAP_SCOPE_BASE, filter, expanded->attrs, NULL, NULL);
+	if (!query) *rcode = RLM_MODULE_FAIL;
 
-free_result:
-	ldap_msgfree(result);
+	return query;
+}
 
-	return rcode;
+/** Apply an LDAP profile found by #ldap_map_profile_async
+ *
+ */
+static rlm_rcode_t ldap_map_profile_resume(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_query_t *query,
+					   fr_ldap_map_exp_t const *expanded)
+{
+	switch (query->ret) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_BAD_DN:
+	case LDAP_PROC_NO_RESULT:
+		RDEBUG2("Profile object \"%s\" not found", query->dn);
+		return RLM_MODULE_NOTFOUND;
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+
+	return ldap_map_profile_process(inst, request, query->ldap_conn, query->result, expanded);
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+/** Find the user, and apply their attributes, groups and profiles, using a connection from the pool
+ *
+ */
+static rlm_rcode_t mod_authorize_sync(rlm_ldap_t const *inst, REQUEST *request)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
 	int			ldap_errno;
 	int			i;
-	rlm_ldap_t const	*inst = instance;
 	struct berval		**values;
 	fr_ldap_connection_t	*conn;
 	LDAPMessage		*result, *entry;
@@ -935,12 +1157,6 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 	fr_ldap_rcode_t		status;
 #endif
 
-	/*
-	 *	Don't be tempted to add a check for User-Name or
-	 *	User-Password here.  LDAP authorization can be used
-	 *	for many things besides searching for users.
-	 */
-
 	if (fr_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
 
 	conn = mod_conn_get(inst, request);
@@ -1157,6 +1373,311 @@ finish:
 	return rcode;
 }
 
+typedef enum {
+	LDAP_AUTZ_FIND_USER = 0,			//!< Searching for the user object.
+	LDAP_AUTZ_GROUPOBJ,				//!< Searching for group objects the user is a member of.
+	LDAP_AUTZ_DEFAULT_PROFILE,			//!< Searching for the default profile.
+	LDAP_AUTZ_USER_PROFILES				//!< Searching for the profiles listed in the user object.
+} ldap_autz_stage_t;
+
+/** Resume context for authorization run on the thread's trunk
+ *
+ */
+typedef struct {
+	ldap_autz_stage_t	stage;			//!< What the query in progress is for.
+	fr_ldap_query_t		*query;			//!< Query in progress.
+
+	fr_ldap_query_t		*user;			//!< Search which found the user object.
+	LDAPMessage		*entry;			//!< The user object.
+
+	fr_ldap_map_exp_t	expanded;		//!< Attributes to retrieve from user objects and profiles.
+
+	struct berval		**profiles;		//!< Values of profile_attr from the user object.
+	int			profile_idx;		//!< Next profile to apply.
+
+	rlm_rcode_t		rcode;			//!< What to return if all the stages succeed.
+} ldap_autz_ctx_t;
+
+static int _ldap_autz_ctx_free(ldap_autz_ctx_t *autz_ctx)
+{
+	/*
+	 *	Cancel the query in progress before freeing
+	 *	the attribute list it references.
+	 */
+	TALLOC_FREE(autz_ctx->query);
+	if (autz_ctx->profiles) ldap_value_free_len(autz_ctx->profiles);
+	talloc_free(autz_ctx->expanded.ctx);
+
+	return 0;
+}
+
+static rlm_rcode_t mod_authorize_resume(void *instance, void *thread, REQUEST *request, void *rctx);
+
+/** Abandon the search in progress if the request is cancelled
+ *
+ */
+static void mod_authorize_signal(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request,
+				 void *rctx, fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	talloc_free(rctx);
+}
+
+/** Start the search for the next stage, or apply the user object's attributes if there are no more
+ *
+ * Stages which aren't configured are skipped.
+ */
+static rlm_rcode_t ldap_autz_next(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request,
+				  ldap_autz_ctx_t *autz_ctx)
+{
+	fr_ldap_connection_t	*conn = autz_ctx->user->ldap_conn;
+	rlm_rcode_t		rcode;
+
+	switch (autz_ctx->stage) {
+	case LDAP_AUTZ_FIND_USER:
+		autz_ctx->stage = LDAP_AUTZ_GROUPOBJ;
+		if (inst->cacheable_group_dn || inst->cacheable_group_name) {
+			autz_ctx->query = rlm_ldap_cacheable_groupobj_async(autz_ctx, inst, request, t->trunk, &rcode);
+			if (autz_ctx->query) goto yield;
+			if (rcode != RLM_MODULE_OK) goto finish;
+		}
+		/* FALL-THROUGH */
+
+	case LDAP_AUTZ_GROUPOBJ:
+		autz_ctx->stage = LDAP_AUTZ_DEFAULT_PROFILE;
+		if (inst->default_profile) {
+			char const *profile;
+			char profile_buff[1024];
+
+			if (tmpl_expand(&profile, profile_buff, sizeof(profile_buff),
+					request, inst->default_profile, NULL, NULL) < 0) {
+				REDEBUG("Failed creating default profile string");
+
+				rcode = RLM_MODULE_INVALID;
+				goto finish;
+			}
+
+			autz_ctx->query = ldap_map_profile_async(autz_ctx, inst, request, t->trunk,
+								 profile, &autz_ctx->expanded, &rcode);
+			if (autz_ctx->query) goto yield;
+			if (rcode != RLM_MODULE_OK) goto finish;
+		}
+		/* FALL-THROUGH */
+
+	case LDAP_AUTZ_DEFAULT_PROFILE:
+		autz_ctx->stage = LDAP_AUTZ_USER_PROFILES;
+		if (inst->profile_attr) {
+			autz_ctx->profiles = ldap_get_values_len(conn->handle, autz_ctx->entry, inst->profile_attr);
+		}
+		/* FALL-THROUGH */
+
+	case LDAP_AUTZ_USER_PROFILES:
+		while (autz_ctx->profiles && autz_ctx->profiles[autz_ctx->profile_idx]) {
+			char *value;
+
+			value = fr_ldap_berval_to_string(request, autz_ctx->profiles[autz_ctx->profile_idx++]);
+			autz_ctx->query = ldap_map_profile_async(autz_ctx, inst, request, t->trunk,
+								 value, &autz_ctx->expanded, &rcode);
+			talloc_free(value);
+			if (autz_ctx->query) goto yield;
+			if (rcode == RLM_MODULE_FAIL) goto finish;
+		}
+		break;
+	}
+
+	rcode = autz_ctx->rcode;
+	if (inst->user_map || inst->valuepair_attr) {
+		RDEBUG2("Processing user attributes");
+		RINDENT();
+		if (fr_ldap_map_do(request, conn, inst->valuepair_attr,
+				   &autz_ctx->expanded, autz_ctx->entry) > 0) rcode = RLM_MODULE_UPDATED;
+		REXDENT();
+		rlm_ldap_check_reply(inst, request, conn);
+	}
+
+finish:
+	talloc_free(autz_ctx);
+
+	return rcode;
+
+yield:
+	return unlang_module_yield(request, mod_authorize_resume, mod_authorize_signal, autz_ctx);
+}
+
+/** Process the result of the search for the current stage
+ *
+ */
+static rlm_rcode_t mod_authorize_resume(void *instance, void *thread, REQUEST *request, void *rctx)
+{
+	rlm_ldap_t const	*inst = talloc_get_type_abort_const(instance, rlm_ldap_t);
+	rlm_ldap_thread_t	*t = talloc_get_type_abort(thread, rlm_ldap_thread_t);
+	ldap_autz_ctx_t		*autz_ctx = talloc_get_type_abort(rctx, ldap_autz_ctx_t);
+	fr_ldap_query_t		*query = autz_ctx->query;
+	rlm_rcode_t		rcode = RLM_MODULE_FAIL;
+
+	switch (autz_ctx->stage) {
+	case LDAP_AUTZ_FIND_USER:
+		switch (query->ret) {
+		case LDAP_PROC_SUCCESS:
+			break;
+
+		case LDAP_PROC_BAD_DN:
+		case LDAP_PROC_NO_RESULT:
+			rcode = RLM_MODULE_NOTFOUND;
+			goto finish;
+
+		default:
+			goto finish;
+		}
+
+		if (!rlm_ldap_find_user_process(inst, request, query->ldap_conn, query->result, &rcode)) goto finish;
+
+		/*
+		 *	Keep the result, we need the user
+		 *	object until all the stages are done.
+		 */
+		autz_ctx->user = query;
+		autz_ctx->query = NULL;
+		autz_ctx->entry = ldap_first_entry(query->ldap_conn->handle, query->result);
+
+		/*
+		 *	Check for access.
+		 */
+		if (inst->userobj_access_attr) {
+			rcode = rlm_ldap_check_access(inst, request, query->ldap_conn, autz_ctx->entry);
+			if (rcode != RLM_MODULE_OK) goto finish;
+		}
+		break;
+
+	case LDAP_AUTZ_GROUPOBJ:
+		switch (query->ret) {
+		case LDAP_PROC_SUCCESS:
+			rcode = rlm_ldap_cacheable_groupobj_process(inst, request, query->ldap_conn, query->result);
+			break;
+
+		case LDAP_PROC_NO_RESULT:
+			RDEBUG2("No cacheable group memberships found in group objects");
+			rcode = RLM_MODULE_OK;
+			break;
+
+		default:
+			break;
+		}
+		TALLOC_FREE(autz_ctx->query);
+		if (rcode != RLM_MODULE_OK) goto finish;
+		break;
+
+	case LDAP_AUTZ_DEFAULT_PROFILE:
+		rcode = ldap_map_profile_resume(inst, request, query, &autz_ctx->expanded);
+		TALLOC_FREE(autz_ctx->query);
+		switch (rcode) {
+		case RLM_MODULE_INVALID:
+		case RLM_MODULE_FAIL:
+			goto finish;
+
+		case RLM_MODULE_UPDATED:
+			autz_ctx->rcode = RLM_MODULE_UPDATED;
+			break;
+
+		default:
+			break;
+		}
+		break;
+
+	case LDAP_AUTZ_USER_PROFILES:
+		rcode = ldap_map_profile_resume(inst, request, query, &autz_ctx->expanded);
+		TALLOC_FREE(autz_ctx->query);
+		if (rcode == RLM_MODULE_FAIL) goto finish;
+		break;
+	}
+
+	return ldap_autz_next(inst, t, request, autz_ctx);
+
+finish:
+	talloc_free(autz_ctx);
+
+	return rcode;
+}
+
+/** Find the user, and apply their attributes, groups and profiles, using the thread's trunk
+ *
+ * Searches are multiplexed on the trunk connections, so the worker can continue
+ * processing other requests while waiting for the directory to respond.
+ */
+static rlm_rcode_t mod_authorize_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request)
+{
+	ldap_autz_ctx_t		*autz_ctx;
+	rlm_rcode_t		rcode;
+
+	MEM(autz_ctx = talloc_zero(request, ldap_autz_ctx_t));
+	talloc_set_destructor(autz_ctx, _ldap_autz_ctx_free);
+	autz_ctx->rcode = RLM_MODULE_OK;
+
+	if (fr_ldap_map_expand(&autz_ctx->expanded, request, inst->user_map) < 0) {
+		talloc_free(autz_ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Add any additional attributes we need for checking access and profiles
+	 */
+	if (inst->userobj_access_attr) {
+		autz_ctx->expanded.attrs[autz_ctx->expanded.count++] = inst->userobj_access_attr;
+	}
+
+	if (inst->profile_attr) {
+		autz_ctx->expanded.attrs[autz_ctx->expanded.count++] = inst->profile_attr;
+	}
+
+	if (inst->valuepair_attr) {
+		autz_ctx->expanded.attrs[autz_ctx->expanded.count++] = inst->valuepair_attr;
+	}
+
+	autz_ctx->expanded.attrs[autz_ctx->expanded.count] = NULL;
+
+	autz_ctx->stage = LDAP_AUTZ_FIND_USER;
+	autz_ctx->query = rlm_ldap_find_user_async(autz_ctx, inst, request, t->trunk,
+						   autz_ctx->expanded.attrs, &rcode);
+	if (!autz_ctx->query) {
+		talloc_free(autz_ctx);
+		return rcode;
+	}
+
+	return unlang_module_yield(request, mod_authorize_resume, mod_authorize_signal, autz_ctx);
+}
+
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
+{
+	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_thread_t	*t = talloc_get_type_abort(thread, rlm_ldap_thread_t);
+
+	/*
+	 *	Don't be tempted to add a check for User-Name or
+	 *	User-Password here.  LDAP authorization can be used
+	 *	for many things besides searching for users.
+	 */
+
+	if (!t->trunk) return mod_authorize_sync(inst, request);
+
+	/*
+	 *	Resolving group memberships from the user object
+	 *	may need a search per group, and retrieving the
+	 *	eDirectory universal password is done with an
+	 *	extended operation.  Neither is supported on the
+	 *	trunk yet.
+	 */
+	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
+		return mod_authorize_sync(inst, request);
+	}
+#ifdef WITH_EDIR
+	if (inst->edir) return mod_authorize_sync(inst, request);
+#endif
+
+	return mod_authorize_async(inst, t, request);
+}
+
 /** Modify user's object in LDAP
  *
  * Process a modifcation map to update a user object in the LDAP directory.
@@ -1576,6 +2097,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 			goto error;
 		}
 	}
+	inst->groupobj_attrs[0] = inst->groupobj_name_attr;
 
 	/*
 	 *	If we have a *pair* as opposed to a *section*
@@ -1997,6 +2519,45 @@ error:
 	return -1;
 }
 
+/** Create the trunks used to run searches and binds for this thread
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_ldap_t		*inst = talloc_get_type_abort(instance, rlm_ldap_t);
+	rlm_ldap_thread_t	*t = talloc_get_type_abort(thread, rlm_ldap_thread_t);
+	fr_trunk_conf_t		bind_conf;
+	char			*log_prefix;
+
+	if (!inst->async) return 0;
+
+	log_prefix = talloc_typed_asprintf(t, "rlm_ldap (%s)", inst->name);
+
+	t->trunk = fr_ldap_trunk_alloc(t, el, &inst->handle_config, &inst->trunk_conf, log_prefix, false);
+	if (!t->trunk) {
+	error:
+		ERROR("Failed creating LDAP trunk");
+		talloc_free(log_prefix);
+		return -1;
+	}
+
+	/*
+	 *	Only one bind can be in progress on
+	 *	a connection at a time.
+	 */
+	bind_conf = inst->trunk_conf;
+	bind_conf.max_req_per_conn = 1;
+	bind_conf.target_req_per_conn = 1;
+
+	t->bind_trunk = fr_ldap_trunk_alloc(t, el, &inst->handle_config, &bind_conf, log_prefix, true);
+	if (!t->bind_trunk) goto error;
+
+	talloc_free(log_prefix);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_ldap_init();
@@ -2017,6 +2578,9 @@ module_t rlm_ldap = {
 	.type		= 0,
 	.inst_size	= sizeof(rlm_ldap_t),
 	.config		= module_config,
+	.thread_inst_size	= sizeof(rlm_ldap_thread_t),
+	.thread_inst_type	= "rlm_ldap_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 	.onload		= mod_load,
 	.unload		= mod_unload,
 	.bootstrap	= mod_bootstrap,
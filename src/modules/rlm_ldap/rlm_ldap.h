@@ -84,6 +84,7 @@ struct ldap_inst_s {
 	int		groupobj_scope;			//!< Search scope.
 
 	char const	*groupobj_name_attr;		//!< The name of the group.
+	char const	*groupobj_attrs[2];		//!< Attributes retrieved when caching group objects.
 	char const	*groupobj_membership_filter;	//!< Filter to only retrieve groups which contain
 							//!< the user as a member.
 
@@ -142,6 +143,10 @@ struct ldap_inst_s {
 	fr_pool_t	*pool;				//!< Connection pool instance.
 	fr_ldap_config_t handle_config;			//!< Connection configuration instance.
 
+	bool		async;				//!< Run authorize and authenticate searches and binds
+							//!< on the per-thread trunks, instead of the pool.
+	fr_trunk_conf_t	trunk_conf;			//!< Configuration for the per-thread trunks.
+
 	/*
 	 *	Global config
 	 */
@@ -151,6 +156,14 @@ struct ldap_inst_s {
 	uint32_t	ldap_debug;			//!< Debug flag for the SDK.
 };
 
+/** Per-thread connections to the directory
+ *
+ */
+typedef struct {
+	fr_ldap_trunk_t	*trunk;				//!< Searches, many outstanding per connection.
+	fr_ldap_trunk_t	*bind_trunk;			//!< User binds, one outstanding per connection.
+} rlm_ldap_thread_t;
+
 extern fr_dict_attr_t const *attr_cleartext_password;
 extern fr_dict_attr_t const *attr_crypt_password;
 extern fr_dict_attr_t const *attr_ldap_userdn;
@@ -166,6 +179,12 @@ extern fr_dict_attr_t const *attr_user_name;
 char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
 			       char const *attrs[], bool force, LDAPMessage **result, rlm_rcode_t *rcode);
 
+char const *rlm_ldap_find_user_process(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t const *conn,
+				       LDAPMessage *result, rlm_rcode_t *rcode);
+
+fr_ldap_query_t *rlm_ldap_find_user_async(TALLOC_CTX *ctx, rlm_ldap_t const *inst, REQUEST *request,
+					  fr_ldap_trunk_t *ttrunk, char const * const *attrs, rlm_rcode_t *rcode);
+
 rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, REQUEST *request,
 				  fr_ldap_connection_t const *conn, LDAPMessage *entry);
 
@@ -179,6 +198,12 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 
 rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn);
 
+fr_ldap_query_t *rlm_ldap_cacheable_groupobj_async(TALLOC_CTX *ctx, rlm_ldap_t const *inst, REQUEST *request,
+						   fr_ldap_trunk_t *ttrunk, rlm_rcode_t *rcode);
+
+rlm_rcode_t rlm_ldap_cacheable_groupobj_process(rlm_ldap_t const *inst, REQUEST *request,
+						fr_ldap_connection_t const *conn, LDAPMessage *result);
+
 rlm_rcode_t rlm_ldap_check_groupobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
 					    VALUE_PAIR *check);
 
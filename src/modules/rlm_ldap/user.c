@@ -36,6 +36,166 @@ USES_APPLE_DEPRECATED_API
 
 #include "rlm_ldap.h"
 
+/** Expand the filter and base DN used to find a user object
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int ldap_find_user_expand(rlm_ldap_t const *inst, REQUEST *request,
+				 char const **filter, char *filter_buff, size_t filter_len,
+				 char const **base_dn, char *base_dn_buff, size_t base_dn_len)
+{
+	*filter = NULL;
+
+	if (inst->userobj_filter) {
+		if (tmpl_expand(filter, filter_buff, filter_len, request, inst->userobj_filter,
+				fr_ldap_escape_func, NULL) < 0) {
+			REDEBUG("Unable to create filter");
+			return -1;
+		}
+	}
+
+	if (tmpl_expand(base_dn, base_dn_buff, base_dn_len, request,
+			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Unable to create base_dn");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Retrieve the DN of a user object from the result of a user search
+ *
+ * Adds the DN to the control list as LDAP-UserDN.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn the search was performed on.
+ * @param[in] result of the search.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return The user's DN or NULL on error.
+ */
+char const *rlm_ldap_find_user_process(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t const *conn,
+				       LDAPMessage *result, rlm_rcode_t *rcode)
+{
+	VALUE_PAIR	*vp = NULL;
+	LDAPMessage	*entry;
+	int		ldap_errno;
+	int		cnt;
+	char		*dn;
+
+	*rcode = RLM_MODULE_FAIL;
+
+	/*
+	 *	Forbid the use of unsorted search results that
+	 *	contain multiple entries, as it's a potential
+	 *	security issue, and likely non deterministic.
+	 */
+	if (!inst->userobj_sort_ctrl) {
+		cnt = ldap_count_entries(conn->handle, result);
+		if (cnt > 1) {
+			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
+				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
+			REDEBUG("The following entries were returned:");
+			RINDENT();
+			for (entry = ldap_first_entry(conn->handle, result);
+			     entry;
+			     entry = ldap_next_entry(conn->handle, entry)) {
+				dn = ldap_get_dn(conn->handle, entry);
+				REDEBUG("%s", dn);
+				ldap_memfree(dn);
+			}
+			REXDENT();
+			*rcode = RLM_MODULE_INVALID;
+			return NULL;
+		}
+	}
+
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s",
+			ldap_err2string(ldap_errno));
+
+		return NULL;
+	}
+
+	dn = ldap_get_dn(conn->handle, entry);
+	if (!dn) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+		return NULL;
+	}
+	fr_ldap_util_normalise_dn(dn, dn);
+
+	RDEBUG2("User object found at DN \"%s\"", dn);
+
+	MEM(pair_update_control(&vp, attr_ldap_userdn) >= 0);
+	fr_pair_value_strcpy(vp, dn);
+	*rcode = RLM_MODULE_OK;
+
+	ldap_memfree(dn);
+
+	return vp->vp_strvalue;
+}
+
+/** Start a search for a user object on a trunk
+ *
+ * Once the search completes, pass the result to #rlm_ldap_find_user_process.
+ *
+ * @param[in] ctx to allocate the query in.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] ttrunk to search on.
+ * @param[in] attrs Additional attributes to retrieve, may be NULL.  Must remain
+ *	valid until the search completes.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return
+ *	- The query.
+ *	- NULL on error.
+ */
+fr_ldap_query_t *rlm_ldap_find_user_async(TALLOC_CTX *ctx, rlm_ldap_t const *inst, REQUEST *request,
+					  fr_ldap_trunk_t *ttrunk, char const * const *attrs, rlm_rcode_t *rcode)
+{
+	static char const * const no_attrs[] = { NULL };
+
+	fr_ldap_query_t	*query;
+	char const	*filter;
+	char		filter_buff[LDAP_MAX_FILTER_STR_LEN];
+	char const	*base_dn;
+	char		base_dn_buff[LDAP_MAX_DN_STR_LEN];
+	LDAPControl	**serverctrls = NULL;
+
+	if (ldap_find_user_expand(inst, request, &filter, filter_buff, sizeof(filter_buff),
+				  &base_dn, base_dn_buff, sizeof(base_dn_buff)) < 0) {
+		*rcode = RLM_MODULE_INVALID;
+		return NULL;
+	}
+
+	/*
+	 *	The controls are sent after we return, so can't
+	 *	live on the stack.
+	 */
+	if (inst->userobj_sort_ctrl) {
+		MEM(serverctrls = talloc_zero_array(ctx, LDAPControl *, 2));
+		serverctrls[0] = inst->userobj_sort_ctrl;
+	}
+
+	query = fr_ldap_trunk_search(ctx, request, ttrunk, base_dn, inst->userobj_scope, filter,
+				     attrs ? attrs : no_attrs, serverctrls, NULL);
+	if (!query) {
+		talloc_free(serverctrls);
+		*rcode = RLM_MODULE_FAIL;
+		return NULL;
+	}
+	if (serverctrls) talloc_steal(query, serverctrls);
+	*rcode = RLM_MODULE_OK;
+
+	return query;
+}
+
 /** Retrieve the DN of a user object
  *
  * Retrieves the DN of a user and adds it to the control list as LDAP-UserDN. Will also retrieve any
@@ -61,10 +221,8 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 
 	fr_ldap_rcode_t	status;
 	VALUE_PAIR	*vp = NULL;
-	LDAPMessage	*tmp_msg = NULL, *entry = NULL;
-	int		ldap_errno;
-	int		cnt;
-	char		*dn = NULL;
+	LDAPMessage	*tmp_msg = NULL;
+	char const	*user_dn;
 	char const	*filter = NULL;
 	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
 	char const	*base_dn;
@@ -115,19 +273,8 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 		(*pconn)->rebound = false;
 	}
 
-	if (inst->userobj_filter) {
-		if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request, inst->userobj_filter,
-				fr_ldap_escape_func, NULL) < 0) {
-			REDEBUG("Unable to create filter");
-			*rcode = RLM_MODULE_INVALID;
-
-			return NULL;
-		}
-	}
-
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Unable to create base_dn");
+	if (ldap_find_user_expand(inst, request, &filter, filter_buff, sizeof(filter_buff),
+				  &base_dn, base_dn_buff, sizeof(base_dn_buff)) < 0) {
 		*rcode = RLM_MODULE_INVALID;
 
 		return NULL;
@@ -151,64 +298,14 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 
 	fr_assert(*pconn);
 
-	/*
-	 *	Forbid the use of unsorted search results that
-	 *	contain multiple entries, as it's a potential
-	 *	security issue, and likely non deterministic.
-	 */
-	if (!inst->userobj_sort_ctrl) {
-		cnt = ldap_count_entries((*pconn)->handle, *result);
-		if (cnt > 1) {
-			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
-				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
-			REDEBUG("The following entries were returned:");
-			RINDENT();
-			for (entry = ldap_first_entry((*pconn)->handle, *result);
-			     entry;
-			     entry = ldap_next_entry((*pconn)->handle, entry)) {
-				dn = ldap_get_dn((*pconn)->handle, entry);
-				REDEBUG("%s", dn);
-				ldap_memfree(dn);
-			}
-			REXDENT();
-			*rcode = RLM_MODULE_INVALID;
-			goto finish;
-		}
-	}
-
-	entry = ldap_first_entry((*pconn)->handle, *result);
-	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s",
-			ldap_err2string(ldap_errno));
-
-		goto finish;
-	}
-
-	dn = ldap_get_dn((*pconn)->handle, entry);
-	if (!dn) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
-
-		goto finish;
-	}
-	fr_ldap_util_normalise_dn(dn, dn);
-
-	RDEBUG2("User object found at DN \"%s\"", dn);
-
-	MEM(pair_update_control(&vp, attr_ldap_userdn) >= 0);
-	fr_pair_value_strcpy(vp, dn);
-	*rcode = RLM_MODULE_OK;
-
-	ldap_memfree(dn);
+	user_dn = rlm_ldap_find_user_process(inst, request, *pconn, *result, rcode);
 
-finish:
 	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
 		ldap_msgfree(*result);
 		*result = NULL;
 	}
 
-	return vp ? vp->vp_strvalue : NULL;
+	return user_dn;
 }
 
 /** Check for presence of access attribute in result
@@ -272,7 +369,7 @@ void rlm_ldap_check_reply(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn
 	    !fr_pair_find_by_da(request->control, attr_user_password, TAG_ANY) &&
 	    !fr_pair_find_by_da(request->control, attr_password_with_header, TAG_ANY) &&
 	    !fr_pair_find_by_da(request->control, attr_crypt_password, TAG_ANY)) {
-		switch (conn->directory->type) {
+		switch (conn->directory ? conn->directory->type : FR_LDAP_DIRECTORY_UNKNOWN) {
 		case FR_LDAP_DIRECTORY_ACTIVE_DIRECTORY:
 			RWDEBUG2("!!! Found map between LDAP attribute and a FreeRADIUS password attribute");
 			RWDEBUG2("!!! Active Directory does not allow passwords to be read via LDAP");
@@ -0,0 +1,2 @@
+SOURCES		:= rlm_match_set.c
+TARGET		:= rlm_match_set.a
@@ -0,0 +1,949 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_match_set.c
+ * @brief Match a string against a large set of patterns in one pass.
+ *
+ * The literal patterns are compiled into an Aho-Corasick automaton,
+ * so the time taken to match a string depends on the length of the
+ * string, and not on the number of patterns.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/map_proc.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/unlang/xlat.h>
+
+#include <ctype.h>
+
+#define MATCH_SET_NONE		UINT32_MAX
+
+static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, REQUEST *request,
+				fr_value_box_t **key, vp_map_t const *maps);
+
+typedef struct {
+	char const		*name;
+	char const		*filename;
+	bool			case_insensitive;
+
+	fr_reload_conf_t	reload_conf;
+	fr_reload_t		*reload;	//!< Holds the current #match_set_data_t.
+} rlm_match_set_t;
+
+typedef enum {
+	MATCH_SET_CONTAINS = 0,			//!< Anywhere in the string.
+	MATCH_SET_PREFIX,			//!< At the start of the string.
+	MATCH_SET_SUFFIX,			//!< At the end of the string.
+	MATCH_SET_EXACT,			//!< The whole string.
+	MATCH_SET_REGEX				//!< A regular expression.
+} match_set_type_t;
+
+static fr_table_num_sorted_t const match_set_type_table[] = {
+	{ "contains",	MATCH_SET_CONTAINS	},
+	{ "exact",	MATCH_SET_EXACT		},
+	{ "prefix",	MATCH_SET_PREFIX	},
+	{ "regex",	MATCH_SET_REGEX		},
+	{ "suffix",	MATCH_SET_SUFFIX	}
+};
+static size_t match_set_type_table_len = NUM_ELEMENTS(match_set_type_table);
+
+typedef enum {
+	MATCH_SET_FIELD_INVALID = 0,
+	MATCH_SET_FIELD_COUNT,			//!< The number of names which matched.
+	MATCH_SET_FIELD_NAME			//!< Each name which matched.
+} match_set_field_t;
+
+static fr_table_num_sorted_t const match_set_field_table[] = {
+	{ "count",	MATCH_SET_FIELD_COUNT	},
+	{ "name",	MATCH_SET_FIELD_NAME	}
+};
+static size_t match_set_field_table_len = NUM_ELEMENTS(match_set_field_table);
+
+typedef struct {
+	uint32_t		name;		//!< Index into the names array.
+	match_set_type_t	type;
+	size_t			len;		//!< Of a literal pattern.
+	uint32_t		next;		//!< Next pattern which ends at the same state.
+#ifdef HAVE_REGEX
+	regex_t			*preg;		//!< Of a regex pattern.
+#endif
+} match_set_pattern_t;
+
+typedef struct {
+	uint8_t			c;
+	uint32_t		state;
+} match_set_edge_t;
+
+typedef struct {
+	uint32_t		edges;		//!< Offset of our first edge in the edges array.
+	uint16_t		num_edges;	//!< Sorted by character.
+	uint32_t		fail;		//!< Longest proper suffix of this state which is
+						///< also a state.
+	uint32_t		out;		//!< Nearest state on the fail chain at which a
+						///< pattern ends.
+	uint32_t		pattern;	//!< First pattern which ends at this state.
+} match_set_state_t;
+
+/** The patterns read from the file
+ *
+ * Replaced as a whole when the file is reloaded.
+ */
+typedef struct {
+	char const		**names;	//!< Returned when a pattern matches.
+	uint32_t		num_names;
+
+	match_set_pattern_t	*patterns;
+	uint32_t		num_patterns;
+
+	match_set_state_t	*states;	//!< State 0 is the root.
+	uint32_t		num_states;
+	match_set_edge_t	*edges;
+
+	uint32_t		root[256];	//!< Transitions from the root, which never fail.
+
+	uint32_t		*regex;		//!< Indexes of the regex patterns.
+	uint32_t		num_regex;
+} match_set_data_t;
+
+/** Scratch space used while reading the file
+ *
+ */
+typedef struct {
+	rlm_match_set_t const	*inst;
+	match_set_data_t	*data;
+
+	fr_hash_table_t		*names;		//!< Of #match_set_name_t, to de-duplicate names.
+	uint32_t		names_allocd;
+	uint32_t		patterns_allocd;
+	uint32_t		regex_allocd;
+
+	uint32_t		*first_child;	//!< Of each state.
+	uint32_t		*sibling;	//!< Next child of the state's parent.
+	uint8_t			*label;		//!< Character on the edge leading to the state.
+	uint32_t		states_allocd;
+} match_set_build_t;
+
+typedef struct {
+	char const		*name;
+	uint32_t		id;
+} match_set_name_t;
+
+/** What a map is being applied from
+ *
+ */
+typedef struct {
+	match_set_data_t const	*data;
+	uint32_t const		*found;		//!< Names which matched.
+	uint32_t		num_found;
+	match_set_field_t	field;		//!< Which field the map wants.
+} match_set_result_t;
+
+static const CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_INPUT | FR_TYPE_REQUIRED | FR_TYPE_NOT_EMPTY, rlm_match_set_t, filename) },
+	{ FR_CONF_OFFSET("case_insensitive", FR_TYPE_BOOL, rlm_match_set_t, case_insensitive), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("reload", FR_TYPE_SUBSECTION, rlm_match_set_t, reload_conf), .subcs = (void const *) fr_reload_config },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Grow an array by doubling its size
+ *
+ */
+#define MATCH_SET_GROW(_ctx, _array, _type, _used, _allocd) \
+do { \
+	if ((_used) == (_allocd)) { \
+		(_allocd) = (_allocd) ? ((_allocd) * 2) : 64; \
+		MEM(_array = talloc_realloc(_ctx, _array, _type, _allocd)); \
+	} \
+} while (0)
+
+static uint32_t match_set_name_hash(void const *data)
+{
+	match_set_name_t const *n = data;
+
+	return fr_hash_string(n->name);
+}
+
+static int match_set_name_cmp(void const *one, void const *two)
+{
+	match_set_name_t const *a = one, *b = two;
+
+	return strcmp(a->name, b->name);
+}
+
+static int match_set_edge_cmp(void const *one, void const *two)
+{
+	match_set_edge_t const *a = one, *b = two;
+
+	return (a->c > b->c) - (a->c < b->c);
+}
+
+/** Find the transition from a state, without following fail links
+ *
+ */
+static inline CC_HINT(always_inline) uint32_t match_set_edge(match_set_data_t const *data,
+							      uint32_t state, uint8_t c)
+{
+	match_set_edge_t const	*edges = &data->edges[data->states[state].edges];
+	int			lo = 0, hi = (int) data->states[state].num_edges - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+
+		if (edges[mid].c == c) return edges[mid].state;
+		if (edges[mid].c < c) {
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return MATCH_SET_NONE;
+}
+
+/** Find the transition from a state, following fail links if necessary
+ *
+ */
+static inline CC_HINT(always_inline) uint32_t match_set_next(match_set_data_t const *data,
+							      uint32_t state, uint8_t c)
+{
+	for (;;) {
+		uint32_t next;
+
+		if (state == 0) return data->root[c];
+
+		next = match_set_edge(data, state, c);
+		if (next != MATCH_SET_NONE) return next;
+
+		state = data->states[state].fail;
+	}
+}
+
+/** Add a state to the automaton
+ *
+ */
+static uint32_t match_set_state_add(match_set_build_t *build)
+{
+	match_set_data_t	*data = build->data;
+	uint32_t		state = data->num_states;
+
+	if (state == build->states_allocd) {
+		MATCH_SET_GROW(data, data->states, match_set_state_t, state, build->states_allocd);
+		MEM(build->first_child = talloc_realloc(build, build->first_child, uint32_t, build->states_allocd));
+		MEM(build->sibling = talloc_realloc(build, build->sibling, uint32_t, build->states_allocd));
+		MEM(build->label = talloc_realloc(build, build->label, uint8_t, build->states_allocd));
+	}
+
+	data->states[state] = (match_set_state_t) {
+		.fail = 0,
+		.out = MATCH_SET_NONE,
+		.pattern = MATCH_SET_NONE
+	};
+	build->first_child[state] = MATCH_SET_NONE;
+	build->sibling[state] = MATCH_SET_NONE;
+	build->label[state] = 0;
+
+	data->num_states++;
+
+	return state;
+}
+
+/** Add a literal pattern to the trie
+ *
+ */
+static void match_set_insert(match_set_build_t *build, uint32_t pattern, uint8_t const *p, size_t len)
+{
+	match_set_data_t	*data = build->data;
+	uint32_t		state = 0;
+	size_t			i;
+
+	for (i = 0; i < len; i++) {
+		uint32_t child;
+
+		for (child = build->first_child[state];
+		     child != MATCH_SET_NONE;
+		     child = build->sibling[child]) {
+			if (build->label[child] == p[i]) break;
+		}
+
+		if (child == MATCH_SET_NONE) {
+			child = match_set_state_add(build);
+			build->label[child] = p[i];
+			build->sibling[child] = build->first_child[state];
+			build->first_child[state] = child;
+		}
+
+		state = child;
+	}
+
+	data->patterns[pattern].next = data->states[state].pattern;
+	data->states[state].pattern = pattern;
+}
+
+/** Turn the trie into an automaton
+ *
+ * Flattens the children of each state into a sorted array of edges,
+ * and then walks the trie breadth first to set the fail links.
+ */
+static void match_set_compile(match_set_build_t *build)
+{
+	match_set_data_t	*data = build->data;
+	uint32_t		*queue, head = 0, tail = 0;
+	uint32_t		state, num_edges = 0, i;
+
+	MEM(data->edges = talloc_array(data, match_set_edge_t, data->num_states));
+	for (state = 0; state < data->num_states; state++) {
+		uint32_t child;
+
+		data->states[state].edges = num_edges;
+		for (child = build->first_child[state];
+		     child != MATCH_SET_NONE;
+		     child = build->sibling[child]) {
+			data->edges[num_edges].c = build->label[child];
+			data->edges[num_edges].state = child;
+			num_edges++;
+		}
+		data->states[state].num_edges = num_edges - data->states[state].edges;
+
+		qsort(&data->edges[data->states[state].edges], data->states[state].num_edges,
+		      sizeof(match_set_edge_t), match_set_edge_cmp);
+	}
+
+	memset(data->root, 0, sizeof(data->root));
+	MEM(queue = talloc_array(build, uint32_t, data->num_states));
+
+	/*
+	 *	The children of the root fail back to the root.
+	 */
+	for (i = 0; i < data->states[0].num_edges; i++) {
+		match_set_edge_t const *edge = &data->edges[data->states[0].edges + i];
+
+		data->root[edge->c] = edge->state;
+		queue[tail++] = edge->state;
+	}
+
+	/*
+	 *	Everything else fails to wherever its parent's fail
+	 *	state goes on the same character.  That state is
+	 *	shallower, so it's already been done.
+	 */
+	while (head < tail) {
+		state = queue[head++];
+
+		for (i = 0; i < data->states[state].num_edges; i++) {
+			match_set_edge_t const	*edge = &data->edges[data->states[state].edges + i];
+			match_set_state_t	*child = &data->states[edge->state];
+			uint32_t		fail;
+
+			fail = match_set_next(data, data->states[state].fail, edge->c);
+			child->fail = fail;
+			child->out = (data->states[fail].pattern != MATCH_SET_NONE) ? fail : data->states[fail].out;
+
+			queue[tail++] = edge->state;
+		}
+	}
+
+	talloc_free(queue);
+}
+
+/** Find or add the name a pattern matches as
+ *
+ */
+static uint32_t match_set_name_add(match_set_build_t *build, char const *name)
+{
+	match_set_data_t	*data = build->data;
+	match_set_name_t	find = { .name = name }, *n;
+
+	n = fr_hash_table_finddata(build->names, &find);
+	if (n) return n->id;
+
+	MATCH_SET_GROW(data, data->names, char const *, data->num_names, build->names_allocd);
+	MEM(data->names[data->num_names] = talloc_typed_strdup(data->names, name));
+
+	MEM(n = talloc(build, match_set_name_t));
+	n->name = data->names[data->num_names];
+	n->id = data->num_names++;
+
+	if (!fr_hash_table_insert(build->names, n)) {
+		talloc_free(n);
+		return MATCH_SET_NONE;
+	}
+
+	return n->id;
+}
+
+/** Parse one line of the file
+ *
+ * Lines are of the form "<name> <type> <pattern>", where the pattern
+ * is the rest of the line.
+ */
+static int match_set_parse(match_set_build_t *build, int lineno, char *buffer)
+{
+	rlm_match_set_t const	*inst = build->inst;
+	match_set_data_t	*data = build->data;
+	match_set_pattern_t	*pattern;
+	char			*p = buffer, *q, *name, *type;
+	int			type_num;
+	size_t			len;
+
+	while (isspace((uint8_t) *p)) p++;
+	if (!*p || (*p == '#')) return 0;
+
+	name = p;
+	while (*p && !isspace((uint8_t) *p)) p++;
+	if (!*p) {
+		fr_strerror_printf("%s[%d]: Missing pattern type", inst->filename, lineno);
+		return -1;
+	}
+	*p++ = '\0';
+
+	while (isspace((uint8_t) *p)) p++;
+	type = p;
+	while (*p && !isspace((uint8_t) *p)) p++;
+	if (*p) *p++ = '\0';
+
+	type_num = fr_table_value_by_str(match_set_type_table, type, -1);
+	if (type_num < 0) {
+		fr_strerror_printf("%s[%d]: Unknown pattern type '%s'", inst->filename, lineno, type);
+		return -1;
+	}
+
+	/*
+	 *	The pattern is the rest of the line, which can be
+	 *	quoted to keep leading or trailing whitespace.
+	 */
+	while (isspace((uint8_t) *p)) p++;
+	q = p + strlen(p);
+	while ((q > p) && isspace((uint8_t) q[-1])) q--;
+	if (((q - p) >= 2) && (*p == '"') && (q[-1] == '"')) {
+		p++;
+		q--;
+	}
+	*q = '\0';
+
+	len = q - p;
+	if (!len) {
+		fr_strerror_printf("%s[%d]: Missing pattern", inst->filename, lineno);
+		return -1;
+	}
+
+	MATCH_SET_GROW(data, data->patterns, match_set_pattern_t, data->num_patterns, build->patterns_allocd);
+	pattern = &data->patterns[data->num_patterns];
+	*pattern = (match_set_pattern_t) {
+		.name = match_set_name_add(build, name),
+		.type = type_num,
+		.len = len,
+		.next = MATCH_SET_NONE
+	};
+	if (pattern->name == MATCH_SET_NONE) {
+		fr_strerror_printf("%s[%d]: Failed adding name '%s'", inst->filename, lineno, name);
+		return -1;
+	}
+
+	if (type_num == MATCH_SET_REGEX) {
+#ifdef HAVE_REGEX
+		fr_regex_flags_t	flags = { .ignore_case = inst->case_insensitive };
+		ssize_t			slen;
+
+		slen = regex_compile(data, &pattern->preg, p, len, &flags, false, false);
+		if (slen == 0) slen = regex_compile(data, &pattern->preg, p, len, &flags, false, true);
+		if (slen <= 0) {
+			fr_strerror_printf_push("%s[%d]: Failed compiling regular expression", inst->filename, lineno);
+			return -1;
+		}
+
+		MATCH_SET_GROW(data, data->regex, uint32_t, data->num_regex, build->regex_allocd);
+		data->regex[data->num_regex++] = data->num_patterns++;
+
+		return 0;
+#else
+		fr_strerror_printf("%s[%d]: Server was built without support for regular expressions",
+				   inst->filename, lineno);
+		return -1;
+#endif
+	}
+
+	if (inst->case_insensitive) for (q = p; *q; q++) *q = tolower((uint8_t) *q);
+
+	match_set_insert(build, data->num_patterns++, (uint8_t const *) p, len);
+
+	return 0;
+}
+
+/** Read the patterns from the file, and compile them
+ *
+ * Called when the module is bootstrapped, and from the reload thread.
+ */
+static void *match_set_load(TALLOC_CTX *ctx, void *uctx)
+{
+	rlm_match_set_t const	*inst = uctx;
+	match_set_build_t	*build;
+	match_set_data_t	*data;
+	FILE			*fp;
+	int			lineno = 1;
+	char			buffer[8192];
+
+	MEM(data = talloc_zero(ctx, match_set_data_t));
+	MEM(build = talloc_zero(NULL, match_set_build_t));
+	build->inst = inst;
+	build->data = data;
+	MEM(build->names = fr_hash_table_create(build, match_set_name_hash, match_set_name_cmp, NULL));
+
+	match_set_state_add(build);	/* The root */
+
+	fp = fopen(inst->filename, "r");
+	if (!fp) {
+		fr_strerror_printf("Error opening filename %s: %s", inst->filename, fr_syserror(errno));
+	error:
+		talloc_free(build);
+		return NULL;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		if (!strchr(buffer, '\n') && !feof(fp)) {
+			fr_strerror_printf("%s[%d]: Line too long", inst->filename, lineno);
+			fclose(fp);
+			goto error;
+		}
+
+		if (match_set_parse(build, lineno, buffer) < 0) {
+			fclose(fp);
+			goto error;
+		}
+
+		lineno++;
+	}
+
+	fclose(fp);
+
+	match_set_compile(build);
+	talloc_free(build);
+
+	return data;
+}
+
+/** Find the names of all the patterns which match a string
+ *
+ * The names are returned in the order their first match ends,
+ * followed by names which were only matched by a regex.
+ *
+ * @param[in] ctx	to allocate the names in.
+ * @param[out] out	indexes into the names array of the data.
+ * @param[in] inst	of the module.
+ * @param[in] data	patterns to match against.
+ * @param[in] in	string to match.
+ * @param[in] inlen	length of the string.
+ * @return
+ *	- The number of names which matched.
+ *	- -1 on error.
+ */
+static ssize_t match_set_find(TALLOC_CTX *ctx, uint32_t **out, rlm_match_set_t const *inst,
+			      match_set_data_t const *data, uint8_t const *in, size_t inlen)
+{
+	uint32_t	*found, num_found = 0, state = 0;
+	uint8_t		*seen;
+	size_t		i;
+
+	*out = NULL;
+	if (!data->num_names) return 0;
+
+	MEM(found = talloc_array(ctx, uint32_t, data->num_names));
+	MEM(seen = talloc_zero_array(found, uint8_t, data->num_names));
+
+	for (i = 0; i < inlen; i++) {
+		uint8_t		c = inst->case_insensitive ? tolower(in[i]) : in[i];
+		uint32_t	s;
+
+		state = match_set_next(data, state, c);
+
+		/*
+		 *	Check every pattern which ends here.  They're
+		 *	either on this state, or on its output chain.
+		 */
+		for (s = (data->states[state].pattern != MATCH_SET_NONE) ? state : data->states[state].out;
+		     s != MATCH_SET_NONE;
+		     s = data->states[s].out) {
+			uint32_t p;
+
+			for (p = data->states[s].pattern; p != MATCH_SET_NONE; p = data->patterns[p].next) {
+				match_set_pattern_t const *pattern = &data->patterns[p];
+
+				if (seen[pattern->name]) continue;
+
+				switch (pattern->type) {
+				case MATCH_SET_PREFIX:
+					if ((i + 1) != pattern->len) continue;
+					break;
+
+				case MATCH_SET_SUFFIX:
+					if ((i + 1) != inlen) continue;
+					break;
+
+				case MATCH_SET_EXACT:
+					if (((i + 1) != inlen) || (pattern->len != inlen)) continue;
+					break;
+
+				default:
+					break;
+				}
+
+				seen[pattern->name] = 1;
+				found[num_found++] = pattern->name;
+			}
+		}
+	}
+
+#ifdef HAVE_REGEX
+	/*
+	 *	Regexes can't be folded into the automaton, so they're
+	 *	run one by one, but only for names we haven't already
+	 *	found.
+	 */
+	for (i = 0; i < data->num_regex; i++) {
+		match_set_pattern_t const	*pattern = &data->patterns[data->regex[i]];
+		int				ret;
+
+		if (seen[pattern->name]) continue;
+
+		ret = regex_exec(pattern->preg, (char const *) in, inlen, NULL);
+		if (ret < 0) {
+			talloc_free(found);
+			return -1;
+		}
+		if (ret == 0) continue;
+
+		seen[pattern->name] = 1;
+		found[num_found++] = pattern->name;
+	}
+#endif
+
+	talloc_free(seen);
+
+	if (!num_found) {
+		talloc_free(found);
+		return 0;
+	}
+
+	*out = found;
+
+	return num_found;
+}
+
+/** Return the names of the patterns which match the input
+ *
+ * Example:
+@verbatim
+"%{match_set:%{User-Name}}" == "blocked"
+@endverbatim
+ *
+ * @ingroup xlat_functions
+ */
+static xlat_action_t match_set_xlat(TALLOC_CTX *ctx, fr_cursor_t *out,
+				    REQUEST *request, void const *xlat_inst, UNUSED void *xlat_thread_inst,
+				    fr_value_box_t **in)
+{
+	rlm_match_set_t const	*inst;
+	void			*instance;
+	match_set_data_t	*data;
+	uint32_t		*found;
+	ssize_t			num_found, i;
+
+	memcpy(&instance, xlat_inst, sizeof(instance));	/* Stupid const issues */
+
+	inst = talloc_get_type_abort(instance, rlm_match_set_t);
+
+	/*
+	 *	Nothing matches nothing.
+	 */
+	if (!*in) return XLAT_ACTION_DONE;
+
+	if (fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true) < 0) {
+		RPEDEBUG("Failed concatenating input");
+		return XLAT_ACTION_FAIL;
+	}
+
+	/*
+	 *	The names are only valid until we leave.
+	 */
+	data = fr_reload_enter(inst->reload);
+
+	num_found = match_set_find(ctx, &found, inst, data,
+				   (uint8_t const *) (*in)->vb_strvalue, (*in)->vb_length);
+	if (num_found < 0) {
+		fr_reload_leave(inst->reload);
+		RPEDEBUG("Failed matching \"%pV\"", *in);
+		return XLAT_ACTION_FAIL;
+	}
+
+	RDEBUG2("Matched %zd name(s)", num_found);
+
+	for (i = 0; i < num_found; i++) {
+		char const	*name = data->names[found[i]];
+		fr_value_box_t	*vb;
+
+		MEM(vb = fr_value_box_alloc_null(ctx));
+		if (fr_value_box_bstrndup(vb, vb, NULL, name, talloc_array_length(name) - 1, false) < 0) {
+			talloc_free(vb);
+			talloc_free(found);
+			fr_reload_leave(inst->reload);
+			return XLAT_ACTION_FAIL;
+		}
+		fr_cursor_append(out, vb);
+	}
+
+	talloc_free(found);
+	fr_reload_leave(inst->reload);
+
+	return XLAT_ACTION_DONE;
+}
+
+static int match_set_xlat_instantiate(void *xlat_inst, UNUSED xlat_exp_t const *exp, void *uctx)
+{
+	*((void **)xlat_inst) = talloc_get_type_abort(uctx, rlm_match_set_t);
+
+	return 0;
+}
+
+/*
+ *	Verify one map entry.
+ */
+static int match_set_map_verify(vp_map_t *map)
+{
+	if (!tmpl_is_attr(map->lhs)) {
+		cf_log_err(map->ci, "Left hand side of map must be an attribute, not a %s",
+			   fr_table_str_by_value(tmpl_type_table, map->lhs->type, "<INVALID>"));
+		return -1;
+	}
+
+	if (!tmpl_is_unparsed(map->rhs) ||
+	    (fr_table_value_by_str(match_set_field_table, map->rhs->name,
+				   MATCH_SET_FIELD_INVALID) == MATCH_SET_FIELD_INVALID)) {
+		cf_log_err(map->ci, "Right hand side of map must be 'name' or 'count'");
+		return -1;
+	}
+
+	switch (map->op) {
+	case T_OP_SET:
+	case T_OP_EQ:
+	case T_OP_ADD:
+		break;
+
+	default:
+		cf_log_err(map->ci, "Operator \"%s\" not allowed for match_set mappings",
+			   fr_table_str_by_value(fr_tokens_table, map->op, "<INVALID>"));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ *	Verify the result of the map.
+ */
+static int match_set_maps_verify(CONF_SECTION *cs, UNUSED void *mod_inst, UNUSED void *proc_inst,
+				 vp_tmpl_t const *src, vp_map_t const *maps)
+{
+	vp_map_t const *map;
+
+	if (!src) {
+		cf_log_err(cs, "Missing key expansion");
+
+		return -1;
+	}
+
+	for (map = maps;
+	     map != NULL;
+	     map = map->next) {
+		vp_map_t *unconst_map;
+
+		memcpy(&unconst_map, &map, sizeof(map));
+
+		/*
+		 *	This function doesn't change the map, so it's OK.
+		 */
+		if (match_set_map_verify(unconst_map) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/*
+ *	Convert the names which matched, or how many there were, to VPs.
+ */
+static int match_set_map_getvalue(TALLOC_CTX *ctx, VALUE_PAIR **out, REQUEST *request,
+				  vp_map_t const *map, void *uctx)
+{
+	match_set_result_t const	*result = uctx;
+	VALUE_PAIR			*head = NULL, *vp;
+	fr_cursor_t			cursor;
+	uint32_t			i;
+	char				buffer[16];
+
+	fr_cursor_init(&cursor, &head);
+
+	for (i = 0; i < result->num_found; i++) {
+		char const *value;
+
+		if (result->field == MATCH_SET_FIELD_COUNT) {
+			snprintf(buffer, sizeof(buffer), "%u", result->num_found);
+			value = buffer;
+		} else {
+			value = result->data->names[result->found[i]];
+		}
+
+		MEM(vp = fr_pair_afrom_da(ctx, map->lhs->tmpl_da));
+		if (fr_pair_value_from_str(vp, value, strlen(value), '\0', true) < 0) {
+			RWDEBUG("Failed parsing value \"%pV\" for attribute %s: %s", fr_box_strvalue(value),
+				map->lhs->tmpl_da->name, fr_strerror());
+			talloc_free(vp);
+			fr_pair_list_free(&head);
+
+			return -1;
+		}
+
+		vp->op = map->op;
+		fr_cursor_append(&cursor, vp);
+
+		if (result->field == MATCH_SET_FIELD_COUNT) break;
+	}
+
+	*out = head;
+	return 0;
+}
+
+/** Match the key against the patterns, and map the results to server attributes
+ *
+ * @param[in] mod_inst	#rlm_match_set_t.
+ * @param[in] proc_inst	unused.
+ * @param[in,out]	request The current request.
+ * @param[in] key	string to match.
+ * @param[in] maps	Head of the map list.
+ * @return
+ *	- #RLM_MODULE_NOOP no patterns matched.
+ *	- #RLM_MODULE_UPDATED if one or more #VALUE_PAIR were added to the #REQUEST.
+ *	- #RLM_MODULE_FAIL if an error occurred.
+ */
+static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, REQUEST *request,
+				fr_value_box_t **key, vp_map_t const *maps)
+{
+	rlm_match_set_t		*inst = talloc_get_type_abort(mod_inst, rlm_match_set_t);
+	rlm_rcode_t		rcode = RLM_MODULE_UPDATED;
+	match_set_data_t	*data;
+	match_set_result_t	result;
+	uint32_t		*found;
+	ssize_t			num_found;
+	vp_map_t const		*map;
+
+	if (!*key) {
+		REDEBUG("match_set key cannot be (null)");
+		return RLM_MODULE_FAIL;
+	}
+
+	if (fr_value_box_list_concat(request, *key, key, FR_TYPE_STRING, true) < 0) {
+		REDEBUG("Failed parsing key");
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	The names are only valid until we leave.
+	 */
+	data = fr_reload_enter(inst->reload);
+
+	num_found = match_set_find(request, &found, inst, data,
+				   (uint8_t const *) (*key)->vb_strvalue, (*key)->vb_length);
+	if (num_found < 0) {
+		RPEDEBUG("Failed matching \"%pV\"", *key);
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+	if (num_found == 0) {
+		rcode = RLM_MODULE_NOOP;
+		goto finish;
+	}
+
+	result = (match_set_result_t) {
+		.data = data,
+		.found = found,
+		.num_found = num_found
+	};
+
+	RINDENT();
+	for (map = maps;
+	     map != NULL;
+	     map = map->next) {
+		result.field = fr_table_value_by_str(match_set_field_table, map->rhs->name, MATCH_SET_FIELD_INVALID);
+
+		if (map_to_request(request, map, match_set_map_getvalue, &result) < 0) {
+			REXDENT();
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+	}
+	REXDENT();
+
+finish:
+	talloc_free(found);
+	fr_reload_leave(inst->reload);
+
+	return rcode;
+}
+
+static int mod_bootstrap(void *instance, CONF_SECTION *conf)
+{
+	rlm_match_set_t	*inst = instance;
+	xlat_t const	*xlat;
+
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
+	/*
+	 *	Read the patterns, and reload them if the file changes.
+	 */
+	inst->reload = fr_reload_alloc(inst, inst->name, &inst->reload_conf, match_set_load, inst);
+	if (!inst->reload) {
+		cf_log_perr(conf, "Failed reading %s", inst->filename);
+		return -1;
+	}
+
+	if ((fr_reload_file_add(inst->reload, inst->filename) < 0) ||
+	    (fr_reload_start(inst->reload) < 0)) {
+		cf_log_perr(conf, "Failed watching %s for changes", inst->filename);
+		return -1;
+	}
+
+	xlat = xlat_async_register(inst, inst->name, match_set_xlat);
+	xlat_async_instantiate_set(xlat, match_set_xlat_instantiate, rlm_match_set_t *, NULL, inst);
+
+	map_proc_register(inst, inst->name, mod_map_proc, match_set_maps_verify, 0);
+
+	return 0;
+}
+
+extern module_t rlm_match_set;
+module_t rlm_match_set = {
+	.magic		= RLM_MODULE_INIT,
+	.name		= "match_set",
+	.inst_size	= sizeof(rlm_match_set_t),
+	.config		= module_config,
+	.bootstrap	= mod_bootstrap
+};
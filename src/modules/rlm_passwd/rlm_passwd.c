@@ -152,11 +152,13 @@ static void release_hash_table(struct hashtable * ht){
 	ht->tablesize = 0;
 }
 
+#ifdef TEST
 static void release_ht(struct hashtable * ht){
 	if (!ht) return;
 	release_hash_table(ht);
 	talloc_free(ht);
 }
+#endif
 
 static struct hashtable * build_hash_table (char const * file, int num_fields,
 					    int key_field, int islist, int tablesize, int ignorenis, char delimiter)
@@ -357,7 +359,8 @@ int main(void){
 
 #else  /* TEST */
 typedef struct {
-	struct hashtable	*ht;
+	fr_reload_t		*reload;	//!< Holds the current hash table.
+	fr_reload_conf_t	reload_conf;
 	struct mypasswd		*pwd_fmt;
 	char const		*filename;
 	char const		*format;
@@ -384,9 +387,38 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("allow_multiple_keys", FR_TYPE_BOOL, rlm_passwd_t, allow_multiple), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("hash_size", FR_TYPE_UINT32, rlm_passwd_t, hash_size), .dflt = "100" },
+
+	{ FR_CONF_OFFSET("reload", FR_TYPE_SUBSECTION, rlm_passwd_t, reload_conf), .subcs = (void const *) fr_reload_config },
 	CONF_PARSER_TERMINATOR
 };
 
+static int _passwd_ht_free(struct hashtable *ht)
+{
+	release_hash_table(ht);
+	return 0;
+}
+
+/** Build a new hash table from the passwd file
+ *
+ * Called during instantiation, and from the reload thread.
+ */
+static void *passwd_load(TALLOC_CTX *ctx, void *uctx)
+{
+	rlm_passwd_t const	*inst = uctx;
+	struct hashtable	*ht;
+
+	ht = build_hash_table(inst->filename, inst->num_fields, inst->key_field, inst->listable,
+			      inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+	if (!ht) {
+		fr_strerror_printf("Can't build hashtable from passwd file %s", inst->filename);
+		return NULL;
+	}
+	talloc_set_destructor(ht, _passwd_ht_free);
+	talloc_steal(ctx, ht);
+
+	return ht;
+}
+
 static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
 	int			num_fields = 0, key_field = -1, listable = 0;
@@ -442,24 +474,13 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
-	inst->ht = build_hash_table(inst->filename, num_fields, key_field, listable,
-				    inst->hash_size, inst->ignore_nislike, *inst->delimiter);
-	if (!inst->ht){
-		ERROR("Can't build hashtable from passwd file");
-		return -1;
-	}
-
 	inst->pwd_fmt = mypasswd_alloc(inst->format, num_fields, &len);
 	if (!inst->pwd_fmt){
 		ERROR("Memory allocation failed");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 	if (!string_to_entry(inst->format, num_fields, ':', inst->pwd_fmt , len)) {
 		ERROR("Unable to convert format entry");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 
@@ -474,16 +495,12 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	}
 	if (!*inst->pwd_fmt->field[key_field]) {
 		cf_log_err(conf, "key field is empty");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 
 	if (fr_dict_attr_by_qualified_name(&da, dict_freeradius,
 					   inst->pwd_fmt->field[key_field], true) != FR_DICT_ATTR_OK) {
 		PERROR("Unable to resolve attribute");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 
@@ -495,6 +512,19 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	DEBUG3("num_fields: %d key_field %d(%s) listable: %s", num_fields, key_field,
 	       inst->pwd_fmt->field[key_field], listable ? "yes" : "no");
 
+	inst->reload = fr_reload_alloc(inst, cf_section_name2(conf) ? cf_section_name2(conf) : cf_section_name1(conf),
+				       &inst->reload_conf, passwd_load, inst);
+	if (!inst->reload) {
+		PERROR("Failed loading %s", inst->filename);
+		return -1;
+	}
+
+	if ((fr_reload_file_add(inst->reload, inst->filename) < 0) ||
+	    (fr_reload_start(inst->reload) < 0)) {
+		PERROR("Failed watching %s for changes", inst->filename);
+		return -1;
+	}
+
 	return 0;
 
 #undef inst
@@ -502,10 +532,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 
 static int mod_detach (void *instance) {
 #define inst ((rlm_passwd_t *)instance)
-	if(inst->ht) {
-		release_ht(inst->ht);
-		inst->ht = NULL;
-	}
+	TALLOC_FREE(inst->reload);
 	talloc_free(inst->pwd_fmt);
 	return 0;
 #undef inst
@@ -541,10 +568,13 @@ static rlm_rcode_t CC_HINT(nonnull) mod_passwd_map(void *instance, UNUSED void *
 	struct mypasswd		*pw, *last_found;
 	fr_cursor_t		cursor;
 	int			found = 0;
+	struct hashtable	*ht;
 
 	key = fr_pair_find_by_da(request->packet->vps, inst->keyattr, TAG_ANY);
 	if (!key) return RLM_MODULE_NOTFOUND;
 
+	ht = fr_reload_enter(inst->reload);
+
 	for (i = fr_cursor_iter_by_da_init(&cursor, &key, inst->keyattr);
 	     i;
 	     i = fr_cursor_next(&cursor)) {
@@ -552,20 +582,22 @@ static rlm_rcode_t CC_HINT(nonnull) mod_passwd_map(void *instance, UNUSED void *
 		 *	Ensure we have the string form of the attribute
 		 */
 		fr_pair_value_snprint(buffer, sizeof(buffer), i, 0);
-		pw = get_pw_nam(buffer, inst->ht, &last_found);
+		pw = get_pw_nam(buffer, ht, &last_found);
 		if (!pw) continue;
 
 		do {
 			result_add(request, inst, request, &request->control, pw, 0, "config");
 			result_add(request->reply, inst, request, &request->reply->vps, pw, 1, "reply_items");
 			result_add(request->packet, inst, request, &request->packet->vps, pw, 2, "request_items");
-		} while ((pw = get_next(buffer, inst->ht, &last_found)));
+		} while ((pw = get_next(buffer, ht, &last_found)));
 
 		found++;
 
 		if (!inst->allow_multiple) break;
 	}
 
+	fr_reload_leave(inst->reload);
+
 	if (!found) return RLM_MODULE_NOTFOUND;
 
 	return RLM_MODULE_OK;
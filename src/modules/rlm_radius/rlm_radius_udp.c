@@ -58,6 +58,7 @@ typedef struct {
 
 	uint32_t		max_packet_size;	//!< Maximum packet size.
 	uint16_t		max_send_coalesce;	//!< Maximum number of packets to coalesce into one mmsg call.
+	uint16_t		max_recv_coalesce;	//!< Maximum number of replies to read with one mmsg call.
 
 	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
 	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
@@ -97,6 +98,7 @@ typedef struct {
 
 	struct mmsghdr		*mmsgvec;		//!< Vector of inbound/outbound packets.
 	udp_coalesced_t		*coalesced;		//!< Outbound coalesced requests.
+	fr_udp_batch_t		*batch;			//!< Inbound coalesced replies.
 
 	size_t			send_buff_actual;	//!< What we believe the maximum SO_SNDBUF size to be.
 							///< We don't try and encode more packet data than this
@@ -178,6 +180,7 @@ static const CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, rlm_radius_udp_t, max_packet_size), .dflt = "4096" },
 	{ FR_CONF_OFFSET("max_send_coalesce", FR_TYPE_UINT16, rlm_radius_udp_t, max_send_coalesce), .dflt = "1024" },
+	{ FR_CONF_OFFSET("max_recv_coalesce", FR_TYPE_UINT16, rlm_radius_udp_t, max_recv_coalesce), .dflt = "64" },
 
 	{ FR_CONF_OFFSET("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET("src_ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_udp_t, src_ipaddr) },
@@ -748,6 +751,10 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 	MEM(h->buffer = talloc_array(h, uint8_t, h->max_packet_size));
 	h->buflen = h->max_packet_size;
 
+	if (h->inst->max_recv_coalesce > 1) {
+		MEM(h->batch = udp_batch_alloc(h, h->inst->max_recv_coalesce, h->max_packet_size));
+	}
+
 	if (!h->inst->replicate) MEM(h->tt = radius_track_alloc(h));
 
 	/*
@@ -2326,17 +2333,33 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 		 *	Drain the socket of all packets.  If we're busy, this
 		 *	saves a round through the event loop.  If we're not
 		 *	busy, a few extra system calls don't matter.
+		 *
+		 *	When batching, recvmmsg() pulls up to
+		 *	max_recv_coalesce replies out of the socket at
+		 *	once, and we work through them here.
 		 */
-		slen = read(h->fd, h->buffer, h->buflen);
-		if (slen == 0) return;
+		if (h->batch) {
+			slen = udp_batch_recv(h->batch, h->fd, h->buffer, h->buflen, UDP_FLAGS_CONNECTED,
+					      NULL, NULL, NULL, NULL, NULL, NULL);
+			if (slen == 0) return;
+
+			if (slen < 0) {
+				PERROR("%s - Failed reading response from socket", h->module_name);
+				fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+				return;
+			}
+		} else {
+			slen = read(h->fd, h->buffer, h->buflen);
+			if (slen == 0) return;
 
-		if (slen < 0) {
-			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+			if (slen < 0) {
+				if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
 
-			ERROR("%s - Failed reading response from socket: %s",
-			      h->module_name, fr_syserror(errno));
-			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
-			return;
+				ERROR("%s - Failed reading response from socket: %s",
+				      h->module_name, fr_syserror(errno));
+				fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+				return;
+			}
 		}
 
 		if (slen < RADIUS_HEADER_LENGTH) {
@@ -2791,6 +2814,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	 *	Always need at least one mmsgvec
 	 */
 	if (inst->max_send_coalesce == 0) inst->max_send_coalesce = 1;
+	if (inst->max_recv_coalesce == 0) inst->max_recv_coalesce = 1;
 
 	/*
 	 *	Ensure that we have a destination address.
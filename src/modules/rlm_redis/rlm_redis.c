@@ -35,11 +35,8 @@ RCSID("$Id$")
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
-
-static CONF_PARSER module_config[] = {
-	REDIS_COMMON_CONFIG,
-	CONF_PARSER_TERMINATOR
-};
+#include <freeradius-devel/redis/pipeline.h>
+#include <freeradius-devel/unlang/base.h>
 
 /** rlm_redis module instance
  *
@@ -50,96 +47,53 @@ typedef struct {
 
 	char const		*name;		//!< Instance name.
 
-	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
+	fr_redis_cluster_t	*cluster;	//!< Redis cluster.  Used for node lookups and remapping.
+
+	fr_trunk_conf_t		trunk_conf;	//!< Configuration for the per-thread pipelined
+						///< connections used by %{redis:...}.
 } rlm_redis_t;
 
-/** Change the state of a connection to READONLY execute a command and switch to READWRITE
+/** rlm_redis thread instance
  *
- * @param[out] status_out Where to write the status from the command.
- * @param[out] reply_out Where to write the reply associated with the highest priority status.
- * @param[in] request The current request.
- * @param[in] conn to issue commands with.
- * @param[in] argc Redis command argument count.
- * @param[in] argv Redis command arguments.
- * @return
- *	- 0 success.
- *	- -1 normal failure.
- *	- -2 failure that may leave the connection in a READONLY state.
  */
-static int redis_command_read_only(fr_redis_rcode_t *status_out, redisReply **reply_out,
-				   REQUEST *request, fr_redis_conn_t *conn, int argc, char const **argv)
-{
-	bool			maybe_more = false;
-	redisReply		*reply;
-	fr_redis_rcode_t	status;
-
-	*reply_out = NULL;
-
-	redisAppendCommand(conn->handle, "READONLY");
-	redisAppendCommandArgv(conn->handle, argc, argv, NULL);
-	redisAppendCommand(conn->handle, "READWRITE");
-
-	/*
-	 *	Process the response for READONLY
-	 */
-	reply = NULL;	/* Doesn't set reply to NULL on error *sigh* */
-	if (redisGetReply(conn->handle, (void **)&reply) == REDIS_OK) maybe_more = true;
-	status = fr_redis_command_status(conn, reply);
-	if (status != REDIS_RCODE_SUCCESS) {
-		REDEBUG("Setting READONLY failed");
-
-		*reply_out = reply;
-		*status_out = status;
-
-		if (maybe_more) {
-			if (redisGetReply(conn->handle, (void **)&reply) != REDIS_OK) return -1;
-			fr_redis_reply_free(&reply);
-			if (redisGetReply(conn->handle, (void **)&reply) != REDIS_OK) return -1;
-			fr_redis_reply_free(&reply);
-		}
-		return -1;
-	}
-
-	fr_redis_reply_free(&reply);
-
-	/*
-	 *	Process the response for the command
-	 */
-	if (redisGetReply(conn->handle, (void **)&reply) == REDIS_OK) maybe_more = true;
-	status = fr_redis_command_status(conn, reply);
-	if (status != REDIS_RCODE_SUCCESS) {
-		*reply_out = reply;
-		*status_out = status;
+typedef struct {
+	fr_redis_cluster_thread_t	*cluster_thread;	//!< Trunks for each of the cluster nodes.
+} rlm_redis_thread_t;
 
-		if (maybe_more) {
-			if (redisGetReply(conn->handle, (void **)&reply) != REDIS_OK) return -1;
-			fr_redis_reply_free(&reply);
-		}
-		return -1;
-	}
+/** Gives the redis xlat access to the module's thread instance
+ *
+ */
+typedef struct {
+	rlm_redis_t const	*inst;
+	rlm_redis_thread_t	*t;
+} redis_xlat_thread_inst_t;
 
-	*reply_out = reply;
-	reply = NULL;
-	*status_out = status;
+/** State for a single %{redis:...} expansion
+ *
+ */
+typedef struct {
+	REQUEST				*request;
+	redis_xlat_thread_inst_t	*xt;
 
-	/*
-	 *	Process the response for READWRITE
-	 */
-	if ((redisGetReply(conn->handle, (void **)&reply) != REDIS_OK) ||
-	    (fr_redis_command_status(conn, reply) != REDIS_RCODE_SUCCESS)) {
-		REDEBUG("Setting READWRITE failed");
+	bool				read_only;	//!< Run the command on a slave.
+	bool				pinned;		//!< Node was specified explicitly, don't follow redirects.
+	int				argc;
+	char const			*argv[MAX_REDIS_ARGS];
+	char				argv_buf[MAX_REDIS_COMMAND_LEN];
 
-		fr_redis_reply_free(&reply);	/* There could be a response we need to free */
-		fr_redis_reply_free(reply_out);
-		*reply_out = reply;
-		*status_out = status;
+	fr_redis_command_set_t		*cmds;		//!< Commands in flight.  NULL once complete.
 
-		return -2;
-	}
-	fr_redis_reply_free(&reply);	/* Free READWRITE response */
+	fr_redis_rcode_t		status;		//!< Status of the command.
+	fr_value_box_t			*vb;		//!< Result of the command.
+	fr_redis_trunk_t		*redirect;	//!< Trunk for the node we were redirected to.
+	uint32_t			redirects;	//!< How many redirects we've followed.
+} redis_xlat_rctx_t;
 
-	return 0;
-}
+static CONF_PARSER module_config[] = {
+	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET("trunk", FR_TYPE_SUBSECTION, rlm_redis_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
+	CONF_PARSER_TERMINATOR
+};
 
 static int redis_xlat_instantiate(void *xlat_inst, UNUSED xlat_exp_t const *exp, void *uctx)
 {
@@ -165,8 +119,6 @@ static xlat_action_t redis_remap_xlat(TALLOC_CTX *ctx, fr_cursor_t *out,
 									    rlm_redis_t);
 
 	fr_socket_addr_t		node_addr;
-	fr_pool_t			*pool;
-	fr_redis_conn_t			*conn;
 	fr_redis_cluster_rcode_t	rcode;
 	fr_value_box_t			*vb;
 
@@ -186,20 +138,12 @@ static xlat_action_t redis_remap_xlat(TALLOC_CTX *ctx, fr_cursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
-	if (fr_redis_cluster_pool_by_node_addr(&pool, inst->cluster, &node_addr, true) < 0) {
-		RPEDEBUG("Failed locating cluster node");
+	rcode = fr_redis_cluster_remap_by_node_addr(request, inst->cluster, &node_addr);
+	if ((rcode == FR_REDIS_CLUSTER_RCODE_FAILED) || (rcode == FR_REDIS_CLUSTER_RCODE_NO_CONNECTION)) {
+		RPEDEBUG("Failed remapping cluster");
 		return XLAT_ACTION_FAIL;
 	}
 
-	conn = fr_pool_connection_get(pool, request);
-	if (!conn) {
-		REDEBUG("No connections available for cluster node");
-		return XLAT_ACTION_FAIL;
-	}
-
-	rcode = fr_redis_cluster_remap(request, inst->cluster, conn);
-	fr_pool_connection_release(pool, request, conn);
-
 	MEM(vb = fr_value_box_alloc_null(ctx));
 	fr_value_box_strdup(vb, vb, NULL, fr_table_str_by_value(fr_redis_cluster_rcodes_table, rcode, "<INVALID>"), false);
 	fr_cursor_append(out, vb);
@@ -280,42 +224,225 @@ static xlat_action_t redis_node_xlat(TALLOC_CTX *ctx, fr_cursor_t *out,
 }
 
 
+/** Write the result of a %{redis:...} command set to the rctx
+ *
+ * The replies are freed along with the command set, so anything
+ * we need has to be copied out here.
+ */
+static void redis_xlat_complete(REQUEST *request, fr_dlist_head_t *completed, void *rctx)
+{
+	redis_xlat_rctx_t	*xrctx = talloc_get_type_abort(rctx, redis_xlat_rctx_t);
+	fr_redis_command_t	*cmd;
+	redisReply		*reply = NULL;
+
+	xrctx->cmds = NULL;
+
+	/*
+	 *	The result we care about is the last command's,
+	 *	unless it's the READWRITE we appended.
+	 */
+	for (cmd = fr_dlist_head(completed); cmd; cmd = fr_dlist_next(completed, cmd)) {
+		redisReply *r = fr_redis_command_get_result(cmd);
+
+		xrctx->status = fr_redis_command_status(NULL, r);
+		reply = r;
+		if (xrctx->status != REDIS_RCODE_SUCCESS) break;
+		if (xrctx->read_only && !fr_dlist_next(completed, fr_dlist_next(completed, cmd))) break;
+	}
+
+	if (!fr_cond_assert(reply)) {
+		xrctx->status = REDIS_RCODE_ERROR;
+		goto finish;
+	}
+
+	switch (xrctx->status) {
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		xrctx->redirect = fr_redis_cluster_thread_trunk_by_redirect(xrctx->xt->t->cluster_thread,
+									    request, reply);
+		break;
+
+	case REDIS_RCODE_SUCCESS:
+		MEM(xrctx->vb = fr_value_box_alloc_null(xrctx));
+
+		switch (reply->type) {
+		case REDIS_REPLY_INTEGER:
+			fr_value_box_asprintf(xrctx->vb, xrctx->vb, NULL, false, "%lld", reply->integer);
+			break;
+
+		case REDIS_REPLY_STATUS:
+		case REDIS_REPLY_STRING:
+			fr_value_box_bstrndup(xrctx->vb, xrctx->vb, NULL, reply->str, reply->len, false);
+			break;
+
+		default:
+			REDEBUG("Server returned non-value type \"%s\"",
+				fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+			xrctx->status = REDIS_RCODE_ERROR;
+			break;
+		}
+		break;
+
+	default:
+		REDEBUG("%s", reply->type == REDIS_REPLY_ERROR ? reply->str : "Command failed");
+		break;
+	}
+
+finish:
+	unlang_interpret_resumable(request);
+}
+
+static void redis_xlat_fail(REQUEST *request, UNUSED fr_dlist_head_t *completed, void *rctx)
+{
+	redis_xlat_rctx_t	*xrctx = talloc_get_type_abort(rctx, redis_xlat_rctx_t);
+
+	xrctx->cmds = NULL;
+	xrctx->status = REDIS_RCODE_RECONNECT;
+
+	unlang_interpret_resumable(request);
+}
+
+/** Enqueue the command on a trunk
+ *
+ * @param[in] xrctx	holding the command to send.
+ * @param[in] rtrunk	to send the command on.
+ * @param[in] asking	Prefix the command with ASKING, to follow an -ASK redirect.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int redis_xlat_enqueue(redis_xlat_rctx_t *xrctx, fr_redis_trunk_t *rtrunk, bool asking)
+{
+	REQUEST			*request = xrctx->request;
+	fr_redis_command_set_t	*cmds;
+
+	cmds = fr_redis_command_set_alloc(NULL, request, redis_xlat_complete, redis_xlat_fail, xrctx);
+
+	if ((asking && (fr_redis_command_preformatted_add(cmds, "ASKING", sizeof("ASKING") - 1) != FR_REDIS_PIPELINE_OK)) ||
+	    (xrctx->read_only && (fr_redis_command_preformatted_add(cmds, "READONLY", sizeof("READONLY") - 1) != FR_REDIS_PIPELINE_OK)) ||
+	    (fr_redis_command_argv_add(cmds, xrctx->argc, xrctx->argv, NULL) != FR_REDIS_PIPELINE_OK) ||
+	    (xrctx->read_only && (fr_redis_command_preformatted_add(cmds, "READWRITE", sizeof("READWRITE") - 1) != FR_REDIS_PIPELINE_OK))) {
+		REDEBUG("Invalid command");
+	error:
+		talloc_free(cmds);
+		return -1;
+	}
+
+	if (redis_command_set_enqueue(rtrunk, cmds) != FR_REDIS_PIPELINE_OK) {
+		REDEBUG("Failed enqueueing command");
+		goto error;
+	}
+	xrctx->cmds = cmds;
+
+	return 0;
+}
+
+static void redis_xlat_signal(UNUSED REQUEST *request, UNUSED void *xlat_inst, UNUSED void *xlat_thread_inst,
+			      void *rctx, fr_state_signal_t action)
+{
+	redis_xlat_rctx_t	*xrctx = talloc_get_type_abort(rctx, redis_xlat_rctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	if (xrctx->cmds) {
+		fr_redis_command_set_cancel(xrctx->cmds);
+		xrctx->cmds = NULL;
+	}
+	talloc_free(xrctx);
+}
+
+static xlat_action_t redis_xlat_resume(TALLOC_CTX *ctx, fr_cursor_t *out,
+				       REQUEST *request, UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+				       UNUSED fr_value_box_t **in, void *rctx)
+{
+	redis_xlat_rctx_t	*xrctx = talloc_get_type_abort(rctx, redis_xlat_rctx_t);
+	rlm_redis_t const	*inst = xrctx->xt->inst;
+	fr_redis_rcode_t	status = xrctx->status;
+	fr_redis_trunk_t	*redirect = xrctx->redirect;
+
+	switch (status) {
+	case REDIS_RCODE_SUCCESS:
+		break;
+
+	/*
+	 *	Follow the redirect
+	 */
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		if (!redirect) break;
+
+		if (xrctx->pinned) {
+			REDEBUG("Node returned a redirect, but redirects are not followed when a node is specified");
+			break;
+		}
+
+		if (++xrctx->redirects > inst->conf.max_redirects) {
+			REDEBUG("Too many redirects (%u)", xrctx->redirects - 1);
+			break;
+		}
+
+		xrctx->redirect = NULL;
+		if (redis_xlat_enqueue(xrctx, redirect, (status == REDIS_RCODE_ASK)) < 0) break;
+
+		return unlang_xlat_yield(request, redis_xlat_resume, redis_xlat_signal, xrctx);
+
+	default:
+		break;
+	}
+
+	if (status != REDIS_RCODE_SUCCESS) {
+		talloc_free(xrctx);
+		return XLAT_ACTION_FAIL;
+	}
+
+	if (xrctx->vb) {
+		fr_cursor_append(out, talloc_steal(ctx, xrctx->vb));
+		xrctx->vb = NULL;
+	}
+	talloc_free(xrctx);
+
+	return XLAT_ACTION_DONE;
+}
+
 /** Xlat to make calls to redis
  *
+ * The command is pipelined with those of other requests on this thread's
+ * connection to the cluster node serving the key.  The request yields
+ * until the result is available.
+ *
 @verbatim
-%{redis:<redis command>}
+%{redis:[-][@<host>[:port]] <redis command>}
 @endverbatim
  *
  * @ingroup xlat_functions
  */
-static ssize_t redis_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
-			  void const *mod_inst, UNUSED void const *xlat_inst,
-			  REQUEST *request, char const *fmt)
+static xlat_action_t redis_xlat(TALLOC_CTX *ctx, UNUSED fr_cursor_t *out,
+				REQUEST *request, UNUSED void const *xlat_inst, void *xlat_thread_inst,
+				fr_value_box_t **in)
 {
-	rlm_redis_t const	*inst = mod_inst;
-	fr_redis_conn_t		*conn;
-
-	bool			read_only = false;
-	uint8_t	const		*key = NULL;
-	size_t			key_len = 0;
+	redis_xlat_thread_inst_t	*xt = talloc_get_type_abort(xlat_thread_inst, redis_xlat_thread_inst_t);
+	redis_xlat_rctx_t		*xrctx;
+	fr_redis_trunk_t		*rtrunk;
+	char const			*p, *q;
 
-	fr_redis_cluster_state_t	state;
-	fr_redis_rcode_t		status;
-	redisReply		*reply = NULL;
-	int			s_ret;
-
-	size_t			len;
-	int			ret;
+	if (!*in) {
+		REDEBUG("Missing command");
+		return XLAT_ACTION_FAIL;
+	}
 
-	char const		*p = fmt, *q;
+	if (fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true) < 0) {
+		RPEDEBUG("Failed concatenating input");
+		return XLAT_ACTION_FAIL;
+	}
 
-	int			argc;
-	char const		*argv[MAX_REDIS_ARGS];
-	char			argv_buf[MAX_REDIS_COMMAND_LEN];
+	MEM(xrctx = talloc_zero(request, redis_xlat_rctx_t));
+	xrctx->request = request;
+	xrctx->xt = xt;
 
+	p = (*in)->vb_strvalue;
 	if (p[0] == '-') {
 		p++;
-		read_only = true;
+		xrctx->read_only = true;
 	}
 
 	/*
@@ -323,7 +450,6 @@ static ssize_t redis_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 	 */
 	if (p[0] == '@') {
 		fr_socket_addr_t	node_addr;
-		fr_pool_t		*pool;
 
 		RDEBUG3("Overriding node selection");
 
@@ -331,99 +457,39 @@ static ssize_t redis_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 		q = strchr(p, ' ');
 		if (!q) {
 			REDEBUG("Found node specifier but no command, format is [-][@<host>[:port]] <redis command>");
-			return -1;
+		error:
+			talloc_free(xrctx);
+			return XLAT_ACTION_FAIL;
 		}
 
 		if (fr_inet_pton_port(&node_addr.ipaddr, &node_addr.port, p, q - p, AF_UNSPEC, true, true) < 0) {
 			RPEDEBUG("Failed parsing node address");
-			return -1;
+			goto error;
 		}
 
 		p = q + 1;
 
-		if (fr_redis_cluster_pool_by_node_addr(&pool, inst->cluster, &node_addr, true) < 0) {
+		rtrunk = fr_redis_cluster_thread_trunk_by_addr(xt->t->cluster_thread, &node_addr);
+		if (!rtrunk) {
 			RPEDEBUG("Failed locating cluster node");
-			return -1;
-		}
-
-		conn = fr_pool_connection_get(pool, request);
-		if (!conn) {
-			REDEBUG("No connections available for cluster node");
-			return -1;
-		}
-
-		argc = rad_expand_xlat(request, p, MAX_REDIS_ARGS, argv, false, sizeof(argv_buf), argv_buf);
-		if (argc <= 0) {
-			RPEDEBUG("Invalid command: %s", p);
-		arg_error:
-			fr_pool_connection_release(pool, request, conn);
-			return -1;
-		}
-		if (argc >= (MAX_REDIS_ARGS - 1)) {
-			RPEDEBUG("Too many parameters; increase MAX_REDIS_ARGS and recompile: %s", p);
-			goto arg_error;
-		}
-
-		RDEBUG2("Executing command: %s", argv[0]);
-		if (argc > 1) {
-			RDEBUG2("With argments");
-			RINDENT();
-			for (int i = 1; i < argc; i++) RDEBUG2("[%i] %s", i, argv[i]);
-			REXDENT();
-		}
-
-		if (!read_only) {
-			reply = redisCommandArgv(conn->handle, argc, argv, NULL);
-			status = fr_redis_command_status(conn, reply);
-		} else if (redis_command_read_only(&status, &reply, request, conn, argc, argv) == -2) {
-			goto close_conn;
+			goto error;
 		}
 
-		if (!reply) goto fail;
-
-		switch (status) {
-		case REDIS_RCODE_MOVE:
-		{
-			fr_value_box_t vb;
-
-			if (fr_redis_reply_to_value_box(NULL, &vb, reply, FR_TYPE_STRING, NULL) == 0) {
-				REDEBUG("Key served by a different node: %pV", &vb);
-				fr_value_box_clear(&vb);
-			}
-			goto fail;
-		}
-
-		case REDIS_RCODE_SUCCESS:
-			goto reply_parse;
-
-		case REDIS_RCODE_RECONNECT:
-		close_conn:
-			fr_pool_connection_close(pool, request, conn);
-			ret = -1;
-			goto finish;
-
-		default:
-		fail:
-			fr_pool_connection_release(pool, request, conn);
-			ret = -1;
-			goto finish;
-		}
+		xrctx->pinned = true;
+	} else {
+		rtrunk = NULL;
 	}
 
-	/*
-	 *	Normal node selection and execution based on key
-	 */
-	argc = rad_expand_xlat(request, p, MAX_REDIS_ARGS, argv, false, sizeof(argv_buf), argv_buf);
-	if (argc <= 0) {
+	xrctx->argc = rad_expand_xlat(request, p, MAX_REDIS_ARGS, xrctx->argv, false,
+				      sizeof(xrctx->argv_buf), xrctx->argv_buf);
+	if (xrctx->argc <= 0) {
 		RPEDEBUG("Invalid command: %s", p);
-		ret = -1;
-		goto finish;
+		goto error;
 	}
 
-	if (argc >= (MAX_REDIS_ARGS - 1)) {
+	if (xrctx->argc >= (MAX_REDIS_ARGS - 1)) {
 		RPEDEBUG("Too many parameters; increase MAX_REDIS_ARGS and recompile: %s", p);
-		ret = -1;
-		goto finish;
+		goto error;
 	}
 
 	/*
@@ -433,61 +499,46 @@ static ssize_t redis_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 	 *	just as expensive as sending them to the wrong server and receiving
 	 *	a redirect.
 	 */
-	if (argc > 1) {
-		key = (uint8_t const *)argv[1];
-	 	key_len = strlen((char const *)key);
-	}
-	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request, key, key_len, read_only);
-	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
-	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
-		RDEBUG2("Executing command: %s", argv[0]);
-		if (argc > 1) {
-			RDEBUG2("With arguments");
-			RINDENT();
-			for (int i = 1; i < argc; i++) RDEBUG2("[%i] %s", i, argv[i]);
-			REXDENT();
-		}
-		if (!read_only) {
-			reply = redisCommandArgv(conn->handle, argc, argv, NULL);
-			status = fr_redis_command_status(conn, reply);
-		} else if (redis_command_read_only(&status, &reply, request, conn, argc, argv) == -2) {
-			state.close_conn = true;
+	if (!rtrunk) {
+		uint8_t const	*key = NULL;
+		size_t		key_len = 0;
+
+		if (xrctx->argc > 1) {
+			key = (uint8_t const *)xrctx->argv[1];
+			key_len = strlen((char const *)key);
 		}
-	}
-	if (s_ret != REDIS_RCODE_SUCCESS) {
-		ret = -1;
-		goto finish;
+
+		rtrunk = fr_redis_cluster_thread_trunk_by_key(xt->t->cluster_thread, request,
+							      key, key_len, xrctx->read_only);
+		if (!rtrunk) goto error;
 	}
 
-	if (!fr_cond_assert(reply)) {
-		ret = -1;
-		goto finish;
+	RDEBUG2("Executing command: %s", xrctx->argv[0]);
+	if (xrctx->argc > 1) {
+		RDEBUG2("With arguments");
+		RINDENT();
+		for (int i = 1; i < xrctx->argc; i++) RDEBUG2("[%i] %s", i, xrctx->argv[i]);
+		REXDENT();
 	}
 
-reply_parse:
-	switch (reply->type) {
-	case REDIS_REPLY_INTEGER:
-		ret = snprintf(*out, outlen, "%lld", reply->integer);
-		break;
+	if (redis_xlat_enqueue(xrctx, rtrunk, false) < 0) goto error;
 
-	case REDIS_REPLY_STATUS:
-	case REDIS_REPLY_STRING:
-		len = (((size_t)reply->len) >= outlen) ? outlen - 1: (size_t) reply->len;
-		memcpy(*out, reply->str, len);
-		(*out)[len] = '\0';
-		ret = reply->len;
-		break;
+	return unlang_xlat_yield(request, redis_xlat_resume, redis_xlat_signal, xrctx);
+}
 
-	default:
-		REDEBUG("Server returned non-value type \"%s\"",
-			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = -1;
-		break;
-	}
+/** Resolves and caches the module's thread instance for use by a specific xlat instance
+ *
+ */
+static int redis_xlat_thread_instantiate(UNUSED void *xlat_inst, void *xlat_thread_inst,
+					 UNUSED xlat_exp_t const *exp, void *uctx)
+{
+	rlm_redis_t			*inst = talloc_get_type_abort(uctx, rlm_redis_t);
+	redis_xlat_thread_inst_t	*xt = xlat_thread_inst;
 
-finish:
-	fr_redis_reply_free(&reply);
-	return ret;
+	xt->inst = inst;
+	xt->t = talloc_get_type_abort(module_thread_by_data(inst)->data, rlm_redis_thread_t);
+
+	return 0;
 }
 
 static int mod_bootstrap(void *instance, CONF_SECTION *conf)
@@ -499,7 +550,8 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
 
-	xlat_register(inst, inst->name, redis_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, false);
+	xlat = xlat_async_register(inst, inst->name, redis_xlat);
+	xlat_async_thread_instantiate_set(xlat, redis_xlat_thread_instantiate, redis_xlat_thread_inst_t, NULL, inst);
 
 	/*
 	 *	%{redis_node:<key>[ idx]}
@@ -527,6 +579,24 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+/** Allocate this thread's trunks
+ *
+ * Connections to each cluster node are opened the first time a command
+ * is routed to that node.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_redis_t		*inst = talloc_get_type_abort(instance, rlm_redis_t);
+	rlm_redis_thread_t	*t = thread;
+
+	t->cluster_thread = fr_redis_cluster_thread_alloc(t, el, &inst->trunk_conf,
+							  inst->cluster, &inst->conf, inst->name);
+	if (!t->cluster_thread) return -1;
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -544,4 +614,7 @@ module_t rlm_redis = {
 	.onload		= mod_load,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_redis_thread_t),
+	.thread_inst_type	= "rlm_redis_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 };
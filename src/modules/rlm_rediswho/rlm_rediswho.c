@@ -35,6 +35,8 @@ RCSID("$Id$")
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/redis/pipeline.h>
+#include <freeradius-devel/unlang/base.h>
 
 typedef struct {
 	fr_redis_conf_t		conf;		//!< Connection parameters for the Redis server.
@@ -51,8 +53,46 @@ typedef struct {
 	char const		*insert;	//!< Command for inserting session data
 	char const		*trim;		//!< Command for trimming the session list.
 	char const		*expire;	//!< Command for expiring entries.
+
+	fr_trunk_conf_t		trunk_conf;	//!< Configuration for the per-thread pipelined connections.
 } rlm_rediswho_t;
 
+typedef struct {
+	fr_redis_cluster_thread_t	*cluster_thread;	//!< Trunks for each of the cluster nodes.
+} rlm_rediswho_thread_t;
+
+/** Which of the commands for an accounting section we're running
+ *
+ */
+typedef enum {
+	REDISWHO_INSERT = 0,
+	REDISWHO_TRIM,
+	REDISWHO_EXPIRE,
+	REDISWHO_DONE
+} rediswho_stage_t;
+
+/** Resume context for the accounting commands
+ *
+ */
+typedef struct {
+	rlm_rediswho_thread_t	*t;
+
+	rediswho_stage_t	stage;		//!< Command being run.
+	char const		*cmd[REDISWHO_DONE];	//!< Unexpanded insert, trim and expire commands.
+	int			count;		//!< Result of the insert command.
+
+	int			argc;
+	char const		*argv[MAX_REDIS_ARGS];
+	char			argv_buf[MAX_REDIS_COMMAND_LEN];
+
+	fr_redis_command_set_t	*cmds;		//!< Commands in flight.  NULL once complete.
+
+	fr_redis_rcode_t	status;		//!< Status of the command.
+	int			result;		//!< Integer returned by the command.
+	fr_redis_trunk_t	*redirect;	//!< Trunk for the node we were redirected to.
+	uint32_t		redirects;	//!< How many redirects we've followed for this command.
+} rediswho_rctx_t;
+
 static CONF_PARSER section_config[] = {
 	{ FR_CONF_OFFSET("insert", FR_TYPE_STRING | FR_TYPE_REQUIRED | FR_TYPE_XLAT, rlm_rediswho_t, insert) },
 	{ FR_CONF_OFFSET("trim", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_rediswho_t, trim) }, /* required only if trim_count > 0 */
@@ -65,6 +105,8 @@ static CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("trim_count", FR_TYPE_INT32, rlm_rediswho_t, trim_count), .dflt = "-1" },
 
+	{ FR_CONF_OFFSET("trunk", FR_TYPE_SUBSECTION, rlm_rediswho_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
+
 	/*
 	 *	These all smash the same variables, because we don't care about them right now.
 	 *	In 3.1, we should have a way of saying "parse a set of sub-sections according to a template"
@@ -95,72 +137,49 @@ fr_dict_attr_autoload_t rlm_rediswho_dict_attr[] = {
 	{ NULL }
 };
 
-/*
- *	Query the database executing a command with no result rows
+/** Record the result of a command
+ *
+ * The replies are freed along with the command set, so anything
+ * we need has to be copied out here.
  */
-static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char const *fmt)
+static void rediswho_command_complete(REQUEST *request, fr_dlist_head_t *completed, void *rctx)
 {
-	fr_redis_conn_t		*conn;
-
-	int 			ret = -1;
-
-	fr_redis_cluster_state_t	state;
-	fr_redis_rcode_t		status;
+	rediswho_rctx_t		*wrctx = talloc_get_type_abort(rctx, rediswho_rctx_t);
+	fr_redis_command_t	*cmd;
 	redisReply		*reply = NULL;
-	int			s_ret;
-
-	uint8_t	const		*key = NULL;
-	size_t			key_len = 0;
-
-	int			argc;
-	char const		*argv[MAX_REDIS_ARGS];
-	char			argv_buf[MAX_REDIS_COMMAND_LEN];
 
-	if (!fmt || !*fmt) return 0;
-
-	argc = rad_expand_xlat(request, fmt, MAX_REDIS_ARGS, argv, false, sizeof(argv_buf), argv_buf);
-	if (argc < 0) {
-		RPEDEBUG("Invalid command: %s", fmt);
-		return -1;
-	}
+	wrctx->cmds = NULL;
+	wrctx->result = -1;
 
 	/*
-	 *	If we've got multiple arguments, the second one is usually the key.
-	 *	The Redis docs say commands should be analysed first to get key
-	 *	positions, but this involves sending them to the server, which is
-	 *	just as expensive as sending them to the wrong server and receiving
-	 *	a redirect.
+	 *	The command we care about is the last one,
+	 *	unless the ASKING before it failed.
 	 */
-	if (argc > 1) {
-		key = (uint8_t const *)argv[1];
-	 	key_len = strlen((char const *)key);
+	for (cmd = fr_dlist_head(completed); cmd; cmd = fr_dlist_next(completed, cmd)) {
+		reply = fr_redis_command_get_result(cmd);
+		wrctx->status = fr_redis_command_status(NULL, reply);
+		if (wrctx->status != REDIS_RCODE_SUCCESS) break;
 	}
 
-	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request, key, key_len, false);
-	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
-	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
-		reply = redisCommandArgv(conn->handle, argc, argv, NULL);
-		status = fr_redis_command_status(conn, reply);
-	}
-	if (s_ret != REDIS_RCODE_SUCCESS) {
-		RERROR("Failed inserting accounting data");
-	error:
-		fr_redis_reply_free(&reply);
-		return -1;
+	if (!fr_cond_assert(reply)) {
+		wrctx->status = REDIS_RCODE_ERROR;
+		goto finish;
 	}
-	if (!fr_cond_assert(reply)) goto error;
 
 	/*
 	 *	Write the response to the debug log
 	 */
 	fr_redis_reply_print(L_DBG_LVL_2, reply, request, 0);
 
-	switch (reply->type) {
-	case REDIS_REPLY_ERROR:
-		break;
+	if (wrctx->status != REDIS_RCODE_SUCCESS) goto finish;
 
+	switch (reply->type) {
 	case REDIS_REPLY_INTEGER:
-		if (reply->integer > 0) ret = reply->integer;
+		if (reply->integer > 0) {
+			wrctx->result = reply->integer;
+			break;
+		}
+		wrctx->status = REDIS_RCODE_ERROR;
 		break;
 
 	/*
@@ -170,40 +189,179 @@ static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char c
 	default:
 		REDEBUG("Expected type \"integer\" got type \"%s\"",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		wrctx->status = REDIS_RCODE_ERROR;
 		break;
 	}
-	fr_redis_reply_free(&reply);
 
-	return ret;
+finish:
+	unlang_interpret_resumable(request);
+}
+
+static void rediswho_command_fail(REQUEST *request, UNUSED fr_dlist_head_t *completed, void *rctx)
+{
+	rediswho_rctx_t		*wrctx = talloc_get_type_abort(rctx, rediswho_rctx_t);
+
+	wrctx->cmds = NULL;
+	wrctx->status = REDIS_RCODE_RECONNECT;
+
+	unlang_interpret_resumable(request);
+}
+
+static rlm_rcode_t rediswho_resume(void *instance, void *thread, REQUEST *request, void *rctx);
+static void rediswho_signal(void *instance, void *thread, REQUEST *request, void *rctx,
+			    fr_state_signal_t action);
+
+/** Enqueue the current command on a trunk, and yield until it completes
+ *
+ * @param[in] request	The current request.
+ * @param[in] wrctx	holding the expanded command.
+ * @param[in] rtrunk	to send the command on.
+ * @param[in] asking	Prefix the command with ASKING, to follow an -ASK redirect.
+ * @return
+ *	- RLM_MODULE_YIELD on success.
+ *	- RLM_MODULE_FAIL on failure.
+ */
+static rlm_rcode_t rediswho_command_enqueue(REQUEST *request, rediswho_rctx_t *wrctx,
+					    fr_redis_trunk_t *rtrunk, bool asking)
+{
+	fr_redis_command_set_t	*cmds;
+
+	cmds = fr_redis_command_set_alloc(NULL, request, rediswho_command_complete, rediswho_command_fail, wrctx);
+
+	if ((asking && (fr_redis_command_preformatted_add(cmds, "ASKING", sizeof("ASKING") - 1) != FR_REDIS_PIPELINE_OK)) ||
+	    (fr_redis_command_argv_add(cmds, wrctx->argc, wrctx->argv, NULL) != FR_REDIS_PIPELINE_OK)) {
+		REDEBUG("Invalid command");
+	error:
+		talloc_free(cmds);
+		talloc_free(wrctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	if (redis_command_set_enqueue(rtrunk, cmds) != FR_REDIS_PIPELINE_OK) {
+		RERROR("Failed inserting accounting data");
+		goto error;
+	}
+	wrctx->cmds = cmds;
+
+	return unlang_module_yield(request, rediswho_resume, rediswho_signal, wrctx);
+}
+
+/** Expand and send the next command that needs to be run
+ *
+ */
+static rlm_rcode_t rediswho_command_next(rlm_rediswho_t const *inst, REQUEST *request, rediswho_rctx_t *wrctx)
+{
+	fr_redis_trunk_t	*rtrunk;
+	char const		*fmt;
+
+	uint8_t	const		*key = NULL;
+	size_t			key_len = 0;
+
+	for (;;) {
+		if (wrctx->stage == REDISWHO_DONE) {
+			talloc_free(wrctx);
+			return RLM_MODULE_OK;
+		}
+
+		/* Only trim if necessary */
+		if ((wrctx->stage == REDISWHO_TRIM) &&
+		    ((inst->trim_count < 0) || (wrctx->count <= inst->trim_count))) {
+			wrctx->stage++;
+			continue;
+		}
+
+		fmt = wrctx->cmd[wrctx->stage];
+		if (fmt && *fmt) break;
+
+		wrctx->stage++;
+	}
+
+	wrctx->argc = rad_expand_xlat(request, fmt, MAX_REDIS_ARGS, wrctx->argv, false,
+				      sizeof(wrctx->argv_buf), wrctx->argv_buf);
+	if (wrctx->argc <= 0) {
+		RPEDEBUG("Invalid command: %s", fmt);
+	error:
+		talloc_free(wrctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	If we've got multiple arguments, the second one is usually the key.
+	 *	The Redis docs say commands should be analysed first to get key
+	 *	positions, but this involves sending them to the server, which is
+	 *	just as expensive as sending them to the wrong server and receiving
+	 *	a redirect.
+	 */
+	if (wrctx->argc > 1) {
+		key = (uint8_t const *)wrctx->argv[1];
+		key_len = strlen((char const *)key);
+	}
+
+	rtrunk = fr_redis_cluster_thread_trunk_by_key(wrctx->t->cluster_thread, request, key, key_len, false);
+	if (!rtrunk) goto error;
+
+	wrctx->redirects = 0;
+
+	return rediswho_command_enqueue(request, wrctx, rtrunk, false);
 }
 
-static rlm_rcode_t mod_accounting_all(rlm_rediswho_t const *inst, REQUEST *request,
-				      char const *insert,
-				      char const *trim,
-				      char const *expire)
+/** Process the result of a command, following redirects, and run the next one
+ *
+ */
+static rlm_rcode_t rediswho_resume(void *instance, UNUSED void *thread, REQUEST *request, void *rctx)
 {
-	int ret;
+	rlm_rediswho_t const	*inst = talloc_get_type_abort_const(instance, rlm_rediswho_t);
+	rediswho_rctx_t		*wrctx = talloc_get_type_abort(rctx, rediswho_rctx_t);
+	fr_redis_trunk_t	*redirect = wrctx->redirect;
+
+	wrctx->redirect = NULL;
+
+	switch (wrctx->status) {
+	case REDIS_RCODE_SUCCESS:
+		if (wrctx->stage == REDISWHO_INSERT) wrctx->count = wrctx->result;
+		wrctx->stage++;
+
+		return rediswho_command_next(inst, request, wrctx);
 
-	ret = rediswho_command(inst, request, insert);
-	if (ret < 0) return RLM_MODULE_FAIL;
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		if (!redirect) break;
 
-	/* Only trim if necessary */
-	if ((inst->trim_count >= 0) && (ret > inst->trim_count)) {
-		if (rediswho_command(inst, request, trim) < 0) return RLM_MODULE_FAIL;
+		if (++wrctx->redirects > inst->conf.max_redirects) {
+			REDEBUG("Too many redirects (%u)", wrctx->redirects - 1);
+			break;
+		}
+
+		return rediswho_command_enqueue(request, wrctx, redirect, (wrctx->status == REDIS_RCODE_ASK));
+
+	default:
+		break;
 	}
 
-	if (rediswho_command(inst, request, expire) < 0) return RLM_MODULE_FAIL;
-	return RLM_MODULE_OK;
+	talloc_free(wrctx);
+
+	return RLM_MODULE_FAIL;
+}
+
+static void rediswho_signal(UNUSED void *instance, UNUSED void *thread, UNUSED REQUEST *request, void *rctx,
+			    fr_state_signal_t action)
+{
+	rediswho_rctx_t		*wrctx = talloc_get_type_abort(rctx, rediswho_rctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	if (wrctx->cmds) fr_redis_command_set_cancel(wrctx->cmds);
+	talloc_free(wrctx);
 }
 
-static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rediswho_t const	*inst = instance;
-	rlm_rcode_t		rcode;
+	rlm_rediswho_thread_t	*t = talloc_get_type_abort(thread, rlm_rediswho_thread_t);
 	VALUE_PAIR		*vp;
 	fr_dict_enum_t		*dv;
 	CONF_SECTION		*cs;
-	char const		*insert, *trim, *expire;
+	rediswho_rctx_t		*wrctx;
 
 	vp = fr_pair_find_by_da(request->packet->vps, attr_acct_status_type, TAG_ANY);
 	if (!vp) {
@@ -223,13 +381,13 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *
 		return RLM_MODULE_NOOP;
 	}
 
-	insert = cf_pair_value(cf_pair_find(cs, "insert"));
-	trim = cf_pair_value(cf_pair_find(cs, "trim"));
-	expire = cf_pair_value(cf_pair_find(cs, "expire"));
+	MEM(wrctx = talloc_zero(request, rediswho_rctx_t));
+	wrctx->t = t;
+	wrctx->cmd[REDISWHO_INSERT] = cf_pair_value(cf_pair_find(cs, "insert"));
+	wrctx->cmd[REDISWHO_TRIM] = cf_pair_value(cf_pair_find(cs, "trim"));
+	wrctx->cmd[REDISWHO_EXPIRE] = cf_pair_value(cf_pair_find(cs, "expire"));
 
-	rcode = mod_accounting_all(inst, request, insert, trim, expire);
-
-	return rcode;
+	return rediswho_command_next(inst, request, wrctx);
 }
 
 static int mod_bootstrap(void *instance, CONF_SECTION *conf)
@@ -253,6 +411,19 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_rediswho_t		*inst = talloc_get_type_abort(instance, rlm_rediswho_t);
+	rlm_rediswho_thread_t	*t = thread;
+
+	t->cluster_thread = fr_redis_cluster_thread_alloc(t, el, &inst->trunk_conf,
+							  inst->cluster, &inst->conf, inst->name);
+	if (!t->cluster_thread) return -1;
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -270,6 +441,9 @@ module_t rlm_rediswho = {
 	.onload		= mod_load,
 	.instantiate	= mod_instantiate,
 	.bootstrap	= mod_bootstrap,
+	.thread_inst_size	= sizeof(rlm_rediswho_thread_t),
+	.thread_inst_type	= "rlm_rediswho_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting
 	},
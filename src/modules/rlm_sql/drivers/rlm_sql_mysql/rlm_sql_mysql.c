@@ -88,6 +88,9 @@ typedef struct {
 	MYSQL		db;
 	MYSQL		*sock;
 	MYSQL_RES	*result;
+#ifdef MYSQL_WAIT_READ
+	int		async_status;	//!< What the non-blocking API is waiting for.
+#endif
 } rlm_sql_mysql_conn_t;
 
 typedef struct {
@@ -273,6 +276,14 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *c
 
 	mysql_options(&(conn->db), MYSQL_READ_DEFAULT_GROUP, "freeradius");
 
+#ifdef MYSQL_WAIT_READ
+	/*
+	 *	Allow queries to be run with the MariaDB non-blocking
+	 *	API.  The normal blocking calls continue to work.
+	 */
+	mysql_options(&(conn->db), MYSQL_OPT_NONBLOCK, 0);
+#endif
+
 	/*
 	 *	We need to know about connection errors, and are capable
 	 *	of reconnecting automatically.
@@ -441,6 +452,87 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 	return RLM_SQL_OK;
 }
 
+#ifdef MYSQL_WAIT_READ
+/** Start a query with the MariaDB non-blocking API
+ *
+ */
+static sql_rcode_t sql_query_send(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	int			ret;
+
+	if (!conn->sock) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	conn->async_status = mysql_real_query_start(&ret, conn->sock, query, strlen(query));
+	if (conn->async_status) return RLM_SQL_OK;
+
+	return sql_check_error(conn->sock, 0);
+}
+
+/** Continue a query started with sql_query_send()
+ *
+ */
+static sql_rcode_t sql_query_recv(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	sql_rcode_t		rcode;
+	char const		*info;
+	int			ret;
+
+	/*
+	 *	async_status is zero if the query completed
+	 *	when it was sent.
+	 */
+	if (conn->async_status) {
+		conn->async_status = mysql_real_query_cont(&ret, conn->sock, conn->async_status);
+		if (conn->async_status) return RLM_SQL_IN_PROGRESS;
+	}
+
+	rcode = sql_check_error(conn->sock, 0);
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	info = mysql_info(conn->sock);
+	if (info) DEBUG2("%s", info);
+
+	return RLM_SQL_OK;
+}
+
+static int sql_fd(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+
+	if (!conn->sock) return -1;
+
+	return mysql_get_socket(conn->sock);
+}
+
+/** Translate what the non-blocking API is waiting for
+ *
+ * The query may complete in mysql_real_query_start(), in which case it's
+ * waiting for nothing.
+ */
+static sql_io_wait_t sql_io_wait(fr_time_delta_t *timeout, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	sql_io_wait_t		wait = SQL_IO_WAIT_NONE;
+
+	*timeout = 0;
+
+	if (conn->async_status & MYSQL_WAIT_READ) wait |= SQL_IO_WAIT_READ;
+	if (conn->async_status & MYSQL_WAIT_WRITE) wait |= SQL_IO_WAIT_WRITE;
+	if (conn->async_status & MYSQL_WAIT_EXCEPT) wait |= SQL_IO_WAIT_READ;
+	if (conn->async_status & MYSQL_WAIT_TIMEOUT) {
+		wait |= SQL_IO_WAIT_TIMEOUT;
+		*timeout = fr_time_delta_from_msec(mysql_get_timeout_value_ms(conn->sock));
+	}
+
+	return wait;
+}
+#endif
+
 static sql_rcode_t sql_store_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
@@ -853,6 +945,12 @@ rlm_sql_driver_t rlm_sql_mysql = {
 	.mod_instantiate		= mod_instantiate,
 	.sql_socket_init		= sql_socket_init,
 	.sql_query			= sql_query,
+#ifdef MYSQL_WAIT_READ
+	.sql_query_send			= sql_query_send,
+	.sql_query_recv			= sql_query_recv,
+	.sql_fd				= sql_fd,
+	.sql_io_wait			= sql_io_wait,
+#endif
 	.sql_select_query		= sql_select_query,
 	.sql_store_result		= sql_store_result,
 	.sql_num_fields			= sql_num_fields,
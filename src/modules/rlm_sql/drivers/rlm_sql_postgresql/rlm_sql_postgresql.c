@@ -72,6 +72,8 @@ typedef struct {
 	int		num_fields;
 	int		affected_rows;
 	char		**row;
+	bool		batch;			//!< Waiting for the results of a batch of statements.
+	bool		flushing;		//!< The query hasn't all been written to the socket.
 } rlm_sql_postgres_conn_t;
 
 static CONF_PARSER driver_config[] = {
@@ -247,6 +249,17 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 		return -1;
 	}
 
+	/*
+	 *  Queries are sent from the network thread, so sending
+	 *  mustn't block if the socket buffer fills up.
+	 */
+	if (PQsetnonblocking(conn->db, 1) != 0) {
+		ERROR("Failed setting non-blocking mode: %s", PQerrorMessage(conn->db));
+		PQfinish(conn->db);
+		conn->db = NULL;
+		return -1;
+	}
+
 	DEBUG2("Connected to database '%s' on '%s' server version %i, protocol version %i, backend PID %i ",
 	       PQdb(conn->db), PQhost(conn->db), PQserverVersion(conn->db), PQprotocolVersion(conn->db),
 	       PQbackendPID(conn->db));
@@ -254,93 +267,14 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
-static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
-					      char const *query)
+/** Classify the result in conn->result
+ *
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_result_status(rlm_sql_postgres_conn_t *conn, rlm_sql_postgres_t *inst)
 {
-	rlm_sql_postgres_conn_t	*conn = handle->conn;
-	rlm_sql_postgres_t	*inst = config->driver;
-	fr_time_delta_t		timeout = fr_time_delta_from_sec(config->query_timeout);
-	fr_time_t		start;
-	int			sockfd;
-	PGresult		*tmp_result;
 	int			numfields = 0;
 	ExecStatusType		status;
 
-	if (!conn->db) {
-		ERROR("Socket not connected");
-		return RLM_SQL_RECONNECT;
-	}
-
-	sockfd = PQsocket(conn->db);
-	if (sockfd < 0) {
-		ERROR("Unable to obtain socket: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
-	}
-
-	if (!PQsendQuery(conn->db, query)) {
-		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
-	}
-
-	/*
-	 *  We try to avoid blocking by waiting until the driver indicates that
-	 *  the result is ready or our timeout expires
-	 */
-	start = fr_time();
-	while (PQisBusy(conn->db)) {
-		int		r;
-		fd_set		read_fd;
-		fr_time_delta_t	elapsed = 0;
-
-		FD_ZERO(&read_fd);
-		FD_SET(sockfd, &read_fd);
-
-		if (config->query_timeout) {
-			elapsed = fr_time() - start;
-			if (elapsed >= timeout) goto too_long;
-		}
-
-		r = select(sockfd + 1, &read_fd, NULL, NULL, config->query_timeout ? &fr_time_delta_to_timeval(timeout - elapsed) : NULL);
-		if (r == 0) {
-		too_long:
-			ERROR("Socket read timeout after %d seconds", config->query_timeout);
-			return RLM_SQL_RECONNECT;
-		}
-		if (r < 0) {
-			if (errno == EINTR) continue;
-			ERROR("Failed in select: %s", fr_syserror(errno));
-			return RLM_SQL_RECONNECT;
-		}
-		if (!PQconsumeInput(conn->db)) {
-			ERROR("Failed reading input: %s", PQerrorMessage(conn->db));
-			return RLM_SQL_RECONNECT;
-		}
-	}
-
-	/*
-	 *  Returns a PGresult pointer or possibly a null pointer.
-	 *  A non-null pointer will generally be returned except in
-	 *  out-of-memory conditions or serious errors such as inability
-	 *  to send the command to the server. If a null pointer is
-	 *  returned, it should be treated like a PGRES_FATAL_ERROR
-	 *  result.
-	 */
-	conn->result = PQgetResult(conn->db);
-
-	/* Discard results for appended queries */
-	while ((tmp_result = PQgetResult(conn->db)) != NULL)
-		PQclear(tmp_result);
-
-	/*
-	 *  As this error COULD be a connection error OR an out-of-memory
-	 *  condition return value WILL be wrong SOME of the time
-	 *  regardless! Pick your poison...
-	 */
-	if (!conn->result) {
-		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
-	}
-
 	status = PQresultStatus(conn->result);
 	switch (status){
 	/*
@@ -385,7 +319,241 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_
 		break;
 	}
 
-	return sql_classify_error(inst, status, conn->result);;
+	return sql_classify_error(inst, status, conn->result);
+}
+
+/** Collect the result of a query once libpq has received all of it
+ *
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_query_result(rlm_sql_postgres_conn_t *conn, rlm_sql_postgres_t *inst)
+{
+	PGresult		*tmp_result;
+
+	/*
+	 *  Returns a PGresult pointer or possibly a null pointer.
+	 *  A non-null pointer will generally be returned except in
+	 *  out-of-memory conditions or serious errors such as inability
+	 *  to send the command to the server. If a null pointer is
+	 *  returned, it should be treated like a PGRES_FATAL_ERROR
+	 *  result.
+	 */
+	conn->result = PQgetResult(conn->db);
+
+	/* Discard results for appended queries */
+	while ((tmp_result = PQgetResult(conn->db)) != NULL)
+		PQclear(tmp_result);
+
+	/*
+	 *  As this error COULD be a connection error OR an out-of-memory
+	 *  condition return value WILL be wrong SOME of the time
+	 *  regardless! Pick your poison...
+	 */
+	if (!conn->result) {
+		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_result_status(conn, inst);
+}
+
+/** Write as much of the query as the socket will take
+ *
+ * @return
+ *	- RLM_SQL_OK if the query has been written.
+ *	- RLM_SQL_IN_PROGRESS if the socket needs to become writable first.
+ *	- RLM_SQL_RECONNECT on error.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_flush(rlm_sql_postgres_conn_t *conn)
+{
+	switch (PQflush(conn->db)) {
+	case 0:
+		conn->flushing = false;
+		return RLM_SQL_OK;
+
+	case 1:
+		conn->flushing = true;
+		return RLM_SQL_IN_PROGRESS;
+
+	default:
+		ERROR("Failed sending query: %s", PQerrorMessage(conn->db));
+		conn->flushing = false;
+		return RLM_SQL_RECONNECT;
+	}
+}
+
+/** Send a query to the server without waiting for the result
+ *
+ * As the connection is non-blocking, the query may only be partially written,
+ * in which case the rest is written by sql_query_recv as the socket becomes
+ * writable.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_query_send(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+						   char const *query)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (!PQsendQuery(conn->db, query)) {
+		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+	conn->batch = false;
+
+	if (sql_flush(conn) == RLM_SQL_RECONNECT) return RLM_SQL_RECONNECT;
+
+	return RLM_SQL_OK;
+}
+
+/** Send multiple statements in one query
+ *
+ * The server runs them in a single transaction, so if any statement fails, none
+ * of them take effect.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_batch_send(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+						   char const *query)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	sql_rcode_t		rcode;
+
+	rcode = sql_query_send(handle, config, query);
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	conn->batch = true;
+
+	return RLM_SQL_OK;
+}
+
+/** Read whatever is available on the socket, and process the result if it's complete
+ *
+ * Called when the socket returned by sql_fd() becomes readable, or writable while
+ * the query is still being written.  For batches, each
+ * call returns the result of the next statement, and #RLM_SQL_NO_MORE_ROWS once
+ * there are no more results.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_query_recv(rlm_sql_handle_t *handle, rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	/*
+	 *  The server may not read the rest of the query until
+	 *  we've read what it's sent, so read before flushing.
+	 */
+	if (!PQconsumeInput(conn->db)) {
+		ERROR("Failed reading input: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (conn->flushing) {
+		sql_rcode_t	rcode;
+
+		rcode = sql_flush(conn);
+		if (rcode != RLM_SQL_OK) return rcode;
+	}
+
+	if (PQisBusy(conn->db)) return RLM_SQL_IN_PROGRESS;
+
+	if (!conn->batch) return sql_query_result(conn, config->driver);
+
+	/*
+	 *  The previous result should have been freed by sql_finish_query.
+	 */
+	if (conn->result) {
+		PQclear(conn->result);
+		conn->result = NULL;
+	}
+
+	conn->result = PQgetResult(conn->db);
+	if (!conn->result) {
+		conn->batch = false;
+		return RLM_SQL_NO_MORE_ROWS;
+	}
+
+	return sql_result_status(conn, config->driver);
+}
+
+static int sql_fd(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	if (!conn->db) return -1;
+
+	return PQsocket(conn->db);
+}
+
+/** Wait for the result, and for the socket to become writable while the query is being written
+ *
+ */
+static sql_io_wait_t sql_io_wait(fr_time_delta_t *timeout, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	*timeout = 0;
+
+	return SQL_IO_WAIT_READ | (conn->flushing ? SQL_IO_WAIT_WRITE : SQL_IO_WAIT_NONE);
+}
+
+static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+					      char const *query)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	fr_time_delta_t		timeout = fr_time_delta_from_sec(config->query_timeout);
+	fr_time_t		start;
+	int			sockfd;
+	sql_rcode_t		rcode;
+
+	rcode = sql_query_send(handle, config, query);
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	sockfd = PQsocket(conn->db);
+	if (sockfd < 0) {
+		ERROR("Unable to obtain socket: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	/*
+	 *  We try to avoid blocking by waiting until the driver indicates that
+	 *  the query has been written and the result is ready, or our timeout
+	 *  expires
+	 */
+	start = fr_time();
+	while (conn->flushing || PQisBusy(conn->db)) {
+		int		r;
+		fd_set		read_fd, write_fd;
+		fr_time_delta_t	elapsed = 0;
+
+		FD_ZERO(&read_fd);
+		FD_SET(sockfd, &read_fd);
+		FD_ZERO(&write_fd);
+		if (conn->flushing) FD_SET(sockfd, &write_fd);
+
+		if (config->query_timeout) {
+			elapsed = fr_time() - start;
+			if (elapsed >= timeout) goto too_long;
+		}
+
+		r = select(sockfd + 1, &read_fd, &write_fd, NULL, config->query_timeout ? &fr_time_delta_to_timeval(timeout - elapsed) : NULL);
+		if (r == 0) {
+		too_long:
+			ERROR("Socket read timeout after %d seconds", config->query_timeout);
+			return RLM_SQL_RECONNECT;
+		}
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			ERROR("Failed in select: %s", fr_syserror(errno));
+			return RLM_SQL_RECONNECT;
+		}
+		if (!PQconsumeInput(conn->db)) {
+			ERROR("Failed reading input: %s", PQerrorMessage(conn->db));
+			return RLM_SQL_RECONNECT;
+		}
+		if (conn->flushing && (sql_flush(conn) == RLM_SQL_RECONNECT)) return RLM_SQL_RECONNECT;
+	}
+
+	return sql_query_result(conn, config->driver);
 }
 
 static sql_rcode_t sql_select_query(rlm_sql_handle_t * handle, rlm_sql_config_t *config, char const *query)
@@ -664,6 +832,11 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.mod_instantiate		= mod_instantiate,
 	.sql_socket_init		= sql_socket_init,
 	.sql_query			= sql_query,
+	.sql_query_send			= sql_query_send,
+	.sql_query_recv			= sql_query_recv,
+	.sql_batch_send			= sql_batch_send,
+	.sql_fd				= sql_fd,
+	.sql_io_wait			= sql_io_wait,
 	.sql_select_query		= sql_select_query,
 	.sql_num_fields			= sql_num_fields,
 	.sql_fields			= sql_fields,
@@ -36,6 +36,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/map_proc.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/pairmove.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/table.h>
 
@@ -82,6 +83,12 @@ static const CONF_PARSER postauth_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER batch_config[] = {
+	{ FR_CONF_OFFSET("max", FR_TYPE_UINT32, rlm_sql_config_t, batch_max), .dflt = "1" },
+	{ FR_CONF_OFFSET("size", FR_TYPE_UINT32, rlm_sql_config_t, batch_size), .dflt = "65536" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("driver", FR_TYPE_STRING, rlm_sql_config_t, sql_driver_name), .dflt = "rlm_sql_null" },
 	{ FR_CONF_OFFSET("server", FR_TYPE_STRING, rlm_sql_config_t, sql_server), .dflt = "" },	/* Must be zero length so drivers can determine if it was set */
@@ -110,6 +117,14 @@ static const CONF_PARSER module_config[] = {
 	 */
 	{ FR_CONF_OFFSET("query_timeout", FR_TYPE_UINT32, rlm_sql_config_t, query_timeout) },
 
+	/*
+	 *	Only used for accounting and post-auth queries, and
+	 *	only for drivers which support non-blocking queries.
+	 */
+	{ FR_CONF_OFFSET("async", FR_TYPE_BOOL, rlm_sql_config_t, async), .dflt = "no" },
+	{ FR_CONF_OFFSET("trunk", FR_TYPE_SUBSECTION, rlm_sql_config_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
+	{ FR_CONF_POINTER("batch", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) batch_config },
+
 	{ FR_CONF_POINTER("accounting", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) acct_config },
 
 	{ FR_CONF_POINTER("post-auth", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) postauth_config },
@@ -1171,9 +1186,50 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->pool = module_connection_pool_init(inst->cs, inst, sql_mod_conn_create, NULL, NULL, NULL, NULL);
 	if (!inst->pool) return -1;
 
+	if (inst->config->async) {
+		if (!inst->driver->sql_query_send || !inst->driver->sql_query_recv || !inst->driver->sql_fd) {
+			WARN("Driver %s does not support async queries, ignoring \"async\"",
+			     inst->config->sql_driver_name);
+			inst->config->async = false;
+		} else {
+			FR_INTEGER_BOUND_CHECK("batch.max", inst->config->batch_max, >=, 1);
+			FR_INTEGER_BOUND_CHECK("batch.max", inst->config->batch_max, <=, 1000);
+			FR_INTEGER_BOUND_CHECK("batch.size", inst->config->batch_size, >=, 1024);
+
+			if ((inst->config->batch_max > 1) && !inst->driver->sql_batch_send) {
+				WARN("Driver %s does not support batching queries, ignoring \"batch.max\"",
+				     inst->config->sql_driver_name);
+				inst->config->batch_max = 1;
+			}
+
+			/*
+			 *	Servers only run one query (or batch of
+			 *	queries) at a time on a connection.  Queries
+			 *	assigned to a connection while it's busy are
+			 *	sent together as the next batch.  The trunk
+			 *	opens more connections as the load increases.
+			 */
+			inst->config->trunk_conf.max_req_per_conn = inst->config->batch_max;
+			inst->config->trunk_conf.target_req_per_conn = inst->config->batch_max;
+		}
+	}
+
 	return RLM_MODULE_OK;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_sql_t		*inst = talloc_get_type_abort(instance, rlm_sql_t);
+	rlm_sql_thread_t	*t = talloc_get_type_abort(thread, rlm_sql_thread_t);
+
+	t->inst = inst;
+	t->el = el;
+
+	if (!inst->config->async) return 0;
+
+	return sql_trunk_thread_instantiate(t, inst, el);
+}
+
 static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
 {
@@ -1416,41 +1472,22 @@ release:
 	return rcode;
 }
 
-/*
- *	Generic function for failing between a bunch of queries.
- *
- *	Uses the same principle as rlm_linelog, expanding the 'reference' config
- *	item using xlat to figure out what query it should execute.
- *
- *	If the reference matches multiple config items, and a query fails or
- *	doesn't update any rows, the next matching config item is used.
+/** Expand 'reference' to find the first query of a redundant set
  *
  */
-static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+static rlm_rcode_t acct_query_find(CONF_PAIR **out, REQUEST *request, sql_acct_section_t *section)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-
-	rlm_sql_handle_t	*handle = NULL;
-	int			sql_ret;
-	int			numaffected = 0;
-
 	CONF_ITEM		*item;
-	CONF_PAIR 		*pair;
-	char const		*attr = NULL;
-	char const		*value;
 
 	char			path[FR_MAX_STRING_LEN];
 	char			*p = path;
-	char			*expanded = NULL;
 
 	fr_assert(section);
 
 	if (section->reference[0] != '.') *p++ = '.';
 
 	if (xlat_eval(p, sizeof(path) - (p - path), request, section->reference, NULL, NULL) < 0) {
-		rcode = RLM_MODULE_FAIL;
-
-		goto finish;
+		return RLM_MODULE_FAIL;
 	}
 
 	/*
@@ -1460,21 +1497,48 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	item = cf_reference_item(NULL, section->cs, path);
 	if (!item) {
 		RWDEBUG("No such configuration item %s", path);
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		return RLM_MODULE_NOOP;
 	}
 	if (cf_item_is_section(item)){
 		RWDEBUG("Sections are not supported as references");
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		return RLM_MODULE_NOOP;
 	}
 
-	pair = cf_item_to_pair(item);
-	attr = cf_pair_attr(pair);
+	*out = cf_item_to_pair(item);
+
+	RDEBUG2("Using query template '%s'", cf_pair_attr(*out));
+
+	return RLM_MODULE_OK;
+}
+
+/*
+ *	Generic function for failing between a bunch of queries.
+ *
+ *	Uses the same principle as rlm_linelog, expanding the 'reference' config
+ *	item using xlat to figure out what query it should execute.
+ *
+ *	If the reference matches multiple config items, and a query fails or
+ *	doesn't update any rows, the next matching config item is used.
+ *
+ */
+static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+
+	rlm_sql_handle_t	*handle = NULL;
+	int			sql_ret;
+	int			numaffected = 0;
+
+	CONF_PAIR 		*pair = NULL;
+	char const		*attr = NULL;
+	char const		*value;
+
+	char			*expanded = NULL;
 
-	RDEBUG2("Using query template '%s'", attr);
+	rcode = acct_query_find(&pair, request, section);
+	if (rcode != RLM_MODULE_OK) return rcode;
+
+	attr = cf_pair_attr(pair);
 
 	handle = fr_pool_connection_get(inst->pool, request);
 	if (!handle) {
@@ -1584,17 +1648,166 @@ finish:
 	return rcode;
 }
 
+/** Resume context for accounting and post-auth queries run on the trunk
+ *
+ */
+typedef struct {
+	sql_acct_section_t	*section;	//!< Section the queries are from.
+	CONF_PAIR		*pair;		//!< Query being run.
+	rlm_sql_trunk_query_t	*query;		//!< Result of the query being run.
+} sql_acct_rctx_t;
+
+static rlm_rcode_t acct_redundant_resume(void *instance, void *thread, REQUEST *request, void *rctx);
+static void acct_redundant_signal(void *instance, void *thread, REQUEST *request, void *rctx,
+				  fr_state_signal_t action);
+
+/** Enqueue the current query from a redundant set, and yield until it completes
+ *
+ */
+static rlm_rcode_t acct_redundant_enqueue(rlm_sql_t const *inst, rlm_sql_thread_t *t, REQUEST *request,
+					  sql_acct_rctx_t *rctx)
+{
+	char const	*value;
+	rlm_rcode_t	rcode;
+
+	value = cf_pair_value(rctx->pair);
+	if (!value) {
+		RDEBUG2("Ignoring null query");
+		rcode = RLM_MODULE_NOOP;
+		goto finish;
+	}
+
+	rctx->query = sql_trunk_query_enqueue(t, request, value, rctx->section);
+	if (!rctx->query) {
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	return unlang_module_yield(request, acct_redundant_resume, acct_redundant_signal, rctx);
+
+finish:
+	talloc_free(rctx);
+	sql_unset_user(inst, request);
+
+	return rcode;
+}
+
+/** Process the result of a query, and try the next query in the set if needed
+ *
+ */
+static rlm_rcode_t acct_redundant_resume(void *instance, void *thread, REQUEST *request, void *ctx)
+{
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(instance, rlm_sql_t);
+	rlm_sql_thread_t	*t = talloc_get_type_abort(thread, rlm_sql_thread_t);
+	sql_acct_rctx_t		*rctx = talloc_get_type_abort(ctx, sql_acct_rctx_t);
+	rlm_sql_trunk_query_t	*query = rctx->query;
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+
+	rctx->query = NULL;
+
+	if (query->empty) {
+		RDEBUG2("Ignoring null query");
+		rcode = RLM_MODULE_NOOP;
+		goto finish;
+	}
+
+	RDEBUG2("SQL query returned: %s", fr_table_str_by_value(sql_rcode_description_table, query->rcode, "<INVALID>"));
+
+	switch (query->rcode) {
+	case RLM_SQL_OK:
+		break;
+
+	case RLM_SQL_QUERY_INVALID:
+		rcode = RLM_MODULE_INVALID;
+		goto finish;
+
+	case RLM_SQL_ALT_QUERY:
+		goto next;
+
+	default:
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	RDEBUG2("%i record(s) updated", query->numaffected);
+
+	if (query->numaffected > 0) goto finish;	/* A query succeeded, were done! */
+
+next:
+	rctx->pair = cf_pair_find_next(rctx->section->cs, rctx->pair, cf_pair_attr(rctx->pair));
+	if (!rctx->pair) {
+		RDEBUG2("No additional queries configured");
+		rcode = RLM_MODULE_NOOP;
+		goto finish;
+	}
+
+	RDEBUG2("Trying next query...");
+	talloc_free(query);
+
+	return acct_redundant_enqueue(inst, t, request, rctx);
+
+finish:
+	talloc_free(query);
+	talloc_free(rctx);
+	sql_unset_user(inst, request);
+
+	return rcode;
+}
+
+static void acct_redundant_signal(void *instance, UNUSED void *thread, REQUEST *request, void *ctx,
+				  fr_state_signal_t action)
+{
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(instance, rlm_sql_t);
+	sql_acct_rctx_t		*rctx = talloc_get_type_abort(ctx, sql_acct_rctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	if (rctx->query) {
+		if (rctx->query->treq) fr_trunk_request_signal_cancel(rctx->query->treq);
+		talloc_free(rctx->query);
+	}
+	talloc_free(rctx);
+	sql_unset_user(inst, request);
+}
+
+/*
+ *	As acct_redundant, but the queries are run on this thread's
+ *	trunk, and the request yields while they're running.
+ */
+static rlm_rcode_t acct_redundant_async(rlm_sql_t const *inst, rlm_sql_thread_t *t, REQUEST *request,
+					sql_acct_section_t *section)
+{
+	sql_acct_rctx_t		*rctx;
+	CONF_PAIR		*pair = NULL;
+	rlm_rcode_t		rcode;
+
+	rcode = acct_query_find(&pair, request, section);
+	if (rcode != RLM_MODULE_OK) return rcode;
+
+	MEM(rctx = talloc_zero(request, sql_acct_rctx_t));
+	rctx->section = section;
+	rctx->pair = pair;
+
+	sql_set_user(inst, request, NULL);
+
+	return acct_redundant_enqueue(inst, t, request, rctx);
+}
+
 #ifdef WITH_ACCOUNTING
 
 /*
  *	Accounting: Insert or update session data in our sql table
  */
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_sql_t const *inst = instance;
 
 	if (inst->config->accounting.reference_cp) {
+		if (inst->config->async) {
+			return acct_redundant_async(inst, talloc_get_type_abort(thread, rlm_sql_thread_t),
+						    request, &inst->config->accounting);
+		}
 		return acct_redundant(inst, request, &inst->config->accounting);
 	}
 
@@ -1606,12 +1819,16 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 /*
  *	Postauth: Write a record of the authentication attempt
  */
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request)
 {
 	rlm_sql_t const *inst = talloc_get_type_abort_const(instance, rlm_sql_t);
 
 	if (inst->config->postauth.reference_cp) {
+		if (inst->config->async) {
+			return acct_redundant_async(inst, talloc_get_type_abort(thread, rlm_sql_thread_t),
+						    request, &inst->config->postauth);
+		}
 		return acct_redundant(inst, request, &inst->config->postauth);
 	}
 
@@ -1633,6 +1850,9 @@ module_t rlm_sql = {
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_sql_thread_t),
+	.thread_inst_type	= "rlm_sql_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 #ifdef WITH_ACCOUNTING
@@ -29,6 +29,7 @@ RCSIDH(rlm_sql_h, "$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/pool.h>
+#include <freeradius-devel/server/trunk.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/exfile.h>
 
@@ -46,8 +47,20 @@ typedef enum {
 	RLM_SQL_RECONNECT = 1,		//!< Stale connection, should reconnect.
 	RLM_SQL_ALT_QUERY,		//!< Key constraint violation, use an alternative query.
 	RLM_SQL_NO_MORE_ROWS,		//!< No more rows available
+	RLM_SQL_IN_PROGRESS,		//!< Query has been sent, but the result isn't
+					///< available yet.
 } sql_rcode_t;
 
+/** What a query started with sql_query_send is waiting for
+ *
+ */
+typedef enum {
+	SQL_IO_WAIT_NONE	= 0x00,		//!< The result is available.
+	SQL_IO_WAIT_READ	= 0x01,		//!< The socket to become readable.
+	SQL_IO_WAIT_WRITE	= 0x02,		//!< The socket to become writable.
+	SQL_IO_WAIT_TIMEOUT	= 0x04,		//!< A timer to expire.
+} sql_io_wait_t;
+
 typedef enum {
 	FALL_THROUGH_NO = 0,
 	FALL_THROUGH_YES,
@@ -125,6 +138,15 @@ typedef struct {
 	char const		*connect_query;			//!< Query executed after establishing
 								//!< new connection.
 
+	bool			async;				//!< Run accounting and post-auth queries
+								///< without blocking the worker, if the
+								///< driver supports it.
+	fr_trunk_conf_t		trunk_conf;			//!< Configuration for the per-thread
+								///< connections used by async queries.
+	uint32_t		batch_max;			//!< Maximum number of async queries to send
+								///< to the server together.
+	uint32_t		batch_size;			//!< Maximum length of a batch of queries.
+
 	void			*driver;			//!< Where drivers should write a
 								//!< pointer to their configurations.
 
@@ -194,6 +216,40 @@ typedef struct {
 				       fr_time_delta_t timeout);
 
 	sql_rcode_t (*sql_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query);
+
+	/*
+	 *	Optional non-blocking interface.  sql_query_send starts
+	 *	a query, sql_query_recv is called each time the socket
+	 *	returned by sql_fd becomes readable (or as directed by
+	 *	sql_io_wait), and returns
+	 *	RLM_SQL_IN_PROGRESS until the result is available.
+	 *	The result is then handled exactly as if it had been
+	 *	returned by sql_query.
+	 */
+	sql_rcode_t (*sql_query_send)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query);
+	sql_rcode_t (*sql_query_recv)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+	int (*sql_fd)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+
+	/*
+	 *	Optional.  Returns what the running query is waiting
+	 *	for, and, if SQL_IO_WAIT_TIMEOUT is set, how long
+	 *	for.  sql_query_recv is called when any of them occur,
+	 *	and immediately if the query is waiting for nothing.
+	 *	Drivers which don't provide it are only called when
+	 *	the socket becomes readable.
+	 */
+	sql_io_wait_t (*sql_io_wait)(fr_time_delta_t *timeout, rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+
+	/*
+	 *	Optional.  Sends multiple statements, separated by ';',
+	 *	which the server must run as a single transaction.
+	 *	sql_query_recv then returns the result of each statement
+	 *	in turn, followed by RLM_SQL_NO_MORE_ROWS.  If a
+	 *	statement fails, there are no results for the statements
+	 *	after it.
+	 */
+	sql_rcode_t (*sql_batch_send)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query);
+
 	sql_rcode_t (*sql_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query);
 	sql_rcode_t (*sql_store_result)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 
@@ -236,6 +292,27 @@ struct sql_inst {
 	fr_dict_attr_t const	*group_da;		//!< Group dictionary attribute.
 };
 
+/** Per-thread instance data
+ *
+ */
+typedef struct {
+	rlm_sql_t const		*inst;			//!< Instance of rlm_sql.
+	fr_event_list_t		*el;			//!< This thread's event list.
+	fr_trunk_t		*trunk;			//!< Connections used for async queries.
+} rlm_sql_thread_t;
+
+/** A query run on a trunk connection
+ *
+ */
+typedef struct {
+	bool			empty;			//!< Query expanded to an empty string,
+							///< and wasn't sent.
+	sql_rcode_t		rcode;			//!< Result of the query.
+	int			numaffected;		//!< Rows changed by the query.
+
+	fr_trunk_request_t	*treq;			//!< Trunk request, for signalling.
+} rlm_sql_trunk_query_t;
+
 typedef struct rlm_sql_grouplist_s rlm_sql_grouplist_t;
 struct rlm_sql_grouplist_s {
 	char			*name;
@@ -253,6 +330,14 @@ sql_rcode_t	rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 int		rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle);
 void		rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, bool force_debug);
 int		sql_set_user(rlm_sql_t const *inst, REQUEST *request, char const *username);
+sql_rcode_t	rlm_sql_query_status(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, sql_rcode_t rcode);
+
+/*
+ *	sql_trunk.c
+ */
+int		sql_trunk_thread_instantiate(rlm_sql_thread_t *t, rlm_sql_t const *inst, fr_event_list_t *el);
+rlm_sql_trunk_query_t *sql_trunk_query_enqueue(rlm_sql_thread_t *t, REQUEST *request,
+					       char const *query, sql_acct_section_t *section);
 
 /*
  *	sql_state.c
@@ -44,6 +44,7 @@ RCSID("$Id$")
  *	readable reason strings.
  */
 fr_table_num_sorted_t const sql_rcode_description_table[] = {
+	{ "in progress",	RLM_SQL_IN_PROGRESS	},
 	{ "need alt query",	RLM_SQL_ALT_QUERY	},
 	{ "no connection",	RLM_SQL_RECONNECT	},
 	{ "no more rows",	RLM_SQL_NO_MORE_ROWS	},
@@ -317,6 +318,63 @@ void rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle
 	talloc_free_children(handle->log_ctx);
 }
 
+/** Log any errors from a query, and release the result if the query failed
+ *
+ * Used by rlm_sql_query, and for queries run on trunk connections.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.  May be NULL.
+ * @param handle the query was executed on.
+ * @param rcode returned by the driver.
+ * @return
+ *	- #RLM_SQL_OK on success.
+ *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
+ *	- #RLM_SQL_ALT_QUERY on constraints violation.
+ */
+sql_rcode_t rlm_sql_query_status(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, sql_rcode_t rcode)
+{
+	switch (rcode) {
+	/*
+	 *	These are bad and should make rlm_sql return invalid
+	 */
+	case RLM_SQL_QUERY_INVALID:
+		rlm_sql_print_error(inst, request, handle, false);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+		break;
+
+	/*
+	 *	Server or client errors.
+	 *
+	 *	If the driver claims to be able to distinguish between
+	 *	duplicate row errors and other errors, and we hit a
+	 *	general error treat it as a failure.
+	 *
+	 *	Otherwise rewrite it to RLM_SQL_ALT_QUERY.
+	 */
+	case RLM_SQL_ERROR:
+		if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
+			rlm_sql_print_error(inst, request, handle, false);
+			(inst->driver->sql_finish_query)(handle, inst->config);
+			break;
+		}
+		rcode = RLM_SQL_ALT_QUERY;
+		/* FALL-THROUGH */
+
+	/*
+	 *	Driver suggested using an alternative query
+	 */
+	case RLM_SQL_ALT_QUERY:
+		rlm_sql_print_error(inst, request, handle, true);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+		break;
+
+	default:
+		break;
+	}
+
+	return rcode;
+}
+
 /** Call the driver's sql_query method, reconnecting if necessary.
  *
  * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
@@ -375,40 +433,9 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 			/* Reconnection succeeded, try again with the new handle */
 			continue;
 
-		/*
-		 *	These are bad and should make rlm_sql return invalid
-		 */
-		case RLM_SQL_QUERY_INVALID:
-			rlm_sql_print_error(inst, request, *handle, false);
-			(inst->driver->sql_finish_query)(*handle, inst->config);
-			break;
-
-		/*
-		 *	Server or client errors.
-		 *
-		 *	If the driver claims to be able to distinguish between
-		 *	duplicate row errors and other errors, and we hit a
-		 *	general error treat it as a failure.
-		 *
-		 *	Otherwise rewrite it to RLM_SQL_ALT_QUERY.
-		 */
-		case RLM_SQL_ERROR:
-			if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
-				rlm_sql_print_error(inst, request, *handle, false);
-				(inst->driver->sql_finish_query)(*handle, inst->config);
-				break;
-			}
-			ret = RLM_SQL_ALT_QUERY;
-			/* FALL-THROUGH */
-
-		/*
-		 *	Driver suggested using an alternative query
-		 */
-		case RLM_SQL_ALT_QUERY:
-			rlm_sql_print_error(inst, request, *handle, true);
-			(inst->driver->sql_finish_query)(*handle, inst->config);
+		default:
+			ret = rlm_sql_query_status(inst, request, *handle, ret);
 			break;
-
 		}
 
 		return ret;
@@ -0,0 +1,730 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file sql_trunk.c
+ * @brief Run queries on per-thread connections without blocking the worker.
+ *
+ * Drivers which implement sql_query_send, sql_query_recv and sql_fd can have
+ * their queries run from a connection trunk.  SQL servers only process one
+ * query per connection at a time, so concurrency comes from the trunk opening
+ * more connections.
+ *
+ * If the driver implements sql_batch_send, queries which are assigned to a
+ * connection while it's busy are sent together, as a single transaction, when
+ * the connection becomes free.  This saves a round trip and a commit per query.
+ * If any query in a batch fails, the whole transaction is rolled back, and the
+ * other queries are retried on their own.
+ *
+ * @copyright 2020 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX "rlm_sql (%s) - "
+#define LOG_PREFIX_ARGS inst->name
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/unlang/base.h>
+
+#include "rlm_sql.h"
+
+/** A connection in the trunk
+ *
+ */
+typedef struct {
+	rlm_sql_t const		*inst;		//!< Instance of rlm_sql.
+	rlm_sql_handle_t	*handle;	//!< Driver connection handle.
+	int			fd;		//!< Socket the driver is using.
+
+	fr_trunk_request_t	**sent;		//!< Requests whose queries are running, in the
+						///< order they were sent.  Entries are NULL if the
+						///< request was released.
+	uint32_t		num_sent;	//!< Number of queries running.
+	uint32_t		num_read;	//!< Number of results read.
+	uint32_t		failed;		//!< Index of the first query which failed.
+	bool			batch;		//!< Queries were sent with sql_batch_send.
+
+	fr_trunk_connection_event_t notify_on;	//!< Events the trunk wants when no query is running.
+	sql_io_wait_t		wait;		//!< Events the running query is waiting for.
+	fr_event_timer_t const	*wait_ev;	//!< Driver timeout for the running query.
+
+	fr_event_timer_t const	*ev;		//!< query_timeout for the running queries.
+} sql_trunk_conn_t;
+
+/** Protocol request, allocated in the treq
+ *
+ */
+typedef struct {
+	char const		*query;		//!< Unexpanded query.
+	sql_acct_section_t	*section;	//!< Section to log the query to.  May be NULL.
+	char			*expanded;	//!< The query we sent.
+	bool			single;		//!< Failed as part of a batch, retry on its own.
+} sql_trunk_request_t;
+
+/** Open a new connection
+ *
+ * Drivers only provide a blocking connect, so this will block the worker until
+ * the connection is established, or the connect_timeout expires.
+ */
+static fr_connection_state_t _sql_conn_init(void **h_out, fr_connection_t *conn, void *uctx)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(uctx, rlm_sql_thread_t);
+	rlm_sql_t const		*inst = t->inst;
+	rlm_sql_t		*mutable;
+	sql_trunk_conn_t	*c;
+
+	MEM(c = talloc_zero(conn, sql_trunk_conn_t));
+	c->inst = inst;
+	MEM(c->sent = talloc_zero_array(c, fr_trunk_request_t *, inst->config->batch_max));
+
+	memcpy(&mutable, &inst, sizeof(mutable));
+	c->handle = sql_mod_conn_create(c, mutable, inst->config->trunk_conf.conn_conf->connection_timeout);
+	if (!c->handle) {
+	error:
+		talloc_free(c);
+		return FR_CONNECTION_STATE_FAILED;
+	}
+
+	c->fd = (inst->driver->sql_fd)(c->handle, inst->config);
+	if (c->fd < 0) {
+		ERROR("Driver did not provide a socket for the connection");
+		goto error;
+	}
+
+	if (fr_connection_signal_on_fd(conn, c->fd) < 0) goto error;
+
+	*h_out = c;
+
+	return FR_CONNECTION_STATE_CONNECTING;
+}
+
+/** Close a connection
+ *
+ */
+static void _sql_conn_close(fr_event_list_t *el, void *h, UNUSED void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(h, sql_trunk_conn_t);
+
+	(void) fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+
+	talloc_free(c);	/* Handle destructor closes the connection */
+}
+
+static fr_connection_t *sql_conn_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+				       fr_connection_conf_t const *conf,
+				       char const *log_prefix, void *uctx)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(uctx, rlm_sql_thread_t);
+	rlm_sql_t const		*inst = t->inst;
+	fr_connection_t		*conn;
+
+	conn = fr_connection_alloc(tconn, el,
+				   &(fr_connection_funcs_t){
+					.init = _sql_conn_init,
+					.close = _sql_conn_close
+				   },
+				   conf,
+				   log_prefix,
+				   t);
+	if (!conn) {
+		PERROR("Failed allocating state handler for new connection");
+		return NULL;
+	}
+
+	return conn;
+}
+
+static void _sql_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	fr_trunk_connection_signal_readable(tconn);
+}
+
+static void _sql_conn_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	fr_trunk_connection_signal_writable(tconn);
+}
+
+static void _sql_conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	sql_trunk_conn_t	*c = talloc_get_type_abort(tconn->conn->h, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+
+	ERROR("Connection failed: %s", fr_syserror(fd_errno));
+
+	fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+/** Register for the I/O events the trunk or the running query need
+ *
+ * While a query is running, and the driver says what it's waiting for,
+ * those events replace the ones the trunk asked for.  Readable and
+ * writable both continue the query, which is what the demuxer does.
+ *
+ * While queries are running, the trunk may still want to write the
+ * requests queued behind them.  The muxer can't send them until the
+ * running queries complete, and the socket is almost always writable,
+ * so writable is ignored until then.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The connection may have been freed.
+ */
+static int sql_conn_events_set(fr_trunk_connection_t *tconn, sql_trunk_conn_t *c, fr_event_list_t *el)
+{
+	rlm_sql_t const		*inst = c->inst;
+	fr_event_fd_cb_t	read_fn = NULL;
+	fr_event_fd_cb_t	write_fn = NULL;
+
+	if (c->num_sent && c->wait) {
+		if (c->wait & SQL_IO_WAIT_READ) read_fn = _sql_conn_readable;
+		if (c->wait & SQL_IO_WAIT_WRITE) write_fn = _sql_conn_readable;
+	} else {
+		switch (c->notify_on) {
+		case FR_TRUNK_CONN_EVENT_NONE:
+			break;
+
+		case FR_TRUNK_CONN_EVENT_READ:
+			read_fn = _sql_conn_readable;
+			break;
+
+		case FR_TRUNK_CONN_EVENT_WRITE:
+			write_fn = _sql_conn_writable;
+			break;
+
+		case FR_TRUNK_CONN_EVENT_BOTH:
+			read_fn = _sql_conn_readable;
+			write_fn = _sql_conn_writable;
+			break;
+		}
+
+		if (c->num_sent) write_fn = NULL;
+	}
+
+	if (!read_fn && !write_fn) {
+		(void) fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+		return 0;
+	}
+
+	if (fr_event_fd_insert(c, el, c->fd, read_fn, write_fn, _sql_conn_error, tconn) < 0) {
+		PERROR("Failed inserting FD event");
+
+		/*
+		 *	May free the connection!
+		 */
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void sql_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+			    fr_event_list_t *el,
+			    fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, sql_trunk_conn_t);
+
+	c->notify_on = notify_on;
+
+	(void) sql_conn_events_set(tconn, c, el);
+}
+
+/** The driver's timer for the running query expired
+ *
+ */
+static void _sql_conn_wait_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	fr_trunk_connection_signal_readable(tconn);
+}
+
+/** Ask the driver what the running query is waiting for, and wait for it
+ *
+ * @return
+ *	- 1 if the result is available now.
+ *	- 0 if the query is waiting for I/O, or a timer.
+ *	- -1 on failure.  The connection may have been freed.
+ */
+static int sql_conn_io_wait(fr_trunk_connection_t *tconn, fr_connection_t *conn)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+	fr_time_delta_t		timeout = 0;
+
+	if (c->wait_ev) fr_event_timer_delete(&c->wait_ev);
+
+	/*
+	 *	Results are read when the socket is readable.
+	 */
+	if (!inst->driver->sql_io_wait) return 0;
+
+	c->wait = (inst->driver->sql_io_wait)(&timeout, c->handle, inst->config);
+	if (!c->wait) return 1;
+
+	if (sql_conn_events_set(tconn, c, conn->el) < 0) return -1;
+
+	if ((c->wait & SQL_IO_WAIT_TIMEOUT) &&
+	    (fr_event_timer_in(c, conn->el, &c->wait_ev, timeout, _sql_conn_wait_timeout, tconn) < 0)) {
+		PERROR("Failed inserting driver timeout");
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** The query didn't complete within query_timeout
+ *
+ * The queries may still be running on the server, so the connection can't be
+ * reused.  Fail the requests, rather than letting the trunk requeue them, as the
+ * queries may still complete.
+ */
+static void _sql_query_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	sql_trunk_conn_t	*c = talloc_get_type_abort(tconn->conn->h, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+
+	uint32_t		i;
+
+	ERROR("Query timeout after %u seconds", inst->config->query_timeout);
+
+	for (i = 0; i < c->num_sent; i++) {
+		if (c->sent[i] && (c->sent[i]->state == FR_TRUNK_REQUEST_STATE_SENT)) fr_trunk_request_signal_fail(c->sent[i]);
+	}
+
+	fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+static void sql_request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, void *uctx);
+
+/** Expand and send queries
+ *
+ * Queries are expanded here, rather than when they're enqueued, as the driver's
+ * escape function needs the connection handle.
+ *
+ * All the queries pending on the connection, up to batch.max queries and
+ * batch.size bytes, are sent together.
+ */
+static void sql_request_mux(UNUSED fr_event_list_t *el,
+			    fr_trunk_connection_t *tconn, fr_connection_t *conn, void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+	fr_trunk_request_t	*treq;
+	sql_trunk_request_t	*u;
+	REQUEST			*request;
+	size_t			len = 0;
+	sql_rcode_t		rcode;
+	uint32_t		i;
+
+	/*
+	 *	Previous query or batch is still running
+	 */
+	if (c->num_sent) return;
+
+	while ((c->num_sent < inst->config->batch_max) && (fr_trunk_connection_pop_request(&treq, tconn) == 0)) {
+		rlm_sql_trunk_query_t	*q = talloc_get_type_abort(treq->rctx, rlm_sql_trunk_query_t);
+
+		u = talloc_get_type_abort(treq->preq, sql_trunk_request_t);
+		request = treq->request;
+
+		/*
+		 *	May have been expanded already, if it didn't
+		 *	fit in the previous batch.
+		 */
+		if (!u->expanded &&
+		    (xlat_aeval(u, &u->expanded, request, u->query, inst->sql_escape_func, c->handle) < 0)) {
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+
+		if (!*u->expanded) {
+			q->empty = true;
+			fr_trunk_request_signal_complete(treq);
+			continue;
+		}
+
+		/*
+		 *	Leave it for the next batch
+		 */
+		if (c->num_sent &&
+		    (u->single || ((len + talloc_array_length(u->expanded)) > inst->config->batch_size))) break;
+
+		if (u->section) rlm_sql_query_log(inst, request, u->section, u->expanded);
+
+		RDEBUG2("Executing query: %s", u->expanded);
+
+		c->sent[c->num_sent++] = treq;
+		len += talloc_array_length(u->expanded);	/* Includes space for the separator */
+		fr_trunk_request_signal_sent(treq);
+
+		if (u->single) break;
+	}
+
+	if (!c->num_sent) return;
+
+	c->num_read = 0;
+	c->failed = UINT32_MAX;
+
+	if (c->num_sent == 1) {
+		u = talloc_get_type_abort(c->sent[0]->preq, sql_trunk_request_t);
+
+		c->batch = false;
+		rcode = (inst->driver->sql_query_send)(c->handle, inst->config, u->expanded);
+	} else {
+		char	*query, *p;
+
+		MEM(query = p = talloc_array(c, char, len));
+		for (i = 0; i < c->num_sent; i++) {
+			size_t	qlen;
+
+			u = talloc_get_type_abort(c->sent[i]->preq, sql_trunk_request_t);
+			qlen = talloc_array_length(u->expanded) - 1;
+
+			if (i > 0) *p++ = ';';
+			memcpy(p, u->expanded, qlen);
+			p += qlen;
+		}
+		*p = '\0';
+
+		DEBUG2("Sending batch of %u queries", c->num_sent);
+
+		c->batch = true;
+		rcode = (inst->driver->sql_batch_send)(c->handle, inst->config, query);
+		talloc_free(query);
+	}
+
+	switch (rcode) {
+	case RLM_SQL_OK:
+		break;
+
+	/*
+	 *	The requests are moved to another connection.
+	 */
+	case RLM_SQL_RECONNECT:
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return;
+
+	default:
+	{
+		rlm_sql_trunk_query_t	*q;
+
+		request = c->sent[0]->request;
+		rcode = rlm_sql_query_status(inst, request, c->handle, rcode);
+
+		for (i = 0; i < c->num_sent; i++) {
+			treq = c->sent[i];
+			if (!treq) continue;
+
+			q = talloc_get_type_abort(treq->rctx, rlm_sql_trunk_query_t);
+			q->rcode = rcode;
+			fr_trunk_request_signal_complete(treq);
+		}
+		c->num_sent = 0;
+	}
+		return;
+	}
+
+	if (inst->config->query_timeout &&
+	    (fr_event_timer_in(c, conn->el, &c->ev, fr_time_delta_from_sec(inst->config->query_timeout),
+			       _sql_query_timeout, tconn) < 0)) {
+		PERROR("Failed inserting query timeout");
+	}
+
+	/*
+	 *	Stop writable events until the queries complete.
+	 *	Drivers with sql_io_wait have their events set below.
+	 */
+	if (!inst->driver->sql_io_wait && (sql_conn_events_set(tconn, c, conn->el) < 0)) return;
+
+	/*
+	 *	The query may have completed as it was sent,
+	 *	in which case there will be no I/O to wake us.
+	 */
+	if (sql_conn_io_wait(tconn, conn) > 0) sql_request_demux(tconn, conn, uctx);
+}
+
+/** Read the results of the queries running on a connection
+ *
+ */
+static void sql_request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+	fr_trunk_request_t	*treq;
+	REQUEST			*request;
+	sql_rcode_t		rcode;
+	uint32_t		i;
+
+	if (!c->num_sent) return;
+
+	/*
+	 *	Read one result per query.  Batches end with
+	 *	RLM_SQL_NO_MORE_ROWS, which may come early if
+	 *	one of the queries failed.
+	 */
+	while (c->num_read < c->num_sent) {
+		int	numaffected = 0;
+
+		rcode = (inst->driver->sql_query_recv)(c->handle, inst->config);
+		if (rcode == RLM_SQL_IN_PROGRESS) {
+			if (sql_conn_io_wait(tconn, conn) <= 0) return;
+			continue;
+		}
+
+		if (rcode == RLM_SQL_RECONNECT) {
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+		}
+
+		if (c->batch && (rcode == RLM_SQL_NO_MORE_ROWS)) break;
+
+		treq = c->sent[c->num_read++];
+		request = (treq && (treq->state == FR_TRUNK_REQUEST_STATE_SENT)) ? treq->request : NULL;
+
+		rcode = rlm_sql_query_status(inst, request, c->handle, rcode);
+		if (rcode == RLM_SQL_OK) {
+			numaffected = (inst->driver->sql_affected_rows)(c->handle, inst->config);
+			(inst->driver->sql_finish_query)(c->handle, inst->config);
+		} else if (c->failed == UINT32_MAX) {
+			c->failed = c->num_read - 1;
+		}
+
+		if (request) {
+			rlm_sql_trunk_query_t	*q = talloc_get_type_abort(treq->rctx, rlm_sql_trunk_query_t);
+
+			q->rcode = rcode;
+			q->numaffected = numaffected;
+		}
+	}
+
+	/*
+	 *	Consume the end of batch marker
+	 */
+	while (c->batch && (c->num_read == c->num_sent)) {
+		rcode = (inst->driver->sql_query_recv)(c->handle, inst->config);
+		if (rcode == RLM_SQL_IN_PROGRESS) {
+			if (sql_conn_io_wait(tconn, conn) <= 0) return;
+			continue;
+		}
+		if (rcode != RLM_SQL_NO_MORE_ROWS) {
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+		}
+		break;
+	}
+
+	if (c->ev) fr_event_timer_delete(&c->ev);
+	if (c->wait_ev) fr_event_timer_delete(&c->wait_ev);
+
+	for (i = 0; i < c->num_sent; i++) {
+		treq = c->sent[i];
+		if (!treq) continue;
+
+		switch (treq->state) {
+		/*
+		 *	The request was cancelled while the
+		 *	query was running.  If the cancellation
+		 *	hasn't been acknowledged yet, the cancel
+		 *	mux completes it.
+		 */
+		case FR_TRUNK_REQUEST_STATE_CANCEL_SENT:
+			fr_trunk_request_signal_cancel_complete(treq);
+			continue;
+
+		case FR_TRUNK_REQUEST_STATE_CANCEL:
+			continue;
+
+		default:
+			break;
+		}
+
+		/*
+		 *	The transaction was rolled back, so
+		 *	the other queries in the batch need
+		 *	to be run again.
+		 */
+		if ((c->num_read < c->num_sent) || ((c->failed != UINT32_MAX) && (c->num_sent > 1))) {
+			if (i != c->failed) {
+				sql_trunk_request_t	*u = talloc_get_type_abort(treq->preq, sql_trunk_request_t);
+
+				u->single = true;
+				fr_trunk_request_requeue(treq);
+				continue;
+			}
+		}
+
+		fr_trunk_request_signal_complete(treq);
+	}
+
+	c->num_sent = 0;
+	c->num_read = 0;
+	c->wait = SQL_IO_WAIT_NONE;
+
+	/*
+	 *	Go back to the events the trunk asked for, which
+	 *	re-arms writable if requests are queued.
+	 */
+	(void) sql_conn_events_set(tconn, c, conn->el);
+}
+
+/** Acknowledge cancellations
+ *
+ * There's no portable way to abort a running query, so the query is left to
+ * complete, and the connection stays busy until its result has been read.
+ */
+static void sql_request_cancel_mux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, sql_trunk_conn_t);
+	fr_trunk_request_t	*treq;
+
+	while (fr_trunk_connection_pop_cancellation(&treq, tconn) == 0) {
+		uint32_t	i;
+
+		fr_trunk_request_signal_cancel_sent(treq);
+
+		for (i = 0; i < c->num_sent; i++) if (c->sent[i] == treq) break;
+
+		/*
+		 *	Results were already read by the demuxer
+		 */
+		if (i == c->num_sent) fr_trunk_request_signal_cancel_complete(treq);
+	}
+}
+
+static void sql_request_conn_release(fr_connection_t *conn, void *preq_to_reset, UNUSED void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, sql_trunk_conn_t);
+	sql_trunk_request_t	*u = talloc_get_type_abort(preq_to_reset, sql_trunk_request_t);
+
+	uint32_t		i;
+
+	TALLOC_FREE(u->expanded);
+
+	for (i = 0; i < c->num_sent; i++) {
+		if (c->sent[i] && (c->sent[i]->preq == preq_to_reset)) {
+			c->sent[i] = NULL;
+			break;
+		}
+	}
+}
+
+static void sql_request_complete(REQUEST *request, UNUSED void *preq, void *rctx, UNUSED void *uctx)
+{
+	rlm_sql_trunk_query_t	*q = talloc_get_type_abort(rctx, rlm_sql_trunk_query_t);
+
+	q->treq = NULL;
+
+	unlang_interpret_resumable(request);
+}
+
+static void sql_request_fail(REQUEST *request, UNUSED void *preq, void *rctx,
+			     UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	rlm_sql_trunk_query_t	*q = talloc_get_type_abort(rctx, rlm_sql_trunk_query_t);
+
+	q->rcode = RLM_SQL_ERROR;
+	q->treq = NULL;
+
+	unlang_interpret_resumable(request);
+}
+
+static void sql_request_free(UNUSED REQUEST *request, void *preq_to_free, UNUSED void *uctx)
+{
+	talloc_free(preq_to_free);
+}
+
+/** Enqueue a query on this thread's trunk
+ *
+ * The caller should yield, and will be resumed when the query completes,
+ * at which point the result is available in the returned structure.
+ * The caller is responsible for freeing it.
+ *
+ * If the request is cancelled before the query completes, the caller must
+ * call #fr_trunk_request_signal_cancel on the treq, if it's still set.
+ *
+ * @param[in] t		Thread specific instance data.
+ * @param[in] request	The current request.
+ * @param[in] query	to expand and execute.
+ * @param[in] section	to log the query to.  May be NULL.
+ * @return
+ *	- The query result structure.
+ *	- NULL if the query couldn't be enqueued.
+ */
+rlm_sql_trunk_query_t *sql_trunk_query_enqueue(rlm_sql_thread_t *t, REQUEST *request,
+					       char const *query, sql_acct_section_t *section)
+{
+	fr_trunk_request_t	*treq;
+	sql_trunk_request_t	*u;
+	rlm_sql_trunk_query_t	*q;
+
+	treq = fr_trunk_request_alloc(t->trunk, request);
+	if (!treq) return NULL;
+
+	MEM(q = talloc_zero(request, rlm_sql_trunk_query_t));
+	MEM(u = talloc_zero(treq, sql_trunk_request_t));
+
+	u->query = query;
+	u->section = section;
+
+	q->rcode = RLM_SQL_ERROR;
+
+	if (fr_trunk_request_enqueue(&treq, t->trunk, request, u, q) < 0) {
+		fr_trunk_request_free(&treq);
+		talloc_free(q);
+		return NULL;
+	}
+	q->treq = treq;
+
+	return q;
+}
+
+/** Allocate this thread's trunk
+ *
+ * @param[in] t		Thread specific instance data.  inst and el must be set.
+ * @param[in] inst	Instance of rlm_sql.
+ * @param[in] el	This thread's event list.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int sql_trunk_thread_instantiate(rlm_sql_thread_t *t, rlm_sql_t const *inst, fr_event_list_t *el)
+{
+	static fr_trunk_io_funcs_t	io_funcs = {
+						.connection_alloc = sql_conn_alloc,
+						.connection_notify = sql_conn_notify,
+						.request_mux = sql_request_mux,
+						.request_demux = sql_request_demux,
+						.request_cancel_mux = sql_request_cancel_mux,
+						.request_conn_release = sql_request_conn_release,
+						.request_complete = sql_request_complete,
+						.request_fail = sql_request_fail,
+						.request_free = sql_request_free
+					};
+
+	t->trunk = fr_trunk_alloc(t, el, &io_funcs, &inst->config->trunk_conf, inst->name, t, false);
+	if (!t->trunk) return -1;
+
+	return 0;
+}
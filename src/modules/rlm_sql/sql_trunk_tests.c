@@ -0,0 +1,318 @@
+#include <freeradius-devel/util/acutest.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "sql_trunk.c"
+
+/*
+ *	Tests for the SQL trunk, using a driver which reads one
+ *	byte per result from a socket pair.  The test plays the
+ *	part of the SQL server, writing results to the other end.
+ *
+ *	'o'	- A statement succeeded.
+ *	'e'	- The end of a batch.
+ */
+typedef struct {
+	int		fd[2];			//!< [0] for the driver, [1] for the "server".
+	unsigned int	sent;			//!< Number of times a query or batch was sent.
+	unsigned int	statements;		//!< Number of statements in the last query or batch.
+} test_sql_conn_t;
+
+typedef struct {
+	unsigned int	completed;		//!< Requests which completed.
+	unsigned int	failed;			//!< Requests which failed.
+} test_sql_stats_t;
+
+#define DEBUG_LVL_SET if (test_verbose_level__ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
+
+static test_sql_conn_t	*test_conn;
+
+static int _test_sql_conn_free(test_sql_conn_t *tc)
+{
+	close(tc->fd[0]);
+	close(tc->fd[1]);
+	if (test_conn == tc) test_conn = NULL;
+
+	return 0;
+}
+
+/*
+ *	Replaces the function in rlm_sql.c, so that the driver
+ *	isn't needed.
+ */
+void *sql_mod_conn_create(TALLOC_CTX *ctx, void *instance, UNUSED fr_time_delta_t timeout)
+{
+	rlm_sql_t		*inst = instance;
+	rlm_sql_handle_t	*handle;
+	test_sql_conn_t		*tc;
+
+	MEM(handle = talloc_zero(ctx, rlm_sql_handle_t));
+	MEM(tc = talloc_zero(handle, test_sql_conn_t));
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, tc->fd) < 0) {
+		talloc_free(handle);
+		return NULL;
+	}
+	fr_nonblock(tc->fd[0]);
+	fr_nonblock(tc->fd[1]);
+	talloc_set_destructor(tc, _test_sql_conn_free);
+
+	handle->conn = tc;
+	handle->inst = inst;
+	test_conn = tc;
+
+	return handle;
+}
+
+void rlm_sql_query_log(UNUSED rlm_sql_t const *inst, UNUSED REQUEST *request,
+		       UNUSED sql_acct_section_t *section, UNUSED char const *query)
+{
+}
+
+sql_rcode_t rlm_sql_query_status(UNUSED rlm_sql_t const *inst, UNUSED REQUEST *request,
+				 UNUSED rlm_sql_handle_t *handle, sql_rcode_t rcode)
+{
+	return rcode;
+}
+
+static int test_sql_fd(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	test_sql_conn_t	*tc = talloc_get_type_abort(handle->conn, test_sql_conn_t);
+
+	return tc->fd[0];
+}
+
+static sql_rcode_t test_sql_query_send(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+				       UNUSED char const *query)
+{
+	test_sql_conn_t	*tc = talloc_get_type_abort(handle->conn, test_sql_conn_t);
+
+	tc->sent++;
+	tc->statements = 1;
+
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t test_sql_batch_send(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+				       char const *query)
+{
+	test_sql_conn_t	*tc = talloc_get_type_abort(handle->conn, test_sql_conn_t);
+	char const	*p;
+
+	tc->sent++;
+	tc->statements = 1;
+	for (p = query; *p; p++) if (*p == ';') tc->statements++;
+
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t test_sql_query_recv(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	test_sql_conn_t	*tc = talloc_get_type_abort(handle->conn, test_sql_conn_t);
+	char		c;
+	ssize_t		slen;
+
+	slen = read(tc->fd[0], &c, 1);
+	if (slen < 0) return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? RLM_SQL_IN_PROGRESS : RLM_SQL_RECONNECT;
+	if (slen == 0) return RLM_SQL_RECONNECT;
+
+	return (c == 'e') ? RLM_SQL_NO_MORE_ROWS : RLM_SQL_OK;
+}
+
+static int test_sql_affected_rows(UNUSED rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	return 1;
+}
+
+static sql_rcode_t test_sql_finish_query(UNUSED rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	return RLM_SQL_OK;
+}
+
+static rlm_sql_driver_t test_sql_driver = {
+	.name			= "test",
+	.sql_query_send		= test_sql_query_send,
+	.sql_query_recv		= test_sql_query_recv,
+	.sql_fd			= test_sql_fd,
+	.sql_batch_send		= test_sql_batch_send,
+	.sql_affected_rows	= test_sql_affected_rows,
+	.sql_finish_query	= test_sql_finish_query
+};
+
+static void test_request_complete(UNUSED REQUEST *request, UNUSED void *preq, void *rctx, void *uctx)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(uctx, rlm_sql_thread_t);
+	rlm_sql_trunk_query_t	*q = talloc_get_type_abort(rctx, rlm_sql_trunk_query_t);
+	test_sql_stats_t	*stats = talloc_get_type_abort(talloc_parent(t), test_sql_stats_t);
+
+	TEST_CHECK(q->rcode == RLM_SQL_OK);
+	q->treq = NULL;
+	stats->completed++;
+}
+
+static void test_request_fail(UNUSED REQUEST *request, UNUSED void *preq, void *rctx,
+			      UNUSED fr_trunk_request_state_t state, void *uctx)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(uctx, rlm_sql_thread_t);
+	rlm_sql_trunk_query_t	*q = talloc_get_type_abort(rctx, rlm_sql_trunk_query_t);
+	test_sql_stats_t	*stats = talloc_get_type_abort(talloc_parent(t), test_sql_stats_t);
+
+	q->treq = NULL;
+	stats->failed++;
+}
+
+/** Enqueue a query, and expand it, as xlat isn't initialised
+ *
+ */
+static rlm_sql_trunk_query_t *test_enqueue(rlm_sql_thread_t *t, REQUEST *request, char const *query)
+{
+	rlm_sql_trunk_query_t	*q;
+	sql_trunk_request_t	*u;
+
+	q = sql_trunk_query_enqueue(t, request, query, NULL);
+	TEST_CHECK(q != NULL);
+	if (!q) return NULL;
+
+	u = talloc_get_type_abort(q->treq->preq, sql_trunk_request_t);
+	u->expanded = talloc_typed_strdup(u, query);
+
+	return q;
+}
+
+/** Service the events which are ready now
+ *
+ * @return the number of events which were ready.
+ */
+static int test_service(fr_event_list_t *el)
+{
+	int	events;
+
+	events = fr_event_corral(el, fr_time(), false);
+	if (events > 0) fr_event_service(el);
+
+	return events;
+}
+
+static void test_server_write(char const *results)
+{
+	TEST_CHECK(test_conn != NULL);
+	if (!test_conn) return;
+
+	TEST_CHECK(write(test_conn->fd[1], results, strlen(results)) == (ssize_t)strlen(results));
+}
+
+/*
+ *	Queries queued behind a running query must be sent as one
+ *	batch when it completes, and while it's running, the
+ *	connection mustn't be woken by the socket being writable.
+ */
+static void test_batch_queued_behind_running_query(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	test_sql_stats_t	*stats;
+	fr_event_list_t		*el;
+	rlm_sql_t		*inst;
+	rlm_sql_config_t	*config;
+	rlm_sql_thread_t	*t;
+	REQUEST			*request;
+	int			i, events;
+
+	static fr_trunk_io_funcs_t io_funcs = {
+		.connection_alloc = sql_conn_alloc,
+		.connection_notify = sql_conn_notify,
+		.request_mux = sql_request_mux,
+		.request_demux = sql_request_demux,
+		.request_cancel_mux = sql_request_cancel_mux,
+		.request_conn_release = sql_request_conn_release,
+		.request_complete = test_request_complete,
+		.request_fail = test_request_fail,
+		.request_free = sql_request_free
+	};
+
+	DEBUG_LVL_SET;
+
+	MEM(el = fr_event_list_alloc(ctx, NULL, NULL));
+
+	MEM(inst = talloc_zero(ctx, rlm_sql_t));
+	MEM(config = talloc_zero(inst, rlm_sql_config_t));
+	inst->name = "test";
+	inst->config = config;
+	inst->driver = &test_sql_driver;
+
+	/*
+	 *	The same limits rlm_sql sets from batch.max
+	 */
+	config->batch_max = 4;
+	config->batch_size = 1024;
+	config->trunk_conf = (fr_trunk_conf_t) {
+		.conn_conf = talloc_zero(inst, fr_connection_conf_t),
+		.start = 1,
+		.min = 1,
+		.max = 1,
+		.max_req_per_conn = 4,
+		.target_req_per_conn = 4
+	};
+
+	MEM(stats = talloc_zero(ctx, test_sql_stats_t));
+	MEM(t = talloc_zero(stats, rlm_sql_thread_t));
+	t->inst = inst;
+	t->el = el;
+	t->trunk = fr_trunk_alloc(t, el, &io_funcs, &config->trunk_conf, inst->name, t, false);
+	TEST_CHECK(t->trunk != NULL);
+	if (!t->trunk) goto finish;
+
+	MEM(request = request_alloc(ctx));
+
+	/*
+	 *	Let the connection establish
+	 */
+	for (i = 0; i < 10; i++) test_service(el);
+	TEST_CHECK(fr_trunk_connection_count_by_state(t->trunk, FR_TRUNK_CONN_ACTIVE) == 1);
+	TEST_CHECK(test_conn != NULL);
+	if (!test_conn) goto finish;
+
+	TEST_CASE("First query is sent on its own");
+	test_enqueue(t, request, "query 0");
+	for (i = 0; i < 10; i++) test_service(el);
+	TEST_CHECK(test_conn->sent == 1);
+	TEST_MSG("Expected 1 send, got %u", test_conn->sent);
+
+	TEST_CASE("Queries queued behind it don't wake the connection");
+	test_enqueue(t, request, "query 1");
+	test_enqueue(t, request, "query 2");
+	test_enqueue(t, request, "query 3");
+
+	for (i = 0; i < 100; i++) {
+		events = test_service(el);
+		if (!TEST_CHECK(events == 0)) {
+			TEST_MSG("Connection woken %i times with no result to read", events);
+			break;
+		}
+	}
+	TEST_CHECK(test_conn->sent == 1);
+	TEST_CHECK(stats->completed == 0);
+
+	TEST_CASE("The queued queries are sent as a batch when the first completes");
+	test_server_write("o");
+	for (i = 0; i < 10; i++) test_service(el);
+	TEST_CHECK(stats->completed == 1);
+	TEST_CHECK(test_conn->sent == 2);
+	TEST_CHECK(test_conn->statements == 3);
+	TEST_MSG("Expected 3 statements in the batch, got %u", test_conn->statements);
+
+	TEST_CASE("The batch completes, and the connection goes idle");
+	test_server_write("oooe");
+	for (i = 0; i < 10; i++) test_service(el);
+	TEST_CHECK(stats->completed == 4);
+	TEST_MSG("Expected 4 completions, got %u", stats->completed);
+	TEST_CHECK(stats->failed == 0);
+	TEST_CHECK(test_service(el) == 0);
+
+finish:
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	{ "Batch - Queued behind a running query",	test_batch_queued_behind_running_query },
+	{ NULL }
+};
@@ -40,35 +40,68 @@ RCSID("$Id$")
 
 #include <pthread.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/*
+ *	Counters are only ever written by the worker which owns them,
+ *	and are read, without locks, by whichever thread is producing
+ *	a report.  Each set of counters starts on its own cache line,
+ *	so workers never write to lines another worker is writing to.
+ */
+#define STATS_CACHE_LINE	64
+
+/*
+ *	Bucket N (N > 0) counts requests which took between 2^(N-1)
+ *	and 2^N microseconds to process.  Bucket 0 counts those which
+ *	took under a microsecond.  The last bucket counts everything
+ *	that took longer.
+ */
+#define STATS_LATENCY_BUCKETS	32
+
 typedef struct {
-	pthread_mutex_t		mutex;
-	fr_dict_attr_t const	*type_da;			//!< FreeRADIUS-Stats4-Type
-	fr_dict_attr_t const	*ipv4_da;			//!< FreeRADIUS-Stats4-IPv4-Address
-	fr_dict_attr_t const	*ipv6_da;			//!< FreeRADIUS-Stats4-IPv6-Address
+	atomic_uint_fast64_t	packets[FR_RADIUS_MAX_PACKET_CODE];	//!< by packet code.
+	atomic_uint_fast64_t	latency[STATS_LATENCY_BUCKETS];		//!< log2 of request processing time.
+} rlm_stats_counters_t;
+
+/** Counters summed over all the workers
+ *
+ */
+typedef struct {
+	uint64_t		packets[FR_RADIUS_MAX_PACKET_CODE];
+	uint64_t		latency[STATS_LATENCY_BUCKETS];
+} rlm_stats_snapshot_t;
+
+typedef struct {
+	char const		*name;				//!< Instance name, for radmin.
+	pthread_mutex_t		mutex;				//!< Protects the list of threads, and the
+								//!< retired counters.  Never taken by workers
+								//!< when processing packets.
 	fr_dlist_head_t		list;				//!< for threads to know about each other
 
-	uint64_t		stats[FR_RADIUS_MAX_PACKET_CODE];
+	rlm_stats_snapshot_t	retired;			//!< Global counters from threads which have exited.
 } rlm_stats_t;
 
 typedef struct {
 	fr_ipaddr_t		ipaddr;				//!< IP address of this thing
 	fr_time_t		created;			//!< when it was created
 	fr_time_t		last_packet;			//!< when we last saw a packet
-	uint64_t		stats[FR_RADIUS_MAX_PACKET_CODE];	//!< actual statistic
+	rlm_stats_counters_t	*counters;			//!< actual statistic
 } rlm_stats_data_t;
 
 typedef struct {
 	rlm_stats_t		*inst;
 
-	fr_time_t		last_global_update;
+	rlm_stats_counters_t	*global;			//!< counters for all packets seen by this thread
 	fr_dlist_t		entry;				//!< for threads to know about each other
 
-	fr_time_t		last_manage;			//!< when we deleted old things
-
+	pthread_mutex_t		mutex;				//!< Held when inserting into, or reading
+								//!< another thread's src and dst trees.
 	rbtree_t		*src;				//!< stats by source
 	rbtree_t		*dst;				//!< stats by destination
-
-	uint64_t		stats[FR_RADIUS_MAX_PACKET_CODE];
 } rlm_stats_thread_t;
 
 static const CONF_PARSER module_config[] = {
@@ -95,52 +128,135 @@ fr_dict_attr_autoload_t rlm_stats_dict_attr[] = {
 	{ NULL }
 };
 
-static void coalesce(uint64_t final_stats[FR_RADIUS_MAX_PACKET_CODE], rlm_stats_thread_t *t,
-		     size_t tree_offset, rlm_stats_data_t *mydata)
+/** Allocate a set of counters aligned to a cache line
+ *
+ */
+static rlm_stats_counters_t *stats_counters_alloc(TALLOC_CTX *ctx)
 {
-	rlm_stats_data_t *stats;
-	rlm_stats_thread_t *other;
-	rbtree_t **tree;
-	uint64_t local_stats[FR_RADIUS_MAX_PACKET_CODE];
+	uint8_t *p;
 
-	tree = (rbtree_t **) (((uint8_t *) t) + tree_offset);
+	MEM(p = talloc_zero_array(ctx, uint8_t, sizeof(rlm_stats_counters_t) + STATS_CACHE_LINE - 1));
 
-	/*
-	 *	Bootstrap with my statistics, where we don't need a
-	 *	lock.
-	 */
-	stats = rbtree_finddata(*tree, mydata);
-	if (!stats) {
-		memset(final_stats, 0, sizeof(uint64_t) * FR_RADIUS_MAX_PACKET_CODE);
-	} else {
-		memcpy(final_stats, stats->stats, sizeof(stats->stats));
+	return (rlm_stats_counters_t *) (((uintptr_t) p + STATS_CACHE_LINE - 1) & ~((uintptr_t) STATS_CACHE_LINE - 1));
+}
+
+/** Increment a counter owned by this thread
+ *
+ * Only the owning thread writes to the counter, so we don't need
+ * a locked read-modify-write.  The atomic load and store are only
+ * there so readers never see a torn value.
+ */
+static inline void stats_inc(atomic_uint_fast64_t *counter)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+			      memory_order_relaxed);
+}
+
+static inline void stats_counters_update(rlm_stats_counters_t *counters, int src_code, int dst_code, int bucket)
+{
+	stats_inc(&counters->packets[src_code]);
+	stats_inc(&counters->packets[dst_code]);
+	stats_inc(&counters->latency[bucket]);
+}
+
+/** Add a set of counters to a snapshot
+ *
+ */
+static void stats_counters_add(rlm_stats_snapshot_t *out, rlm_stats_counters_t *in)
+{
+	int i;
+
+	for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
+		out->packets[i] += atomic_load_explicit(&in->packets[i], memory_order_relaxed);
 	}
 
-	/*
-	 *	Loop over all of the other thread instances, locking
-	 *	them, and adding their statistics in.
-	 */
-	for (other = fr_dlist_head(&t->inst->list);
-	     other != NULL;
-	     other = fr_dlist_next(&t->inst->list, other)) {
-		int i;
+	for (i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+		out->latency[i] += atomic_load_explicit(&in->latency[i], memory_order_relaxed);
+	}
+}
+
+/** Find the counters for an IP address, creating them if necessary
+ *
+ * Lookups are done without the lock, as only this thread modifies
+ * the tree.  Inserts are done with the lock held, so that other
+ * threads can read the tree.
+ */
+static rlm_stats_data_t *stats_data_find(rlm_stats_thread_t *t, rbtree_t *tree, fr_ipaddr_t const *ipaddr,
+					 fr_time_t now)
+{
+	rlm_stats_data_t mydata, *stats;
+
+	mydata.ipaddr = *ipaddr;
+	stats = rbtree_finddata(tree, &mydata);
+	if (stats) return stats;
+
+	MEM(stats = talloc_zero(t, rlm_stats_data_t));
+	stats->ipaddr = *ipaddr;
+	stats->created = now;
+	stats->counters = stats_counters_alloc(stats);
 
-		if (other == t) continue;
+	pthread_mutex_lock(&t->mutex);
+	(void) rbtree_insert(tree, stats);
+	pthread_mutex_unlock(&t->mutex);
 
-		tree = (rbtree_t **) (((uint8_t *) other) + tree_offset);
-		stats = rbtree_finddata(*tree, mydata);
-		if (!stats) {
+	return stats;
+}
+
+/** Sum the counters from all of the threads
+ *
+ * @param[out] out		Where to write the totals.
+ * @param[in] inst		Module instance.
+ * @param[in] stats_type	One of the FR_FREERADIUS_STATS4_TYPE_VALUE_* values.
+ * @param[in] ipaddr		of the client or listener.  Ignored for global statistics.
+ */
+static void stats_aggregate(rlm_stats_snapshot_t *out, rlm_stats_t *inst, uint32_t stats_type,
+			    fr_ipaddr_t const *ipaddr)
+{
+	rlm_stats_thread_t *t;
+	size_t tree_offset = 0;
+	rlm_stats_data_t mydata;
+
+	memset(out, 0, sizeof(*out));
+
+	switch (stats_type) {
+	case FR_FREERADIUS_STATS4_TYPE_VALUE_CLIENT:
+		tree_offset = offsetof(rlm_stats_thread_t, src);
+		break;
+
+	case FR_FREERADIUS_STATS4_TYPE_VALUE_LISTENER:
+		tree_offset = offsetof(rlm_stats_thread_t, dst);
+		break;
+
+	default:
+		break;
+	}
+
+	if (tree_offset) mydata.ipaddr = *ipaddr;
+
+	pthread_mutex_lock(&inst->mutex);
+	if (!tree_offset) memcpy(out, &inst->retired, sizeof(*out));
+
+	for (t = fr_dlist_head(&inst->list);
+	     t != NULL;
+	     t = fr_dlist_next(&inst->list, t)) {
+		rlm_stats_data_t *stats;
+		rbtree_t **tree;
+
+		if (!tree_offset) {
+			stats_counters_add(out, t->global);
 			continue;
 		}
-		memcpy(&local_stats, stats->stats, sizeof(stats->stats));
 
-		for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
-			final_stats[i] += local_stats[i];
-		}
+		tree = (rbtree_t **) (((uint8_t *) t) + tree_offset);
+
+		pthread_mutex_lock(&t->mutex);
+		stats = rbtree_finddata(*tree, &mydata);
+		if (stats) stats_counters_add(out, stats->counters);
+		pthread_mutex_unlock(&t->mutex);
 	}
+	pthread_mutex_unlock(&inst->mutex);
 }
 
-
 /*
  *	Do the statistics
  */
@@ -151,10 +267,9 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 	rlm_stats_thread_t *t = thread;
 	rlm_stats_t *inst = instance;
 	VALUE_PAIR *vp;
-	rlm_stats_data_t mydata, *stats;
 	fr_cursor_t cursor;
 	char buffer[64];
-	uint64_t local_stats[NUM_ELEMENTS(inst->stats)];
+	rlm_stats_snapshot_t snapshot;
 
 	/*
 	 *	Increment counters only in "send foo" sections.
@@ -162,7 +277,10 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 	 *	i.e. only when we have a reply to send.
 	 */
 	if (request->request_state == REQUEST_SEND) {
-		int src_code, dst_code;
+		int src_code, dst_code, bucket;
+		uint64_t usec;
+		rlm_stats_data_t *stats;
+		fr_time_t now = request->async->recv_time;
 
 		src_code = request->packet->code;
 		if (src_code >= FR_RADIUS_MAX_PACKET_CODE) src_code = 0;
@@ -170,62 +288,30 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 		dst_code = request->reply->code;
 		if (dst_code >= FR_RADIUS_MAX_PACKET_CODE) dst_code = 0;
 
-		t->stats[src_code]++;
-		t->stats[dst_code]++;
+		usec = (fr_time() - request->async->recv_time) / 1000;
+		bucket = usec ? fr_high_bit_pos(usec) : 0;
+		if (bucket >= STATS_LATENCY_BUCKETS) bucket = STATS_LATENCY_BUCKETS - 1;
+
+		stats_counters_update(t->global, src_code, dst_code, bucket);
 
 		/*
 		 *	Update source statistics
 		 */
-		mydata.ipaddr = request->packet->src_ipaddr;
-		stats = rbtree_finddata(t->src, &mydata);
-		if (!stats) {
-			MEM(stats = talloc_zero(t, rlm_stats_data_t));
-
-			stats->ipaddr = request->packet->src_ipaddr;
-			stats->created = request->async->recv_time;
-
-			(void) rbtree_insert(t->src, stats);
-		}
-
-		stats->last_packet = request->async->recv_time;
-		stats->stats[src_code]++;
-		stats->stats[dst_code]++;
+		stats = stats_data_find(t, t->src, &request->packet->src_ipaddr, now);
+		stats->last_packet = now;
+		stats_counters_update(stats->counters, src_code, dst_code, bucket);
 
 		/*
 		 *	Update destination statistics
 		 */
-		mydata.ipaddr = request->packet->dst_ipaddr;
-		stats = rbtree_finddata(t->dst, &mydata);
-		if (!stats) {
-			MEM(stats = talloc_zero(t, rlm_stats_data_t));
-
-			stats->ipaddr = request->packet->dst_ipaddr;
-			stats->created = request->async->recv_time;
-
-			(void) rbtree_insert(t->dst, stats);
-		}
-
-		stats->last_packet = request->async->recv_time;
-		stats->stats[src_code]++;
-		stats->stats[dst_code]++;
+		stats = stats_data_find(t, t->dst, &request->packet->dst_ipaddr, now);
+		stats->last_packet = now;
+		stats_counters_update(stats->counters, src_code, dst_code, bucket);
 
 		/*
 		 *	@todo - periodically clean up old entries.
 		 */
 
-		if ((t->last_global_update + NSEC) > request->async->recv_time) {
-			return RLM_MODULE_UPDATED;
-		}
-
-		t->last_global_update = request->async->recv_time;
-
-		pthread_mutex_lock(&inst->mutex);
-		for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
-			inst->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		pthread_mutex_unlock(&inst->mutex);
-
 		return RLM_MODULE_UPDATED;
 	}
 
@@ -254,38 +340,17 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 
 	switch (stats_type) {
 	case FR_FREERADIUS_STATS4_TYPE_VALUE_GLOBAL:			/* global */
-		/*
-		 *	Merge our stats with the global stats, and then copy
-		 *	the global stats to a thread-local variable.
-		 *
-		 *	The copy helps minimize mutex contention.
-		 */
-		pthread_mutex_lock(&inst->mutex);
-		for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
-			inst->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		memcpy(&local_stats, inst->stats, sizeof(inst->stats));
-		pthread_mutex_unlock(&inst->mutex);
+		stats_aggregate(&snapshot, inst, stats_type, NULL);
 		vp = NULL;
 		break;
 
 	case FR_FREERADIUS_STATS4_TYPE_VALUE_CLIENT:			/* src */
-		vp = fr_pair_find_by_da(request->packet->vps, attr_freeradius_stats4_ipv4_address, TAG_ANY);
-		if (!vp) vp = fr_pair_find_by_da(request->packet->vps, attr_freeradius_stats4_ipv6_address, TAG_ANY);
-		if (!vp) return RLM_MODULE_NOOP;
-
-		mydata.ipaddr = vp->vp_ip;
-		coalesce(local_stats, t, offsetof(rlm_stats_thread_t, src), &mydata);
-		break;
-
 	case FR_FREERADIUS_STATS4_TYPE_VALUE_LISTENER:			/* dst */
 		vp = fr_pair_find_by_da(request->packet->vps, attr_freeradius_stats4_ipv4_address, TAG_ANY);
 		if (!vp) vp = fr_pair_find_by_da(request->packet->vps, attr_freeradius_stats4_ipv6_address, TAG_ANY);
 		if (!vp) return RLM_MODULE_NOOP;
 
-		mydata.ipaddr = vp->vp_ip;
-		coalesce(local_stats, t, offsetof(rlm_stats_thread_t, dst), &mydata);
+		stats_aggregate(&snapshot, inst, stats_type, &vp->vp_ip);
 		break;
 
 	default:
@@ -306,14 +371,14 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 	for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
 		fr_dict_attr_t const *da;
 
-		if (!local_stats[i]) continue;
+		if (!snapshot.packets[i]) continue;
 
 		strlcpy(buffer + 18, fr_packet_codes[i], sizeof(buffer) - 18);
 		da = fr_dict_attr_by_name(dict_radius, buffer);
 		if (!da) continue;
 
 		MEM(vp = fr_pair_afrom_da(request->reply, da));
-		vp->vp_uint64 = local_stats[i];
+		vp->vp_uint64 = snapshot.packets[i];
 
 		fr_cursor_append(&cursor, vp);
 		(void) fr_cursor_tail(&cursor);
@@ -322,6 +387,105 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 	return RLM_MODULE_OK;
 }
 
+/** Print a snapshot for radmin
+ *
+ */
+static void stats_snapshot_fprint(FILE *fp, rlm_stats_snapshot_t const *snapshot)
+{
+	int i;
+
+	for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
+		if (!snapshot->packets[i] || !fr_packet_codes[i]) continue;
+
+		fprintf(fp, "packets.%s\t%" PRIu64 "\n", fr_packet_codes[i], snapshot->packets[i]);
+	}
+
+	for (i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+		if (!snapshot->latency[i]) continue;
+
+		if (i == (STATS_LATENCY_BUCKETS - 1)) {
+			fprintf(fp, "latency.over_%" PRIu64 "us\t%" PRIu64 "\n",
+				((uint64_t) 1) << (i - 1), snapshot->latency[i]);
+			continue;
+		}
+
+		fprintf(fp, "latency.under_%" PRIu64 "us\t%" PRIu64 "\n",
+			((uint64_t) 1) << i, snapshot->latency[i]);
+	}
+}
+
+static int cmd_stats_global(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_stats_t *inst = talloc_get_type_abort(ctx, rlm_stats_t);
+	rlm_stats_snapshot_t snapshot;
+
+	stats_aggregate(&snapshot, inst, FR_FREERADIUS_STATS4_TYPE_VALUE_GLOBAL, NULL);
+	stats_snapshot_fprint(fp, &snapshot);
+
+	return 0;
+}
+
+static int cmd_stats_client(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+{
+	rlm_stats_t *inst = talloc_get_type_abort(ctx, rlm_stats_t);
+	rlm_stats_snapshot_t snapshot;
+
+	stats_aggregate(&snapshot, inst, FR_FREERADIUS_STATS4_TYPE_VALUE_CLIENT, &info->box[0]->vb_ip);
+	stats_snapshot_fprint(fp, &snapshot);
+
+	return 0;
+}
+
+static int cmd_stats_listener(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+{
+	rlm_stats_t *inst = talloc_get_type_abort(ctx, rlm_stats_t);
+	rlm_stats_snapshot_t snapshot;
+
+	stats_aggregate(&snapshot, inst, FR_FREERADIUS_STATS4_TYPE_VALUE_LISTENER, &info->box[0]->vb_ip);
+	stats_snapshot_fprint(fp, &snapshot);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "stats",
+		.name = "module",
+		.help = "Statistics collected by modules.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats module",
+		.add_name = true,
+		.name = "global",
+		.func = cmd_stats_global,
+		.help = "Show packet counts and processing times for all packets.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats module",
+		.add_name = true,
+		.name = "client",
+		.syntax = "IPADDR",
+		.func = cmd_stats_client,
+		.help = "Show packet counts and processing times for packets from a client.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats module",
+		.add_name = true,
+		.name = "listener",
+		.syntax = "IPADDR",
+		.func = cmd_stats_listener,
+		.help = "Show packet counts and processing times for packets received by a listener.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
 
 static int data_cmp(const void *one, const void *two)
 {
@@ -343,8 +507,11 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 
 	t->inst = inst;
 
-	t->src = rbtree_talloc_create(t, data_cmp, rlm_stats_data_t, NULL, RBTREE_FLAG_LOCK);
-	t->dst = rbtree_talloc_create(t, data_cmp, rlm_stats_data_t, NULL, RBTREE_FLAG_LOCK);
+	t->global = stats_counters_alloc(t);
+
+	pthread_mutex_init(&t->mutex, NULL);
+	t->src = rbtree_talloc_create(t, data_cmp, rlm_stats_data_t, NULL, RBTREE_FLAG_NONE);
+	t->dst = rbtree_talloc_create(t, data_cmp, rlm_stats_data_t, NULL, RBTREE_FLAG_NONE);
 
 	pthread_mutex_lock(&inst->mutex);
 	fr_dlist_insert_head(&inst->list, t);
@@ -361,25 +528,36 @@ static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 {
 	rlm_stats_thread_t *t = talloc_get_type_abort(thread, rlm_stats_thread_t);
 	rlm_stats_t *inst = t->inst;
-	int i;
 
+	/*
+	 *	Keep the global counters, so the totals don't
+	 *	go backwards.
+	 */
 	pthread_mutex_lock(&inst->mutex);
-	for (i = 0; i < FR_RADIUS_MAX_PACKET_CODE; i++) {
-		inst->stats[i] += t->stats[i];
-	}
+	stats_counters_add(&inst->retired, t->global);
 	fr_dlist_remove(&inst->list, t);
 	pthread_mutex_unlock(&inst->mutex);
 
+	pthread_mutex_destroy(&t->mutex);
+
 	return 0;
 }
 
-static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
 	rlm_stats_t	*inst = instance;
 
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
 	pthread_mutex_init(&inst->mutex, NULL);
 	fr_dlist_init(&inst->list, rlm_stats_thread_t, entry);
 
+	if (fr_command_register_hook(NULL, inst->name, inst, cmd_table) < 0) {
+		PERROR("Failed registering radmin commands");
+		return -1;
+	}
+
 	return 0;
 }
 
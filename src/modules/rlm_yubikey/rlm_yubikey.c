@@ -134,24 +134,40 @@ static ssize_t modhex2hex(char const *modhex, uint8_t *hex, size_t len)
  *
  * @ingroup xlat_functions
  */
-static ssize_t modhex_to_hex_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
-			  	  UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
-			  	  REQUEST *request, char const *fmt)
+static xlat_action_t modhex_to_hex_xlat(TALLOC_CTX *ctx, fr_cursor_t *out,
+					REQUEST *request, UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+					fr_value_box_t **in)
 {
-	ssize_t len;
+	ssize_t		len;
+	char		*hex;
+	fr_value_box_t	*vb;
 
-	if (outlen < strlen(fmt)) return 0;
+	if (!*in) {
+	invalid:
+		REDEBUG("Modhex string invalid");
+		return XLAT_ACTION_FAIL;
+	}
 
-	/*
-	 *	mod2hex allows conversions in place
-	 */
-	len = modhex2hex(fmt, (uint8_t *) *out, strlen(fmt));
+	if (fr_value_box_list_concat(ctx, *in, in, FR_TYPE_STRING, true) < 0) {
+		RPEDEBUG("Failed concatenating input");
+		return XLAT_ACTION_FAIL;
+	}
+
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	MEM(hex = talloc_array(vb, char, (*in)->vb_length + 1));
+
+	len = modhex2hex((*in)->vb_strvalue, (uint8_t *) hex, (*in)->vb_length);
 	if (len <= 0) {
-		REDEBUG("Modhex string invalid");
-		return -1;
+		talloc_free(vb);
+		goto invalid;
 	}
+	hex[len] = '\0';
+
+	MEM(hex = talloc_bstr_realloc(vb, hex, len));
+	fr_value_box_bstrsteal(vb, vb, NULL, hex, false);
+	fr_cursor_append(out, vb);
 
-	return len;
+	return XLAT_ACTION_DONE;
 }
 
 
@@ -177,7 +193,7 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 
 	if (!cf_section_name2(conf)) return 0;
 
-	xlat_register(inst, "modhextohex", modhex_to_hex_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
+	xlat_async_register(inst, "modhextohex", modhex_to_hex_xlat);
 
 	return 0;
 }
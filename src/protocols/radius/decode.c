@@ -387,7 +387,7 @@ static ssize_t decode_concat(TALLOC_CTX *ctx, fr_cursor_t *cursor,
 	 */
 	if (!total) return 2;
 
-	vp = fr_pair_afrom_da(ctx, parent);
+	vp = fr_pair_afrom_da_len(ctx, parent, total);
 	if (!vp) return -1;
 
 	p = talloc_array(vp, uint8_t, total);
@@ -1439,8 +1439,11 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_cursor_t *cursor, fr_dic
 	/*
 	 *	And now that we've verified the basic type
 	 *	information, decode the actual p.
+	 *
+	 *	Strings and octets get their buffer from the
+	 *	same allocation as the pair.
 	 */
-	vp = fr_pair_afrom_da(ctx, parent);
+	vp = fr_pair_afrom_da_len(ctx, parent, data_len);
 	if (!vp) return -1;
 	vp->tag = tag;
 
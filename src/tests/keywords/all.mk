@@ -127,3 +127,26 @@ $(OUTPUT)/%: $(DIR)/% $(TESTBINDIR)/unit_test_module | $(KEYWORD_RADDB) $(KEYWOR
 			touch "$@"; \
 		fi \
 	fi
+
+#
+#  Time the interpreter.  This isn't part of "make test", as the
+#  numbers are only useful when compared against another build.
+#
+#	make test.keywords.bench KEYWORD_BENCH_COUNT=100000
+#
+KEYWORD_BENCH		:= interpret-modules interpret-conditions
+KEYWORD_BENCH_COUNT	?= 10000
+KEYWORD_BENCH_DIR	:= $(DIR)
+KEYWORD_BENCH_OUTPUT	:= $(OUTPUT)
+
+.PHONY: test.keywords.bench
+test.keywords.bench: $(TESTBINDIR)/unit_test_module | $(KEYWORD_RADDB) $(KEYWORD_LIBS) build.raddb rlm_test.la $(KEYWORD_BENCH_OUTPUT)
+	${Q}for x in $(KEYWORD_BENCH); do \
+		cp $(KEYWORD_BENCH_DIR)/default-input.attrs $(KEYWORD_BENCH_OUTPUT)/$$x.attrs; \
+		echo "KEYWORD-BENCH $$x"; \
+		if ! KEYWORD=$$x $(TESTBIN)/unit_test_module -D share/dictionary -d src/tests/keywords/ -i "$(KEYWORD_BENCH_OUTPUT)/$$x.attrs" -f "$(KEYWORD_BENCH_OUTPUT)/$$x.attrs" -o /dev/null -c $(KEYWORD_BENCH_COUNT) > "$(KEYWORD_BENCH_OUTPUT)/$$x.bench" 2>&1; then \
+			cat "$(KEYWORD_BENCH_OUTPUT)/$$x.bench"; \
+			exit 1; \
+		fi; \
+		grep -E 'Processed|Executed' "$(KEYWORD_BENCH_OUTPUT)/$$x.bench"; \
+	done
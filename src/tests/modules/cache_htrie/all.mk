@@ -0,0 +1 @@
+cache_htrie.test:
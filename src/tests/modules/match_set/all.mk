@@ -0,0 +1,3 @@
+#
+#  Test the "match_set" module
+#